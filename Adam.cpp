@@ -1,4 +1,23 @@
 #include "Adam.hpp"
+#include "Adam_checkpoint.hpp"
+#include "Adam_sparse.hpp"
+#include "L_BFGS.hpp"
+#include "async_function.hpp"
+#include "automatic_differentiation.hpp"
+#include "dense_rows.hpp"
+#include "finite_difference.hpp"
+#include "function_combinators.hpp"
+#include "instrumentation.hpp"
+#include "multistart.hpp"
+#include "separable_function.hpp"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 using namespace Optimize;
 
@@ -20,6 +39,55 @@ Rosenbrock(const std::valarray<double>& x, double* f, std::valarray<double>* df,
   }
 }
 
+// Stands for a remote evaluation service: the submitted jobs are run
+// in order by a background thread
+class Evaluation_Service
+{
+  std::mutex _mutex;
+  std::condition_variable _submitted;
+  std::deque<std::function<void()>> _jobs;
+  bool _stop = false;
+  std::thread _worker;
+
+ public:
+  Evaluation_Service()
+      : _worker([this]() {
+          for (;;)
+          {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _submitted.wait(lock, [this]() { return _stop or not _jobs.empty(); });
+            if (_jobs.empty()) return;
+
+            auto job = std::move(_jobs.front());
+            _jobs.pop_front();
+            lock.unlock();
+
+            job();
+          }
+        })
+  {
+  }
+  ~Evaluation_Service()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _submitted.notify_one();
+    _worker.join();
+  }
+
+  void
+  submit(std::function<void()> job)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _jobs.push_back(std::move(job));
+    }
+    _submitted.notify_one();
+  }
+};
+
 int
 main()
 {
@@ -31,19 +99,484 @@ main()
 
   f.initialize_counter();
 
-  bool has_converged = Adam_optimize(
-      f,
-      x,
-      y,
-      grad,
+  auto profile = std::make_shared<Evaluation_Profile>();
+  auto f_timed = instrument(f, profile);
+  Time_Split time_split;
 
-      _Adam_beta_1_         = 0.6,
-      _Adam_beta_2_         = 0.6,
-      _Adam_alpha_schedule_ = [](const size_t t) -> double { return 1 / sqrt(t); },
-      _absolute_epsilon_    = 0.01,
-      _verbose_             = true);
+  bool has_converged = timed_run(*profile, time_split, [&]() {
+    return Adam_optimize(
+        f_timed,
+        x,
+        y,
+        grad,
+
+        _Adam_beta_1_         = 0.6,
+        _Adam_beta_2_         = 0.6,
+        _Adam_alpha_schedule_ = [](const size_t t) -> double { return 1 / sqrt(t); },
+        _absolute_epsilon_    = 0.01,
+        _verbose_             = true);
+  });
 
   std::cerr << "has converged: " << std::boolalpha << has_converged << std::endl;
   std::cerr << "f counter:  " << f.f_counter() << std::endl;
   std::cerr << "df counter: " << f.df_counter() << std::endl;
+  std::cerr << *profile << time_split;
+
+  ////////////////
+
+  std::cerr << std::endl << "L-BFGS" << std::endl;
+
+  f.initialize_counter();
+  x = 2;
+
+  has_converged = L_BFGS_optimize(f, x, y, grad, _absolute_epsilon_ = 0.01, _verbose_ = true);
+
+  std::cerr << "has converged: " << std::boolalpha << has_converged << std::endl;
+  std::cerr << "f counter:  " << f.f_counter() << std::endl;
+  std::cerr << "df counter: " << f.df_counter() << std::endl;
+
+  ////////////////
+
+  std::cerr << std::endl << "Checkpoint and resume" << std::endl;
+
+  const std::string checkpoint_path =
+      (std::filesystem::temp_directory_path() / "Adam_demo.ckpt").string();
+
+  auto checkpointed_configuration =
+      make_Adam_configuration<double>(_Adam_alpha_schedule_ = Adam_alpha_constant_schedule(0.01),
+                                      _maximimum_iterations_ = 301);
+
+  // Reference: 300 steps at once
+  std::valarray<double> x_reference = {0.3, -0.7};
+  Adam_optimize(checkpointed_configuration, f, x_reference, y, grad);
+
+  // 130 steps, checkpoints every 50 steps and at the end of the run
+  {
+    Adam_Checkpointer checkpointer(checkpoint_path, 50);
+    Adam_Workspace<double> workspace;
+    x = {0.3, -0.7};
+
+    auto interrupted_configuration                 = checkpointed_configuration;
+    interrupted_configuration.maximimum_iterations = 131;
+    interrupted_configuration.checkpoint =
+        checkpointer.hook(interrupted_configuration, x, workspace);
+
+    Adam_optimize(interrupted_configuration, f, x, y, grad, workspace);
+    checkpointer.flush();
+
+    std::cerr << "checkpoints written: " << checkpointer.written() << std::endl;
+  }
+
+  // Resumes from the last one (step 130)
+  Adam_Workspace<double> resumed_workspace;
+  const Adam_Checkpoint_Header checkpoint_header =
+      resume_from_checkpoint(checkpoint_path, x, resumed_workspace);
+
+  auto resumed_configuration                 = checkpointed_configuration;
+  resumed_configuration.maximimum_iterations = 301 - checkpoint_header.step_count;
+  Adam_optimize(resumed_configuration, f, x, y, grad, resumed_workspace);
+  std::remove(checkpoint_path.c_str());
+
+  std::cerr << "resumed from step " << checkpoint_header.step_count << ", "
+            << resumed_workspace.step_count() << " steps, |x - x_reference| = "
+            << std::abs(x - x_reference).max() << std::endl;
+
+  ////////////////
+
+  std::cerr << std::endl << "Multistart" << std::endl;
+
+  std::vector<std::valarray<double>> initial_points;
+  for (int i = 0; i < 16; ++i)
+  {
+    initial_points.push_back({-2 + 0.25 * i, 2 - 0.25 * i});
+  }
+
+  Thread_Pool thread_pool(4);
+  auto report = multistart(&thread_pool, f, initial_points, [](const auto& f, auto& x) {
+    double y;
+    std::valarray<double> grad(x.size());
+    return Adam_optimize(
+        f,
+        x,
+        y,
+        grad,
+
+        _Adam_beta_1_          = 0.6,
+        _Adam_beta_2_          = 0.6,
+        _Adam_alpha_schedule_  = [](const size_t t) -> double { return 1 / sqrt(t); },
+        _absolute_epsilon_     = 0.01,
+        _maximimum_iterations_ = 1000);
+  });
+
+  size_t converged_count = 0;
+  for (const auto& result : report.results) converged_count += result.has_converged;
+
+  std::cerr << "converged starts: " << converged_count << "/" << initial_points.size() << std::endl;
+  std::cerr << "f counter:  " << report.f_counter << std::endl;
+  std::cerr << "df counter: " << report.df_counter << std::endl;
+
+  ////////////////
+
+  std::cerr << std::endl << "Reverse mode automatic differentiation" << std::endl;
+
+  // Rosenbrock with c = 10, no hand-written gradient
+  auto Rosenbrock_ad = [](const auto& x) {
+    return (1 - x[0]) * (1 - x[0]) + 10 * (x[1] - x[0] * x[0]) * (x[1] - x[0] * x[0]);
+  };
+  auto f_ad = reverse_mode_differentiable_function<std::valarray<double>, double>(Rosenbrock_ad);
+
+  std::valarray<double> grad_ad(2);
+  x = {0.3, -0.7};
+  f.df(x, grad);
+  f_ad.df(x, grad_ad);
+
+  std::cerr << "hand-written gradient: " << grad[0] << " " << grad[1] << std::endl;
+  std::cerr << "reverse mode gradient: " << grad_ad[0] << " " << grad_ad[1] << std::endl;
+
+  ////////////////
+
+  // Gradient from f values only, evaluated by several threads
+  Function<std::valarray<double>, double> f_values(f);
+  f_values.initialize_counter(Counter_Policy::Relaxed_Atomic);
+
+  auto f_fd = finite_difference(f_values, Finite_Difference_Scheme::Central, &thread_pool);
+
+  std::valarray<double> grad_fd(2);
+  f_fd.df(x, grad_fd);
+
+  std::cerr << "central difference:    " << grad_fd[0] << " " << grad_fd[1] << std::endl;
+
+  // Nested: the finite differences of each start run inline on the
+  // multistart() worker
+  auto report_fd = multistart(&thread_pool, f_fd, initial_points, [](const auto& f, auto& x) {
+    double y;
+    std::valarray<double> grad(x.size());
+    return Adam_optimize(
+        f,
+        x,
+        y,
+        grad,
+
+        _Adam_beta_1_          = 0.6,
+        _Adam_beta_2_          = 0.6,
+        _Adam_alpha_schedule_  = [](const size_t t) -> double { return 1 / sqrt(t); },
+        _absolute_epsilon_     = 0.01,
+        _maximimum_iterations_ = 1000);
+  });
+
+  converged_count = 0;
+  for (const auto& result : report_fd.results) converged_count += result.has_converged;
+
+  std::cerr << "finite difference multistart, converged starts: " << converged_count << "/"
+            << initial_points.size() << std::endl;
+
+  ////////////////
+
+  std::cerr << std::endl << "Asynchronous objective" << std::endl;
+
+  // Rosenbrock evaluations completed by the service thread
+  Evaluation_Service service;
+  Async_Function<std::valarray<double>, double> f_async(
+      [&service](const std::valarray<double>& x, Async_Completion<double> done) {
+        service.submit([x, done]() {
+          double y;
+          Rosenbrock(x, &y, nullptr, 10);
+          done(y);
+        });
+      });
+  // Launched by several threads (multistart_in_flight())
+  f_async.initialize_counter(Counter_Policy::Relaxed_Atomic);
+
+  x = {0.3, -0.7};
+  std::cerr << "future: f(x) = " << f_async.f(x).get() << std::endl;
+
+  // The perturbed points of a gradient are in flight together
+  auto f_async_fd = finite_difference(f_async);
+  f_async_fd.df(x, grad_fd);
+
+  std::cerr << "asynchronous central difference: " << grad_fd[0] << " " << grad_fd[1]
+            << std::endl;
+
+  // 8 starts in flight, each one blocked on its pending evaluations
+  auto report_async =
+      multistart_in_flight(8, f_async_fd, initial_points, [](const auto& f, auto& x) {
+        double y;
+        std::valarray<double> grad(x.size());
+        return Adam_optimize(
+            f,
+            x,
+            y,
+            grad,
+
+            _Adam_beta_1_          = 0.6,
+            _Adam_beta_2_          = 0.6,
+            _Adam_alpha_schedule_  = [](const size_t t) -> double { return 1 / sqrt(t); },
+            _absolute_epsilon_     = 0.01,
+            _maximimum_iterations_ = 1000);
+      });
+
+  converged_count = 0;
+  for (const auto& result : report_async.results) converged_count += result.has_converged;
+
+  std::cerr << "asynchronous multistart, converged starts: " << converged_count << "/"
+            << initial_points.size() << std::endl;
+  std::cerr << "launched evaluations: " << f_async.f_counter() << std::endl;
+
+  ////////////////
+
+  std::cerr << std::endl << "Combinators" << std::endl;
+
+  // 0.01 |x|^2 + 2 Rosenbrock(x) + Rosenbrock(R x), R: swaps the
+  // coordinates. The type-erased Rosenbrock terms expect caller-sized
+  // gradients.
+  auto ridge = accumulating_function<std::valarray<double>, double, std::valarray<double>>(
+      [](const std::valarray<double>& x,
+         double* y,
+         std::valarray<double>* df,
+         const double scale) {
+        if (y) *y += scale * 0.01 * (x * x).sum();
+        if (df) *df += (scale * 0.02) * x;
+      });
+  auto swapped = linear_composition<std::valarray<double>, std::valarray<double>>(
+      f,
+      [](const std::valarray<double>& x, std::valarray<double>& z) {
+        z.resize(2);
+        z[0] = x[1];
+        z[1] = x[0];
+      },
+      [](const std::valarray<double>& w, std::valarray<double>& df) {
+        df[0] += w[1];
+        df[1] += w[0];
+      });
+  auto combination = sum_function(ridge, scaled_function(2.0, f), swapped);
+
+  x = {0.3, -0.7};
+  std::valarray<double> grad_sum(2), grad_term(2);
+  double y_term;
+  combination.f_df(x, y, grad_sum);
+
+  f.f_df(x, y_term, grad_term);
+  std::valarray<double> grad_expected = 0.02 * x + 2.0 * grad_term;
+  double y_expected                   = 0.01 * (x * x).sum() + 2 * y_term;
+  f.f_df({x[1], x[0]}, y_term, grad_term);
+  grad_expected += std::valarray<double>{grad_term[1], grad_term[0]};
+  y_expected += y_term;
+
+  std::cerr << "fused f:         " << y << " (terms: " << y_expected << ")" << std::endl;
+  std::cerr << "fused gradient:  " << grad_sum[0] << " " << grad_sum[1]
+            << " (terms: " << grad_expected[0] << " " << grad_expected[1] << ")" << std::endl;
+
+  x = {0.3, -0.7};
+  const bool combination_converged = L_BFGS_optimize(
+      combination.as_differentiable_function(), x, y, grad, _absolute_epsilon_ = 1e-8);
+
+  std::cerr << "L-BFGS converged: " << combination_converged << " x = " << x[0] << " " << x[1]
+            << std::endl;
+
+  ////////////////
+
+  std::cerr << std::endl << "Separable objective" << std::endl;
+
+  // Least squares fit of y_i = a + b t_i, 1003 terms evaluated by the
+  // pool, 7 terms per chunk
+  const size_t sample_count = 1003;
+  Sum_Of_Terms_Function<std::valarray<double>, double, std::valarray<double>> samples(
+      sample_count,
+      [](const std::valarray<double>& x,
+         Span<const size_t> indices,
+         double* y,
+         std::valarray<double>* df) {
+        assert(df == nullptr or df->size() == 2);
+
+        if (y) *y = 0;
+        if (df) *df = 0;
+        for (const size_t i : indices)
+        {
+          const double t = 0.001 * i;
+          const double r = x[0] + x[1] * t - (1 + 2 * t + 0.1 * std::sin(double(i)));
+          if (y) *y += r * r / indices.size();
+          if (df) *df += (2 * r / indices.size()) * std::valarray<double>{1, t};
+        }
+      });
+  samples.initialize_counter(Counter_Policy::Relaxed_Atomic);
+
+  auto fit = separable_function(samples, &thread_pool, 7);
+
+  x = {0, 0};
+  const bool fit_converged = L_BFGS_optimize(fit, x, y, grad, _absolute_epsilon_ = 1e-10);
+
+  std::cerr << "L-BFGS converged: " << fit_converged << " a = " << x[0] << " b = " << x[1]
+            << std::endl;
+  std::cerr << "evaluated terms: " << samples.df_counter() << std::endl;
+
+  // Nested: each start evaluates the terms inline on its worker
+  auto report_fit = multistart(&thread_pool, fit, initial_points, [](const auto& f, auto& x) {
+    double y;
+    std::valarray<double> grad(x.size());
+    return L_BFGS_optimize(f, x, y, grad, _absolute_epsilon_ = 1e-8);
+  });
+
+  converged_count = 0;
+  for (const auto& result : report_fit.results) converged_count += result.has_converged;
+
+  std::cerr << "separable multistart, converged starts: " << converged_count << "/"
+            << initial_points.size() << std::endl;
+
+  ////////////////
+
+  std::cerr << std::endl << "Dense rows" << std::endl;
+
+  // Rows (t_i, y_i) of a float matrix file, same least squares fit
+  const std::string rows_path = (std::filesystem::temp_directory_path() / "Adam_demo.bin").string();
+  {
+    std::ofstream rows_file(rows_path, std::ios::binary);
+    for (size_t i = 0; i < 4000; ++i)
+    {
+      const float row[2] = {float(0.00025 * i), float(1 + 0.5 * i * 0.00025 + 0.1 * std::sin(i))};
+      rows_file.write(reinterpret_cast<const char*>(row), sizeof(row));
+    }
+  }
+  auto row_loss = [](const std::valarray<double>& x,
+                     Span<const float> row,
+                     double* y,
+                     std::valarray<double>* df) {
+    const double r = x[0] + x[1] * row[0] - row[1];
+    if (y) *y += r * r;
+    if (df) *df += (2 * r) * std::valarray<double>{1, row[0]};
+  };
+
+  // Blocks of 256 rows, the next one read by the pool
+  auto reader = std::make_shared<const Row_Block_Reader<float>>(rows_path, 2, 0, 256, &thread_pool);
+  auto read_rows =
+      dense_rows_objective<std::valarray<double>, double, std::valarray<double>>(reader, row_loss);
+
+  x = {0, 0};
+  const bool rows_converged = L_BFGS_optimize(read_rows, x, y, grad, _absolute_epsilon_ = 1e-10);
+
+  std::cerr << "L-BFGS converged: " << rows_converged << " a = " << x[0] << " b = " << x[1]
+            << std::endl;
+
+#if defined(MATH_FUNCTIONS_HAS_MMAP)
+  auto matrix      = std::make_shared<const Mapped_Matrix<float>>(rows_path, 2);
+  auto mapped_rows = dense_rows_objective<std::valarray<double>, double, std::valarray<double>>(
+      matrix, row_loss);
+
+  double y_mapped;
+  std::valarray<double> grad_mapped(2);
+  read_rows.f_df(x, y, grad);
+  mapped_rows.f_df(x, y_mapped, grad_mapped);
+
+  std::cerr << "mapped - read: " << std::abs(y_mapped - y) << " "
+            << std::abs(grad_mapped - grad).max() << std::endl;
+
+  // Mini-batches of rows
+  auto row_terms = dense_rows_sum_of_terms<std::valarray<double>, double, std::valarray<double>>(
+      matrix, row_loss);
+
+  x = {0, 0};
+  Adam_optimize(row_terms,
+                x,
+                y,
+                grad,
+                _Adam_minibatch_size_  = 64,
+                _maximimum_iterations_ = 5000,
+                _Adam_alpha_schedule_  = Adam_alpha_constant_schedule(0.01));
+
+  std::cerr << "mini-batch Adam: a = " << x[0] << " b = " << x[1] << std::endl;
+#endif
+  std::remove(rows_path.c_str());
+
+  ////////////////
+
+  std::cerr << std::endl << "Sparse gradient" << std::endl;
+
+  // F(x) = sum_i (x_i - t_i)^2, the gradient entries pushed as a
+  // Sparse_Vector
+  const size_t sparse_size = 1000;
+  auto target              = [](const size_t i) { return 1 + 0.001 * double(i); };
+
+  Differentiable_Function<std::valarray<double>, double, std::valarray<double>> dense_sum(
+      [&](const std::valarray<double>& x, double* y, std::valarray<double>* df) {
+        if (y) *y = 0;
+        for (size_t i = 0; i < x.size(); ++i)
+        {
+          const double r = x[i] - target(i);
+          if (y) *y += r * r;
+          if (df) (*df)[i] = 2 * r;
+        }
+      });
+  Differentiable_Function<std::valarray<double>, double, Sparse_Vector<double>> sparse_sum(
+      [&](const std::valarray<double>& x, double* y, Sparse_Vector<double>* df) {
+        if (y) *y = 0;
+        if (df) df->clear();
+        for (size_t i = 0; i < x.size(); ++i)
+        {
+          const double r = x[i] - target(i);
+          if (y) *y += r * r;
+          if (df) df->push_back(i, 2 * r);
+        }
+      });
+
+  // Every coordinate active at each step: the dense iterations (up to
+  // the FMA roundings of the SIMD dense kernel)
+  const auto sparse_configuration =
+      make_Adam_configuration<double>(_Adam_alpha_schedule_ = Adam_alpha_constant_schedule(0.01),
+                                      _maximimum_iterations_ = 200);
+
+  std::valarray<double> x_dense(0., sparse_size), grad_dense(sparse_size);
+  std::valarray<double> x_lazy(0., sparse_size);
+  Sparse_Vector<double> sparse_grad;
+
+  Adam_optimize(sparse_configuration, dense_sum, x_dense, y, grad_dense);
+  Adam_optimize(sparse_configuration, sparse_sum, x_lazy, y, sparse_grad);
+
+  std::cerr << "all active, |x_lazy - x_dense| = " << std::abs(x_lazy - x_dense).max()
+            << std::endl;
+
+  // One term per coordinate, mini-batches of 50 terms: a coordinate
+  // is active once per epoch, its moment decays over the skipped steps
+  // are caught up when it is next active
+  Sum_Of_Terms_Function<std::valarray<double>, double, Sparse_Vector<double>> coordinate_terms(
+      sparse_size,
+      [&](const std::valarray<double>& x,
+          Span<const size_t> indices,
+          double* y,
+          Sparse_Vector<double>* df) {
+        if (y) *y = 0;
+        if (df) df->clear();
+        for (const size_t i : indices)
+        {
+          const double r = x[i] - target(i);
+          if (y) *y += r * r / indices.size();
+          if (df) df->push_back(i, 2 * r / indices.size());
+        }
+      });
+  coordinate_terms.initialize_counter();
+
+  const auto lazy_configuration = make_Adam_minibatch_configuration<double>(
+      _Adam_alpha_schedule_  = Adam_alpha_constant_schedule(0.1),
+      _Adam_minibatch_size_  = 50,
+      _maximimum_iterations_ = 2000);
+
+  Lazy_Adam_Workspace<double> lazy_workspace;
+  x_lazy = 0;
+  Adam_optimize(lazy_configuration, coordinate_terms, x_lazy, y, sparse_grad, lazy_workspace);
+
+  double lazy_error = 0;
+  for (size_t i = 0; i < sparse_size; ++i)
+  {
+    lazy_error = std::max(lazy_error, std::abs(x_lazy[i] - target(i)));
+  }
+  std::cerr << "mini-batch lazy Adam, steps: " << lazy_workspace.step_count()
+            << " coordinate updates: " << coordinate_terms.df_counter()
+            << " (dense: " << lazy_workspace.step_count() * sparse_size << ")"
+            << " max |x_i - t_i| = " << lazy_error << std::endl;
+
+  // Dense moments, the pending decays applied
+  lazy_workspace.synchronize();
+
+  double m_k_max = 0;
+  for (const double m_i : lazy_workspace.m_k()) m_k_max = std::max(m_k_max, std::abs(m_i));
+
+  std::cerr << "synchronized |m_k|_inf = " << m_k_max << std::endl;
 }
@@ -1,12 +1,23 @@
 #pragma once
 
+#include "Adam_mixed_kernel.hpp"
 #include "functions.hpp"
+#include "iteration_log.hpp"
+#include "iteration_observer.hpp"
 #include "named_types.hpp"
+#include "sum_of_terms.hpp"
+#include "vector_traits.hpp"
 
+#include <algorithm>
 #include <cmath>
-#include <iomanip>
-#include <iostream>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <type_traits>
+#include <utility>
 #include <valarray>
+#include <vector>
 
 namespace Optimize
 {
@@ -34,21 +45,90 @@ namespace Optimize
       Named_Assert_Type<struct Adam_Beta_2_Tag, Assert_In_01_Strict<double>, double>;
   static constexpr auto _Adam_beta_2_ = typename Adam_Beta_2::argument_syntactic_sugar();
 
+  // Number of threads for the elementwise update and the gradient norm,
+  // worth it for very large domains only
+  //
+  using Adam_Threads = Named_Assert_Type<struct Adam_Threads_Tag, Assert_Positive<size_t>, size_t>;
+  static constexpr auto _Adam_threads_ = typename Adam_Threads::argument_syntactic_sugar();
+
   using Adam_Internal_Epsilon =
       Named_Assert_Type<struct Adam_Internal_Epsilon_Tag, Assert_In_01_Strict<double>, double>;
   static constexpr auto _Adam_internal_epsilon_ =
       typename Adam_Internal_Epsilon::argument_syntactic_sugar();
 
+  // When the objective value is needed (verbose mode...) use one
+  // f_df() call instead of df() + f()
+  //
+  using Adam_Fused_Evaluation = Named_Type<struct Adam_Fused_Evaluation_Tag, bool>;
+  static constexpr auto _Adam_fused_evaluation_ =
+      typename Adam_Fused_Evaluation::argument_syntactic_sugar();
+
+  // Computes y at each iteration (thanks to f_df() if fused
+  // evaluation is on). On return y is the objective value at the last
+  // gradient evaluation point.
+  //
+  using Adam_Track_Objective = Named_Type<struct Adam_Track_Objective_Tag, bool>;
+  static constexpr auto _Adam_track_objective_ =
+      typename Adam_Track_Objective::argument_syntactic_sugar();
+
+  // Called at each iteration, see Iteration_Record. y is NaN unless
+  // computed anyway (track_objective, verbose)
+  //
+  using Adam_Observer =
+      Named_Std_Function<struct Adam_Observer_Tag, void, const Iteration_Record&>;
+  static constexpr auto _Adam_observer_ = typename Adam_Observer::argument_syntactic_sugar();
+
+  // AdamW: decoupled weight decay, x -= alpha * weight_decay * x at
+  // each step (0: Adam)
+  //
+  using Adam_Weight_Decay =
+      Named_Assert_Type<struct Adam_Weight_Decay_Tag, Assert_Non_Negative<double>, double>;
+  static constexpr auto _Adam_weight_decay_ =
+      typename Adam_Weight_Decay::argument_syntactic_sugar();
+
+  // AMSGrad: steps use the running maximum of the second moment (one
+  // more vector in the workspace)
+  //
+  using Adam_AMSGrad = Named_Type<struct Adam_AMSGrad_Tag, bool>;
+  static constexpr auto _Adam_amsgrad_ = typename Adam_AMSGrad::argument_syntactic_sugar();
+
+  // Called after each step with the workspace step count and
+  // run_end = false, then once at the end of the run with
+  // run_end = true, see Adam_Checkpointer (Adam_checkpoint.hpp)
+  //
+  using Adam_Checkpoint =
+      Named_Std_Function<struct Adam_Checkpoint_Tag, void, const size_t, const bool>;
+  static constexpr auto _Adam_checkpoint_ = typename Adam_Checkpoint::argument_syntactic_sugar();
+
+  // Mini-batch Adam (Sum_Of_Terms_Function objectives): number of
+  // terms per step and seed of the shuffling (reproducible runs)
+  //
+  using Adam_Minibatch_Size =
+      Named_Assert_Type<struct Adam_Minibatch_Size_Tag, Assert_Positive<size_t>, size_t>;
+  static constexpr auto _Adam_minibatch_size_ =
+      typename Adam_Minibatch_Size::argument_syntactic_sugar();
+
+  using Adam_Shuffle_Seed = Named_Type<struct Adam_Shuffle_Seed_Tag, std::uint64_t>;
+  static constexpr auto _Adam_shuffle_seed_ =
+      typename Adam_Shuffle_Seed::argument_syntactic_sugar();
+
   ///////////////////
   // Configuration //
   ///////////////////
   //
-  template <typename SCALAR_TYPE>
+  // ALPHA_SCHEDULE: Adam_Alpha_Schedule (std::function, settable by
+  // configure_Adam()) or any callable double(size_t) to have it
+  // inlined in the iterations (see with_alpha_schedule())
+  //
+  template <typename SCALAR_TYPE, typename ALPHA_SCHEDULE = Adam_Alpha_Schedule>
   struct Adam_Configuration
   {
+    using scalar_type         = SCALAR_TYPE;
+    using alpha_schedule_type = ALPHA_SCHEDULE;
+
     Maximum_Iterations maximimum_iterations = 100;
 
-    Adam_Alpha_Schedule alpha_schedule = Adam_alpha_constant_schedule(0.01);
+    ALPHA_SCHEDULE alpha_schedule = Adam_alpha_constant_schedule(0.01);
 
     Adam_Beta_1 beta_1 = 0.9;
     Adam_Beta_2 beta_2 = 0.999;
@@ -57,15 +137,39 @@ namespace Optimize
 
     Verbose verbose = false;
 
+    Adam_Fused_Evaluation fused_evaluation = true;
+    Adam_Track_Objective track_objective   = false;
+
+    Adam_Observer observer;  // none
+
+    Adam_Checkpoint checkpoint;  // none
+
+    Adam_Threads threads = 1;
+
     Adam_Internal_Epsilon internal_epsilon = std::sqrt(std::numeric_limits<SCALAR_TYPE>::epsilon());
+
+    Adam_Weight_Decay weight_decay = 0;
+    Adam_AMSGrad amsgrad           = false;
   };
 
-  template <typename SCALAR_TYPE, typename VECTOR_TYPE, typename... USER_ARGS>
+  template <typename SCALAR_TYPE, typename ALPHA_SCHEDULE = Adam_Alpha_Schedule>
+  struct Adam_Minibatch_Configuration : public Adam_Configuration<SCALAR_TYPE, ALPHA_SCHEDULE>
+  {
+    Adam_Minibatch_Size minibatch_size = 32;
+    Adam_Shuffle_Seed shuffle_seed     = 0;
+  };
+
+  // Builds a configuration once, to be reused by the Adam_optimize()
+  // overloads taking a configuration (or by an Adam_Solver) instead of
+  // parsing the options at each call:
+  //
+  //   const auto configuration = make_Adam_configuration<double>(_Adam_beta_1_ = 0.8);
+  //
+  //   for (...) Adam_optimize(configuration, f, x, y, grad);
+  //
+  template <typename SCALAR_TYPE, typename... USER_ARGS>
   Adam_Configuration<SCALAR_TYPE>
-  configure_Adam(
-      const Differentiable_Function<VECTOR_TYPE, SCALAR_TYPE, VECTOR_TYPE>& /*objective_function*/,
-      const VECTOR_TYPE& /*x_init*/,
-      USER_ARGS... user_args)
+  make_Adam_configuration(const USER_ARGS&... user_args)
   {
     Adam_Configuration<SCALAR_TYPE> configuration;
 
@@ -74,92 +178,735 @@ namespace Optimize
                                               configuration.beta_2,
                                               configuration.maximimum_iterations,
                                               configuration.absolute_epsilon,
-                                              configuration.verbose);
+                                              configuration.verbose,
+                                              configuration.fused_evaluation,
+                                              configuration.track_objective,
+                                              configuration.observer,
+                                              configuration.checkpoint,
+                                              configuration.threads,
+                                              configuration.internal_epsilon,
+                                              configuration.weight_decay,
+                                              configuration.amsgrad);
     optional_argument(options, user_args...);
 
     return configuration;
   }
 
-  // Here specialization
-  template <typename SCALAR_TYPE>
-  auto
-  squared_norm_2(const std::valarray<SCALAR_TYPE>& v)
+  template <typename SCALAR_TYPE, typename... USER_ARGS>
+  Adam_Minibatch_Configuration<SCALAR_TYPE>
+  make_Adam_minibatch_configuration(const USER_ARGS&... user_args)
   {
-    using std::abs;
-    using std::pow;
+    Adam_Minibatch_Configuration<SCALAR_TYPE> configuration;
 
-    using real_type = decltype(std::abs(std::declval<SCALAR_TYPE>()));
+    auto options = take_optional_argument_ref(configuration.alpha_schedule,
+                                              configuration.beta_1,
+                                              configuration.beta_2,
+                                              configuration.maximimum_iterations,
+                                              configuration.absolute_epsilon,
+                                              configuration.verbose,
+                                              configuration.fused_evaluation,
+                                              configuration.track_objective,
+                                              configuration.observer,
+                                              configuration.checkpoint,
+                                              configuration.threads,
+                                              configuration.internal_epsilon,
+                                              configuration.weight_decay,
+                                              configuration.amsgrad,
+                                              configuration.minibatch_size,
+                                              configuration.shuffle_seed);
+    optional_argument(options, user_args...);
 
-    real_type sum = 0;
+    return configuration;
+  }
 
-    const size_t n = v.size();
-    for (size_t i = 0; i < n; i++)
-    {
-      sum += pow(abs(v[i]), 2);
-    }
-    return sum;
+  template <typename SCALAR_TYPE, typename VECTOR_TYPE, typename... USER_ARGS>
+  Adam_Configuration<SCALAR_TYPE>
+  configure_Adam(
+      const Differentiable_Function<VECTOR_TYPE, SCALAR_TYPE, VECTOR_TYPE>& /*objective_function*/,
+      const VECTOR_TYPE& /*x_init*/,
+      USER_ARGS... user_args)
+  {
+    return make_Adam_configuration<SCALAR_TYPE>(user_args...);
   }
-  template <typename SCALAR_TYPE>
+
+  template <typename SCALAR_TYPE, typename VECTOR_TYPE, typename STORAGE, typename... USER_ARGS>
+  Adam_Minibatch_Configuration<SCALAR_TYPE>
+  configure_Adam(
+      const Sum_Of_Terms_Function<VECTOR_TYPE, SCALAR_TYPE, VECTOR_TYPE, STORAGE>& /*objective*/,
+      const VECTOR_TYPE& /*x_init*/,
+      USER_ARGS... user_args)
+  {
+    return make_Adam_minibatch_configuration<SCALAR_TYPE>(user_args...);
+  }
+
+  // Same configuration with an inlined alpha schedule:
+  //
+  //   auto configuration = with_alpha_schedule(make_Adam_configuration<double>(),
+  //                                            Adam_alpha_constant_schedule(0.1));
+  //
+  template <typename SCALAR_TYPE, typename ALPHA_SCHEDULE, typename NEW_ALPHA_SCHEDULE>
+  Adam_Configuration<SCALAR_TYPE, std::decay_t<NEW_ALPHA_SCHEDULE>>
+  with_alpha_schedule(const Adam_Configuration<SCALAR_TYPE, ALPHA_SCHEDULE>& configuration,
+                      NEW_ALPHA_SCHEDULE&& alpha_schedule)
+  {
+    static_assert(std::is_invocable_r_v<double, std::decay_t<NEW_ALPHA_SCHEDULE>, size_t>);
+
+    return {configuration.maximimum_iterations,
+            std::forward<NEW_ALPHA_SCHEDULE>(alpha_schedule),
+            configuration.beta_1,
+            configuration.beta_2,
+            configuration.absolute_epsilon,
+            configuration.verbose,
+            configuration.fused_evaluation,
+            configuration.track_objective,
+            configuration.observer,
+            configuration.checkpoint,
+            configuration.threads,
+            configuration.internal_epsilon,
+            configuration.weight_decay,
+            configuration.amsgrad};
+  }
+  template <typename SCALAR_TYPE, typename ALPHA_SCHEDULE, typename NEW_ALPHA_SCHEDULE>
+  Adam_Minibatch_Configuration<SCALAR_TYPE, std::decay_t<NEW_ALPHA_SCHEDULE>>
+  with_alpha_schedule(
+      const Adam_Minibatch_Configuration<SCALAR_TYPE, ALPHA_SCHEDULE>& configuration,
+      NEW_ALPHA_SCHEDULE&& alpha_schedule)
+  {
+    const Adam_Configuration<SCALAR_TYPE, ALPHA_SCHEDULE>& base = configuration;
+
+    return {with_alpha_schedule(base, std::forward<NEW_ALPHA_SCHEDULE>(alpha_schedule)),
+            configuration.minibatch_size,
+            configuration.shuffle_seed};
+  }
+
+  // Any contiguous vector (see Vector_Traits)
+  template <typename VECTOR_TYPE, std::enable_if_t<is_vector_v<VECTOR_TYPE>>* = nullptr>
+  auto
+  squared_norm_2(const VECTOR_TYPE& v)
+  {
+    using traits = Vector_Traits<VECTOR_TYPE>;
+
+    return squared_norm_2_kernel(traits::data(v), traits::size(v));
+  }
+  template <typename VECTOR_TYPE, std::enable_if_t<is_vector_v<VECTOR_TYPE>>* = nullptr>
   auto
-  norm_2(const std::valarray<SCALAR_TYPE>& v)
+  norm_2(const VECTOR_TYPE& v)
   {
     return std::sqrt(squared_norm_2(v));
   }
 
-  // Returns true if has converged
-  template <typename SCALAR_TYPE, typename CONFIGURATION_TYPE>
-  bool
-  Adam_optimize(const CONFIGURATION_TYPE& configuration,
-                const Differentiable_Function<std::valarray<SCALAR_TYPE>,
-                                              SCALAR_TYPE,
-                                              std::valarray<SCALAR_TYPE>>& objective_function,
-                std::valarray<SCALAR_TYPE>& x_init,
-                SCALAR_TYPE& y,
-                std::valarray<SCALAR_TYPE>& grad)
+  ////////////////////
+  // Adam_Workspace //
+  ////////////////////
+  //
+  // Adam state (moments, step count) and buffers, reusable between
+  // Adam_optimize() calls:
+  //
+  // - repeated optimizations: reset() is a cold start without
+  //   allocation if the domain size does not grow
+  //
+  // - continued optimizations: a new Adam_optimize() call with the same
+  //   workspace resumes from its moments and step count (the alpha
+  //   schedule continues from step_count() + 1), warm_start() restores
+  //   saved moments
+  //
+  // A domain size mismatch at the start of Adam_optimize() is a cold
+  // start.
+  //
+  // MOMENT_TYPE: moments storage (float, bfloat16...), see mixed
+  // precision below
+  //
+  template <typename SCALAR_TYPE, typename MOMENT_TYPE = SCALAR_TYPE>
+  class Adam_Workspace
   {
-    using vector_type = std::valarray<SCALAR_TYPE>;
+   protected:
+    Aligned_Vector<MOMENT_TYPE> _m_k;
+    Aligned_Vector<MOMENT_TYPE> _v_k;
+    Aligned_Vector<MOMENT_TYPE> _v_max_k;  // AMSGrad only
+    size_t _step_count;
+
+    // beta^step_count running products of the last run, recomputed
+    // after warm_start() or if the betas have changed
+    SCALAR_TYPE _beta_1 = 0;
+    SCALAR_TYPE _beta_2 = 0;
+    SCALAR_TYPE _beta_1_power = 1;
+    SCALAR_TYPE _beta_2_power = 1;
+
+    Adam_Partial_Sums<SCALAR_TYPE> _partial_sums;
+    std::unique_ptr<Thread_Pool> _thread_pool;
+
+   public:
+    Adam_Workspace() : _step_count{0} {}
+    explicit Adam_Workspace(const size_t domain_size) : Adam_Workspace() { reset(domain_size); }
+
+    // Cold start: zero moments
+    void
+    reset(const size_t domain_size)
+    {
+      _m_k.assign(domain_size, MOMENT_TYPE(0));
+      _v_k.assign(domain_size, MOMENT_TYPE(0));
+      _v_max_k.clear();
+      _step_count = 0;
+      _beta_1     = 0;
+      _beta_2     = 0;
+      _partial_sums.resize(Adam_chunk_count(domain_size));
+    }
+
+    // Warm start from moments saved from m_k(), v_k() and step_count()
+    template <typename VECTOR_TYPE>
+    void
+    warm_start(const VECTOR_TYPE& m_k, const VECTOR_TYPE& v_k, const size_t step_count)
+    {
+      using traits = Vector_Traits<VECTOR_TYPE>;
+
+      const size_t domain_size = traits::size(m_k);
+      assert(traits::size(v_k) == domain_size);
+
+      _m_k.assign(traits::data(m_k), traits::data(m_k) + domain_size);
+      _v_k.assign(traits::data(v_k), traits::data(v_k) + domain_size);
+      _v_max_k.clear();
+      _step_count = step_count;
+      _beta_1     = 0;
+      _beta_2     = 0;
+      _partial_sums.resize(Adam_chunk_count(domain_size));
+    }
+
+    // Same with the AMSGrad maximum of v_k
+    template <typename VECTOR_TYPE>
+    void
+    warm_start(const VECTOR_TYPE& m_k,
+               const VECTOR_TYPE& v_k,
+               const VECTOR_TYPE& v_max_k,
+               const size_t step_count)
+    {
+      using traits = Vector_Traits<VECTOR_TYPE>;
 
-    const size_t domain_size = x_init.size();
+      warm_start(m_k, v_k, step_count);
+
+      assert(traits::size(v_max_k) == domain_size());
+      _v_max_k.assign(traits::data(v_max_k), traits::data(v_max_k) + domain_size());
+    }
+
+    size_t
+    domain_size() const
+    {
+      return _m_k.size();
+    }
+    size_t
+    step_count() const
+    {
+      return _step_count;
+    }
+    Span<const MOMENT_TYPE>
+    m_k() const
+    {
+      return {_m_k.data(), _m_k.size()};
+    }
+    Span<const MOMENT_TYPE>
+    v_k() const
+    {
+      return {_v_k.data(), _v_k.size()};
+    }
+    // Empty unless AMSGrad steps have been done
+    Span<const MOMENT_TYPE>
+    v_max_k() const
+    {
+      return {_v_max_k.data(), _v_max_k.size()};
+    }
 
-    vector_type m_k(domain_size);
-    m_k = 0;
-    vector_type hat_m_k(domain_size);
-    vector_type v_k(domain_size);
-    v_k = 0;
-    vector_type hat_v_k(domain_size);
+    //////////////////////////////
+    // Used by Adam_optimize() //
+    //////////////////////////////
+    //
+    MOMENT_TYPE*
+    m_k_data()
+    {
+      return _m_k.data();
+    }
+    MOMENT_TYPE*
+    v_k_data()
+    {
+      return _v_k.data();
+    }
+    // AMSGrad maximum of v_k, starts from v_k after a reset() or a
+    // warm_start()
+    MOMENT_TYPE*
+    v_max_k_data()
+    {
+      if (_v_max_k.size() != _v_k.size()) _v_max_k = _v_k;
 
-    // shortcut
-    const auto& alpha_schedule = configuration.alpha_schedule;
+      return _v_max_k.data();
+    }
+    Adam_Partial_Sums<SCALAR_TYPE>&
+    partial_sums()
+    {
+      return _partial_sums;
+    }
 
-    const auto& beta_1 = configuration.beta_1.value();
-    const auto& beta_2 = configuration.beta_2.value();
+    // nullptr if threads == 1, kept while the thread count is unchanged
+    Thread_Pool*
+    thread_pool(const size_t threads)
+    {
+      if (threads <= 1) return nullptr;
 
-    const auto& internal_epsilon = configuration.internal_epsilon.value();
+      if ((not _thread_pool) or (_thread_pool->size() != threads))
+      {
+        _thread_pool = std::make_unique<Thread_Pool>(threads);
+      }
+      return _thread_pool.get();
+    }
 
-    bool has_converged = false;
-    for (size_t k = 1; k < configuration.maximimum_iterations.value(); ++k)
+    // step_scalars beta powers at step_count()
+    void
+    load(Adam_Step_Scalars<SCALAR_TYPE>& step_scalars) const
     {
-      objective_function.df(x_init, grad);
+      if ((_beta_1 == step_scalars.beta_1) and (_beta_2 == step_scalars.beta_2))
+      {
+        step_scalars.beta_1_power = _beta_1_power;
+        step_scalars.beta_2_power = _beta_2_power;
+      }
+      else
+      {
+        using std::pow;
 
-      const auto grad_norm = norm_2(grad);
-      has_converged        = grad_norm < configuration.absolute_epsilon.value();
+        step_scalars.beta_1_power = pow(step_scalars.beta_1, SCALAR_TYPE(_step_count));
+        step_scalars.beta_2_power = pow(step_scalars.beta_2, SCALAR_TYPE(_step_count));
+      }
+    }
+    // After a step
+    void
+    save(const Adam_Step_Scalars<SCALAR_TYPE>& step_scalars)
+    {
+      ++_step_count;
+      _beta_1       = step_scalars.beta_1;
+      _beta_2       = step_scalars.beta_2;
+      _beta_1_power = step_scalars.beta_1_power;
+      _beta_2_power = step_scalars.beta_2_power;
+    }
+  };
 
-      if (configuration.verbose.value() and (has_converged or (k % 10 == 1)))
+  namespace Adam_Detail
+  {
+    // The iterations, OBJECTIVE provides f(), f_df(), df() at the
+    // current iteration, next_iteration() and the convergence test
+    // has_converged(), STEP the gradient norm and the update (see
+    // Dense_Step)
+    template <typename SCALAR_TYPE,
+              typename CONFIGURATION_TYPE,
+              typename OBJECTIVE,
+              typename PARAMETER_VECTOR,
+              typename GRADIENT_VECTOR,
+              typename WORKSPACE,
+              typename STEP>
+    bool
+    Adam_loop(const CONFIGURATION_TYPE& configuration,
+              OBJECTIVE& objective_function,
+              PARAMETER_VECTOR& x_init,
+              SCALAR_TYPE& y,
+              GRADIENT_VECTOR& grad,
+              WORKSPACE& workspace,
+              const STEP& step)
+    {
+      // shortcut
+      const auto& alpha_schedule = configuration.alpha_schedule;
+
+      Adam_Step_Scalars<SCALAR_TYPE> step_scalars(configuration.beta_1.value(),
+                                                  configuration.beta_2.value(),
+                                                  configuration.internal_epsilon.value());
+      step_scalars.weight_decay = configuration.weight_decay.value();
+      workspace.load(step_scalars);
+
+      const bool verbose          = configuration.verbose.value();
+      const bool fused_evaluation = configuration.fused_evaluation.value();
+      const bool track_objective  = configuration.track_objective.value();
+      const bool observed         = not configuration.observer.is_empty();
+      const bool checkpointed     = not configuration.checkpoint.is_empty();
+
+      const Iteration_Timer timer(observed);
+      const Verbose_Scope verbose_scope(verbose);
+
+      bool has_converged = false;
+      for (size_t k = 1; k < configuration.maximimum_iterations.value(); ++k)
       {
-        objective_function.f(x_init, y);
-        std::cerr << std::setw(5) << k << " " << std::setw(15) << std::setprecision(10) << y << " "
-                  << std::setw(15) << std::setprecision(10) << grad_norm << std::endl;
+        const bool print_iteration = verbose and (k % 10 == 1);
+
+        objective_function.next_iteration();
+
+        step.prepare_gradient(grad);
+
+        bool has_y = false;
+        if (fused_evaluation and (track_objective or print_iteration))
+        {
+          objective_function.f_df(x_init, y, grad);
+          has_y = true;
+        }
+        else
+        {
+          objective_function.df(x_init, grad);
+        }
+
+        const auto grad_norm = step.gradient_norm(grad);
+        has_converged =
+            objective_function.has_converged(grad_norm < configuration.absolute_epsilon.value());
+
+        if (track_objective and not has_y)
+        {
+          objective_function.f(x_init, y);
+          has_y = true;
+        }
+
+        const bool show_iteration = print_iteration or (verbose and has_converged);
+        if (show_iteration and not has_y)
+        {
+          objective_function.f(x_init, y);
+          has_y = true;
+        }
+
+        const double alpha =
+            has_converged ? iteration_not_available : alpha_schedule(workspace.step_count() + 1);
+
+        if (observed or show_iteration)
+        {
+          const Iteration_Record record =
+              make_iteration_record(step.solver_name(),
+                                    k,
+                                    timer.elapsed(),
+                                    has_y ? double(y) : iteration_not_available,
+                                    double(grad_norm),
+                                    alpha);
+
+          if (show_iteration) verbose_log().push(record);
+          if (observed) configuration.observer(record);
+        }
+        if (has_converged) break;
+
+        step_scalars.next_iteration(alpha);
+        step.update(step_scalars, std::as_const(grad), x_init);
+        workspace.save(step_scalars);
+
+        if (checkpointed) configuration.checkpoint(workspace.step_count(), false);
       }
-      if (has_converged) break;
 
-      m_k     = beta_1 * m_k + (1 - beta_1) * grad;
-      v_k     = beta_2 * v_k + (1 - beta_2) * grad * grad;
-      hat_m_k = (1 / (1 - std::pow(beta_1, k))) * m_k;
-      hat_v_k = (1 / (1 - std::pow(beta_2, k))) * v_k;
-      x_init  = x_init - alpha_schedule(k) * hat_m_k / (sqrt(hat_v_k) + internal_epsilon);
+      if (checkpointed) configuration.checkpoint(workspace.step_count(), true);
+
+      return has_converged;
     }
 
-    return has_converged;
+    // Updates all the coordinates, PARAMETER_VECTOR and
+    // GRADIENT_VECTOR are any contiguous vectors (see Vector_Traits)
+    template <typename SCALAR_TYPE, typename MOMENT_TYPE>
+    struct Dense_Step
+    {
+      Adam_Workspace<SCALAR_TYPE, MOMENT_TYPE>& workspace;
+      Thread_Pool* const thread_pool;
+      MOMENT_TYPE* const v_max_k;  // AMSGrad, otherwise nullptr
+      const bool weight_decay;     // AdamW
+
+      const char*
+      solver_name() const
+      {
+        if (v_max_k) return weight_decay ? "AMSGrad_W" : "AMSGrad";
+
+        return weight_decay ? "AdamW" : "Adam";
+      }
+
+      template <typename GRADIENT_VECTOR>
+      void
+      prepare_gradient(GRADIENT_VECTOR&) const
+      {
+      }
+
+      template <typename GRADIENT_VECTOR>
+      SCALAR_TYPE
+      gradient_norm(const GRADIENT_VECTOR& grad) const
+      {
+        using traits = Vector_Traits<GRADIENT_VECTOR>;
+
+        return std::sqrt(mixed_squared_norm_2_kernel<SCALAR_TYPE>(
+            thread_pool, traits::data(grad), traits::size(grad), workspace.partial_sums()));
+      }
+
+      template <typename GRADIENT_VECTOR, typename PARAMETER_VECTOR>
+      void
+      update(const Adam_Step_Scalars<SCALAR_TYPE>& step_scalars,
+             const GRADIENT_VECTOR& grad,
+             PARAMETER_VECTOR& x_init) const
+      {
+        using parameter_traits = Vector_Traits<PARAMETER_VECTOR>;
+        using gradient_traits  = Vector_Traits<GRADIENT_VECTOR>;
+
+        if (v_max_k or weight_decay)
+        {
+          Adam_variant_step_kernel(thread_pool,
+                                   step_scalars,
+                                   parameter_traits::size(x_init),
+                                   gradient_traits::data(grad),
+                                   workspace.m_k_data(),
+                                   workspace.v_k_data(),
+                                   v_max_k,
+                                   parameter_traits::data(x_init));
+          return;
+        }
+        Adam_mixed_step_kernel(thread_pool,
+                               step_scalars,
+                               parameter_traits::size(x_init),
+                               gradient_traits::data(grad),
+                               workspace.m_k_data(),
+                               workspace.v_k_data(),
+                               parameter_traits::data(x_init));
+      }
+    };
+
+    // x_init and grad are used in place
+    template <typename SCALAR_TYPE,
+              typename CONFIGURATION_TYPE,
+              typename OBJECTIVE,
+              typename PARAMETER_VECTOR,
+              typename GRADIENT_VECTOR,
+              typename MOMENT_TYPE>
+    bool
+    Adam_iterate(const CONFIGURATION_TYPE& configuration,
+                 OBJECTIVE& objective_function,
+                 PARAMETER_VECTOR& x_init,
+                 SCALAR_TYPE& y,
+                 GRADIENT_VECTOR& grad,
+                 Adam_Workspace<SCALAR_TYPE, MOMENT_TYPE>& workspace)
+    {
+      const size_t domain_size = Vector_Traits<PARAMETER_VECTOR>::size(x_init);
+      Vector_Traits<GRADIENT_VECTOR>::resize(grad, domain_size);
+
+      // The only allocations (none with a reused workspace), the
+      // iterations are allocation-free (provided that the objective
+      // function is)
+      if (workspace.domain_size() != domain_size) workspace.reset(domain_size);
+
+      const Dense_Step<SCALAR_TYPE, MOMENT_TYPE> step{
+          workspace,
+          workspace.thread_pool(configuration.threads.value()),
+          configuration.amsgrad.value() ? workspace.v_max_k_data() : nullptr,
+          configuration.weight_decay.value() > 0};
+
+      return Adam_loop(configuration, objective_function, x_init, y, grad, workspace, step);
+    }
+
+    // Deterministic objective
+    template <typename DIFFERENTIABLE_FUNCTION>
+    struct Full_Objective
+    {
+      const DIFFERENTIABLE_FUNCTION& _objective_function;
+
+      template <typename... ARGS>
+      void
+      f(ARGS&&... args) const
+      {
+        _objective_function.f(std::forward<ARGS>(args)...);
+      }
+      template <typename... ARGS>
+      void
+      f_df(ARGS&&... args) const
+      {
+        _objective_function.f_df(std::forward<ARGS>(args)...);
+      }
+      template <typename... ARGS>
+      void
+      df(ARGS&&... args) const
+      {
+        _objective_function.df(std::forward<ARGS>(args)...);
+      }
+      void
+      next_iteration()
+      {
+      }
+      bool
+      has_converged(const bool below_epsilon) const
+      {
+        return below_epsilon;
+      }
+    };
+
+    // Shuffled mini-batches, each epoch visits all the terms once (the
+    // last mini-batch of an epoch can be smaller)
+    //
+    // Convergence: the gradient norm below epsilon for consecutive
+    // mini-batches covering term_count terms (one epoch), a single
+    // noisy mini-batch is not enough
+    template <typename SUM_OF_TERMS_FUNCTION>
+    class Minibatch_Objective
+    {
+      const SUM_OF_TERMS_FUNCTION& _objective_function;
+      std::vector<size_t> _permutation;
+      std::mt19937_64 _engine;
+      size_t _minibatch_size;
+      size_t _position;
+      Span<const size_t> _minibatch;
+      size_t _converged_terms;  // of the consecutive mini-batches below epsilon
+
+     public:
+      Minibatch_Objective(const SUM_OF_TERMS_FUNCTION& objective_function,
+                          const size_t minibatch_size,
+                          const std::uint64_t shuffle_seed)
+          : _objective_function(objective_function),
+            _permutation(objective_function.term_count()),
+            _engine(shuffle_seed),
+            _minibatch_size(std::min(minibatch_size, objective_function.term_count())),
+            _position(_permutation.size()),
+            _converged_terms(0)
+      {
+        assert(not _permutation.empty());
+
+        std::iota(_permutation.begin(), _permutation.end(), size_t(0));
+      }
+
+      void
+      next_iteration()
+      {
+        if (_position == _permutation.size())
+        {
+          std::shuffle(_permutation.begin(), _permutation.end(), _engine);
+          _position = 0;
+        }
+        const size_t size = std::min(_minibatch_size, _permutation.size() - _position);
+
+        _minibatch = Span<const size_t>(_permutation.data() + _position, size);
+        _position += size;
+      }
+
+      bool
+      has_converged(const bool below_epsilon)
+      {
+        _converged_terms = below_epsilon ? _converged_terms + _minibatch.size() : 0;
+
+        return _converged_terms >= _permutation.size();
+      }
+
+      template <typename X, typename Y>
+      void
+      f(const X& x, Y& y) const
+      {
+        _objective_function.f_minibatch(x, _minibatch, y);
+      }
+      template <typename X, typename Y, typename DF>
+      void
+      f_df(const X& x, Y& y, DF& df) const
+      {
+        _objective_function.f_df_minibatch(x, _minibatch, y, df);
+      }
+      template <typename X, typename DF>
+      void
+      df(const X& x, DF& df) const
+      {
+        _objective_function.df_minibatch(x, _minibatch, df);
+      }
+    };
+  }
+
+  // VECTOR_TYPE: std::valarray, std::vector, Aligned_Vector, Span...
+  // (see Vector_Traits), x_init and grad are used in place
+  //
+  // workspace: resumes from its state, see Adam_Workspace
+  //
+  // Mixed precision: the parameter, gradient and moment scalar types
+  // (PARAMETER_VECTOR, GRADIENT_VECTOR and workspace MOMENT_TYPE) can
+  // differ from SCALAR_TYPE, the objective value type also used for
+  // the step scalars and the gradient norm accumulation:
+  //
+  //   // float parameters and gradient, bfloat16 moments, double accumulation
+  //   Differentiable_Function<Aligned_Vector<float>, double, Aligned_Vector<float>> f(...);
+  //   Adam_Workspace<double, bfloat16> workspace;
+  //
+  //   Adam_optimize(make_Adam_configuration<double>(), f, x, y, grad, workspace);
+  //
+  // See Adam_mixed_kernel.hpp
+  //
+  // Returns true if has converged
+  template <typename SCALAR_TYPE,
+            typename CONFIGURATION_TYPE,
+            typename PARAMETER_VECTOR,
+            typename GRADIENT_VECTOR,
+            typename MOMENT_TYPE>
+  bool
+  Adam_optimize(
+      const CONFIGURATION_TYPE& configuration,
+      const Differentiable_Function<PARAMETER_VECTOR, SCALAR_TYPE, GRADIENT_VECTOR>&
+          objective_function,
+      PARAMETER_VECTOR& x_init,
+      SCALAR_TYPE& y,
+      GRADIENT_VECTOR& grad,
+      Adam_Workspace<SCALAR_TYPE, MOMENT_TYPE>& workspace)
+  {
+    Adam_Detail::Full_Objective<std::decay_t<decltype(objective_function)>> objective{
+        objective_function};
+
+    return Adam_Detail::Adam_iterate(configuration, objective, x_init, y, grad, workspace);
+  }
+
+  template <typename SCALAR_TYPE,
+            typename CONFIGURATION_TYPE,
+            typename PARAMETER_VECTOR,
+            typename GRADIENT_VECTOR>
+  bool
+  Adam_optimize(
+      const CONFIGURATION_TYPE& configuration,
+      const Differentiable_Function<PARAMETER_VECTOR, SCALAR_TYPE, GRADIENT_VECTOR>&
+          objective_function,
+      PARAMETER_VECTOR& x_init,
+      SCALAR_TYPE& y,
+      GRADIENT_VECTOR& grad)
+  {
+    Adam_Workspace<SCALAR_TYPE> workspace;
+
+    return Adam_optimize(configuration, objective_function, x_init, y, grad, workspace);
+  }
+
+  // Mini-batch version: each step evaluates the gradient on a slice
+  // of the shuffled terms. y and the gradient norm are the mini-batch
+  // ones, it has converged when the gradient norm stays below
+  // absolute_epsilon for a whole epoch of consecutive mini-batches.
+  //
+  // A resumed optimization starts a new epoch with a fresh shuffling
+  //
+  // Returns true if has converged
+  template <typename SCALAR_TYPE,
+            typename ALPHA_SCHEDULE,
+            typename PARAMETER_VECTOR,
+            typename GRADIENT_VECTOR,
+            typename STORAGE,
+            typename MOMENT_TYPE>
+  bool
+  Adam_optimize(
+      const Adam_Minibatch_Configuration<SCALAR_TYPE, ALPHA_SCHEDULE>& configuration,
+      const Sum_Of_Terms_Function<PARAMETER_VECTOR, SCALAR_TYPE, GRADIENT_VECTOR, STORAGE>&
+          objective_function,
+      PARAMETER_VECTOR& x_init,
+      SCALAR_TYPE& y,
+      GRADIENT_VECTOR& grad,
+      Adam_Workspace<SCALAR_TYPE, MOMENT_TYPE>& workspace)
+  {
+    Adam_Detail::Minibatch_Objective<std::decay_t<decltype(objective_function)>> objective(
+        objective_function,
+        configuration.minibatch_size.value(),
+        configuration.shuffle_seed.value());
+
+    return Adam_Detail::Adam_iterate(configuration, objective, x_init, y, grad, workspace);
+  }
+
+  template <typename SCALAR_TYPE,
+            typename ALPHA_SCHEDULE,
+            typename PARAMETER_VECTOR,
+            typename GRADIENT_VECTOR,
+            typename STORAGE>
+  bool
+  Adam_optimize(
+      const Adam_Minibatch_Configuration<SCALAR_TYPE, ALPHA_SCHEDULE>& configuration,
+      const Sum_Of_Terms_Function<PARAMETER_VECTOR, SCALAR_TYPE, GRADIENT_VECTOR, STORAGE>&
+          objective_function,
+      PARAMETER_VECTOR& x_init,
+      SCALAR_TYPE& y,
+      GRADIENT_VECTOR& grad)
+  {
+    Adam_Workspace<SCALAR_TYPE> workspace;
+
+    return Adam_optimize(configuration, objective_function, x_init, y, grad, workspace);
   }
 
   template <typename SCALAR_TYPE, typename VECTOR_TYPE, typename... USER_ARGS>
@@ -176,4 +923,100 @@ namespace Optimize
 
     return Adam_optimize(configuration, objective_function, x_init, y, grad);
   }
+
+  template <typename SCALAR_TYPE, typename VECTOR_TYPE, typename STORAGE, typename... USER_ARGS>
+  bool
+  Adam_optimize(
+      const Sum_Of_Terms_Function<VECTOR_TYPE, SCALAR_TYPE, VECTOR_TYPE, STORAGE>& objective,
+      VECTOR_TYPE& x_init,
+      SCALAR_TYPE& y,
+      VECTOR_TYPE& grad,
+      USER_ARGS... user_args)
+  {
+    auto configuration =
+        configure_Adam(objective, x_init, std::forward<USER_ARGS>(user_args)...);
+
+    return Adam_optimize(configuration, objective, x_init, y, grad);
+  }
+
+  /////////////////
+  // Adam_Solver //
+  /////////////////
+  //
+  // A configuration and a workspace, for repeated or continued
+  // optimizations without reallocation:
+  //
+  //   Adam_Solver solver(configure_Adam(f, x, _Adam_beta_1_ = 0.8));
+  //
+  //   solver.optimize(f, x, y, grad);  // cold start
+  //   solver.resume(f, x, y, grad);    // continues for at most
+  //                                    // maximimum_iterations more
+  //
+  // OBJECTIVE: Differentiable_Function, or Sum_Of_Terms_Function with
+  // an Adam_Minibatch_Configuration
+  //
+  // MOMENT_TYPE: see Adam_Workspace
+  //
+  template <typename CONFIGURATION_TYPE,
+            typename MOMENT_TYPE = typename CONFIGURATION_TYPE::scalar_type>
+  class Adam_Solver
+  {
+   public:
+    using configuration_type = CONFIGURATION_TYPE;
+    using scalar_type        = typename CONFIGURATION_TYPE::scalar_type;
+    using workspace_type     = Adam_Workspace<scalar_type, MOMENT_TYPE>;
+
+   protected:
+    configuration_type _configuration;
+    workspace_type _workspace;
+
+   public:
+    explicit Adam_Solver(const configuration_type& configuration = configuration_type())
+        : _configuration(configuration)
+    {
+    }
+
+    const configuration_type&
+    configuration() const
+    {
+      return _configuration;
+    }
+    configuration_type&
+    configuration()
+    {
+      return _configuration;
+    }
+    const workspace_type&
+    workspace() const
+    {
+      return _workspace;
+    }
+    workspace_type&
+    workspace()
+    {
+      return _workspace;
+    }
+
+    // Returns true if has converged
+    template <typename OBJECTIVE, typename PARAMETER_VECTOR, typename GRADIENT_VECTOR>
+    bool
+    optimize(const OBJECTIVE& objective,
+             PARAMETER_VECTOR& x_init,
+             scalar_type& y,
+             GRADIENT_VECTOR& grad)
+    {
+      _workspace.reset(Vector_Traits<PARAMETER_VECTOR>::size(x_init));
+
+      return resume(objective, x_init, y, grad);
+    }
+    template <typename OBJECTIVE, typename PARAMETER_VECTOR, typename GRADIENT_VECTOR>
+    bool
+    resume(const OBJECTIVE& objective,
+           PARAMETER_VECTOR& x_init,
+           scalar_type& y,
+           GRADIENT_VECTOR& grad)
+    {
+      return Adam_optimize(_configuration, objective, x_init, y, grad, _workspace);
+    }
+  };
 }
@@ -0,0 +1,662 @@
+#pragma once
+
+#include "Adam.hpp"
+#include "bfloat16.hpp"
+#include "span.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) or defined(__APPLE__)
+#define MATH_FUNCTIONS_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Checkpoints of long Adam runs: the state (step count, x, m_k, v_k,
+// objective counters, configuration) is saved every N steps and/or T
+// seconds, and a crashed or pre-empted run resumes from the last one:
+//
+//   Adam_Workspace<double> workspace;
+//   if (std::ifstream("run.ckpt")) resume_from_checkpoint("run.ckpt", x, workspace);
+//
+//   Adam_Checkpointer checkpointer("run.ckpt", 1000, 60.);  // every 1000 steps or 60s
+//
+//   auto configuration       = make_Adam_configuration<double>(...);
+//   configuration.checkpoint = checkpointer.hook(configuration, x, workspace, f);
+//
+//   Adam_optimize(configuration, f, x, y, grad, workspace);  // continues
+//                                                            // from the checkpoint
+//
+// The solver thread only copies the state into a buffer, a writer
+// thread writes it (to path.tmp, then renamed: a checkpoint file is
+// always complete). A checkpoint due while the previous one is still
+// being written is postponed to the next step. The end of the run
+// state is always saved (waiting for the writer if needed).
+//
+// File: an Adam_Checkpoint_Header followed by the raw arrays (native
+// byte order) at cache line aligned offsets, hence memory-mappable:
+// Adam_Checkpoint_File gives the arrays without copy.
+
+namespace Optimize
+{
+  ///////////////////////////
+  // Adam_Checkpoint_Header //
+  ///////////////////////////
+  //
+  enum class Checkpoint_Scalar_Type : std::uint32_t
+  {
+    Float    = 1,
+    Double   = 2,
+    BFloat16 = 3
+  };
+
+  template <typename T>
+  constexpr Checkpoint_Scalar_Type
+  checkpoint_scalar_type()
+  {
+    if constexpr (std::is_same_v<T, float>)
+    {
+      return Checkpoint_Scalar_Type::Float;
+    }
+    else if constexpr (std::is_same_v<T, double>)
+    {
+      return Checkpoint_Scalar_Type::Double;
+    }
+    else
+    {
+      static_assert(std::is_same_v<T, bfloat16>, "float, double or bfloat16 only");
+      return Checkpoint_Scalar_Type::BFloat16;
+    }
+  }
+
+  struct Adam_Checkpoint_Header
+  {
+    char magic[8];                // "AdamCkpt"
+    std::uint32_t version;        // 1
+    std::uint32_t header_size;    // sizeof(Adam_Checkpoint_Header)
+    std::uint64_t file_size;      // bytes
+    std::uint64_t domain_size;    // x, m_k, v_k sizes
+    std::uint64_t step_count;     // Adam_Workspace::step_count()
+    std::uint32_t parameter_type; // Checkpoint_Scalar_Type of x
+    std::uint32_t moment_type;    // Checkpoint_Scalar_Type of m_k, v_k
+    std::uint64_t f_counter;      // objective counters (0: not recorded)
+    std::uint64_t df_counter;
+
+    // Configuration
+    double beta_1;
+    double beta_2;
+    double internal_epsilon;
+    double weight_decay;
+
+    // From the file start, cache line aligned
+    std::uint64_t x_offset;
+    std::uint64_t m_k_offset;
+    std::uint64_t v_k_offset;
+    std::uint64_t v_max_k_offset;  // 0: no AMSGrad maximum
+  };
+
+  static_assert(sizeof(Adam_Checkpoint_Header) == 128);
+  static_assert(std::is_trivially_copyable_v<Adam_Checkpoint_Header>);
+
+  namespace Adam_Checkpoint_Detail
+  {
+    static constexpr char magic[8]              = {'A', 'd', 'a', 'm', 'C', 'k', 'p', 't'};
+    static constexpr std::uint32_t version      = 1;
+    static constexpr std::uint64_t array_align  = cache_line_size;
+
+    inline std::uint64_t
+    align_up(const std::uint64_t offset)
+    {
+      return (offset + array_align - 1) / array_align * array_align;
+    }
+
+    inline size_t
+    scalar_size(const std::uint32_t type)
+    {
+      switch (Checkpoint_Scalar_Type(type))
+      {
+        case Checkpoint_Scalar_Type::Float:
+          return sizeof(float);
+        case Checkpoint_Scalar_Type::Double:
+          return sizeof(double);
+        case Checkpoint_Scalar_Type::BFloat16:
+          return sizeof(bfloat16);
+      }
+      return 0;
+    }
+  }
+
+  ///////////////////////
+  // Adam_Checkpointer //
+  ///////////////////////
+  //
+  // Owns the writer thread, must outlive the hooks. The destructor
+  // writes the pending checkpoint.
+  //
+  class Adam_Checkpointer
+  {
+   protected:
+    std::string _path;
+    size_t _every_steps;    // 0: never
+    double _every_seconds;  // 0: never
+
+    // Solver thread
+    size_t _last_step;  // max(): not started
+    std::chrono::steady_clock::time_point _last_time;
+
+    // Handed to the writer while _busy
+    std::vector<unsigned char> _buffer;
+    std::atomic<bool> _busy;
+    std::atomic<size_t> _written;
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _stop;                  // guarded by _mutex
+    std::exception_ptr _error;   // first write error, guarded by _mutex
+    std::thread _writer;
+
+    void
+    write_file() const
+    {
+      const std::string temporary_path = _path + ".tmp";
+
+      std::FILE* const file = std::fopen(temporary_path.c_str(), "wb");
+      if (not file)
+      {
+        throw std::system_error(errno, std::generic_category(), "fopen " + temporary_path);
+      }
+      bool ok = std::fwrite(_buffer.data(), 1, _buffer.size(), file) == _buffer.size();
+      ok      = (std::fflush(file) == 0) and ok;
+#if defined(MATH_FUNCTIONS_HAS_MMAP)
+      ok = (::fsync(::fileno(file)) == 0) and ok;
+#endif
+      const int error = errno;
+      ok              = (std::fclose(file) == 0) and ok;
+
+      if (not ok)
+      {
+        throw std::system_error(error, std::generic_category(), "write " + temporary_path);
+      }
+
+      if (std::rename(temporary_path.c_str(), _path.c_str()) != 0)
+      {
+        throw std::system_error(errno, std::generic_category(), "rename " + temporary_path);
+      }
+    }
+
+    void
+    run_writer()
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      for (;;)
+      {
+        _wake.wait(lock, [this]() { return _stop or _busy.load(std::memory_order_acquire); });
+        if (not _busy.load(std::memory_order_acquire)) return;
+
+        lock.unlock();
+        try
+        {
+          write_file();
+          _written.fetch_add(1, std::memory_order_relaxed);
+        }
+        catch (...)
+        {
+          lock.lock();
+          if (not _error) _error = std::current_exception();
+          lock.unlock();
+        }
+        lock.lock();
+
+        _busy.store(false, std::memory_order_release);
+        _wake.notify_all();
+      }
+    }
+
+    void
+    wait_idle()
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _wake.wait(lock, [this]() { return not _busy.load(std::memory_order_acquire); });
+    }
+
+    // Starts the interval at the first step of a run
+    bool
+    is_due(const size_t step_count)
+    {
+      if (_last_step == std::numeric_limits<size_t>::max())
+      {
+        _last_step = step_count - 1;
+        if (_every_seconds > 0) _last_time = std::chrono::steady_clock::now();
+      }
+
+      if ((_every_steps > 0) and (step_count - _last_step >= _every_steps)) return true;
+
+      if (_every_seconds > 0)
+      {
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - _last_time;
+        return elapsed.count() >= _every_seconds;
+      }
+      return false;
+    }
+
+    // Solver thread: copies the state into the buffer and wakes the
+    // writer, nothing if still writing
+    template <typename SCALAR_TYPE, typename PARAMETER_VECTOR, typename MOMENT_TYPE>
+    void
+    checkpoint(Adam_Checkpoint_Header header,
+               const PARAMETER_VECTOR& x,
+               const Adam_Workspace<SCALAR_TYPE, MOMENT_TYPE>& workspace)
+    {
+      using namespace Adam_Checkpoint_Detail;
+
+      using traits         = Vector_Traits<PARAMETER_VECTOR>;
+      using parameter_type = std::remove_const_t<typename traits::scalar_type>;
+
+      if (_busy.load(std::memory_order_acquire)) return;
+
+      const size_t n = workspace.domain_size();
+      assert(traits::size(x) == n);
+
+      const auto v_max_k        = workspace.v_max_k();
+      const size_t x_bytes      = n * sizeof(parameter_type);
+      const size_t moment_bytes = n * sizeof(MOMENT_TYPE);
+
+      std::memcpy(header.magic, magic, sizeof(header.magic));
+      header.version        = version;
+      header.header_size    = sizeof(Adam_Checkpoint_Header);
+      header.domain_size    = n;
+      header.step_count     = workspace.step_count();
+      header.parameter_type = std::uint32_t(checkpoint_scalar_type<parameter_type>());
+      header.moment_type    = std::uint32_t(checkpoint_scalar_type<MOMENT_TYPE>());
+      header.x_offset       = align_up(sizeof(Adam_Checkpoint_Header));
+      header.m_k_offset     = align_up(header.x_offset + x_bytes);
+      header.v_k_offset     = align_up(header.m_k_offset + moment_bytes);
+      header.v_max_k_offset = v_max_k.empty() ? 0 : align_up(header.v_k_offset + moment_bytes);
+      header.file_size      = (v_max_k.empty() ? header.v_k_offset : header.v_max_k_offset) +
+                         moment_bytes;
+
+      // No allocation once the capacity is reached, only the alignment
+      // padding is zeroed
+      _buffer.resize(header.file_size);
+
+      unsigned char* const data = _buffer.data();
+      const auto copy = [data](const std::uint64_t offset,
+                               const void* const source,
+                               const size_t bytes,
+                               const std::uint64_t next_offset) {
+        std::memcpy(data + offset, source, bytes);
+        std::memset(data + offset + bytes, 0, next_offset - offset - bytes);
+      };
+      const std::uint64_t v_k_end = v_max_k.empty() ? header.file_size : header.v_max_k_offset;
+
+      copy(0, &header, sizeof(header), header.x_offset);
+      copy(header.x_offset, traits::data(x), x_bytes, header.m_k_offset);
+      copy(header.m_k_offset, workspace.m_k().data(), moment_bytes, header.v_k_offset);
+      copy(header.v_k_offset, workspace.v_k().data(), moment_bytes, v_k_end);
+      if (not v_max_k.empty())
+      {
+        copy(header.v_max_k_offset, v_max_k.data(), moment_bytes, header.file_size);
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _busy.store(true, std::memory_order_release);
+      }
+      _wake.notify_all();
+
+      _last_step = header.step_count;
+      if (_every_seconds > 0) _last_time = std::chrono::steady_clock::now();
+    }
+
+    template <typename CONFIGURATION_TYPE,
+              typename PARAMETER_VECTOR,
+              typename SCALAR_TYPE,
+              typename MOMENT_TYPE,
+              typename COUNTERS>
+    Adam_Checkpoint
+    make_hook(const CONFIGURATION_TYPE& configuration,
+              const PARAMETER_VECTOR& x,
+              const Adam_Workspace<SCALAR_TYPE, MOMENT_TYPE>& workspace,
+              COUNTERS counters)
+    {
+      Adam_Checkpoint_Header header{};
+      header.beta_1           = configuration.beta_1.value();
+      header.beta_2           = configuration.beta_2.value();
+      header.internal_epsilon = configuration.internal_epsilon.value();
+      header.weight_decay     = configuration.weight_decay.value();
+
+      _last_step = std::numeric_limits<size_t>::max();
+
+      return [this, header, &x, &workspace, counters](const size_t step_count,
+                                                      const bool run_end) {
+        if (run_end)
+        {
+          // Final state, unless already saved (or no step)
+          if ((_last_step == std::numeric_limits<size_t>::max()) or (step_count == _last_step))
+          {
+            return;
+          }
+          wait_idle();
+        }
+        else if (not is_due(step_count))
+        {
+          return;
+        }
+
+        Adam_Checkpoint_Header stamped = header;
+        counters(stamped.f_counter, stamped.df_counter);
+
+        checkpoint(stamped, x, workspace);
+      };
+    }
+
+   public:
+    // every_steps, every_seconds: 0 for never
+    Adam_Checkpointer(const std::string& path,
+                      const size_t every_steps,
+                      const double every_seconds = 0)
+        : _path{path},
+          _every_steps{every_steps},
+          _every_seconds{every_seconds},
+          _last_step{std::numeric_limits<size_t>::max()},
+          _busy{false},
+          _written{0},
+          _stop{false}
+    {
+      assert(every_seconds >= 0);
+
+      _writer = std::thread([this]() { run_writer(); });
+    }
+
+    Adam_Checkpointer(const Adam_Checkpointer&) = delete;
+    Adam_Checkpointer& operator=(const Adam_Checkpointer&) = delete;
+
+    ~Adam_Checkpointer()
+    {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+      }
+      _wake.notify_all();
+      _writer.join();
+    }
+
+    // Checkpoints of x and workspace (and configuration), both must
+    // outlive the hook. One run at a time per checkpointer.
+    template <typename CONFIGURATION_TYPE,
+              typename PARAMETER_VECTOR,
+              typename SCALAR_TYPE,
+              typename MOMENT_TYPE>
+    Adam_Checkpoint
+    hook(const CONFIGURATION_TYPE& configuration,
+         const PARAMETER_VECTOR& x,
+         const Adam_Workspace<SCALAR_TYPE, MOMENT_TYPE>& workspace)
+    {
+      return make_hook(configuration, x, workspace, [](std::uint64_t&, std::uint64_t&) {});
+    }
+    // Same with the objective counters (must be initialized)
+    template <typename CONFIGURATION_TYPE,
+              typename PARAMETER_VECTOR,
+              typename SCALAR_TYPE,
+              typename MOMENT_TYPE,
+              typename OBJECTIVE>
+    Adam_Checkpoint
+    hook(const CONFIGURATION_TYPE& configuration,
+         const PARAMETER_VECTOR& x,
+         const Adam_Workspace<SCALAR_TYPE, MOMENT_TYPE>& workspace,
+         const OBJECTIVE& objective_function)
+    {
+      return make_hook(configuration,
+                       x,
+                       workspace,
+                       [objective_function](std::uint64_t& f_counter, std::uint64_t& df_counter) {
+                         f_counter  = objective_function.f_counter();
+                         df_counter = objective_function.df_counter();
+                       });
+    }
+
+    // Waits for the checkpoint being written, rethrows the first write
+    // error
+    void
+    flush()
+    {
+      wait_idle();
+
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_error) std::rethrow_exception(_error);
+    }
+
+    // Number of checkpoints written
+    size_t
+    written() const
+    {
+      return _written.load(std::memory_order_relaxed);
+    }
+  };
+
+  //////////////////////////
+  // Adam_Checkpoint_File //
+  //////////////////////////
+  //
+  // Read-only view of a checkpoint file: memory-mapped (POSIX),
+  // otherwise read in memory. The arrays are used in place.
+  //
+  class Adam_Checkpoint_File
+  {
+   protected:
+    const unsigned char* _data = nullptr;
+    size_t _size               = 0;
+#if defined(MATH_FUNCTIONS_HAS_MMAP)
+    void* _mapping = nullptr;
+#else
+    std::vector<unsigned char> _content;
+#endif
+
+    const Adam_Checkpoint_Header&
+    checked_header(const std::string& path) const
+    {
+      using namespace Adam_Checkpoint_Detail;
+
+      if (_size < sizeof(Adam_Checkpoint_Header))
+      {
+        throw std::runtime_error(path + ": not an Adam checkpoint");
+      }
+      const Adam_Checkpoint_Header& h = header();
+
+      const size_t x_bytes      = h.domain_size * scalar_size(h.parameter_type);
+      const size_t moment_bytes = h.domain_size * scalar_size(h.moment_type);
+
+      const auto fits = [&](const std::uint64_t offset, const size_t bytes) {
+        return (offset % array_align == 0) and (offset >= sizeof(Adam_Checkpoint_Header)) and
+               (offset <= _size) and (bytes <= _size - offset);
+      };
+      const bool valid =
+          (std::memcmp(h.magic, magic, sizeof(h.magic)) == 0) and (h.version == version) and
+          (h.header_size == sizeof(Adam_Checkpoint_Header)) and (h.file_size == _size) and
+          (scalar_size(h.parameter_type) > 0) and (scalar_size(h.moment_type) > 0) and
+          fits(h.x_offset, x_bytes) and fits(h.m_k_offset, moment_bytes) and
+          fits(h.v_k_offset, moment_bytes) and
+          ((h.v_max_k_offset == 0) or fits(h.v_max_k_offset, moment_bytes));
+
+      if (not valid) throw std::runtime_error(path + ": invalid Adam checkpoint");
+
+      return h;
+    }
+
+    template <typename T>
+    Span<const T>
+    array(const std::uint64_t offset, const std::uint32_t type) const
+    {
+      assert(type == std::uint32_t(checkpoint_scalar_type<T>()));
+      (void)type;
+
+      if (offset == 0) return {nullptr, 0};
+
+      return {reinterpret_cast<const T*>(_data + offset), size_t(header().domain_size)};
+    }
+
+   public:
+    explicit Adam_Checkpoint_File(const std::string& path)
+    {
+#if defined(MATH_FUNCTIONS_HAS_MMAP)
+      const int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) throw std::system_error(errno, std::generic_category(), "open " + path);
+
+      struct stat file_status;
+      if (::fstat(fd, &file_status) != 0)
+      {
+        const int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "fstat " + path);
+      }
+      _size = size_t(file_status.st_size);
+
+      if (_size > 0)
+      {
+        void* const mapping = ::mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+          const int error = errno;
+          ::close(fd);
+          throw std::system_error(error, std::generic_category(), "mmap " + path);
+        }
+        _mapping = mapping;
+        _data    = static_cast<const unsigned char*>(mapping);
+      }
+      ::close(fd);  // the mapping stays valid
+#else
+      std::ifstream file(path, std::ios::binary | std::ios::ate);
+      if (not file) throw std::runtime_error("cannot open " + path);
+
+      _content.resize(size_t(file.tellg()));
+      file.seekg(0);
+      if (not file.read(reinterpret_cast<char*>(_content.data()), _content.size()))
+      {
+        throw std::runtime_error("read error " + path);
+      }
+      _data = _content.data();
+      _size = _content.size();
+#endif
+      try
+      {
+        checked_header(path);
+      }
+      catch (...)
+      {
+#if defined(MATH_FUNCTIONS_HAS_MMAP)
+        if (_mapping) ::munmap(_mapping, _size);
+#endif
+        throw;
+      }
+    }
+
+    Adam_Checkpoint_File(const Adam_Checkpoint_File&) = delete;
+    Adam_Checkpoint_File& operator=(const Adam_Checkpoint_File&) = delete;
+
+    ~Adam_Checkpoint_File()
+    {
+#if defined(MATH_FUNCTIONS_HAS_MMAP)
+      if (_mapping) ::munmap(_mapping, _size);
+#endif
+    }
+
+    const Adam_Checkpoint_Header&
+    header() const
+    {
+      return *reinterpret_cast<const Adam_Checkpoint_Header*>(_data);
+    }
+
+    // T: the stored scalar types (asserted)
+    template <typename T>
+    Span<const T>
+    x() const
+    {
+      return array<T>(header().x_offset, header().parameter_type);
+    }
+    template <typename T>
+    Span<const T>
+    m_k() const
+    {
+      return array<T>(header().m_k_offset, header().moment_type);
+    }
+    template <typename T>
+    Span<const T>
+    v_k() const
+    {
+      return array<T>(header().v_k_offset, header().moment_type);
+    }
+    // Empty without AMSGrad maximum
+    template <typename T>
+    Span<const T>
+    v_max_k() const
+    {
+      return array<T>(header().v_max_k_offset, header().moment_type);
+    }
+  };
+
+  ////////////////////////////
+  // resume_from_checkpoint //
+  ////////////////////////////
+  //
+  // x_init and the workspace (warm start) from a checkpoint, a later
+  // Adam_optimize() call with this workspace continues the run. The
+  // counters and the configuration of the checkpointed run are in the
+  // returned header.
+  //
+  // Throws if the file is not a checkpoint of these scalar types
+  //
+  template <typename PARAMETER_VECTOR, typename SCALAR_TYPE, typename MOMENT_TYPE>
+  Adam_Checkpoint_Header
+  resume_from_checkpoint(const std::string& path,
+                         PARAMETER_VECTOR& x_init,
+                         Adam_Workspace<SCALAR_TYPE, MOMENT_TYPE>& workspace)
+  {
+    using traits         = Vector_Traits<PARAMETER_VECTOR>;
+    using parameter_type = typename traits::scalar_type;
+
+    const Adam_Checkpoint_File file(path);
+    const Adam_Checkpoint_Header header = file.header();
+
+    if ((header.parameter_type != std::uint32_t(checkpoint_scalar_type<parameter_type>())) or
+        (header.moment_type != std::uint32_t(checkpoint_scalar_type<MOMENT_TYPE>())))
+    {
+      throw std::runtime_error(path + ": checkpoint scalar types mismatch");
+    }
+
+    const auto x = file.x<parameter_type>();
+    traits::resize(x_init, x.size());
+    std::copy(x.begin(), x.end(), traits::data(x_init));
+
+    if (header.v_max_k_offset == 0)
+    {
+      workspace.warm_start(file.m_k<MOMENT_TYPE>(), file.v_k<MOMENT_TYPE>(), header.step_count);
+    }
+    else
+    {
+      workspace.warm_start(file.m_k<MOMENT_TYPE>(),
+                           file.v_k<MOMENT_TYPE>(),
+                           file.v_max_k<MOMENT_TYPE>(),
+                           header.step_count);
+    }
+    return header;
+  }
+}
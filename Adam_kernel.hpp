@@ -0,0 +1,630 @@
+#pragma once
+
+#include "cache_line.hpp"
+#include "simd.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+namespace Optimize
+{
+  ///////////////////////
+  // Adam_Step_Scalars //
+  ///////////////////////
+  //
+  // Iteration-dependent scalars, bias corrections use the running
+  // products beta^k instead of std::pow(beta, k)
+  //
+  template <typename SCALAR_TYPE>
+  struct Adam_Step_Scalars
+  {
+    SCALAR_TYPE beta_1;
+    SCALAR_TYPE beta_2;
+    SCALAR_TYPE internal_epsilon;
+    SCALAR_TYPE weight_decay = 0;  // AdamW, see Adam_variant_step_kernel()
+
+    SCALAR_TYPE beta_1_power = 1;  // beta_1^k
+    SCALAR_TYPE beta_2_power = 1;  // beta_2^k
+
+    // Computed by next_iteration()
+    SCALAR_TYPE step_scale        = 0;  // alpha / (1 - beta_1^k)
+    SCALAR_TYPE v_bias_correction = 0;  // 1 / (1 - beta_2^k)
+    SCALAR_TYPE decay_scale       = 0;  // alpha * weight_decay
+
+    Adam_Step_Scalars(const SCALAR_TYPE beta_1,
+                      const SCALAR_TYPE beta_2,
+                      const SCALAR_TYPE internal_epsilon)
+        : beta_1{beta_1}, beta_2{beta_2}, internal_epsilon{internal_epsilon}
+    {
+    }
+
+    // Before the k-th step (k=1,2...)
+    void
+    next_iteration(const SCALAR_TYPE alpha)
+    {
+      beta_1_power *= beta_1;
+      beta_2_power *= beta_2;
+
+      step_scale        = alpha / (1 - beta_1_power);
+      v_bias_correction = 1 / (1 - beta_2_power);
+      decay_scale       = alpha * weight_decay;
+    }
+  };
+
+  namespace Adam_Kernel_Detail
+  {
+    ////////////
+    // Scalar //
+    ////////////
+    //
+    template <typename SCALAR_TYPE>
+    void
+    Adam_step_scalar(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                     const size_t n,
+                     const SCALAR_TYPE* const grad,
+                     SCALAR_TYPE* const m_k,
+                     SCALAR_TYPE* const v_k,
+                     SCALAR_TYPE* const x)
+    {
+      using std::sqrt;
+
+      const SCALAR_TYPE beta_1            = scalars.beta_1;
+      const SCALAR_TYPE one_minus_beta_1  = 1 - scalars.beta_1;
+      const SCALAR_TYPE beta_2            = scalars.beta_2;
+      const SCALAR_TYPE one_minus_beta_2  = 1 - scalars.beta_2;
+      const SCALAR_TYPE step_scale        = scalars.step_scale;
+      const SCALAR_TYPE v_bias_correction = scalars.v_bias_correction;
+      const SCALAR_TYPE internal_epsilon  = scalars.internal_epsilon;
+
+      for (size_t i = 0; i < n; ++i)
+      {
+        const SCALAR_TYPE g = grad[i];
+        const SCALAR_TYPE m = beta_1 * m_k[i] + one_minus_beta_1 * g;
+        const SCALAR_TYPE v = beta_2 * v_k[i] + one_minus_beta_2 * g * g;
+
+        m_k[i] = m;
+        v_k[i] = v;
+        x[i] -= step_scale * m / (sqrt(v_bias_correction * v) + internal_epsilon);
+      }
+    }
+
+    template <typename SCALAR_TYPE>
+    auto
+    squared_norm_2_scalar(const SCALAR_TYPE* const v, const size_t n)
+    {
+      using std::abs;
+
+      using real_type = decltype(abs(std::declval<SCALAR_TYPE>()));
+
+      real_type sum = 0;
+      for (size_t i = 0; i < n; ++i)
+      {
+        const real_type abs_v_i = abs(v[i]);
+        sum += abs_v_i * abs_v_i;
+      }
+      return sum;
+    }
+
+#if defined(MATH_FUNCTIONS_SIMD_X86)
+    //////////
+    // AVX2 //
+    //////////
+    //
+    __attribute__((target("avx2,fma"))) inline void
+    Adam_step_avx2(const Adam_Step_Scalars<double>& scalars,
+                   const size_t n,
+                   const double* const grad,
+                   double* const m_k,
+                   double* const v_k,
+                   double* const x)
+    {
+      const __m256d beta_1            = _mm256_set1_pd(scalars.beta_1);
+      const __m256d one_minus_beta_1  = _mm256_set1_pd(1 - scalars.beta_1);
+      const __m256d beta_2            = _mm256_set1_pd(scalars.beta_2);
+      const __m256d one_minus_beta_2  = _mm256_set1_pd(1 - scalars.beta_2);
+      const __m256d step_scale        = _mm256_set1_pd(scalars.step_scale);
+      const __m256d v_bias_correction = _mm256_set1_pd(scalars.v_bias_correction);
+      const __m256d internal_epsilon  = _mm256_set1_pd(scalars.internal_epsilon);
+
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        const __m256d g = _mm256_loadu_pd(grad + i);
+        const __m256d m =
+            _mm256_fmadd_pd(beta_1, _mm256_loadu_pd(m_k + i), _mm256_mul_pd(one_minus_beta_1, g));
+        const __m256d v = _mm256_fmadd_pd(
+            beta_2, _mm256_loadu_pd(v_k + i), _mm256_mul_pd(_mm256_mul_pd(one_minus_beta_2, g), g));
+
+        _mm256_storeu_pd(m_k + i, m);
+        _mm256_storeu_pd(v_k + i, v);
+
+        const __m256d denominator =
+            _mm256_add_pd(_mm256_sqrt_pd(_mm256_mul_pd(v_bias_correction, v)), internal_epsilon);
+        _mm256_storeu_pd(x + i,
+                         _mm256_sub_pd(_mm256_loadu_pd(x + i),
+                                       _mm256_div_pd(_mm256_mul_pd(step_scale, m), denominator)));
+      }
+      Adam_step_scalar(scalars, n - i, grad + i, m_k + i, v_k + i, x + i);
+    }
+
+    __attribute__((target("avx2,fma"))) inline void
+    Adam_step_avx2(const Adam_Step_Scalars<float>& scalars,
+                   const size_t n,
+                   const float* const grad,
+                   float* const m_k,
+                   float* const v_k,
+                   float* const x)
+    {
+      const __m256 beta_1            = _mm256_set1_ps(scalars.beta_1);
+      const __m256 one_minus_beta_1  = _mm256_set1_ps(1 - scalars.beta_1);
+      const __m256 beta_2            = _mm256_set1_ps(scalars.beta_2);
+      const __m256 one_minus_beta_2  = _mm256_set1_ps(1 - scalars.beta_2);
+      const __m256 step_scale        = _mm256_set1_ps(scalars.step_scale);
+      const __m256 v_bias_correction = _mm256_set1_ps(scalars.v_bias_correction);
+      const __m256 internal_epsilon  = _mm256_set1_ps(scalars.internal_epsilon);
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        const __m256 g = _mm256_loadu_ps(grad + i);
+        const __m256 m =
+            _mm256_fmadd_ps(beta_1, _mm256_loadu_ps(m_k + i), _mm256_mul_ps(one_minus_beta_1, g));
+        const __m256 v = _mm256_fmadd_ps(
+            beta_2, _mm256_loadu_ps(v_k + i), _mm256_mul_ps(_mm256_mul_ps(one_minus_beta_2, g), g));
+
+        _mm256_storeu_ps(m_k + i, m);
+        _mm256_storeu_ps(v_k + i, v);
+
+        const __m256 denominator =
+            _mm256_add_ps(_mm256_sqrt_ps(_mm256_mul_ps(v_bias_correction, v)), internal_epsilon);
+        _mm256_storeu_ps(x + i,
+                         _mm256_sub_ps(_mm256_loadu_ps(x + i),
+                                       _mm256_div_ps(_mm256_mul_ps(step_scale, m), denominator)));
+      }
+      Adam_step_scalar(scalars, n - i, grad + i, m_k + i, v_k + i, x + i);
+    }
+
+    __attribute__((target("avx2,fma"))) inline double
+    squared_norm_2_avx2(const double* const v, const size_t n)
+    {
+      // two accumulators to hide the FMA latency
+      __m256d sum_0 = _mm256_setzero_pd();
+      __m256d sum_1 = _mm256_setzero_pd();
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        const __m256d v_0 = _mm256_loadu_pd(v + i);
+        const __m256d v_1 = _mm256_loadu_pd(v + i + 4);
+        sum_0             = _mm256_fmadd_pd(v_0, v_0, sum_0);
+        sum_1             = _mm256_fmadd_pd(v_1, v_1, sum_1);
+      }
+      const __m256d sum = _mm256_add_pd(sum_0, sum_1);
+
+      __m128d sum_128 = _mm_add_pd(_mm256_castpd256_pd128(sum), _mm256_extractf128_pd(sum, 1));
+      sum_128         = _mm_add_sd(sum_128, _mm_unpackhi_pd(sum_128, sum_128));
+
+      return _mm_cvtsd_f64(sum_128) + squared_norm_2_scalar(v + i, n - i);
+    }
+
+    __attribute__((target("avx2,fma"))) inline float
+    squared_norm_2_avx2(const float* const v, const size_t n)
+    {
+      __m256 sum_0 = _mm256_setzero_ps();
+      __m256 sum_1 = _mm256_setzero_ps();
+
+      size_t i = 0;
+      for (; i + 16 <= n; i += 16)
+      {
+        const __m256 v_0 = _mm256_loadu_ps(v + i);
+        const __m256 v_1 = _mm256_loadu_ps(v + i + 8);
+        sum_0            = _mm256_fmadd_ps(v_0, v_0, sum_0);
+        sum_1            = _mm256_fmadd_ps(v_1, v_1, sum_1);
+      }
+      const __m256 sum = _mm256_add_ps(sum_0, sum_1);
+
+      __m128 sum_128 = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+      sum_128        = _mm_add_ps(sum_128, _mm_movehl_ps(sum_128, sum_128));
+      sum_128        = _mm_add_ss(sum_128, _mm_shuffle_ps(sum_128, sum_128, 0x1));
+
+      return _mm_cvtss_f32(sum_128) + squared_norm_2_scalar(v + i, n - i);
+    }
+
+    /////////////
+    // AVX-512 //
+    /////////////
+    //
+    // Note: _mm512_maskz_sqrt_* rather than _mm512_sqrt_* avoids a GCC
+    // -Wmaybe-uninitialized false positive
+    //
+    __attribute__((target("avx512f"))) inline void
+    Adam_step_avx512(const Adam_Step_Scalars<double>& scalars,
+                     const size_t n,
+                     const double* const grad,
+                     double* const m_k,
+                     double* const v_k,
+                     double* const x)
+    {
+      const __m512d beta_1            = _mm512_set1_pd(scalars.beta_1);
+      const __m512d one_minus_beta_1  = _mm512_set1_pd(1 - scalars.beta_1);
+      const __m512d beta_2            = _mm512_set1_pd(scalars.beta_2);
+      const __m512d one_minus_beta_2  = _mm512_set1_pd(1 - scalars.beta_2);
+      const __m512d step_scale        = _mm512_set1_pd(scalars.step_scale);
+      const __m512d v_bias_correction = _mm512_set1_pd(scalars.v_bias_correction);
+      const __m512d internal_epsilon  = _mm512_set1_pd(scalars.internal_epsilon);
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        const __m512d g = _mm512_loadu_pd(grad + i);
+        const __m512d m =
+            _mm512_fmadd_pd(beta_1, _mm512_loadu_pd(m_k + i), _mm512_mul_pd(one_minus_beta_1, g));
+        const __m512d v = _mm512_fmadd_pd(
+            beta_2, _mm512_loadu_pd(v_k + i), _mm512_mul_pd(_mm512_mul_pd(one_minus_beta_2, g), g));
+
+        _mm512_storeu_pd(m_k + i, m);
+        _mm512_storeu_pd(v_k + i, v);
+
+        const __m512d denominator =
+            _mm512_add_pd(_mm512_maskz_sqrt_pd(__mmask8(-1), _mm512_mul_pd(v_bias_correction, v)),
+                          internal_epsilon);
+        _mm512_storeu_pd(x + i,
+                         _mm512_sub_pd(_mm512_loadu_pd(x + i),
+                                       _mm512_div_pd(_mm512_mul_pd(step_scale, m), denominator)));
+      }
+      Adam_step_scalar(scalars, n - i, grad + i, m_k + i, v_k + i, x + i);
+    }
+
+    __attribute__((target("avx512f"))) inline void
+    Adam_step_avx512(const Adam_Step_Scalars<float>& scalars,
+                     const size_t n,
+                     const float* const grad,
+                     float* const m_k,
+                     float* const v_k,
+                     float* const x)
+    {
+      const __m512 beta_1            = _mm512_set1_ps(scalars.beta_1);
+      const __m512 one_minus_beta_1  = _mm512_set1_ps(1 - scalars.beta_1);
+      const __m512 beta_2            = _mm512_set1_ps(scalars.beta_2);
+      const __m512 one_minus_beta_2  = _mm512_set1_ps(1 - scalars.beta_2);
+      const __m512 step_scale        = _mm512_set1_ps(scalars.step_scale);
+      const __m512 v_bias_correction = _mm512_set1_ps(scalars.v_bias_correction);
+      const __m512 internal_epsilon  = _mm512_set1_ps(scalars.internal_epsilon);
+
+      size_t i = 0;
+      for (; i + 16 <= n; i += 16)
+      {
+        const __m512 g = _mm512_loadu_ps(grad + i);
+        const __m512 m =
+            _mm512_fmadd_ps(beta_1, _mm512_loadu_ps(m_k + i), _mm512_mul_ps(one_minus_beta_1, g));
+        const __m512 v = _mm512_fmadd_ps(
+            beta_2, _mm512_loadu_ps(v_k + i), _mm512_mul_ps(_mm512_mul_ps(one_minus_beta_2, g), g));
+
+        _mm512_storeu_ps(m_k + i, m);
+        _mm512_storeu_ps(v_k + i, v);
+
+        const __m512 denominator =
+            _mm512_add_ps(_mm512_maskz_sqrt_ps(__mmask16(-1), _mm512_mul_ps(v_bias_correction, v)),
+                          internal_epsilon);
+        _mm512_storeu_ps(x + i,
+                         _mm512_sub_ps(_mm512_loadu_ps(x + i),
+                                       _mm512_div_ps(_mm512_mul_ps(step_scale, m), denominator)));
+      }
+      Adam_step_scalar(scalars, n - i, grad + i, m_k + i, v_k + i, x + i);
+    }
+
+    __attribute__((target("avx512f"))) inline double
+    squared_norm_2_avx512(const double* const v, const size_t n)
+    {
+      __m512d sum_0 = _mm512_setzero_pd();
+      __m512d sum_1 = _mm512_setzero_pd();
+
+      size_t i = 0;
+      for (; i + 16 <= n; i += 16)
+      {
+        const __m512d v_0 = _mm512_loadu_pd(v + i);
+        const __m512d v_1 = _mm512_loadu_pd(v + i + 8);
+        sum_0             = _mm512_fmadd_pd(v_0, v_0, sum_0);
+        sum_1             = _mm512_fmadd_pd(v_1, v_1, sum_1);
+      }
+      // Same order as _mm512_reduce_add_pd(), which triggers a
+      // spurious GCC 12 -Wmaybe-uninitialized once inlined
+      alignas(64) double lanes[8];
+      _mm512_store_pd(lanes, _mm512_add_pd(sum_0, sum_1));
+
+      const double sum = ((lanes[0] + lanes[4]) + (lanes[2] + lanes[6])) +
+                         ((lanes[1] + lanes[5]) + (lanes[3] + lanes[7]));
+      return sum + squared_norm_2_scalar(v + i, n - i);
+    }
+
+    __attribute__((target("avx512f"))) inline float
+    squared_norm_2_avx512(const float* const v, const size_t n)
+    {
+      __m512 sum_0 = _mm512_setzero_ps();
+      __m512 sum_1 = _mm512_setzero_ps();
+
+      size_t i = 0;
+      for (; i + 32 <= n; i += 32)
+      {
+        const __m512 v_0 = _mm512_loadu_ps(v + i);
+        const __m512 v_1 = _mm512_loadu_ps(v + i + 16);
+        sum_0            = _mm512_fmadd_ps(v_0, v_0, sum_0);
+        sum_1            = _mm512_fmadd_ps(v_1, v_1, sum_1);
+      }
+      // Same order as _mm512_reduce_add_ps(), see the double overload
+      alignas(64) float lanes[16];
+      _mm512_store_ps(lanes, _mm512_add_ps(sum_0, sum_1));
+
+      const float sum =
+          (((lanes[0] + lanes[8]) + (lanes[4] + lanes[12])) +
+           ((lanes[2] + lanes[10]) + (lanes[6] + lanes[14]))) +
+          (((lanes[1] + lanes[9]) + (lanes[5] + lanes[13])) +
+           ((lanes[3] + lanes[11]) + (lanes[7] + lanes[15])));
+      return sum + squared_norm_2_scalar(v + i, n - i);
+    }
+#endif
+
+#if defined(MATH_FUNCTIONS_SIMD_NEON)
+    //////////
+    // NEON //
+    //////////
+    //
+    inline void
+    Adam_step_neon(const Adam_Step_Scalars<double>& scalars,
+                   const size_t n,
+                   const double* const grad,
+                   double* const m_k,
+                   double* const v_k,
+                   double* const x)
+    {
+      const float64x2_t beta_1            = vdupq_n_f64(scalars.beta_1);
+      const float64x2_t one_minus_beta_1  = vdupq_n_f64(1 - scalars.beta_1);
+      const float64x2_t beta_2            = vdupq_n_f64(scalars.beta_2);
+      const float64x2_t one_minus_beta_2  = vdupq_n_f64(1 - scalars.beta_2);
+      const float64x2_t step_scale        = vdupq_n_f64(scalars.step_scale);
+      const float64x2_t v_bias_correction = vdupq_n_f64(scalars.v_bias_correction);
+      const float64x2_t internal_epsilon  = vdupq_n_f64(scalars.internal_epsilon);
+
+      size_t i = 0;
+      for (; i + 2 <= n; i += 2)
+      {
+        const float64x2_t g = vld1q_f64(grad + i);
+        const float64x2_t m = vfmaq_f64(vmulq_f64(one_minus_beta_1, g), beta_1, vld1q_f64(m_k + i));
+        const float64x2_t v =
+            vfmaq_f64(vmulq_f64(vmulq_f64(one_minus_beta_2, g), g), beta_2, vld1q_f64(v_k + i));
+
+        vst1q_f64(m_k + i, m);
+        vst1q_f64(v_k + i, v);
+
+        const float64x2_t denominator =
+            vaddq_f64(vsqrtq_f64(vmulq_f64(v_bias_correction, v)), internal_epsilon);
+        vst1q_f64(x + i,
+                  vsubq_f64(vld1q_f64(x + i), vdivq_f64(vmulq_f64(step_scale, m), denominator)));
+      }
+      Adam_step_scalar(scalars, n - i, grad + i, m_k + i, v_k + i, x + i);
+    }
+
+    inline void
+    Adam_step_neon(const Adam_Step_Scalars<float>& scalars,
+                   const size_t n,
+                   const float* const grad,
+                   float* const m_k,
+                   float* const v_k,
+                   float* const x)
+    {
+      const float32x4_t beta_1            = vdupq_n_f32(scalars.beta_1);
+      const float32x4_t one_minus_beta_1  = vdupq_n_f32(1 - scalars.beta_1);
+      const float32x4_t beta_2            = vdupq_n_f32(scalars.beta_2);
+      const float32x4_t one_minus_beta_2  = vdupq_n_f32(1 - scalars.beta_2);
+      const float32x4_t step_scale        = vdupq_n_f32(scalars.step_scale);
+      const float32x4_t v_bias_correction = vdupq_n_f32(scalars.v_bias_correction);
+      const float32x4_t internal_epsilon  = vdupq_n_f32(scalars.internal_epsilon);
+
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        const float32x4_t g = vld1q_f32(grad + i);
+        const float32x4_t m = vfmaq_f32(vmulq_f32(one_minus_beta_1, g), beta_1, vld1q_f32(m_k + i));
+        const float32x4_t v =
+            vfmaq_f32(vmulq_f32(vmulq_f32(one_minus_beta_2, g), g), beta_2, vld1q_f32(v_k + i));
+
+        vst1q_f32(m_k + i, m);
+        vst1q_f32(v_k + i, v);
+
+        const float32x4_t denominator =
+            vaddq_f32(vsqrtq_f32(vmulq_f32(v_bias_correction, v)), internal_epsilon);
+        vst1q_f32(x + i,
+                  vsubq_f32(vld1q_f32(x + i), vdivq_f32(vmulq_f32(step_scale, m), denominator)));
+      }
+      Adam_step_scalar(scalars, n - i, grad + i, m_k + i, v_k + i, x + i);
+    }
+
+    inline double
+    squared_norm_2_neon(const double* const v, const size_t n)
+    {
+      float64x2_t sum_0 = vdupq_n_f64(0);
+      float64x2_t sum_1 = vdupq_n_f64(0);
+
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        const float64x2_t v_0 = vld1q_f64(v + i);
+        const float64x2_t v_1 = vld1q_f64(v + i + 2);
+        sum_0                 = vfmaq_f64(sum_0, v_0, v_0);
+        sum_1                 = vfmaq_f64(sum_1, v_1, v_1);
+      }
+      return vaddvq_f64(vaddq_f64(sum_0, sum_1)) + squared_norm_2_scalar(v + i, n - i);
+    }
+
+    inline float
+    squared_norm_2_neon(const float* const v, const size_t n)
+    {
+      float32x4_t sum_0 = vdupq_n_f32(0);
+      float32x4_t sum_1 = vdupq_n_f32(0);
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        const float32x4_t v_0 = vld1q_f32(v + i);
+        const float32x4_t v_1 = vld1q_f32(v + i + 4);
+        sum_0                 = vfmaq_f32(sum_0, v_0, v_0);
+        sum_1                 = vfmaq_f32(sum_1, v_1, v_1);
+      }
+      return vaddvq_f32(vaddq_f32(sum_0, sum_1)) + squared_norm_2_scalar(v + i, n - i);
+    }
+#endif
+
+    template <typename SCALAR_TYPE>
+    constexpr bool has_simd_kernel_v =
+        std::is_same_v<SCALAR_TYPE, float> or std::is_same_v<SCALAR_TYPE, double>;
+  }
+
+  //////////////////////
+  // Adam_step_kernel //
+  //////////////////////
+  //
+  // One pass over memory, in place, no allocation:
+  //
+  //   m_k = beta_1 * m_k + (1 - beta_1) * grad
+  //   v_k = beta_2 * v_k + (1 - beta_2) * grad^2
+  //   x  -= alpha * hat_m_k / (sqrt(hat_v_k) + internal_epsilon)
+  //
+  // where hat_m_k, hat_v_k are the bias corrected moments.
+  //
+  // float and double use the SIMD kernel selected by
+  // simd_instruction_set()
+  //
+  template <typename SCALAR_TYPE>
+  void
+  Adam_step_kernel(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                   const size_t n,
+                   const SCALAR_TYPE* const grad,
+                   SCALAR_TYPE* const m_k,
+                   SCALAR_TYPE* const v_k,
+                   SCALAR_TYPE* const x)
+  {
+    if constexpr (Adam_Kernel_Detail::has_simd_kernel_v<SCALAR_TYPE>)
+    {
+      switch (simd_instruction_set())
+      {
+#if defined(MATH_FUNCTIONS_SIMD_X86)
+        case Simd_Instruction_Set::AVX512:
+          return Adam_Kernel_Detail::Adam_step_avx512(scalars, n, grad, m_k, v_k, x);
+        case Simd_Instruction_Set::AVX2:
+          return Adam_Kernel_Detail::Adam_step_avx2(scalars, n, grad, m_k, v_k, x);
+#endif
+#if defined(MATH_FUNCTIONS_SIMD_NEON)
+        case Simd_Instruction_Set::NEON:
+          return Adam_Kernel_Detail::Adam_step_neon(scalars, n, grad, m_k, v_k, x);
+#endif
+        default:
+          break;
+      }
+    }
+    Adam_Kernel_Detail::Adam_step_scalar(scalars, n, grad, m_k, v_k, x);
+  }
+
+  ///////////////////////////
+  // squared_norm_2_kernel //
+  ///////////////////////////
+  //
+  // sum |v_i|^2, ditto for SIMD
+  //
+  template <typename SCALAR_TYPE>
+  auto
+  squared_norm_2_kernel(const SCALAR_TYPE* const v, const size_t n)
+  {
+    if constexpr (Adam_Kernel_Detail::has_simd_kernel_v<SCALAR_TYPE>)
+    {
+      switch (simd_instruction_set())
+      {
+#if defined(MATH_FUNCTIONS_SIMD_X86)
+        case Simd_Instruction_Set::AVX512:
+          return Adam_Kernel_Detail::squared_norm_2_avx512(v, n);
+        case Simd_Instruction_Set::AVX2:
+          return Adam_Kernel_Detail::squared_norm_2_avx2(v, n);
+#endif
+#if defined(MATH_FUNCTIONS_SIMD_NEON)
+        case Simd_Instruction_Set::NEON:
+          return Adam_Kernel_Detail::squared_norm_2_neon(v, n);
+#endif
+        default:
+          break;
+      }
+    }
+    return Adam_Kernel_Detail::squared_norm_2_scalar(v, n);
+  }
+
+  ///////////////////////////////
+  // Chunked (parallel) kernels //
+  ///////////////////////////////
+  //
+  // Vectors are split into fixed chunks that do not depend on the
+  // thread count. Chunk partial sums are reduced in chunk order, hence
+  // results are reproducible whatever the number of threads.
+  //
+  // thread_pool == nullptr: sequential
+  //
+  // Multiple of any SIMD width, cache line aligned when data is.
+  static constexpr size_t Adam_chunk_size = 1 << 14;
+
+  inline size_t
+  Adam_chunk_count(const size_t n)
+  {
+    return (n + Adam_chunk_size - 1) / Adam_chunk_size;
+  }
+
+  template <typename SCALAR_TYPE>
+  void
+  Adam_step_kernel(Thread_Pool* const thread_pool,
+                   const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                   const size_t n,
+                   const SCALAR_TYPE* const grad,
+                   SCALAR_TYPE* const m_k,
+                   SCALAR_TYPE* const v_k,
+                   SCALAR_TYPE* const x)
+  {
+    parallel_for(thread_pool, Adam_chunk_count(n), [&](const size_t chunk) {
+      const size_t begin = chunk * Adam_chunk_size;
+      const size_t size  = std::min(Adam_chunk_size, n - begin);
+
+      Adam_step_kernel(scalars, size, grad + begin, m_k + begin, v_k + begin, x + begin);
+    });
+  }
+
+  // Per chunk partial sums, allocated once and reused
+  template <typename SCALAR_TYPE>
+  using Adam_Partial_Sums =
+      std::vector<Cache_Padded<decltype(squared_norm_2_kernel(std::declval<const SCALAR_TYPE*>(),
+                                                              size_t()))>>;
+
+  template <typename SCALAR_TYPE>
+  auto
+  squared_norm_2_kernel(Thread_Pool* const thread_pool,
+                        const SCALAR_TYPE* const v,
+                        const size_t n,
+                        Adam_Partial_Sums<SCALAR_TYPE>& partial_sums)
+  {
+    const size_t chunk_count = Adam_chunk_count(n);
+    if (partial_sums.size() < chunk_count) partial_sums.resize(chunk_count);
+
+    parallel_for(thread_pool, chunk_count, [&](const size_t chunk) {
+      const size_t begin = chunk * Adam_chunk_size;
+      const size_t size  = std::min(Adam_chunk_size, n - begin);
+
+      partial_sums[chunk].value = squared_norm_2_kernel(v + begin, size);
+    });
+
+    decltype(partial_sums[0].value) sum = 0;
+    for (size_t chunk = 0; chunk < chunk_count; ++chunk)
+    {
+      sum += partial_sums[chunk].value;
+    }
+    return sum;
+  }
+}
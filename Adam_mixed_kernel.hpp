@@ -0,0 +1,1405 @@
+#pragma once
+
+#include "Adam_kernel.hpp"
+#include "bfloat16.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Mixed precision Adam kernels: parameters, gradient and moments have
+// their own scalar types, the step scalars and the norm accumulators
+// have a fourth one. By example float parameters and gradient,
+// bfloat16 moments and double norms: 20 bytes of memory traffic per
+// component and step instead of 56 for double.
+//
+// The update is computed in the parameter precision (float for
+// bfloat16 parameters), values are converted at load and store time.
+//
+// SIMD kernels: parameters in float or double, gradient and moments in
+// float, double or bfloat16. The other combinations (bfloat16
+// parameters...) use the scalar kernels.
+
+namespace Optimize
+{
+  namespace Adam_Mixed_Kernel_Detail
+  {
+    template <typename PARAMETER_TYPE>
+    struct Compute_Type
+    {
+      using type = PARAMETER_TYPE;
+    };
+    template <>
+    struct Compute_Type<bfloat16>
+    {
+      using type = float;
+    };
+
+    template <typename PARAMETER_TYPE>
+    using compute_type_t = typename Compute_Type<PARAMETER_TYPE>::type;
+
+    // Rounded conversion, double -> bfloat16 is rounded to float first
+    // like the SIMD kernels do
+    template <typename STORAGE_TYPE, typename COMPUTE_TYPE>
+    STORAGE_TYPE
+    to_storage(const COMPUTE_TYPE value)
+    {
+      if constexpr (std::is_same_v<STORAGE_TYPE, bfloat16>)
+      {
+        return bfloat16(float(value));
+      }
+      else
+      {
+        return STORAGE_TYPE(value);
+      }
+    }
+
+    ////////////
+    // Scalar //
+    ////////////
+    //
+    template <typename SCALAR_TYPE,
+              typename GRADIENT_TYPE,
+              typename MOMENT_TYPE,
+              typename PARAMETER_TYPE>
+    void
+    Adam_step_scalar(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                     const size_t n,
+                     const GRADIENT_TYPE* const grad,
+                     MOMENT_TYPE* const m_k,
+                     MOMENT_TYPE* const v_k,
+                     PARAMETER_TYPE* const x)
+    {
+      using std::sqrt;
+
+      using compute_type = compute_type_t<PARAMETER_TYPE>;
+
+      const compute_type beta_1            = compute_type(scalars.beta_1);
+      const compute_type one_minus_beta_1  = compute_type(1 - scalars.beta_1);
+      const compute_type beta_2            = compute_type(scalars.beta_2);
+      const compute_type one_minus_beta_2  = compute_type(1 - scalars.beta_2);
+      const compute_type step_scale        = compute_type(scalars.step_scale);
+      const compute_type v_bias_correction = compute_type(scalars.v_bias_correction);
+      const compute_type internal_epsilon  = compute_type(scalars.internal_epsilon);
+
+      for (size_t i = 0; i < n; ++i)
+      {
+        const compute_type g = compute_type(grad[i]);
+        const compute_type m = beta_1 * compute_type(m_k[i]) + one_minus_beta_1 * g;
+        const compute_type v = beta_2 * compute_type(v_k[i]) + one_minus_beta_2 * g * g;
+
+        m_k[i] = to_storage<MOMENT_TYPE>(m);
+        v_k[i] = to_storage<MOMENT_TYPE>(v);
+        x[i]   = to_storage<PARAMETER_TYPE>(
+            compute_type(x[i]) -
+            step_scale * m / (sqrt(v_bias_correction * v) + internal_epsilon));
+      }
+    }
+
+    // Adam_step_scalar() with the variants, see Adam_variant_step_kernel()
+    //
+    template <typename SCALAR_TYPE,
+              typename GRADIENT_TYPE,
+              typename MOMENT_TYPE,
+              typename PARAMETER_TYPE>
+    void
+    Adam_variant_step_scalar(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                             const size_t n,
+                             const GRADIENT_TYPE* const grad,
+                             MOMENT_TYPE* const m_k,
+                             MOMENT_TYPE* const v_k,
+                             MOMENT_TYPE* const v_max_k,
+                             PARAMETER_TYPE* const x)
+    {
+      using std::max;
+      using std::sqrt;
+
+      using compute_type = compute_type_t<PARAMETER_TYPE>;
+
+      const compute_type beta_1            = compute_type(scalars.beta_1);
+      const compute_type one_minus_beta_1  = compute_type(1 - scalars.beta_1);
+      const compute_type beta_2            = compute_type(scalars.beta_2);
+      const compute_type one_minus_beta_2  = compute_type(1 - scalars.beta_2);
+      const compute_type step_scale        = compute_type(scalars.step_scale);
+      const compute_type v_bias_correction = compute_type(scalars.v_bias_correction);
+      const compute_type internal_epsilon  = compute_type(scalars.internal_epsilon);
+      const compute_type decay_scale       = compute_type(scalars.decay_scale);
+
+      for (size_t i = 0; i < n; ++i)
+      {
+        const compute_type g = compute_type(grad[i]);
+        const compute_type m = beta_1 * compute_type(m_k[i]) + one_minus_beta_1 * g;
+        const compute_type v = beta_2 * compute_type(v_k[i]) + one_minus_beta_2 * g * g;
+
+        m_k[i] = to_storage<MOMENT_TYPE>(m);
+        v_k[i] = to_storage<MOMENT_TYPE>(v);
+
+        compute_type v_step = v;
+        if (v_max_k)
+        {
+          v_step     = max(compute_type(v_max_k[i]), v);
+          v_max_k[i] = to_storage<MOMENT_TYPE>(v_step);
+        }
+
+        const compute_type x_i = compute_type(x[i]);
+
+        x[i] = to_storage<PARAMETER_TYPE>(
+            x_i - decay_scale * x_i -
+            step_scale * m / (sqrt(v_bias_correction * v_step) + internal_epsilon));
+      }
+    }
+
+    template <typename ACCUMULATOR_TYPE, typename SCALAR_TYPE>
+    ACCUMULATOR_TYPE
+    squared_norm_2_scalar(const SCALAR_TYPE* const v, const size_t n)
+    {
+      ACCUMULATOR_TYPE sum = 0;
+      for (size_t i = 0; i < n; ++i)
+      {
+        const ACCUMULATOR_TYPE v_i = ACCUMULATOR_TYPE(v[i]);
+        sum += v_i * v_i;
+      }
+      return sum;
+    }
+
+#if defined(MATH_FUNCTIONS_SIMD_X86)
+    ////////////////////////////
+    // AVX2 loads and stores //
+    ////////////////////////////
+    //
+    // Converting to (from) 8 floats or 4 doubles. bfloat16 values are
+    // computed from the 32 bits patterns as in bfloat16::from_float().
+    //
+    __attribute__((target("avx2"))) inline __m128i
+    to_bfloat16_sse(const __m128 v)
+    {
+      const __m128i u       = _mm_castps_si128(v);
+      const __m128i high    = _mm_srli_epi32(u, 16);
+      const __m128i rounded = _mm_srli_epi32(
+          _mm_add_epi32(u, _mm_add_epi32(_mm_and_si128(high, _mm_set1_epi32(1)),
+                                         _mm_set1_epi32(0x7FFF))),
+          16);
+      const __m128i nan = _mm_or_si128(high, _mm_set1_epi32(0x0040));
+
+      return _mm_blendv_epi8(rounded, nan, _mm_castps_si128(_mm_cmpunord_ps(v, v)));
+    }
+    __attribute__((target("avx2"))) inline __m256i
+    to_bfloat16_avx2(const __m256 v)
+    {
+      const __m256i u       = _mm256_castps_si256(v);
+      const __m256i high    = _mm256_srli_epi32(u, 16);
+      const __m256i rounded = _mm256_srli_epi32(
+          _mm256_add_epi32(u, _mm256_add_epi32(_mm256_and_si256(high, _mm256_set1_epi32(1)),
+                                               _mm256_set1_epi32(0x7FFF))),
+          16);
+      const __m256i nan = _mm256_or_si256(high, _mm256_set1_epi32(0x0040));
+
+      return _mm256_blendv_epi8(
+          rounded, nan, _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q)));
+    }
+
+    __attribute__((target("avx2"))) inline __m256
+    load_avx2_ps(const float* const p)
+    {
+      return _mm256_loadu_ps(p);
+    }
+    __attribute__((target("avx2"))) inline __m256
+    load_avx2_ps(const double* const p)
+    {
+      return _mm256_set_m128(_mm256_cvtpd_ps(_mm256_loadu_pd(p + 4)),
+                             _mm256_cvtpd_ps(_mm256_loadu_pd(p)));
+    }
+    __attribute__((target("avx2"))) inline __m256
+    load_avx2_ps(const bfloat16* const p)
+    {
+      const __m128i bits = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(bits), 16));
+    }
+    __attribute__((target("avx2"))) inline void
+    store_avx2_ps(float* const p, const __m256 v)
+    {
+      _mm256_storeu_ps(p, v);
+    }
+    __attribute__((target("avx2"))) inline void
+    store_avx2_ps(double* const p, const __m256 v)
+    {
+      _mm256_storeu_pd(p, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+      _mm256_storeu_pd(p + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+    }
+    __attribute__((target("avx2"))) inline void
+    store_avx2_ps(bfloat16* const p, const __m256 v)
+    {
+      const __m256i bits = to_bfloat16_avx2(v);
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i*>(p),
+          _mm_packus_epi32(_mm256_castsi256_si128(bits), _mm256_extracti128_si256(bits, 1)));
+    }
+
+    __attribute__((target("avx2"))) inline __m256d
+    load_avx2_pd(const float* const p)
+    {
+      return _mm256_cvtps_pd(_mm_loadu_ps(p));
+    }
+    __attribute__((target("avx2"))) inline __m256d
+    load_avx2_pd(const double* const p)
+    {
+      return _mm256_loadu_pd(p);
+    }
+    __attribute__((target("avx2"))) inline __m256d
+    load_avx2_pd(const bfloat16* const p)
+    {
+      const __m128i bits = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+      return _mm256_cvtps_pd(_mm_castsi128_ps(_mm_slli_epi32(_mm_cvtepu16_epi32(bits), 16)));
+    }
+    __attribute__((target("avx2"))) inline void
+    store_avx2_pd(float* const p, const __m256d v)
+    {
+      _mm_storeu_ps(p, _mm256_cvtpd_ps(v));
+    }
+    __attribute__((target("avx2"))) inline void
+    store_avx2_pd(double* const p, const __m256d v)
+    {
+      _mm256_storeu_pd(p, v);
+    }
+    __attribute__((target("avx2"))) inline void
+    store_avx2_pd(bfloat16* const p, const __m256d v)
+    {
+      const __m128i bits = to_bfloat16_sse(_mm256_cvtpd_ps(v));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packus_epi32(bits, bits));
+    }
+
+    //////////
+    // AVX2 //
+    //////////
+    //
+    template <typename SCALAR_TYPE, typename GRADIENT_TYPE, typename MOMENT_TYPE>
+    __attribute__((target("avx2,fma"))) inline void
+    Adam_step_avx2(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                   const size_t n,
+                   const GRADIENT_TYPE* const grad,
+                   MOMENT_TYPE* const m_k,
+                   MOMENT_TYPE* const v_k,
+                   float* const x)
+    {
+      const __m256 beta_1            = _mm256_set1_ps(float(scalars.beta_1));
+      const __m256 one_minus_beta_1  = _mm256_set1_ps(float(1 - scalars.beta_1));
+      const __m256 beta_2            = _mm256_set1_ps(float(scalars.beta_2));
+      const __m256 one_minus_beta_2  = _mm256_set1_ps(float(1 - scalars.beta_2));
+      const __m256 step_scale        = _mm256_set1_ps(float(scalars.step_scale));
+      const __m256 v_bias_correction = _mm256_set1_ps(float(scalars.v_bias_correction));
+      const __m256 internal_epsilon  = _mm256_set1_ps(float(scalars.internal_epsilon));
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        const __m256 g = load_avx2_ps(grad + i);
+        const __m256 m =
+            _mm256_fmadd_ps(beta_1, load_avx2_ps(m_k + i), _mm256_mul_ps(one_minus_beta_1, g));
+        const __m256 v = _mm256_fmadd_ps(
+            beta_2, load_avx2_ps(v_k + i), _mm256_mul_ps(_mm256_mul_ps(one_minus_beta_2, g), g));
+
+        store_avx2_ps(m_k + i, m);
+        store_avx2_ps(v_k + i, v);
+
+        const __m256 denominator =
+            _mm256_add_ps(_mm256_sqrt_ps(_mm256_mul_ps(v_bias_correction, v)), internal_epsilon);
+        _mm256_storeu_ps(x + i,
+                         _mm256_sub_ps(_mm256_loadu_ps(x + i),
+                                       _mm256_div_ps(_mm256_mul_ps(step_scale, m), denominator)));
+      }
+      Adam_step_scalar(scalars, n - i, grad + i, m_k + i, v_k + i, x + i);
+    }
+
+    template <typename SCALAR_TYPE, typename GRADIENT_TYPE, typename MOMENT_TYPE>
+    __attribute__((target("avx2,fma"))) inline void
+    Adam_step_avx2(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                   const size_t n,
+                   const GRADIENT_TYPE* const grad,
+                   MOMENT_TYPE* const m_k,
+                   MOMENT_TYPE* const v_k,
+                   double* const x)
+    {
+      const __m256d beta_1            = _mm256_set1_pd(double(scalars.beta_1));
+      const __m256d one_minus_beta_1  = _mm256_set1_pd(double(1 - scalars.beta_1));
+      const __m256d beta_2            = _mm256_set1_pd(double(scalars.beta_2));
+      const __m256d one_minus_beta_2  = _mm256_set1_pd(double(1 - scalars.beta_2));
+      const __m256d step_scale        = _mm256_set1_pd(double(scalars.step_scale));
+      const __m256d v_bias_correction = _mm256_set1_pd(double(scalars.v_bias_correction));
+      const __m256d internal_epsilon  = _mm256_set1_pd(double(scalars.internal_epsilon));
+
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        const __m256d g = load_avx2_pd(grad + i);
+        const __m256d m =
+            _mm256_fmadd_pd(beta_1, load_avx2_pd(m_k + i), _mm256_mul_pd(one_minus_beta_1, g));
+        const __m256d v = _mm256_fmadd_pd(
+            beta_2, load_avx2_pd(v_k + i), _mm256_mul_pd(_mm256_mul_pd(one_minus_beta_2, g), g));
+
+        store_avx2_pd(m_k + i, m);
+        store_avx2_pd(v_k + i, v);
+
+        const __m256d denominator =
+            _mm256_add_pd(_mm256_sqrt_pd(_mm256_mul_pd(v_bias_correction, v)), internal_epsilon);
+        _mm256_storeu_pd(x + i,
+                         _mm256_sub_pd(_mm256_loadu_pd(x + i),
+                                       _mm256_div_pd(_mm256_mul_pd(step_scale, m), denominator)));
+      }
+      Adam_step_scalar(scalars, n - i, grad + i, m_k + i, v_k + i, x + i);
+    }
+
+    template <typename SCALAR_TYPE, typename GRADIENT_TYPE, typename MOMENT_TYPE>
+    __attribute__((target("avx2,fma"))) inline void
+    Adam_variant_step_avx2(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                           const size_t n,
+                           const GRADIENT_TYPE* const grad,
+                           MOMENT_TYPE* const m_k,
+                           MOMENT_TYPE* const v_k,
+                           MOMENT_TYPE* const v_max_k,
+                           float* const x)
+    {
+      const __m256 beta_1            = _mm256_set1_ps(float(scalars.beta_1));
+      const __m256 one_minus_beta_1  = _mm256_set1_ps(float(1 - scalars.beta_1));
+      const __m256 beta_2            = _mm256_set1_ps(float(scalars.beta_2));
+      const __m256 one_minus_beta_2  = _mm256_set1_ps(float(1 - scalars.beta_2));
+      const __m256 step_scale        = _mm256_set1_ps(float(scalars.step_scale));
+      const __m256 v_bias_correction = _mm256_set1_ps(float(scalars.v_bias_correction));
+      const __m256 internal_epsilon  = _mm256_set1_ps(float(scalars.internal_epsilon));
+      const __m256 decay_scale       = _mm256_set1_ps(float(scalars.decay_scale));
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        const __m256 g = load_avx2_ps(grad + i);
+        const __m256 m =
+            _mm256_fmadd_ps(beta_1, load_avx2_ps(m_k + i), _mm256_mul_ps(one_minus_beta_1, g));
+        const __m256 v = _mm256_fmadd_ps(
+            beta_2, load_avx2_ps(v_k + i), _mm256_mul_ps(_mm256_mul_ps(one_minus_beta_2, g), g));
+
+        store_avx2_ps(m_k + i, m);
+        store_avx2_ps(v_k + i, v);
+
+        __m256 v_step = v;
+        if (v_max_k)
+        {
+          v_step = _mm256_max_ps(v, load_avx2_ps(v_max_k + i));
+          store_avx2_ps(v_max_k + i, v_step);
+        }
+
+        const __m256 x_i = _mm256_loadu_ps(x + i);
+
+        const __m256 denominator = _mm256_add_ps(
+            _mm256_sqrt_ps(_mm256_mul_ps(v_bias_correction, v_step)), internal_epsilon);
+        _mm256_storeu_ps(x + i,
+                         _mm256_sub_ps(_mm256_fnmadd_ps(decay_scale, x_i, x_i),
+                                       _mm256_div_ps(_mm256_mul_ps(step_scale, m), denominator)));
+      }
+      Adam_variant_step_scalar(
+          scalars, n - i, grad + i, m_k + i, v_k + i, v_max_k ? v_max_k + i : nullptr, x + i);
+    }
+
+    template <typename SCALAR_TYPE, typename GRADIENT_TYPE, typename MOMENT_TYPE>
+    __attribute__((target("avx2,fma"))) inline void
+    Adam_variant_step_avx2(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                           const size_t n,
+                           const GRADIENT_TYPE* const grad,
+                           MOMENT_TYPE* const m_k,
+                           MOMENT_TYPE* const v_k,
+                           MOMENT_TYPE* const v_max_k,
+                           double* const x)
+    {
+      const __m256d beta_1            = _mm256_set1_pd(double(scalars.beta_1));
+      const __m256d one_minus_beta_1  = _mm256_set1_pd(double(1 - scalars.beta_1));
+      const __m256d beta_2            = _mm256_set1_pd(double(scalars.beta_2));
+      const __m256d one_minus_beta_2  = _mm256_set1_pd(double(1 - scalars.beta_2));
+      const __m256d step_scale        = _mm256_set1_pd(double(scalars.step_scale));
+      const __m256d v_bias_correction = _mm256_set1_pd(double(scalars.v_bias_correction));
+      const __m256d internal_epsilon  = _mm256_set1_pd(double(scalars.internal_epsilon));
+      const __m256d decay_scale       = _mm256_set1_pd(double(scalars.decay_scale));
+
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        const __m256d g = load_avx2_pd(grad + i);
+        const __m256d m =
+            _mm256_fmadd_pd(beta_1, load_avx2_pd(m_k + i), _mm256_mul_pd(one_minus_beta_1, g));
+        const __m256d v = _mm256_fmadd_pd(
+            beta_2, load_avx2_pd(v_k + i), _mm256_mul_pd(_mm256_mul_pd(one_minus_beta_2, g), g));
+
+        store_avx2_pd(m_k + i, m);
+        store_avx2_pd(v_k + i, v);
+
+        __m256d v_step = v;
+        if (v_max_k)
+        {
+          v_step = _mm256_max_pd(v, load_avx2_pd(v_max_k + i));
+          store_avx2_pd(v_max_k + i, v_step);
+        }
+
+        const __m256d x_i = _mm256_loadu_pd(x + i);
+
+        const __m256d denominator = _mm256_add_pd(
+            _mm256_sqrt_pd(_mm256_mul_pd(v_bias_correction, v_step)), internal_epsilon);
+        _mm256_storeu_pd(x + i,
+                         _mm256_sub_pd(_mm256_fnmadd_pd(decay_scale, x_i, x_i),
+                                       _mm256_div_pd(_mm256_mul_pd(step_scale, m), denominator)));
+      }
+      Adam_variant_step_scalar(
+          scalars, n - i, grad + i, m_k + i, v_k + i, v_max_k ? v_max_k + i : nullptr, x + i);
+    }
+
+    template <typename SCALAR_TYPE>
+    __attribute__((target("avx2,fma"))) inline double
+    squared_norm_2_avx2_pd(const SCALAR_TYPE* const v, const size_t n)
+    {
+      __m256d sum_0 = _mm256_setzero_pd();
+      __m256d sum_1 = _mm256_setzero_pd();
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        const __m256d v_0 = load_avx2_pd(v + i);
+        const __m256d v_1 = load_avx2_pd(v + i + 4);
+        sum_0             = _mm256_fmadd_pd(v_0, v_0, sum_0);
+        sum_1             = _mm256_fmadd_pd(v_1, v_1, sum_1);
+      }
+      const __m256d sum = _mm256_add_pd(sum_0, sum_1);
+
+      __m128d sum_128 = _mm_add_pd(_mm256_castpd256_pd128(sum), _mm256_extractf128_pd(sum, 1));
+      sum_128         = _mm_add_sd(sum_128, _mm_unpackhi_pd(sum_128, sum_128));
+
+      return _mm_cvtsd_f64(sum_128) + squared_norm_2_scalar<double>(v + i, n - i);
+    }
+
+    template <typename SCALAR_TYPE>
+    __attribute__((target("avx2,fma"))) inline float
+    squared_norm_2_avx2_ps(const SCALAR_TYPE* const v, const size_t n)
+    {
+      __m256 sum_0 = _mm256_setzero_ps();
+      __m256 sum_1 = _mm256_setzero_ps();
+
+      size_t i = 0;
+      for (; i + 16 <= n; i += 16)
+      {
+        const __m256 v_0 = load_avx2_ps(v + i);
+        const __m256 v_1 = load_avx2_ps(v + i + 8);
+        sum_0            = _mm256_fmadd_ps(v_0, v_0, sum_0);
+        sum_1            = _mm256_fmadd_ps(v_1, v_1, sum_1);
+      }
+      const __m256 sum = _mm256_add_ps(sum_0, sum_1);
+
+      __m128 sum_128 = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+      sum_128        = _mm_add_ps(sum_128, _mm_movehl_ps(sum_128, sum_128));
+      sum_128        = _mm_add_ss(sum_128, _mm_shuffle_ps(sum_128, sum_128, 0x1));
+
+      return _mm_cvtss_f32(sum_128) + squared_norm_2_scalar<float>(v + i, n - i);
+    }
+
+    ///////////////////////////////
+    // AVX-512 loads and stores //
+    ///////////////////////////////
+    //
+    // Converting to (from) 16 floats or 8 doubles
+    //
+    // Note: the masked (all lanes) intrinsics avoid the GCC
+    // -Wmaybe-uninitialized false positives, see Adam_kernel.hpp
+    //
+    __attribute__((target("avx512f"))) inline __m512i
+    to_bfloat16_avx512(const __m512 v)
+    {
+      const __m512i u       = _mm512_castps_si512(v);
+      const __m512i high    = _mm512_maskz_srli_epi32(__mmask16(-1), u, 16);
+      const __m512i biased =
+          _mm512_add_epi32(u, _mm512_add_epi32(_mm512_and_si512(high, _mm512_set1_epi32(1)),
+                                               _mm512_set1_epi32(0x7FFF)));
+      const __m512i rounded = _mm512_maskz_srli_epi32(__mmask16(-1), biased, 16);
+      const __m512i nan = _mm512_or_si512(high, _mm512_set1_epi32(0x0040));
+
+      return _mm512_mask_blend_epi32(_mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q), rounded, nan);
+    }
+
+    __attribute__((target("avx512f"))) inline __m512
+    load_avx512_ps(const float* const p)
+    {
+      return _mm512_loadu_ps(p);
+    }
+    __attribute__((target("avx512f"))) inline __m512
+    load_avx512_ps(const double* const p)
+    {
+      const __m256 low  = _mm512_maskz_cvtpd_ps(__mmask8(-1), _mm512_loadu_pd(p));
+      const __m256 high = _mm512_maskz_cvtpd_ps(__mmask8(-1), _mm512_loadu_pd(p + 8));
+
+      const __m512d low_only =
+          _mm512_maskz_insertf64x4(__mmask8(-1), _mm512_setzero_pd(), _mm256_castps_pd(low), 0);
+      return _mm512_castpd_ps(
+          _mm512_maskz_insertf64x4(__mmask8(-1), low_only, _mm256_castps_pd(high), 1));
+    }
+    __attribute__((target("avx512f"))) inline __m512
+    load_avx512_ps(const bfloat16* const p)
+    {
+      const __m256i bits = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+      return _mm512_castsi512_ps(_mm512_maskz_slli_epi32(
+          __mmask16(-1), _mm512_maskz_cvtepu16_epi32(__mmask16(-1), bits), 16));
+    }
+    __attribute__((target("avx512f"))) inline void
+    store_avx512_ps(float* const p, const __m512 v)
+    {
+      _mm512_storeu_ps(p, v);
+    }
+    __attribute__((target("avx512f"))) inline void
+    store_avx512_ps(double* const p, const __m512 v)
+    {
+      const __m512d both = _mm512_castps_pd(v);
+      const __m256 low   = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(__mmask8(-1), both, 0));
+      const __m256 high  = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(__mmask8(-1), both, 1));
+
+      _mm512_storeu_pd(p, _mm512_maskz_cvtps_pd(__mmask8(-1), low));
+      _mm512_storeu_pd(p + 8, _mm512_maskz_cvtps_pd(__mmask8(-1), high));
+    }
+    __attribute__((target("avx512f"))) inline void
+    store_avx512_ps(bfloat16* const p, const __m512 v)
+    {
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(p),
+                          _mm512_maskz_cvtepi32_epi16(__mmask16(-1), to_bfloat16_avx512(v)));
+    }
+
+    __attribute__((target("avx512f"))) inline __m512d
+    load_avx512_pd(const float* const p)
+    {
+      return _mm512_maskz_cvtps_pd(__mmask8(-1), _mm256_loadu_ps(p));
+    }
+    __attribute__((target("avx512f"))) inline __m512d
+    load_avx512_pd(const double* const p)
+    {
+      return _mm512_loadu_pd(p);
+    }
+    __attribute__((target("avx512f"))) inline __m512d
+    load_avx512_pd(const bfloat16* const p)
+    {
+      return _mm512_maskz_cvtps_pd(__mmask8(-1), load_avx2_ps(p));
+    }
+    __attribute__((target("avx512f"))) inline void
+    store_avx512_pd(float* const p, const __m512d v)
+    {
+      _mm256_storeu_ps(p, _mm512_maskz_cvtpd_ps(__mmask8(-1), v));
+    }
+    __attribute__((target("avx512f"))) inline void
+    store_avx512_pd(double* const p, const __m512d v)
+    {
+      _mm512_storeu_pd(p, v);
+    }
+    __attribute__((target("avx512f"))) inline void
+    store_avx512_pd(bfloat16* const p, const __m512d v)
+    {
+      store_avx2_ps(p, _mm512_maskz_cvtpd_ps(__mmask8(-1), v));
+    }
+
+    /////////////
+    // AVX-512 //
+    /////////////
+    //
+    template <typename SCALAR_TYPE, typename GRADIENT_TYPE, typename MOMENT_TYPE>
+    __attribute__((target("avx512f"))) inline void
+    Adam_step_avx512(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                     const size_t n,
+                     const GRADIENT_TYPE* const grad,
+                     MOMENT_TYPE* const m_k,
+                     MOMENT_TYPE* const v_k,
+                     float* const x)
+    {
+      const __m512 beta_1            = _mm512_set1_ps(float(scalars.beta_1));
+      const __m512 one_minus_beta_1  = _mm512_set1_ps(float(1 - scalars.beta_1));
+      const __m512 beta_2            = _mm512_set1_ps(float(scalars.beta_2));
+      const __m512 one_minus_beta_2  = _mm512_set1_ps(float(1 - scalars.beta_2));
+      const __m512 step_scale        = _mm512_set1_ps(float(scalars.step_scale));
+      const __m512 v_bias_correction = _mm512_set1_ps(float(scalars.v_bias_correction));
+      const __m512 internal_epsilon  = _mm512_set1_ps(float(scalars.internal_epsilon));
+
+      size_t i = 0;
+      for (; i + 16 <= n; i += 16)
+      {
+        const __m512 g = load_avx512_ps(grad + i);
+        const __m512 m =
+            _mm512_fmadd_ps(beta_1, load_avx512_ps(m_k + i), _mm512_mul_ps(one_minus_beta_1, g));
+        const __m512 v = _mm512_fmadd_ps(
+            beta_2, load_avx512_ps(v_k + i), _mm512_mul_ps(_mm512_mul_ps(one_minus_beta_2, g), g));
+
+        store_avx512_ps(m_k + i, m);
+        store_avx512_ps(v_k + i, v);
+
+        const __m512 denominator =
+            _mm512_add_ps(_mm512_maskz_sqrt_ps(__mmask16(-1), _mm512_mul_ps(v_bias_correction, v)),
+                          internal_epsilon);
+        _mm512_storeu_ps(x + i,
+                         _mm512_sub_ps(_mm512_loadu_ps(x + i),
+                                       _mm512_div_ps(_mm512_mul_ps(step_scale, m), denominator)));
+      }
+      Adam_step_scalar(scalars, n - i, grad + i, m_k + i, v_k + i, x + i);
+    }
+
+    template <typename SCALAR_TYPE, typename GRADIENT_TYPE, typename MOMENT_TYPE>
+    __attribute__((target("avx512f"))) inline void
+    Adam_step_avx512(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                     const size_t n,
+                     const GRADIENT_TYPE* const grad,
+                     MOMENT_TYPE* const m_k,
+                     MOMENT_TYPE* const v_k,
+                     double* const x)
+    {
+      const __m512d beta_1            = _mm512_set1_pd(double(scalars.beta_1));
+      const __m512d one_minus_beta_1  = _mm512_set1_pd(double(1 - scalars.beta_1));
+      const __m512d beta_2            = _mm512_set1_pd(double(scalars.beta_2));
+      const __m512d one_minus_beta_2  = _mm512_set1_pd(double(1 - scalars.beta_2));
+      const __m512d step_scale        = _mm512_set1_pd(double(scalars.step_scale));
+      const __m512d v_bias_correction = _mm512_set1_pd(double(scalars.v_bias_correction));
+      const __m512d internal_epsilon  = _mm512_set1_pd(double(scalars.internal_epsilon));
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        const __m512d g = load_avx512_pd(grad + i);
+        const __m512d m =
+            _mm512_fmadd_pd(beta_1, load_avx512_pd(m_k + i), _mm512_mul_pd(one_minus_beta_1, g));
+        const __m512d v = _mm512_fmadd_pd(
+            beta_2, load_avx512_pd(v_k + i), _mm512_mul_pd(_mm512_mul_pd(one_minus_beta_2, g), g));
+
+        store_avx512_pd(m_k + i, m);
+        store_avx512_pd(v_k + i, v);
+
+        const __m512d denominator =
+            _mm512_add_pd(_mm512_maskz_sqrt_pd(__mmask8(-1), _mm512_mul_pd(v_bias_correction, v)),
+                          internal_epsilon);
+        _mm512_storeu_pd(x + i,
+                         _mm512_sub_pd(_mm512_loadu_pd(x + i),
+                                       _mm512_div_pd(_mm512_mul_pd(step_scale, m), denominator)));
+      }
+      Adam_step_scalar(scalars, n - i, grad + i, m_k + i, v_k + i, x + i);
+    }
+
+    template <typename SCALAR_TYPE, typename GRADIENT_TYPE, typename MOMENT_TYPE>
+    __attribute__((target("avx512f"))) inline void
+    Adam_variant_step_avx512(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                             const size_t n,
+                             const GRADIENT_TYPE* const grad,
+                             MOMENT_TYPE* const m_k,
+                             MOMENT_TYPE* const v_k,
+                             MOMENT_TYPE* const v_max_k,
+                             float* const x)
+    {
+      const __m512 beta_1            = _mm512_set1_ps(float(scalars.beta_1));
+      const __m512 one_minus_beta_1  = _mm512_set1_ps(float(1 - scalars.beta_1));
+      const __m512 beta_2            = _mm512_set1_ps(float(scalars.beta_2));
+      const __m512 one_minus_beta_2  = _mm512_set1_ps(float(1 - scalars.beta_2));
+      const __m512 step_scale        = _mm512_set1_ps(float(scalars.step_scale));
+      const __m512 v_bias_correction = _mm512_set1_ps(float(scalars.v_bias_correction));
+      const __m512 internal_epsilon  = _mm512_set1_ps(float(scalars.internal_epsilon));
+      const __m512 decay_scale       = _mm512_set1_ps(float(scalars.decay_scale));
+
+      size_t i = 0;
+      for (; i + 16 <= n; i += 16)
+      {
+        const __m512 g = load_avx512_ps(grad + i);
+        const __m512 m =
+            _mm512_fmadd_ps(beta_1, load_avx512_ps(m_k + i), _mm512_mul_ps(one_minus_beta_1, g));
+        const __m512 v = _mm512_fmadd_ps(
+            beta_2, load_avx512_ps(v_k + i), _mm512_mul_ps(_mm512_mul_ps(one_minus_beta_2, g), g));
+
+        store_avx512_ps(m_k + i, m);
+        store_avx512_ps(v_k + i, v);
+
+        __m512 v_step = v;
+        if (v_max_k)
+        {
+          v_step = _mm512_maskz_max_ps(__mmask16(-1), v, load_avx512_ps(v_max_k + i));
+          store_avx512_ps(v_max_k + i, v_step);
+        }
+
+        const __m512 x_i = _mm512_loadu_ps(x + i);
+
+        const __m512 denominator = _mm512_add_ps(
+            _mm512_maskz_sqrt_ps(__mmask16(-1), _mm512_mul_ps(v_bias_correction, v_step)),
+            internal_epsilon);
+        _mm512_storeu_ps(x + i,
+                         _mm512_sub_ps(_mm512_fnmadd_ps(decay_scale, x_i, x_i),
+                                       _mm512_div_ps(_mm512_mul_ps(step_scale, m), denominator)));
+      }
+      Adam_variant_step_scalar(
+          scalars, n - i, grad + i, m_k + i, v_k + i, v_max_k ? v_max_k + i : nullptr, x + i);
+    }
+
+    template <typename SCALAR_TYPE, typename GRADIENT_TYPE, typename MOMENT_TYPE>
+    __attribute__((target("avx512f"))) inline void
+    Adam_variant_step_avx512(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                             const size_t n,
+                             const GRADIENT_TYPE* const grad,
+                             MOMENT_TYPE* const m_k,
+                             MOMENT_TYPE* const v_k,
+                             MOMENT_TYPE* const v_max_k,
+                             double* const x)
+    {
+      const __m512d beta_1            = _mm512_set1_pd(double(scalars.beta_1));
+      const __m512d one_minus_beta_1  = _mm512_set1_pd(double(1 - scalars.beta_1));
+      const __m512d beta_2            = _mm512_set1_pd(double(scalars.beta_2));
+      const __m512d one_minus_beta_2  = _mm512_set1_pd(double(1 - scalars.beta_2));
+      const __m512d step_scale        = _mm512_set1_pd(double(scalars.step_scale));
+      const __m512d v_bias_correction = _mm512_set1_pd(double(scalars.v_bias_correction));
+      const __m512d internal_epsilon  = _mm512_set1_pd(double(scalars.internal_epsilon));
+      const __m512d decay_scale       = _mm512_set1_pd(double(scalars.decay_scale));
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        const __m512d g = load_avx512_pd(grad + i);
+        const __m512d m =
+            _mm512_fmadd_pd(beta_1, load_avx512_pd(m_k + i), _mm512_mul_pd(one_minus_beta_1, g));
+        const __m512d v = _mm512_fmadd_pd(
+            beta_2, load_avx512_pd(v_k + i), _mm512_mul_pd(_mm512_mul_pd(one_minus_beta_2, g), g));
+
+        store_avx512_pd(m_k + i, m);
+        store_avx512_pd(v_k + i, v);
+
+        __m512d v_step = v;
+        if (v_max_k)
+        {
+          v_step = _mm512_maskz_max_pd(__mmask8(-1), v, load_avx512_pd(v_max_k + i));
+          store_avx512_pd(v_max_k + i, v_step);
+        }
+
+        const __m512d x_i = _mm512_loadu_pd(x + i);
+
+        const __m512d denominator = _mm512_add_pd(
+            _mm512_maskz_sqrt_pd(__mmask8(-1), _mm512_mul_pd(v_bias_correction, v_step)),
+            internal_epsilon);
+        _mm512_storeu_pd(x + i,
+                         _mm512_sub_pd(_mm512_fnmadd_pd(decay_scale, x_i, x_i),
+                                       _mm512_div_pd(_mm512_mul_pd(step_scale, m), denominator)));
+      }
+      Adam_variant_step_scalar(
+          scalars, n - i, grad + i, m_k + i, v_k + i, v_max_k ? v_max_k + i : nullptr, x + i);
+    }
+
+    template <typename SCALAR_TYPE>
+    __attribute__((target("avx512f"))) inline double
+    squared_norm_2_avx512_pd(const SCALAR_TYPE* const v, const size_t n)
+    {
+      __m512d sum_0 = _mm512_setzero_pd();
+      __m512d sum_1 = _mm512_setzero_pd();
+
+      size_t i = 0;
+      for (; i + 16 <= n; i += 16)
+      {
+        const __m512d v_0 = load_avx512_pd(v + i);
+        const __m512d v_1 = load_avx512_pd(v + i + 8);
+        sum_0             = _mm512_fmadd_pd(v_0, v_0, sum_0);
+        sum_1             = _mm512_fmadd_pd(v_1, v_1, sum_1);
+      }
+      // Same order as _mm512_reduce_add_pd(), see squared_norm_2_avx512()
+      alignas(64) double lanes[8];
+      _mm512_store_pd(lanes, _mm512_add_pd(sum_0, sum_1));
+
+      const double sum = ((lanes[0] + lanes[4]) + (lanes[2] + lanes[6])) +
+                         ((lanes[1] + lanes[5]) + (lanes[3] + lanes[7]));
+      return sum + squared_norm_2_scalar<double>(v + i, n - i);
+    }
+
+    template <typename SCALAR_TYPE>
+    __attribute__((target("avx512f"))) inline float
+    squared_norm_2_avx512_ps(const SCALAR_TYPE* const v, const size_t n)
+    {
+      __m512 sum_0 = _mm512_setzero_ps();
+      __m512 sum_1 = _mm512_setzero_ps();
+
+      size_t i = 0;
+      for (; i + 32 <= n; i += 32)
+      {
+        const __m512 v_0 = load_avx512_ps(v + i);
+        const __m512 v_1 = load_avx512_ps(v + i + 16);
+        sum_0            = _mm512_fmadd_ps(v_0, v_0, sum_0);
+        sum_1            = _mm512_fmadd_ps(v_1, v_1, sum_1);
+      }
+      // Same order as _mm512_reduce_add_ps()
+      alignas(64) float lanes[16];
+      _mm512_store_ps(lanes, _mm512_add_ps(sum_0, sum_1));
+
+      for (size_t width = 8; width > 0; width /= 2)
+      {
+        for (size_t lane = 0; lane < width; ++lane) lanes[lane] += lanes[lane + width];
+      }
+      return lanes[0] + squared_norm_2_scalar<float>(v + i, n - i);
+    }
+#endif
+
+#if defined(MATH_FUNCTIONS_SIMD_NEON)
+    ////////////////////////////
+    // NEON loads and stores //
+    ////////////////////////////
+    //
+    // Converting to (from) 4 floats or 2 doubles
+    //
+    inline uint32x4_t
+    to_bfloat16_neon(const float32x4_t v)
+    {
+      const uint32x4_t u       = vreinterpretq_u32_f32(v);
+      const uint32x4_t high    = vshrq_n_u32(u, 16);
+      const uint32x4_t rounded = vshrq_n_u32(
+          vaddq_u32(u, vaddq_u32(vandq_u32(high, vdupq_n_u32(1)), vdupq_n_u32(0x7FFF))), 16);
+      const uint32x4_t nan = vorrq_u32(high, vdupq_n_u32(0x0040));
+
+      return vbslq_u32(vceqq_f32(v, v), rounded, nan);
+    }
+
+    inline float32x4_t
+    load_neon_f32(const float* const p)
+    {
+      return vld1q_f32(p);
+    }
+    inline float32x4_t
+    load_neon_f32(const double* const p)
+    {
+      return vcombine_f32(vcvt_f32_f64(vld1q_f64(p)), vcvt_f32_f64(vld1q_f64(p + 2)));
+    }
+    inline float32x4_t
+    load_neon_f32(const bfloat16* const p)
+    {
+      return vreinterpretq_f32_u32(vshll_n_u16(vld1_u16(reinterpret_cast<const uint16_t*>(p)), 16));
+    }
+    inline void
+    store_neon_f32(float* const p, const float32x4_t v)
+    {
+      vst1q_f32(p, v);
+    }
+    inline void
+    store_neon_f32(double* const p, const float32x4_t v)
+    {
+      vst1q_f64(p, vcvt_f64_f32(vget_low_f32(v)));
+      vst1q_f64(p + 2, vcvt_high_f64_f32(v));
+    }
+    inline void
+    store_neon_f32(bfloat16* const p, const float32x4_t v)
+    {
+      vst1_u16(reinterpret_cast<uint16_t*>(p), vmovn_u32(to_bfloat16_neon(v)));
+    }
+
+    inline float64x2_t
+    load_neon_f64(const float* const p)
+    {
+      return vcvt_f64_f32(vld1_f32(p));
+    }
+    inline float64x2_t
+    load_neon_f64(const double* const p)
+    {
+      return vld1q_f64(p);
+    }
+    inline float64x2_t
+    load_neon_f64(const bfloat16* const p)
+    {
+      const uint32x2_t bits = vcreate_u32((std::uint64_t(p[0].bits) << 16) |
+                                          (std::uint64_t(p[1].bits) << 48));
+      return vcvt_f64_f32(vreinterpret_f32_u32(bits));
+    }
+    inline void
+    store_neon_f64(float* const p, const float64x2_t v)
+    {
+      vst1_f32(p, vcvt_f32_f64(v));
+    }
+    inline void
+    store_neon_f64(double* const p, const float64x2_t v)
+    {
+      vst1q_f64(p, v);
+    }
+    inline void
+    store_neon_f64(bfloat16* const p, const float64x2_t v)
+    {
+      const uint32x4_t bits = to_bfloat16_neon(vcombine_f32(vcvt_f32_f64(v), vdup_n_f32(0)));
+
+      p[0].bits = std::uint16_t(vgetq_lane_u32(bits, 0));
+      p[1].bits = std::uint16_t(vgetq_lane_u32(bits, 1));
+    }
+
+    //////////
+    // NEON //
+    //////////
+    //
+    template <typename SCALAR_TYPE, typename GRADIENT_TYPE, typename MOMENT_TYPE>
+    inline void
+    Adam_step_neon(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                   const size_t n,
+                   const GRADIENT_TYPE* const grad,
+                   MOMENT_TYPE* const m_k,
+                   MOMENT_TYPE* const v_k,
+                   float* const x)
+    {
+      const float32x4_t beta_1            = vdupq_n_f32(float(scalars.beta_1));
+      const float32x4_t one_minus_beta_1  = vdupq_n_f32(float(1 - scalars.beta_1));
+      const float32x4_t beta_2            = vdupq_n_f32(float(scalars.beta_2));
+      const float32x4_t one_minus_beta_2  = vdupq_n_f32(float(1 - scalars.beta_2));
+      const float32x4_t step_scale        = vdupq_n_f32(float(scalars.step_scale));
+      const float32x4_t v_bias_correction = vdupq_n_f32(float(scalars.v_bias_correction));
+      const float32x4_t internal_epsilon  = vdupq_n_f32(float(scalars.internal_epsilon));
+
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        const float32x4_t g = load_neon_f32(grad + i);
+        const float32x4_t m =
+            vfmaq_f32(vmulq_f32(one_minus_beta_1, g), beta_1, load_neon_f32(m_k + i));
+        const float32x4_t v =
+            vfmaq_f32(vmulq_f32(vmulq_f32(one_minus_beta_2, g), g), beta_2, load_neon_f32(v_k + i));
+
+        store_neon_f32(m_k + i, m);
+        store_neon_f32(v_k + i, v);
+
+        const float32x4_t denominator =
+            vaddq_f32(vsqrtq_f32(vmulq_f32(v_bias_correction, v)), internal_epsilon);
+        vst1q_f32(x + i,
+                  vsubq_f32(vld1q_f32(x + i), vdivq_f32(vmulq_f32(step_scale, m), denominator)));
+      }
+      Adam_step_scalar(scalars, n - i, grad + i, m_k + i, v_k + i, x + i);
+    }
+
+    template <typename SCALAR_TYPE, typename GRADIENT_TYPE, typename MOMENT_TYPE>
+    inline void
+    Adam_step_neon(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                   const size_t n,
+                   const GRADIENT_TYPE* const grad,
+                   MOMENT_TYPE* const m_k,
+                   MOMENT_TYPE* const v_k,
+                   double* const x)
+    {
+      const float64x2_t beta_1            = vdupq_n_f64(double(scalars.beta_1));
+      const float64x2_t one_minus_beta_1  = vdupq_n_f64(double(1 - scalars.beta_1));
+      const float64x2_t beta_2            = vdupq_n_f64(double(scalars.beta_2));
+      const float64x2_t one_minus_beta_2  = vdupq_n_f64(double(1 - scalars.beta_2));
+      const float64x2_t step_scale        = vdupq_n_f64(double(scalars.step_scale));
+      const float64x2_t v_bias_correction = vdupq_n_f64(double(scalars.v_bias_correction));
+      const float64x2_t internal_epsilon  = vdupq_n_f64(double(scalars.internal_epsilon));
+
+      size_t i = 0;
+      for (; i + 2 <= n; i += 2)
+      {
+        const float64x2_t g = load_neon_f64(grad + i);
+        const float64x2_t m =
+            vfmaq_f64(vmulq_f64(one_minus_beta_1, g), beta_1, load_neon_f64(m_k + i));
+        const float64x2_t v =
+            vfmaq_f64(vmulq_f64(vmulq_f64(one_minus_beta_2, g), g), beta_2, load_neon_f64(v_k + i));
+
+        store_neon_f64(m_k + i, m);
+        store_neon_f64(v_k + i, v);
+
+        const float64x2_t denominator =
+            vaddq_f64(vsqrtq_f64(vmulq_f64(v_bias_correction, v)), internal_epsilon);
+        vst1q_f64(x + i,
+                  vsubq_f64(vld1q_f64(x + i), vdivq_f64(vmulq_f64(step_scale, m), denominator)));
+      }
+      Adam_step_scalar(scalars, n - i, grad + i, m_k + i, v_k + i, x + i);
+    }
+
+    template <typename SCALAR_TYPE, typename GRADIENT_TYPE, typename MOMENT_TYPE>
+    inline void
+    Adam_variant_step_neon(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                           const size_t n,
+                           const GRADIENT_TYPE* const grad,
+                           MOMENT_TYPE* const m_k,
+                           MOMENT_TYPE* const v_k,
+                           MOMENT_TYPE* const v_max_k,
+                           float* const x)
+    {
+      const float32x4_t beta_1            = vdupq_n_f32(float(scalars.beta_1));
+      const float32x4_t one_minus_beta_1  = vdupq_n_f32(float(1 - scalars.beta_1));
+      const float32x4_t beta_2            = vdupq_n_f32(float(scalars.beta_2));
+      const float32x4_t one_minus_beta_2  = vdupq_n_f32(float(1 - scalars.beta_2));
+      const float32x4_t step_scale        = vdupq_n_f32(float(scalars.step_scale));
+      const float32x4_t v_bias_correction = vdupq_n_f32(float(scalars.v_bias_correction));
+      const float32x4_t internal_epsilon  = vdupq_n_f32(float(scalars.internal_epsilon));
+      const float32x4_t decay_scale       = vdupq_n_f32(float(scalars.decay_scale));
+
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        const float32x4_t g = load_neon_f32(grad + i);
+        const float32x4_t m =
+            vfmaq_f32(vmulq_f32(one_minus_beta_1, g), beta_1, load_neon_f32(m_k + i));
+        const float32x4_t v =
+            vfmaq_f32(vmulq_f32(vmulq_f32(one_minus_beta_2, g), g), beta_2, load_neon_f32(v_k + i));
+
+        store_neon_f32(m_k + i, m);
+        store_neon_f32(v_k + i, v);
+
+        float32x4_t v_step = v;
+        if (v_max_k)
+        {
+          v_step = vmaxnmq_f32(v, load_neon_f32(v_max_k + i));
+          store_neon_f32(v_max_k + i, v_step);
+        }
+
+        const float32x4_t x_i = vld1q_f32(x + i);
+
+        const float32x4_t denominator =
+            vaddq_f32(vsqrtq_f32(vmulq_f32(v_bias_correction, v_step)), internal_epsilon);
+        vst1q_f32(x + i,
+                  vsubq_f32(vfmsq_f32(x_i, decay_scale, x_i),
+                            vdivq_f32(vmulq_f32(step_scale, m), denominator)));
+      }
+      Adam_variant_step_scalar(
+          scalars, n - i, grad + i, m_k + i, v_k + i, v_max_k ? v_max_k + i : nullptr, x + i);
+    }
+
+    template <typename SCALAR_TYPE, typename GRADIENT_TYPE, typename MOMENT_TYPE>
+    inline void
+    Adam_variant_step_neon(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                           const size_t n,
+                           const GRADIENT_TYPE* const grad,
+                           MOMENT_TYPE* const m_k,
+                           MOMENT_TYPE* const v_k,
+                           MOMENT_TYPE* const v_max_k,
+                           double* const x)
+    {
+      const float64x2_t beta_1            = vdupq_n_f64(double(scalars.beta_1));
+      const float64x2_t one_minus_beta_1  = vdupq_n_f64(double(1 - scalars.beta_1));
+      const float64x2_t beta_2            = vdupq_n_f64(double(scalars.beta_2));
+      const float64x2_t one_minus_beta_2  = vdupq_n_f64(double(1 - scalars.beta_2));
+      const float64x2_t step_scale        = vdupq_n_f64(double(scalars.step_scale));
+      const float64x2_t v_bias_correction = vdupq_n_f64(double(scalars.v_bias_correction));
+      const float64x2_t internal_epsilon  = vdupq_n_f64(double(scalars.internal_epsilon));
+      const float64x2_t decay_scale       = vdupq_n_f64(double(scalars.decay_scale));
+
+      size_t i = 0;
+      for (; i + 2 <= n; i += 2)
+      {
+        const float64x2_t g = load_neon_f64(grad + i);
+        const float64x2_t m =
+            vfmaq_f64(vmulq_f64(one_minus_beta_1, g), beta_1, load_neon_f64(m_k + i));
+        const float64x2_t v =
+            vfmaq_f64(vmulq_f64(vmulq_f64(one_minus_beta_2, g), g), beta_2, load_neon_f64(v_k + i));
+
+        store_neon_f64(m_k + i, m);
+        store_neon_f64(v_k + i, v);
+
+        float64x2_t v_step = v;
+        if (v_max_k)
+        {
+          v_step = vmaxnmq_f64(v, load_neon_f64(v_max_k + i));
+          store_neon_f64(v_max_k + i, v_step);
+        }
+
+        const float64x2_t x_i = vld1q_f64(x + i);
+
+        const float64x2_t denominator =
+            vaddq_f64(vsqrtq_f64(vmulq_f64(v_bias_correction, v_step)), internal_epsilon);
+        vst1q_f64(x + i,
+                  vsubq_f64(vfmsq_f64(x_i, decay_scale, x_i),
+                            vdivq_f64(vmulq_f64(step_scale, m), denominator)));
+      }
+      Adam_variant_step_scalar(
+          scalars, n - i, grad + i, m_k + i, v_k + i, v_max_k ? v_max_k + i : nullptr, x + i);
+    }
+
+    template <typename SCALAR_TYPE>
+    inline double
+    squared_norm_2_neon_f64(const SCALAR_TYPE* const v, const size_t n)
+    {
+      float64x2_t sum_0 = vdupq_n_f64(0);
+      float64x2_t sum_1 = vdupq_n_f64(0);
+
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        const float64x2_t v_0 = load_neon_f64(v + i);
+        const float64x2_t v_1 = load_neon_f64(v + i + 2);
+        sum_0                 = vfmaq_f64(sum_0, v_0, v_0);
+        sum_1                 = vfmaq_f64(sum_1, v_1, v_1);
+      }
+      return vaddvq_f64(vaddq_f64(sum_0, sum_1)) + squared_norm_2_scalar<double>(v + i, n - i);
+    }
+
+    template <typename SCALAR_TYPE>
+    inline float
+    squared_norm_2_neon_f32(const SCALAR_TYPE* const v, const size_t n)
+    {
+      float32x4_t sum_0 = vdupq_n_f32(0);
+      float32x4_t sum_1 = vdupq_n_f32(0);
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        const float32x4_t v_0 = load_neon_f32(v + i);
+        const float32x4_t v_1 = load_neon_f32(v + i + 4);
+        sum_0                 = vfmaq_f32(sum_0, v_0, v_0);
+        sum_1                 = vfmaq_f32(sum_1, v_1, v_1);
+      }
+      return vaddvq_f32(vaddq_f32(sum_0, sum_1)) + squared_norm_2_scalar<float>(v + i, n - i);
+    }
+#endif
+
+    template <typename SCALAR_TYPE>
+    constexpr bool is_simd_storage_v = std::is_same_v<SCALAR_TYPE, float> or
+                                       std::is_same_v<SCALAR_TYPE, double> or
+                                       std::is_same_v<SCALAR_TYPE, bfloat16>;
+
+    template <typename SCALAR_TYPE>
+    constexpr bool is_simd_compute_v =
+        std::is_same_v<SCALAR_TYPE, float> or std::is_same_v<SCALAR_TYPE, double>;
+  }
+
+  ////////////////////////////
+  // Adam_mixed_step_kernel //
+  ////////////////////////////
+  //
+  // Adam_step_kernel() with separate types. SCALAR_TYPE (step scalars)
+  // is the accumulator type.
+  //
+  // Same types: forwards to Adam_step_kernel()
+  //
+  template <typename SCALAR_TYPE,
+            typename GRADIENT_TYPE,
+            typename MOMENT_TYPE,
+            typename PARAMETER_TYPE>
+  void
+  Adam_mixed_step_kernel(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                         const size_t n,
+                         const GRADIENT_TYPE* const grad,
+                         MOMENT_TYPE* const m_k,
+                         MOMENT_TYPE* const v_k,
+                         PARAMETER_TYPE* const x)
+  {
+    using namespace Adam_Mixed_Kernel_Detail;
+
+    if constexpr (std::is_same_v<GRADIENT_TYPE, SCALAR_TYPE> and
+                  std::is_same_v<MOMENT_TYPE, SCALAR_TYPE> and
+                  std::is_same_v<PARAMETER_TYPE, SCALAR_TYPE>)
+    {
+      Adam_step_kernel(scalars, n, grad, m_k, v_k, x);
+    }
+    else
+    {
+      if constexpr (is_simd_storage_v<GRADIENT_TYPE> and is_simd_storage_v<MOMENT_TYPE> and
+                    is_simd_compute_v<PARAMETER_TYPE>)
+      {
+        switch (simd_instruction_set())
+        {
+#if defined(MATH_FUNCTIONS_SIMD_X86)
+          case Simd_Instruction_Set::AVX512:
+            return Adam_step_avx512(scalars, n, grad, m_k, v_k, x);
+          case Simd_Instruction_Set::AVX2:
+            return Adam_step_avx2(scalars, n, grad, m_k, v_k, x);
+#endif
+#if defined(MATH_FUNCTIONS_SIMD_NEON)
+          case Simd_Instruction_Set::NEON:
+            return Adam_step_neon(scalars, n, grad, m_k, v_k, x);
+#endif
+          default:
+            break;
+        }
+      }
+      Adam_Mixed_Kernel_Detail::Adam_step_scalar(scalars, n, grad, m_k, v_k, x);
+    }
+  }
+
+  /////////////////////////////////
+  // mixed_squared_norm_2_kernel //
+  /////////////////////////////////
+  //
+  // sum v_i^2 accumulated in ACCUMULATOR_TYPE (float or double)
+  //
+  // Same types: forwards to squared_norm_2_kernel()
+  //
+  template <typename ACCUMULATOR_TYPE, typename SCALAR_TYPE>
+  ACCUMULATOR_TYPE
+  mixed_squared_norm_2_kernel(const SCALAR_TYPE* const v, const size_t n)
+  {
+    using namespace Adam_Mixed_Kernel_Detail;
+
+    if constexpr (std::is_same_v<SCALAR_TYPE, ACCUMULATOR_TYPE>)
+    {
+      return squared_norm_2_kernel(v, n);
+    }
+    else
+    {
+      static_assert(is_simd_compute_v<ACCUMULATOR_TYPE>);
+
+      if constexpr (is_simd_storage_v<SCALAR_TYPE>)
+      {
+        constexpr bool is_double = std::is_same_v<ACCUMULATOR_TYPE, double>;
+
+        switch (simd_instruction_set())
+        {
+#if defined(MATH_FUNCTIONS_SIMD_X86)
+          case Simd_Instruction_Set::AVX512:
+            if constexpr (is_double)
+            {
+              return squared_norm_2_avx512_pd(v, n);
+            }
+            else
+            {
+              return squared_norm_2_avx512_ps(v, n);
+            }
+          case Simd_Instruction_Set::AVX2:
+            if constexpr (is_double)
+            {
+              return squared_norm_2_avx2_pd(v, n);
+            }
+            else
+            {
+              return squared_norm_2_avx2_ps(v, n);
+            }
+#endif
+#if defined(MATH_FUNCTIONS_SIMD_NEON)
+          case Simd_Instruction_Set::NEON:
+            if constexpr (is_double)
+            {
+              return squared_norm_2_neon_f64(v, n);
+            }
+            else
+            {
+              return squared_norm_2_neon_f32(v, n);
+            }
+#endif
+          default:
+            break;
+        }
+      }
+      return Adam_Mixed_Kernel_Detail::squared_norm_2_scalar<ACCUMULATOR_TYPE>(v, n);
+    }
+  }
+
+  //////////////////////////////
+  // Adam_variant_step_kernel //
+  //////////////////////////////
+  //
+  // Adam_mixed_step_kernel() with the variants:
+  //
+  // - AdamW, decoupled weight decay (scalars.weight_decay > 0):
+  //
+  //     x -= alpha * weight_decay * x
+  //
+  //   before the Adam step, without any gradient contribution
+  //
+  // - AMSGrad (v_max_k != nullptr): the step uses the running maximum
+  //   of v_k instead of v_k
+  //
+  //     v_max_k = max(v_max_k, v_k)
+  //
+  // Same SIMD kernels as Adam_mixed_step_kernel(), the same types
+  // included. Both variants off is the plain Adam step (use
+  // Adam_mixed_step_kernel() instead)
+  //
+  template <typename SCALAR_TYPE,
+            typename GRADIENT_TYPE,
+            typename MOMENT_TYPE,
+            typename PARAMETER_TYPE>
+  void
+  Adam_variant_step_kernel(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                           const size_t n,
+                           const GRADIENT_TYPE* const grad,
+                           MOMENT_TYPE* const m_k,
+                           MOMENT_TYPE* const v_k,
+                           MOMENT_TYPE* const v_max_k,
+                           PARAMETER_TYPE* const x)
+  {
+    using namespace Adam_Mixed_Kernel_Detail;
+
+    if constexpr (is_simd_storage_v<GRADIENT_TYPE> and is_simd_storage_v<MOMENT_TYPE> and
+                  is_simd_compute_v<PARAMETER_TYPE>)
+    {
+      switch (simd_instruction_set())
+      {
+#if defined(MATH_FUNCTIONS_SIMD_X86)
+        case Simd_Instruction_Set::AVX512:
+          return Adam_variant_step_avx512(scalars, n, grad, m_k, v_k, v_max_k, x);
+        case Simd_Instruction_Set::AVX2:
+          return Adam_variant_step_avx2(scalars, n, grad, m_k, v_k, v_max_k, x);
+#endif
+#if defined(MATH_FUNCTIONS_SIMD_NEON)
+        case Simd_Instruction_Set::NEON:
+          return Adam_variant_step_neon(scalars, n, grad, m_k, v_k, v_max_k, x);
+#endif
+        default:
+          break;
+      }
+    }
+    Adam_Mixed_Kernel_Detail::Adam_variant_step_scalar(scalars, n, grad, m_k, v_k, v_max_k, x);
+  }
+
+  ////////////////////////////////
+  // Chunked (parallel) kernels //
+  ////////////////////////////////
+  //
+  // Same chunks as the Adam_kernel.hpp ones: reproducible whatever the
+  // number of threads, identical to them for same types
+  //
+  template <typename SCALAR_TYPE,
+            typename GRADIENT_TYPE,
+            typename MOMENT_TYPE,
+            typename PARAMETER_TYPE>
+  void
+  Adam_mixed_step_kernel(Thread_Pool* const thread_pool,
+                         const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                         const size_t n,
+                         const GRADIENT_TYPE* const grad,
+                         MOMENT_TYPE* const m_k,
+                         MOMENT_TYPE* const v_k,
+                         PARAMETER_TYPE* const x)
+  {
+    parallel_for(thread_pool, Adam_chunk_count(n), [&](const size_t chunk) {
+      const size_t begin = chunk * Adam_chunk_size;
+      const size_t size  = std::min(Adam_chunk_size, n - begin);
+
+      Adam_mixed_step_kernel(scalars, size, grad + begin, m_k + begin, v_k + begin, x + begin);
+    });
+  }
+
+  template <typename SCALAR_TYPE,
+            typename GRADIENT_TYPE,
+            typename MOMENT_TYPE,
+            typename PARAMETER_TYPE>
+  void
+  Adam_variant_step_kernel(Thread_Pool* const thread_pool,
+                           const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                           const size_t n,
+                           const GRADIENT_TYPE* const grad,
+                           MOMENT_TYPE* const m_k,
+                           MOMENT_TYPE* const v_k,
+                           MOMENT_TYPE* const v_max_k,
+                           PARAMETER_TYPE* const x)
+  {
+    parallel_for(thread_pool, Adam_chunk_count(n), [&](const size_t chunk) {
+      const size_t begin = chunk * Adam_chunk_size;
+      const size_t size  = std::min(Adam_chunk_size, n - begin);
+
+      Adam_variant_step_kernel(scalars,
+                               size,
+                               grad + begin,
+                               m_k + begin,
+                               v_k + begin,
+                               v_max_k ? v_max_k + begin : nullptr,
+                               x + begin);
+    });
+  }
+
+  template <typename ACCUMULATOR_TYPE, typename SCALAR_TYPE>
+  ACCUMULATOR_TYPE
+  mixed_squared_norm_2_kernel(Thread_Pool* const thread_pool,
+                              const SCALAR_TYPE* const v,
+                              const size_t n,
+                              Adam_Partial_Sums<ACCUMULATOR_TYPE>& partial_sums)
+  {
+    const size_t chunk_count = Adam_chunk_count(n);
+    if (partial_sums.size() < chunk_count) partial_sums.resize(chunk_count);
+
+    parallel_for(thread_pool, chunk_count, [&](const size_t chunk) {
+      const size_t begin = chunk * Adam_chunk_size;
+      const size_t size  = std::min(Adam_chunk_size, n - begin);
+
+      partial_sums[chunk].value = mixed_squared_norm_2_kernel<ACCUMULATOR_TYPE>(v + begin, size);
+    });
+
+    ACCUMULATOR_TYPE sum = 0;
+    for (size_t chunk = 0; chunk < chunk_count; ++chunk)
+    {
+      sum += partial_sums[chunk].value;
+    }
+    return sum;
+  }
+}
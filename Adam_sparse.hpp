@@ -0,0 +1,352 @@
+#pragma once
+
+#include "Adam.hpp"
+#include "sparse_vector.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// Lazy Adam for sparse gradients (see Sparse_Vector): a step only
+// touches the coordinates with a non-zero gradient entry, its cost is
+// proportional to the non-zero count instead of the domain size.
+//
+//   Differentiable_Function<std::valarray<double>, double, Sparse_Vector<double>> f(...);
+//   Sparse_Vector<double> grad;
+//
+//   Adam_optimize(make_Adam_configuration<double>(), f, x, y, grad);
+//
+// The moments of a coordinate skipped during s steps (zero gradient
+// entry) are caught up when it is next active:
+//
+//   m_k *= beta_1^s
+//   v_k *= beta_2^s
+//
+// hence they are those of the dense iterations. x_i is not moved
+// during the skipped steps (dense Adam still moves it by the decaying
+// moment): the usual lazy Adam approximation, exact if each
+// coordinate is active at each step.
+//
+// The iterations are sequential (the threads option is ignored), without
+// the AdamW and AMSGrad variants.
+
+namespace Optimize
+{
+  /////////////////////////
+  // Lazy_Adam_Workspace //
+  /////////////////////////
+  //
+  // Adam_Workspace and the last step of each coordinate. m_k() and
+  // v_k() are the dense moments after synchronize() only.
+  //
+  template <typename SCALAR_TYPE>
+  class Lazy_Adam_Workspace : protected Adam_Workspace<SCALAR_TYPE>
+  {
+    using base_type = Adam_Workspace<SCALAR_TYPE>;
+
+   protected:
+    // Step of the last update of each coordinate (0: never updated)
+    std::vector<size_t> _last_step;
+
+   public:
+    Lazy_Adam_Workspace() = default;
+    explicit Lazy_Adam_Workspace(const size_t domain_size) { reset(domain_size); }
+
+    // Cold start: zero moments
+    void
+    reset(const size_t domain_size)
+    {
+      base_type::reset(domain_size);
+      _last_step.assign(domain_size, 0);
+    }
+
+    // Warm start from dense moments (see Adam_Workspace)
+    template <typename VECTOR_TYPE>
+    void
+    warm_start(const VECTOR_TYPE& m_k, const VECTOR_TYPE& v_k, const size_t step_count)
+    {
+      base_type::warm_start(m_k, v_k, step_count);
+      _last_step.assign(base_type::domain_size(), step_count);
+    }
+
+    // Catches up the moment decays of all the coordinates with the
+    // betas of the last run, O(domain size)
+    void
+    synchronize()
+    {
+      using std::pow;
+
+      const size_t step_count = base_type::step_count();
+
+      for (size_t i = 0; i < _last_step.size(); ++i)
+      {
+        const size_t skipped = step_count - _last_step[i];
+        if (skipped == 0) continue;
+
+        this->_m_k[i] *= pow(this->_beta_1, SCALAR_TYPE(skipped));
+        this->_v_k[i] *= pow(this->_beta_2, SCALAR_TYPE(skipped));
+        _last_step[i] = step_count;
+      }
+    }
+
+    using base_type::domain_size;
+    using base_type::m_k;
+    using base_type::step_count;
+    using base_type::v_k;
+
+    //////////////////////////////
+    // Used by Adam_optimize() //
+    //////////////////////////////
+    //
+    // The decays pending from a run with other betas are caught up
+    // first
+    void
+    load(Adam_Step_Scalars<SCALAR_TYPE>& step_scalars)
+    {
+      const bool betas_changed =
+          (this->_beta_1 != step_scalars.beta_1) or (this->_beta_2 != step_scalars.beta_2);
+
+      if (betas_changed and (base_type::step_count() > 0)) synchronize();
+
+      base_type::load(step_scalars);
+    }
+
+    using base_type::m_k_data;
+    using base_type::save;
+    using base_type::v_k_data;
+
+    size_t*
+    last_step_data()
+    {
+      return _last_step.data();
+    }
+  };
+
+  //////////////////////////
+  // Lazy_Adam_step_kernel //
+  //////////////////////////
+  //
+  // The Adam step (see Adam_step_kernel) of the coalesced entries of
+  // grad only, k = step_count() + 1 being the current step:
+  //
+  //   m_i *= beta_1^s, v_i *= beta_2^s   with s = k - 1 - last_step_i
+  //
+  // then the usual update and last_step_i = k.
+  //
+  template <typename SCALAR_TYPE>
+  void
+  Lazy_Adam_step_kernel(const Adam_Step_Scalars<SCALAR_TYPE>& scalars,
+                        const size_t k,
+                        const Sparse_Vector<SCALAR_TYPE>& grad,
+                        SCALAR_TYPE* const m_k,
+                        SCALAR_TYPE* const v_k,
+                        size_t* const last_step,
+                        SCALAR_TYPE* const x)
+  {
+    using std::pow;
+    using std::sqrt;
+
+    assert(grad.is_coalesced());
+
+    const SCALAR_TYPE beta_1            = scalars.beta_1;
+    const SCALAR_TYPE one_minus_beta_1  = 1 - scalars.beta_1;
+    const SCALAR_TYPE beta_2            = scalars.beta_2;
+    const SCALAR_TYPE one_minus_beta_2  = 1 - scalars.beta_2;
+    const SCALAR_TYPE step_scale        = scalars.step_scale;
+    const SCALAR_TYPE v_bias_correction = scalars.v_bias_correction;
+    const SCALAR_TYPE internal_epsilon  = scalars.internal_epsilon;
+
+    const auto indices = grad.indices();
+    const auto values  = grad.values();
+
+    for (size_t j = 0; j < indices.size(); ++j)
+    {
+      const size_t i = indices[j];
+      assert(last_step[i] < k);
+
+      SCALAR_TYPE m_i = m_k[i];
+      SCALAR_TYPE v_i = v_k[i];
+
+      const size_t skipped = k - 1 - last_step[i];
+      if (skipped > 0)
+      {
+        m_i *= pow(beta_1, SCALAR_TYPE(skipped));
+        v_i *= pow(beta_2, SCALAR_TYPE(skipped));
+      }
+
+      const SCALAR_TYPE g = values[j];
+      const SCALAR_TYPE m = beta_1 * m_i + one_minus_beta_1 * g;
+      const SCALAR_TYPE v = beta_2 * v_i + one_minus_beta_2 * g * g;
+
+      m_k[i]       = m;
+      v_k[i]       = v;
+      last_step[i] = k;
+      x[i] -= step_scale * m / (sqrt(v_bias_correction * v) + internal_epsilon);
+    }
+  }
+
+  namespace Adam_Detail
+  {
+    // Updates the non-zero coordinates only (see Adam_loop)
+    template <typename SCALAR_TYPE>
+    struct Lazy_Step
+    {
+      Lazy_Adam_Workspace<SCALAR_TYPE>& workspace;
+
+      const char*
+      solver_name() const
+      {
+        return "Lazy_Adam";
+      }
+
+      void
+      prepare_gradient(Sparse_Vector<SCALAR_TYPE>& grad) const
+      {
+        grad.clear();
+      }
+
+      SCALAR_TYPE
+      gradient_norm(Sparse_Vector<SCALAR_TYPE>& grad) const
+      {
+        using std::sqrt;
+
+        grad.coalesce();
+
+        const auto values = grad.values();
+        return sqrt(squared_norm_2_kernel(values.data(), values.size()));
+      }
+
+      template <typename PARAMETER_VECTOR>
+      void
+      update(const Adam_Step_Scalars<SCALAR_TYPE>& step_scalars,
+             const Sparse_Vector<SCALAR_TYPE>& grad,
+             PARAMETER_VECTOR& x_init) const
+      {
+        Lazy_Adam_step_kernel(step_scalars,
+                              workspace.step_count() + 1,
+                              grad,
+                              workspace.m_k_data(),
+                              workspace.v_k_data(),
+                              workspace.last_step_data(),
+                              Vector_Traits<PARAMETER_VECTOR>::data(x_init));
+      }
+    };
+
+    template <typename SCALAR_TYPE,
+              typename CONFIGURATION_TYPE,
+              typename OBJECTIVE,
+              typename PARAMETER_VECTOR>
+    bool
+    Lazy_Adam_iterate(const CONFIGURATION_TYPE& configuration,
+                      OBJECTIVE& objective_function,
+                      PARAMETER_VECTOR& x_init,
+                      SCALAR_TYPE& y,
+                      Sparse_Vector<SCALAR_TYPE>& grad,
+                      Lazy_Adam_Workspace<SCALAR_TYPE>& workspace)
+    {
+      static_assert(
+          std::is_same_v<typename Vector_Traits<PARAMETER_VECTOR>::scalar_type, SCALAR_TYPE>,
+          "Lazy Adam: no mixed precision");
+
+      // The AdamW decay and the AMSGrad maximum would touch all the
+      // coordinates
+      assert(configuration.weight_decay.value() == 0);
+      assert(not configuration.amsgrad.value());
+
+      const size_t domain_size = Vector_Traits<PARAMETER_VECTOR>::size(x_init);
+      if (grad.size() != domain_size) grad.resize(domain_size);
+
+      if (workspace.domain_size() != domain_size) workspace.reset(domain_size);
+
+      const Lazy_Step<SCALAR_TYPE> step{workspace};
+
+      return Adam_loop(configuration, objective_function, x_init, y, grad, workspace, step);
+    }
+  }
+
+  // PARAMETER_VECTOR: any contiguous vector (see Vector_Traits) of
+  // SCALAR_TYPE, x_init and grad are used in place
+  //
+  // workspace: resumes from its state, see Lazy_Adam_Workspace
+  //
+  // Returns true if has converged
+  template <typename SCALAR_TYPE, typename CONFIGURATION_TYPE, typename PARAMETER_VECTOR>
+  bool
+  Adam_optimize(
+      const CONFIGURATION_TYPE& configuration,
+      const Differentiable_Function<PARAMETER_VECTOR, SCALAR_TYPE, Sparse_Vector<SCALAR_TYPE>>&
+          objective_function,
+      PARAMETER_VECTOR& x_init,
+      SCALAR_TYPE& y,
+      Sparse_Vector<SCALAR_TYPE>& grad,
+      Lazy_Adam_Workspace<SCALAR_TYPE>& workspace)
+  {
+    Adam_Detail::Full_Objective<std::decay_t<decltype(objective_function)>> objective{
+        objective_function};
+
+    return Adam_Detail::Lazy_Adam_iterate(configuration, objective, x_init, y, grad, workspace);
+  }
+
+  template <typename SCALAR_TYPE, typename CONFIGURATION_TYPE, typename PARAMETER_VECTOR>
+  bool
+  Adam_optimize(
+      const CONFIGURATION_TYPE& configuration,
+      const Differentiable_Function<PARAMETER_VECTOR, SCALAR_TYPE, Sparse_Vector<SCALAR_TYPE>>&
+          objective_function,
+      PARAMETER_VECTOR& x_init,
+      SCALAR_TYPE& y,
+      Sparse_Vector<SCALAR_TYPE>& grad)
+  {
+    Lazy_Adam_Workspace<SCALAR_TYPE> workspace;
+
+    return Adam_optimize(configuration, objective_function, x_init, y, grad, workspace);
+  }
+
+  // Mini-batch version (see Adam.hpp), the typical sparse use: a
+  // mini-batch of sparse rows has a sparse gradient
+  //
+  // Returns true if has converged
+  template <typename SCALAR_TYPE,
+            typename ALPHA_SCHEDULE,
+            typename PARAMETER_VECTOR,
+            typename STORAGE>
+  bool
+  Adam_optimize(const Adam_Minibatch_Configuration<SCALAR_TYPE, ALPHA_SCHEDULE>& configuration,
+                const Sum_Of_Terms_Function<PARAMETER_VECTOR,
+                                            SCALAR_TYPE,
+                                            Sparse_Vector<SCALAR_TYPE>,
+                                            STORAGE>& objective_function,
+                PARAMETER_VECTOR& x_init,
+                SCALAR_TYPE& y,
+                Sparse_Vector<SCALAR_TYPE>& grad,
+                Lazy_Adam_Workspace<SCALAR_TYPE>& workspace)
+  {
+    Adam_Detail::Minibatch_Objective<std::decay_t<decltype(objective_function)>> objective(
+        objective_function,
+        configuration.minibatch_size.value(),
+        configuration.shuffle_seed.value());
+
+    return Adam_Detail::Lazy_Adam_iterate(configuration, objective, x_init, y, grad, workspace);
+  }
+
+  template <typename SCALAR_TYPE,
+            typename ALPHA_SCHEDULE,
+            typename PARAMETER_VECTOR,
+            typename STORAGE>
+  bool
+  Adam_optimize(const Adam_Minibatch_Configuration<SCALAR_TYPE, ALPHA_SCHEDULE>& configuration,
+                const Sum_Of_Terms_Function<PARAMETER_VECTOR,
+                                            SCALAR_TYPE,
+                                            Sparse_Vector<SCALAR_TYPE>,
+                                            STORAGE>& objective_function,
+                PARAMETER_VECTOR& x_init,
+                SCALAR_TYPE& y,
+                Sparse_Vector<SCALAR_TYPE>& grad)
+  {
+    Lazy_Adam_Workspace<SCALAR_TYPE> workspace;
+
+    return Adam_optimize(configuration, objective_function, x_init, y, grad, workspace);
+  }
+}
@@ -0,0 +1,477 @@
+#pragma once
+
+#include "Adam_kernel.hpp"
+#include "functions.hpp"
+#include "iteration_log.hpp"
+#include "iteration_observer.hpp"
+#include "line_search.hpp"
+#include "named_types.hpp"
+#include "vector_traits.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+// Limited memory BFGS for smooth full-batch objectives: a quasi-Newton
+// direction from the last history_size (step, gradient change) pairs,
+// and a line search along it (strong Wolfe by default, see
+// line_search.hpp). Each trial point is one f_df() call (counted by
+// the objective counters), the accepted one is the next iterate:
+//
+//   L_BFGS_optimize(f, x, y, grad, _L_BFGS_history_size_ = 5, _verbose_ = true);
+//   f.df_counter();  // objective evaluations
+//
+// Typically far fewer evaluations than Adam on small and medium
+// smooth problems, see Adam.hpp for stochastic (mini-batch) ones.
+
+namespace Optimize
+{
+  ///////////////////////////
+  // Dedicated Named_Types //
+  ///////////////////////////
+  //
+  // Number of (step, gradient change) pairs of the inverse Hessian
+  // approximation
+  //
+  using L_BFGS_History_Size =
+      Named_Assert_Type<struct L_BFGS_History_Size_Tag, Assert_Positive<size_t>, size_t>;
+  static constexpr auto _L_BFGS_history_size_ =
+      typename L_BFGS_History_Size::argument_syntactic_sugar();
+
+  // Called at each iteration, see Iteration_Record (step: accepted
+  // line search step)
+  //
+  using L_BFGS_Observer =
+      Named_Std_Function<struct L_BFGS_Observer_Tag, void, const Iteration_Record&>;
+  static constexpr auto _L_BFGS_observer_ = typename L_BFGS_Observer::argument_syntactic_sugar();
+
+  ///////////////////
+  // Configuration //
+  ///////////////////
+  //
+  template <typename SCALAR_TYPE>
+  struct L_BFGS_Configuration
+  {
+    using scalar_type = SCALAR_TYPE;
+
+    Maximum_Iterations maximimum_iterations = 100;
+
+    L_BFGS_History_Size history_size = 10;
+
+    Line_Search_Configuration line_search;
+
+    Absolute_Epsilon absolute_epsilon = 1e-6;
+
+    Verbose verbose = false;
+
+    L_BFGS_Observer observer;  // none
+  };
+
+  // See make_Adam_configuration()
+  template <typename SCALAR_TYPE, typename... USER_ARGS>
+  L_BFGS_Configuration<SCALAR_TYPE>
+  make_L_BFGS_configuration(const USER_ARGS&... user_args)
+  {
+    L_BFGS_Configuration<SCALAR_TYPE> configuration;
+
+    auto options = take_optional_argument_ref(configuration.maximimum_iterations,
+                                              configuration.history_size,
+                                              configuration.line_search.method,
+                                              configuration.line_search.c_1,
+                                              configuration.line_search.c_2,
+                                              configuration.line_search.maximum_evaluations,
+                                              configuration.absolute_epsilon,
+                                              configuration.verbose,
+                                              configuration.observer);
+    optional_argument(options, user_args...);
+
+    return configuration;
+  }
+
+  template <typename SCALAR_TYPE, typename VECTOR_TYPE, typename... USER_ARGS>
+  L_BFGS_Configuration<SCALAR_TYPE>
+  configure_L_BFGS(
+      const Differentiable_Function<VECTOR_TYPE, SCALAR_TYPE, VECTOR_TYPE>& /*objective_function*/,
+      const VECTOR_TYPE& /*x_init*/,
+      USER_ARGS... user_args)
+  {
+    return make_L_BFGS_configuration<SCALAR_TYPE>(user_args...);
+  }
+
+  //////////////////////
+  // L_BFGS_Workspace //
+  //////////////////////
+  //
+  // History pairs, search direction and line search storage, reusable
+  // between L_BFGS_optimize() calls: a new call with the same
+  // workspace continues with its history, reset() is a cold start.
+  // A domain or history size mismatch at the start of
+  // L_BFGS_optimize() is a cold start.
+  //
+  // VECTOR_TYPE: the objective domain type (see Line_Search_Workspace)
+  //
+  template <typename VECTOR_TYPE>
+  class L_BFGS_Workspace
+  {
+   public:
+    using scalar_type = typename Vector_Traits<VECTOR_TYPE>::scalar_type;
+
+   protected:
+    // Row j of the ring is pair (_history_begin + j) % _history_size
+    Aligned_Vector<scalar_type> _s;  // x_k+1 - x_k
+    Aligned_Vector<scalar_type> _y;  // grad_k+1 - grad_k
+    std::vector<scalar_type> _rho;   // 1 / <s, y>
+    std::vector<scalar_type> _alpha;
+    size_t _domain_size;
+    size_t _history_size;
+    size_t _history_begin;
+    size_t _history_count;
+
+    Aligned_Vector<scalar_type> _direction;
+    Line_Search_Workspace<VECTOR_TYPE> _line_search;
+
+    size_t
+    row(const size_t j) const
+    {
+      assert(j < _history_count);
+
+      return (_history_begin + j) % _history_size;
+    }
+
+   public:
+    L_BFGS_Workspace()
+        : _domain_size{0}, _history_size{0}, _history_begin{0}, _history_count{0}
+    {
+    }
+
+    // Cold start: empty history
+    void
+    reset(const size_t domain_size, const size_t history_size)
+    {
+      assert(history_size > 0);
+
+      _s.assign(domain_size * history_size, scalar_type(0));
+      _y.assign(domain_size * history_size, scalar_type(0));
+      _rho.assign(history_size, scalar_type(0));
+      _alpha.assign(history_size, scalar_type(0));
+      _direction.assign(domain_size, scalar_type(0));
+      _domain_size  = domain_size;
+      _history_size = history_size;
+      _line_search.resize(domain_size);
+      _line_search.reset();
+      clear_history();
+    }
+
+    size_t
+    domain_size() const
+    {
+      return _domain_size;
+    }
+    size_t
+    history_size() const
+    {
+      return _history_size;
+    }
+    size_t
+    history_count() const
+    {
+      return _history_count;
+    }
+
+    ///////////////////////////////
+    // Used by L_BFGS_optimize() //
+    ///////////////////////////////
+    //
+    void
+    clear_history()
+    {
+      _history_begin = 0;
+      _history_count = 0;
+    }
+
+    // Pairs j = 0 (oldest) ... history_count() - 1 (newest)
+    scalar_type*
+    s_data(const size_t j)
+    {
+      return _s.data() + row(j) * _domain_size;
+    }
+    scalar_type*
+    y_data(const size_t j)
+    {
+      return _y.data() + row(j) * _domain_size;
+    }
+    scalar_type&
+    rho(const size_t j)
+    {
+      return _rho[row(j)];
+    }
+    scalar_type&
+    alpha(const size_t j)
+    {
+      return _alpha[row(j)];
+    }
+
+    // New newest pair (the oldest one is dropped if full), to be filled
+    // through s_data(), y_data() and rho() of history_count() - 1
+    void
+    push_pair()
+    {
+      if (_history_count < _history_size)
+      {
+        ++_history_count;
+      }
+      else
+      {
+        _history_begin = (_history_begin + 1) % _history_size;
+      }
+    }
+
+    scalar_type*
+    direction_data()
+    {
+      return _direction.data();
+    }
+    Span<const scalar_type>
+    direction() const
+    {
+      return {_direction.data(), _direction.size()};
+    }
+    Line_Search_Workspace<VECTOR_TYPE>&
+    line_search()
+    {
+      return _line_search;
+    }
+  };
+
+  namespace L_BFGS_Detail
+  {
+    using Line_Search_Detail::dot;
+
+    // v += a * u
+    template <typename SCALAR_TYPE>
+    void
+    axpy(const SCALAR_TYPE a, const SCALAR_TYPE* const u, SCALAR_TYPE* const v, const size_t n)
+    {
+      for (size_t i = 0; i < n; ++i) v[i] += a * u[i];
+    }
+
+    // direction = -H grad (two-loop recursion), H0 = gamma I with
+    // gamma = <s, y> / <y, y> of the newest pair
+    template <typename VECTOR_TYPE>
+    void
+    L_BFGS_direction(L_BFGS_Workspace<VECTOR_TYPE>& workspace,
+                     const typename L_BFGS_Workspace<VECTOR_TYPE>::scalar_type* const grad)
+    {
+      const size_t n     = workspace.domain_size();
+      const size_t count = workspace.history_count();
+      auto* const d      = workspace.direction_data();
+
+      for (size_t i = 0; i < n; ++i) d[i] = -grad[i];
+
+      if (count == 0) return;
+
+      for (size_t j = count; j-- > 0;)
+      {
+        workspace.alpha(j) = workspace.rho(j) * dot(workspace.s_data(j), d, n);
+        axpy(-workspace.alpha(j), workspace.y_data(j), d, n);
+      }
+
+      const auto* const y_newest = workspace.y_data(count - 1);
+      const auto gamma = 1 / (workspace.rho(count - 1) * dot(y_newest, y_newest, n));
+      for (size_t i = 0; i < n; ++i) d[i] *= gamma;
+
+      for (size_t j = 0; j < count; ++j)
+      {
+        const auto beta = workspace.rho(j) * dot(workspace.y_data(j), d, n);
+        axpy(workspace.alpha(j) - beta, workspace.s_data(j), d, n);
+      }
+    }
+
+  }
+
+  // VECTOR_TYPE: std::valarray, std::vector, Aligned_Vector...
+  // (resizable, see Vector_Traits), x_init and grad are used in place
+  //
+  // workspace: continues with its history, see L_BFGS_Workspace
+  //
+  // Returns true if has converged
+  template <typename SCALAR_TYPE, typename VECTOR_TYPE>
+  bool
+  L_BFGS_optimize(
+      const L_BFGS_Configuration<SCALAR_TYPE>& configuration,
+      const Differentiable_Function<VECTOR_TYPE, SCALAR_TYPE, VECTOR_TYPE>& objective_function,
+      VECTOR_TYPE& x_init,
+      SCALAR_TYPE& y,
+      VECTOR_TYPE& grad,
+      L_BFGS_Workspace<VECTOR_TYPE>& workspace)
+  {
+    using namespace L_BFGS_Detail;
+
+    using traits      = Vector_Traits<VECTOR_TYPE>;
+    using scalar_type = typename traits::scalar_type;
+
+    const size_t domain_size  = traits::size(x_init);
+    const size_t history_size = configuration.history_size.value();
+
+    traits::resize(grad, domain_size);
+
+    if ((workspace.domain_size() != domain_size) or (workspace.history_size() != history_size))
+    {
+      workspace.reset(domain_size, history_size);
+    }
+
+    const bool verbose  = configuration.verbose.value();
+    const bool observed = not configuration.observer.is_empty();
+
+    const Iteration_Timer timer(observed);
+    const Verbose_Scope verbose_scope(verbose);
+
+    objective_function.f_df(x_init, y, grad);
+
+    bool has_converged = false;
+    for (size_t k = 1; k < configuration.maximimum_iterations.value(); ++k)
+    {
+      const scalar_type* const g = traits::data(grad);
+
+      const auto grad_norm = std::sqrt(squared_norm_2_kernel(g, domain_size));
+      has_converged        = grad_norm < configuration.absolute_epsilon.value();
+
+      if (verbose and ((k % 10 == 1) or has_converged))
+      {
+        verbose_log().push(make_iteration_record(
+            "L-BFGS", k, iteration_not_available, y, grad_norm, iteration_not_available));
+      }
+
+      if (has_converged)
+      {
+        if (observed)
+        {
+          configuration.observer(make_iteration_record(
+              "L-BFGS", k, timer.elapsed(), y, grad_norm, iteration_not_available));
+        }
+        break;
+      }
+
+      // Quasi-Newton direction, steepest descent if it is not a descent
+      // one
+      L_BFGS_direction(workspace, g);
+      auto directional_derivative = dot(g, workspace.direction_data(), domain_size);
+
+      if (not(directional_derivative < 0))
+      {
+        workspace.clear_history();
+        L_BFGS_direction(workspace, g);
+        directional_derivative = -grad_norm * grad_norm;
+      }
+
+      // Without history the first trial step has a unit length
+      const auto steepest_step = std::min(SCALAR_TYPE(1), SCALAR_TYPE(1 / grad_norm));
+
+      auto result = line_search(configuration.line_search,
+                                objective_function,
+                                x_init,
+                                y,
+                                workspace.direction(),
+                                SCALAR_TYPE(directional_derivative),
+                                (workspace.history_count() == 0) ? steepest_step : SCALAR_TYPE(1),
+                                workspace.line_search());
+
+      if ((not result.success) and (workspace.history_count() > 0))
+      {
+        // Stale curvature information: retry along the steepest descent
+        workspace.clear_history();
+        L_BFGS_direction(workspace, g);
+
+        result = line_search(configuration.line_search,
+                             objective_function,
+                             x_init,
+                             y,
+                             workspace.direction(),
+                             SCALAR_TYPE(-grad_norm * grad_norm),
+                             steepest_step,
+                             workspace.line_search());
+      }
+      const bool accepted = result.success;
+
+      if (observed)
+      {
+        const double step = accepted ? double(result.step) : iteration_not_available;
+
+        configuration.observer(
+            make_iteration_record("L-BFGS", k, timer.elapsed(), y, grad_norm, step));
+      }
+      if (not accepted) break;
+
+      // New pair, kept if the curvature condition holds
+      scalar_type* const x_k           = traits::data(x_init);
+      scalar_type* const g_k           = traits::data(grad);
+      const scalar_type* const x_trial = traits::data(workspace.line_search().x_trial());
+      const scalar_type* const g_trial = traits::data(workspace.line_search().grad_trial());
+
+      scalar_type s_dot_y = 0;
+      scalar_type y_dot_y = 0;
+      for (size_t i = 0; i < domain_size; ++i)
+      {
+        const scalar_type s_i = x_trial[i] - x_k[i];
+        const scalar_type y_i = g_trial[i] - g_k[i];
+
+        s_dot_y += s_i * y_i;
+        y_dot_y += y_i * y_i;
+      }
+
+      if (s_dot_y > std::numeric_limits<scalar_type>::epsilon() * y_dot_y)
+      {
+        workspace.push_pair();
+
+        const size_t newest    = workspace.history_count() - 1;
+        scalar_type* const s_k = workspace.s_data(newest);
+        scalar_type* const y_k = workspace.y_data(newest);
+
+        for (size_t i = 0; i < domain_size; ++i)
+        {
+          s_k[i] = x_trial[i] - x_k[i];
+          y_k[i] = g_trial[i] - g_k[i];
+        }
+        workspace.rho(newest) = 1 / s_dot_y;
+      }
+
+      std::copy(x_trial, x_trial + domain_size, x_k);
+      std::copy(g_trial, g_trial + domain_size, g_k);
+      y = result.y;
+    }
+
+    return has_converged;
+  }
+
+  template <typename SCALAR_TYPE, typename VECTOR_TYPE>
+  bool
+  L_BFGS_optimize(
+      const L_BFGS_Configuration<SCALAR_TYPE>& configuration,
+      const Differentiable_Function<VECTOR_TYPE, SCALAR_TYPE, VECTOR_TYPE>& objective_function,
+      VECTOR_TYPE& x_init,
+      SCALAR_TYPE& y,
+      VECTOR_TYPE& grad)
+  {
+    L_BFGS_Workspace<VECTOR_TYPE> workspace;
+
+    return L_BFGS_optimize(configuration, objective_function, x_init, y, grad, workspace);
+  }
+
+  template <typename SCALAR_TYPE, typename VECTOR_TYPE, typename... USER_ARGS>
+  bool
+  L_BFGS_optimize(
+      const Differentiable_Function<VECTOR_TYPE, SCALAR_TYPE, VECTOR_TYPE>& objective_function,
+      VECTOR_TYPE& x_init,
+      SCALAR_TYPE& y,
+      VECTOR_TYPE& grad,
+      USER_ARGS... user_args)
+  {
+    auto configuration =
+        configure_L_BFGS(objective_function, x_init, std::forward<USER_ARGS>(user_args)...);
+
+    return L_BFGS_optimize(configuration, objective_function, x_init, y, grad);
+  }
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include "evaluation_counter.hpp"
+#include "functions.hpp"
+
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Asynchronous objectives (remote simulation service, GPU kernel...):
+// an evaluation is launched and completes later, possibly on another
+// thread, without blocking a solver thread meanwhile.
+//
+//   Async_Function<std::valarray<double>, double> f(
+//       [&](const std::valarray<double>& x, Async_Completion<double> done) {
+//         client.submit(x, [done](double y) { done(y); });  // x copied by submit
+//       });
+//
+//   f.f(x, [](const double* y, std::exception_ptr error) { ... });  // callback
+//   std::future<double> y = f.f(x);                                 // future
+//
+// The callback form is the one to wrap into a C++20 awaitable.
+//
+// as_function() is a blocking Function whose f_batch() keeps all the
+// points of the batch in flight: drivers that evaluate through
+// f_batch() (finite_difference()), or run many blocked solvers
+// (multistart_in_flight()), hide the latency.
+
+//////////////////////
+// Async_Completion //
+//////////////////////
+//
+// Called exactly once, with the value or with the error. Cheap to
+// copy (shared handler), callable from any thread.
+//
+template <typename CODOMAIN_TYPE>
+class Async_Completion
+{
+ public:
+  using handler_type = std::function<void(const CODOMAIN_TYPE* y, std::exception_ptr error)>;
+
+ protected:
+  std::shared_ptr<const handler_type> _handler;
+
+ public:
+  Async_Completion() = default;
+
+  template <typename HANDLER,
+            std::enable_if_t<std::is_invocable_v<std::decay_t<HANDLER>&,
+                                                 const CODOMAIN_TYPE*,
+                                                 std::exception_ptr>>* = nullptr>
+  Async_Completion(HANDLER&& handler)
+      : _handler{std::make_shared<const handler_type>(std::forward<HANDLER>(handler))}
+  {
+  }
+
+  void
+  operator()(const CODOMAIN_TYPE& y) const
+  {
+    assert(_handler);
+    (*_handler)(&y, nullptr);
+  }
+  void
+  operator()(std::exception_ptr error) const
+  {
+    assert(_handler and error);
+    (*_handler)(nullptr, std::move(error));
+  }
+};
+
+////////////////////
+// Async_Function //
+////////////////////
+//
+template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE>
+class Async_Function
+{
+ public:
+  using domain_type     = DOMAIN_TYPE;
+  using codomain_type   = CODOMAIN_TYPE;
+  using completion_type = Async_Completion<CODOMAIN_TYPE>;
+
+  // x is only valid during the call: copy it if the evaluation needs
+  // it later
+  struct Interface
+  {
+    virtual void f(const domain_type& x, completion_type done) const = 0;
+
+    virtual ~Interface() = default;
+  };
+
+ protected:
+  std::shared_ptr<const Interface> _pimpl;
+  std::shared_ptr<Evaluation_Counter> _f_counter;
+
+ public:
+  // lambda(const domain_type& x, Async_Completion<codomain_type> done)
+  template <typename F,
+            std::enable_if_t<std::is_invocable_v<std::decay_t<F>&,
+                                                 const DOMAIN_TYPE&,
+                                                 completion_type>>* = nullptr>
+  Async_Function(F&& f)
+  {
+    struct Impl final : public Interface
+    {
+      std::decay_t<F> _f;
+
+      Impl(F&& f) : _f(std::forward<F>(f)) {}
+
+      void
+      f(const DOMAIN_TYPE& x, completion_type done) const override
+      {
+        _f(x, std::move(done));
+      }
+    };
+    _pimpl = std::make_shared<const Impl>(std::forward<F>(f));
+  }
+
+  // Non-blocking, done(y, nullptr) or done(nullptr, error)
+  template <typename HANDLER>
+  void
+  f(const domain_type& x, HANDLER&& done) const
+  {
+    if (_f_counter) ++(*_f_counter);
+
+    (*_pimpl).f(x, completion_type(std::forward<HANDLER>(done)));
+  }
+
+  std::future<codomain_type>
+  f(const domain_type& x) const
+  {
+    auto promise = std::make_shared<std::promise<codomain_type>>();
+    auto future  = promise->get_future();
+
+    f(x, [promise](const codomain_type* y, std::exception_ptr error) {
+      if (error)
+      {
+        promise->set_exception(std::move(error));
+      }
+      else
+      {
+        promise->set_value(*y);
+      }
+    });
+    return future;
+  }
+
+  // Blocking Function, f_batch() launches all the points then waits
+  // for them. An evaluation error is rethrown once all the batch is
+  // completed.
+  Function<domain_type, codomain_type> as_function() const;
+
+  // Incremented at launch by f(), on the launching thread:
+  // Counter_Policy::Relaxed_Atomic or Sharded if several threads
+  // launch evaluations (multistart_in_flight()...)
+  void
+  initialize_counter(const Counter_Policy policy = Counter_Policy::Plain)
+  {
+    _f_counter = make_evaluation_counter(policy);
+  }
+
+  size_t
+  f_counter() const
+  {
+    assert(_f_counter);
+    return _f_counter->value();
+  }
+};
+
+namespace Async_Function_Detail
+{
+  // Waits for the completion of count points
+  class Completion_Latch
+  {
+    std::mutex _mutex;
+    std::condition_variable _completed;
+    size_t _remaining;
+    std::vector<bool> _signalled;  // per point
+    std::exception_ptr _error;     // first one
+
+   public:
+    explicit Completion_Latch(const size_t count) : _remaining{count}, _signalled(count, false)
+    {
+    }
+
+    // Point i completed, ignored if it already has (an implementation
+    // signalling done then throwing). store() runs under the lock, only
+    // for the first completion: a result is never written after wait()
+    // has returned.
+    template <typename STORE>
+    void
+    count_down(const size_t i, std::exception_ptr error, STORE&& store)
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      assert(i < _signalled.size());
+      if (_signalled[i]) return;
+      _signalled[i] = true;
+
+      store();
+      if (error and not _error) _error = std::move(error);
+      if (--_remaining == 0) _completed.notify_all();
+    }
+
+    // Rethrows the first error
+    void
+    wait()
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _completed.wait(lock, [this]() { return _remaining == 0; });
+
+      if (_error) std::rethrow_exception(_error);
+    }
+  };
+}
+
+template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE>
+Function<DOMAIN_TYPE, CODOMAIN_TYPE>
+Async_Function<DOMAIN_TYPE, CODOMAIN_TYPE>::as_function() const
+{
+  return {batch_lambda,
+          [async_f = *this](Span<const DOMAIN_TYPE> x, Span<CODOMAIN_TYPE> y) {
+            using Async_Function_Detail::Completion_Latch;
+
+            const size_t n = x.size();
+            if (n == 0) return;
+
+            // shared: a completion can still run its handler after the
+            // latch has let wait() return
+            auto latch = std::make_shared<Completion_Latch>(n);
+
+            for (size_t i = 0; i < n; ++i)
+            {
+              CODOMAIN_TYPE* const y_i = &y[i];
+
+              try
+              {
+                async_f.f(x[i],
+                          [latch, i, y_i](const CODOMAIN_TYPE* value, std::exception_ptr error) {
+                            latch->count_down(i, std::move(error), [&]() {
+                              if (value) *y_i = *value;
+                            });
+                          });
+              }
+              catch (...)
+              {
+                // Launch failure: the points not launched (point i
+                // unless already signalled) complete with the error
+                for (size_t j = i; j < n; ++j)
+                {
+                  latch->count_down(j, std::current_exception(), []() {});
+                }
+                break;
+              }
+            }
+            latch->wait();
+          }};
+}
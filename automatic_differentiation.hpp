@@ -0,0 +1,655 @@
+#pragma once
+
+#include "functions.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Differentiable_Function from f alone, f being a generic lambda:
+//
+//   auto Rosenbrock = [](const auto& x) {
+//     return (1 - x[0]) * (1 - x[0]) + 10 * (x[1] - x[0] * x[0]) * (x[1] - x[0] * x[0]);
+//   };
+//
+//   auto f = reverse_mode_differentiable_function<std::valarray<double>, double>(Rosenbrock);
+//
+// - reverse mode (Var): f_df() computes the value and the whole
+//   gradient in one forward + one backward sweep, whatever the
+//   dimension. The tape is a per-thread arena reused across calls.
+//
+// - forward mode (Dual): one sweep per domain component, best for
+//   scalar or small domains.
+//
+// f() calls the lambda with the plain domain type (no overhead). The
+// domain is a scalar T or a container of T (std::valarray,
+// std::vector), x is then given as an indexable container with
+// size(). Call math functions unqualified (using std::sin; sin(x)).
+
+namespace Automatic_Differentiation_Detail
+{
+  static constexpr size_t no_index = std::numeric_limits<size_t>::max();
+}
+
+//////////
+// Tape //
+//////////
+//
+// Nodes of the computational graph, at most two parents each.
+// Rewinding keeps the capacity: nodes are not reallocated from one
+// evaluation to the next.
+//
+template <typename T>
+class Tape
+{
+ public:
+  struct Node
+  {
+    size_t parent[2];
+    T partial[2];
+  };
+
+ protected:
+  std::vector<Node> _nodes;
+  std::vector<T> _adjoints;
+
+ public:
+  size_t
+  size() const
+  {
+    return _nodes.size();
+  }
+
+  // Leaf: parents are itself with null partials
+  size_t
+  push_leaf()
+  {
+    const size_t index = _nodes.size();
+    _nodes.push_back(Node{{index, index}, {T(0), T(0)}});
+    return index;
+  }
+  size_t
+  push(const size_t parent_0, const T partial_0, const size_t parent_1, const T partial_1)
+  {
+    _nodes.push_back(Node{{parent_0, parent_1}, {partial_0, partial_1}});
+    return _nodes.size() - 1;
+  }
+
+  // Backward sweep from output down to begin, returns the adjoints
+  // (indexed by node)
+  const std::vector<T>&
+  adjoints(const size_t begin, const size_t output)
+  {
+    assert(begin <= output and output < _nodes.size());
+
+    if (_adjoints.size() < _nodes.size()) _adjoints.resize(_nodes.size());
+    std::fill(_adjoints.begin() + begin, _adjoints.begin() + output + 1, T(0));
+
+    _adjoints[output] = T(1);
+    for (size_t i = output + 1; i-- > begin;)
+    {
+      const T adjoint = _adjoints[i];
+      if (adjoint == T(0)) continue;
+
+      const Node& node = _nodes[i];
+      _adjoints[node.parent[0]] += node.partial[0] * adjoint;
+      _adjoints[node.parent[1]] += node.partial[1] * adjoint;
+    }
+    return _adjoints;
+  }
+
+  void
+  rewind(const size_t size)
+  {
+    assert(size <= _nodes.size());
+    _nodes.resize(size);
+  }
+};
+
+// The per-thread tape, nested evaluations stack on it
+template <typename T>
+Tape<T>&
+thread_tape()
+{
+  static thread_local Tape<T> tape;
+  return tape;
+}
+
+/////////
+// Var //
+/////////
+//
+// Reverse mode variable, a null tape means a constant
+//
+template <typename T>
+struct Var
+{
+  T value;
+  size_t index;
+  Tape<T>* tape;
+
+  Var(const T value = T(0))
+      : value{value}, index{Automatic_Differentiation_Detail::no_index}, tape{nullptr}
+  {
+  }
+  Var(const T value, const size_t index, Tape<T>* const tape)
+      : value{value}, index{index}, tape{tape}
+  {
+  }
+
+  Var& operator+=(const Var& other);
+  Var& operator-=(const Var& other);
+  Var& operator*=(const Var& other);
+  Var& operator/=(const Var& other);
+};
+
+namespace Automatic_Differentiation_Detail
+{
+  template <typename T>
+  Var<T>
+  unary(const Var<T>& a, const T value, const T partial)
+  {
+    if (not a.tape) return Var<T>(value);
+    return {value, a.tape->push(a.index, partial, a.index, T(0)), a.tape};
+  }
+
+  template <typename T>
+  Var<T>
+  binary(const Var<T>& a, const Var<T>& b, const T value, const T partial_a, const T partial_b)
+  {
+    if (not a.tape) return unary(b, value, partial_b);
+    if (not b.tape) return unary(a, value, partial_a);
+
+    assert(a.tape == b.tape);
+    return {value, a.tape->push(a.index, partial_a, b.index, partial_b), a.tape};
+  }
+}
+
+// Var op Var, Var op scalar and scalar op Var (through the implicit
+// constant Var)
+//
+#define MATH_FUNCTIONS_AD_VAR_BINARY(OP, VALUE, PARTIAL_A, PARTIAL_B)                     \
+  template <typename T>                                                                   \
+  Var<T> operator OP(const Var<T>& a, const Var<T>& b)                                    \
+  {                                                                                       \
+    return Automatic_Differentiation_Detail::binary(a, b, VALUE, PARTIAL_A, PARTIAL_B);   \
+  }                                                                                       \
+  template <typename T, typename S, std::enable_if_t<std::is_arithmetic_v<S>>* = nullptr> \
+  Var<T> operator OP(const Var<T>& a, const S b)                                          \
+  {                                                                                       \
+    return a OP Var<T>(T(b));                                                             \
+  }                                                                                       \
+  template <typename T, typename S, std::enable_if_t<std::is_arithmetic_v<S>>* = nullptr> \
+  Var<T> operator OP(const S a, const Var<T>& b)                                          \
+  {                                                                                       \
+    return Var<T>(T(a)) OP b;                                                             \
+  }
+
+MATH_FUNCTIONS_AD_VAR_BINARY(+, a.value + b.value, T(1), T(1))
+MATH_FUNCTIONS_AD_VAR_BINARY(-, a.value - b.value, T(1), T(-1))
+MATH_FUNCTIONS_AD_VAR_BINARY(*, a.value * b.value, b.value, a.value)
+MATH_FUNCTIONS_AD_VAR_BINARY(/,
+                             a.value / b.value,
+                             T(1) / b.value,
+                             -a.value / (b.value * b.value))
+
+#undef MATH_FUNCTIONS_AD_VAR_BINARY
+
+template <typename T>
+Var<T>&
+Var<T>::operator+=(const Var& other)
+{
+  return *this = *this + other;
+}
+template <typename T>
+Var<T>&
+Var<T>::operator-=(const Var& other)
+{
+  return *this = *this - other;
+}
+template <typename T>
+Var<T>&
+Var<T>::operator*=(const Var& other)
+{
+  return *this = *this * other;
+}
+template <typename T>
+Var<T>&
+Var<T>::operator/=(const Var& other)
+{
+  return *this = *this / other;
+}
+
+template <typename T>
+Var<T>
+operator-(const Var<T>& a)
+{
+  return Automatic_Differentiation_Detail::unary(a, -a.value, T(-1));
+}
+template <typename T>
+Var<T>
+operator+(const Var<T>& a)
+{
+  return a;
+}
+
+#define MATH_FUNCTIONS_AD_VAR_COMPARISON(OP)                                              \
+  template <typename T>                                                                   \
+  bool operator OP(const Var<T>& a, const Var<T>& b)                                      \
+  {                                                                                       \
+    return a.value OP b.value;                                                            \
+  }                                                                                       \
+  template <typename T, typename S, std::enable_if_t<std::is_arithmetic_v<S>>* = nullptr> \
+  bool operator OP(const Var<T>& a, const S b)                                            \
+  {                                                                                       \
+    return a.value OP b;                                                                  \
+  }                                                                                       \
+  template <typename T, typename S, std::enable_if_t<std::is_arithmetic_v<S>>* = nullptr> \
+  bool operator OP(const S a, const Var<T>& b)                                            \
+  {                                                                                       \
+    return a OP b.value;                                                                  \
+  }
+
+MATH_FUNCTIONS_AD_VAR_COMPARISON(<)
+MATH_FUNCTIONS_AD_VAR_COMPARISON(<=)
+MATH_FUNCTIONS_AD_VAR_COMPARISON(>)
+MATH_FUNCTIONS_AD_VAR_COMPARISON(>=)
+MATH_FUNCTIONS_AD_VAR_COMPARISON(==)
+MATH_FUNCTIONS_AD_VAR_COMPARISON(!=)
+
+#undef MATH_FUNCTIONS_AD_VAR_COMPARISON
+
+// Math functions: value, derivative
+//
+#define MATH_FUNCTIONS_AD_VAR_UNARY(NAME, VALUE, DERIVATIVE)              \
+  template <typename T>                                                   \
+  Var<T> NAME(const Var<T>& a)                                            \
+  {                                                                       \
+    using std::NAME;                                                      \
+    const T value = VALUE;                                                \
+    return Automatic_Differentiation_Detail::unary(a, value, DERIVATIVE); \
+  }
+
+MATH_FUNCTIONS_AD_VAR_UNARY(sin, sin(a.value), std::cos(a.value))
+MATH_FUNCTIONS_AD_VAR_UNARY(cos, cos(a.value), -std::sin(a.value))
+MATH_FUNCTIONS_AD_VAR_UNARY(tan, tan(a.value), 1 + value * value)
+MATH_FUNCTIONS_AD_VAR_UNARY(exp, exp(a.value), value)
+MATH_FUNCTIONS_AD_VAR_UNARY(log, log(a.value), 1 / a.value)
+MATH_FUNCTIONS_AD_VAR_UNARY(sqrt, sqrt(a.value), 1 / (2 * value))
+MATH_FUNCTIONS_AD_VAR_UNARY(tanh, tanh(a.value), 1 - value * value)
+MATH_FUNCTIONS_AD_VAR_UNARY(abs, abs(a.value), (a.value < 0) ? T(-1) : T(1))
+
+#undef MATH_FUNCTIONS_AD_VAR_UNARY
+
+template <typename T, typename S, std::enable_if_t<std::is_arithmetic_v<S>>* = nullptr>
+Var<T>
+pow(const Var<T>& a, const S exponent)
+{
+  const T value = std::pow(a.value, T(exponent));
+  return Automatic_Differentiation_Detail::unary(
+      a, value, T(exponent) * std::pow(a.value, T(exponent) - 1));
+}
+
+//////////
+// Dual //
+//////////
+//
+// Forward mode number: value + derivative along one direction
+//
+template <typename T>
+struct Dual
+{
+  T value;
+  T derivative;
+
+  Dual(const T value = T(0), const T derivative = T(0)) : value{value}, derivative{derivative} {}
+
+  Dual& operator+=(const Dual& other);
+  Dual& operator-=(const Dual& other);
+  Dual& operator*=(const Dual& other);
+  Dual& operator/=(const Dual& other);
+};
+
+#define MATH_FUNCTIONS_AD_DUAL_BINARY(OP, VALUE, DERIVATIVE)                              \
+  template <typename T>                                                                   \
+  Dual<T> operator OP(const Dual<T>& a, const Dual<T>& b)                                 \
+  {                                                                                       \
+    return Dual<T>(VALUE, DERIVATIVE);                                                    \
+  }                                                                                       \
+  template <typename T, typename S, std::enable_if_t<std::is_arithmetic_v<S>>* = nullptr> \
+  Dual<T> operator OP(const Dual<T>& a, const S b)                                        \
+  {                                                                                       \
+    return a OP Dual<T>(T(b));                                                            \
+  }                                                                                       \
+  template <typename T, typename S, std::enable_if_t<std::is_arithmetic_v<S>>* = nullptr> \
+  Dual<T> operator OP(const S a, const Dual<T>& b)                                        \
+  {                                                                                       \
+    return Dual<T>(T(a)) OP b;                                                            \
+  }
+
+MATH_FUNCTIONS_AD_DUAL_BINARY(+, a.value + b.value, a.derivative + b.derivative)
+MATH_FUNCTIONS_AD_DUAL_BINARY(-, a.value - b.value, a.derivative - b.derivative)
+MATH_FUNCTIONS_AD_DUAL_BINARY(*, a.value * b.value, a.derivative * b.value + a.value * b.derivative)
+MATH_FUNCTIONS_AD_DUAL_BINARY(/,
+                              a.value / b.value,
+                              (a.derivative * b.value - a.value * b.derivative) /
+                                  (b.value * b.value))
+
+#undef MATH_FUNCTIONS_AD_DUAL_BINARY
+
+template <typename T>
+Dual<T>&
+Dual<T>::operator+=(const Dual& other)
+{
+  return *this = *this + other;
+}
+template <typename T>
+Dual<T>&
+Dual<T>::operator-=(const Dual& other)
+{
+  return *this = *this - other;
+}
+template <typename T>
+Dual<T>&
+Dual<T>::operator*=(const Dual& other)
+{
+  return *this = *this * other;
+}
+template <typename T>
+Dual<T>&
+Dual<T>::operator/=(const Dual& other)
+{
+  return *this = *this / other;
+}
+
+template <typename T>
+Dual<T>
+operator-(const Dual<T>& a)
+{
+  return Dual<T>(-a.value, -a.derivative);
+}
+template <typename T>
+Dual<T>
+operator+(const Dual<T>& a)
+{
+  return a;
+}
+
+#define MATH_FUNCTIONS_AD_DUAL_COMPARISON(OP)                                             \
+  template <typename T>                                                                   \
+  bool operator OP(const Dual<T>& a, const Dual<T>& b)                                    \
+  {                                                                                       \
+    return a.value OP b.value;                                                            \
+  }                                                                                       \
+  template <typename T, typename S, std::enable_if_t<std::is_arithmetic_v<S>>* = nullptr> \
+  bool operator OP(const Dual<T>& a, const S b)                                           \
+  {                                                                                       \
+    return a.value OP b;                                                                  \
+  }                                                                                       \
+  template <typename T, typename S, std::enable_if_t<std::is_arithmetic_v<S>>* = nullptr> \
+  bool operator OP(const S a, const Dual<T>& b)                                           \
+  {                                                                                       \
+    return a OP b.value;                                                                  \
+  }
+
+MATH_FUNCTIONS_AD_DUAL_COMPARISON(<)
+MATH_FUNCTIONS_AD_DUAL_COMPARISON(<=)
+MATH_FUNCTIONS_AD_DUAL_COMPARISON(>)
+MATH_FUNCTIONS_AD_DUAL_COMPARISON(>=)
+MATH_FUNCTIONS_AD_DUAL_COMPARISON(==)
+MATH_FUNCTIONS_AD_DUAL_COMPARISON(!=)
+
+#undef MATH_FUNCTIONS_AD_DUAL_COMPARISON
+
+#define MATH_FUNCTIONS_AD_DUAL_UNARY(NAME, VALUE, DERIVATIVE) \
+  template <typename T>                                       \
+  Dual<T> NAME(const Dual<T>& a)                              \
+  {                                                           \
+    using std::NAME;                                          \
+    const T value = VALUE;                                    \
+    return Dual<T>(value, (DERIVATIVE)*a.derivative);         \
+  }
+
+MATH_FUNCTIONS_AD_DUAL_UNARY(sin, sin(a.value), std::cos(a.value))
+MATH_FUNCTIONS_AD_DUAL_UNARY(cos, cos(a.value), -std::sin(a.value))
+MATH_FUNCTIONS_AD_DUAL_UNARY(tan, tan(a.value), 1 + value * value)
+MATH_FUNCTIONS_AD_DUAL_UNARY(exp, exp(a.value), value)
+MATH_FUNCTIONS_AD_DUAL_UNARY(log, log(a.value), 1 / a.value)
+MATH_FUNCTIONS_AD_DUAL_UNARY(sqrt, sqrt(a.value), 1 / (2 * value))
+MATH_FUNCTIONS_AD_DUAL_UNARY(tanh, tanh(a.value), 1 - value * value)
+MATH_FUNCTIONS_AD_DUAL_UNARY(abs, abs(a.value), (a.value < 0) ? T(-1) : T(1))
+
+#undef MATH_FUNCTIONS_AD_DUAL_UNARY
+
+template <typename T, typename S, std::enable_if_t<std::is_arithmetic_v<S>>* = nullptr>
+Dual<T>
+pow(const Dual<T>& a, const S exponent)
+{
+  const T value = std::pow(a.value, T(exponent));
+  return Dual<T>(value, T(exponent) * std::pow(a.value, T(exponent) - 1) * a.derivative);
+}
+
+namespace Automatic_Differentiation_Detail
+{
+  // Scalar domain or container of scalars
+  template <typename DOMAIN_TYPE, typename = void>
+  struct Domain_Traits
+  {
+    using scalar_type = DOMAIN_TYPE;
+  };
+  template <typename DOMAIN_TYPE>
+  struct Domain_Traits<DOMAIN_TYPE, std::enable_if_t<not std::is_arithmetic_v<DOMAIN_TYPE>>>
+  {
+    using scalar_type = std::decay_t<decltype(std::declval<const DOMAIN_TYPE&>()[0])>;
+  };
+
+  template <typename T>
+  T
+  value_of(const Var<T>& x)
+  {
+    return x.value;
+  }
+  template <typename T>
+  T
+  value_of(const Dual<T>& x)
+  {
+    return x.value;
+  }
+  template <typename T, std::enable_if_t<std::is_arithmetic_v<T>>* = nullptr>
+  T
+  value_of(const T x)
+  {
+    return x;
+  }
+
+  template <typename DIFFERENTIAL_TYPE, typename DOMAIN_TYPE>
+  void
+  resize_like(DIFFERENTIAL_TYPE& df, const DOMAIN_TYPE& x)
+  {
+    if (df.size() != x.size()) df.resize(x.size());
+  }
+
+  // Reverse mode f_df, y or df can be null
+  template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE, typename DIFFERENTIAL_TYPE, typename F>
+  void
+  reverse_mode_f_df(const F& f, const DOMAIN_TYPE& x, CODOMAIN_TYPE* y, DIFFERENTIAL_TYPE* df)
+  {
+    using T = typename Domain_Traits<DOMAIN_TYPE>::scalar_type;
+
+    Tape<T>& tape     = thread_tape<T>();
+    const size_t mark = tape.size();
+
+    if constexpr (std::is_arithmetic_v<DOMAIN_TYPE>)
+    {
+      const Var<T> x_var(x, tape.push_leaf(), &tape);
+      const Var<T> y_var = f(x_var);
+
+      if (y) *y = CODOMAIN_TYPE(y_var.value);
+      if (df) *df = (y_var.tape) ? tape.adjoints(mark, y_var.index)[x_var.index] : T(0);
+    }
+    else
+    {
+      // Reused buffer (per thread), taken during the evaluation so
+      // that a nested evaluation gets its own
+      static thread_local std::vector<Var<T>> x_var_buffer;
+      std::vector<Var<T>> x_var;
+      x_var.swap(x_var_buffer);
+
+      const size_t n = x.size();
+      x_var.clear();
+      for (size_t i = 0; i < n; ++i) x_var.emplace_back(x[i], tape.push_leaf(), &tape);
+
+      const Var<T> y_var = f(static_cast<const std::vector<Var<T>>&>(x_var));
+
+      if (y) *y = CODOMAIN_TYPE(y_var.value);
+      if (df)
+      {
+        resize_like(*df, x);
+        if (y_var.tape)
+        {
+          const auto& adjoints = tape.adjoints(mark, y_var.index);
+          for (size_t i = 0; i < n; ++i) (*df)[i] = adjoints[x_var[i].index];
+        }
+        else
+        {
+          for (size_t i = 0; i < n; ++i) (*df)[i] = T(0);
+        }
+      }
+      x_var.swap(x_var_buffer);
+    }
+    tape.rewind(mark);
+  }
+
+  // Forward mode f_df, y or df can be null
+  template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE, typename DIFFERENTIAL_TYPE, typename F>
+  void
+  forward_mode_f_df(const F& f, const DOMAIN_TYPE& x, CODOMAIN_TYPE* y, DIFFERENTIAL_TYPE* df)
+  {
+    using T = typename Domain_Traits<DOMAIN_TYPE>::scalar_type;
+
+    if constexpr (std::is_arithmetic_v<DOMAIN_TYPE>)
+    {
+      const Dual<T> y_dual = f(Dual<T>(x, T(1)));
+
+      if (y) *y = CODOMAIN_TYPE(y_dual.value);
+      if (df) *df = y_dual.derivative;
+    }
+    else
+    {
+      if (not df)
+      {
+        if (y) *y = CODOMAIN_TYPE(value_of(f(x)));
+        return;
+      }
+
+      static thread_local std::vector<Dual<T>> x_dual_buffer;
+      std::vector<Dual<T>> x_dual;
+      x_dual.swap(x_dual_buffer);
+
+      const size_t n = x.size();
+      x_dual.assign(n, Dual<T>());
+      for (size_t i = 0; i < n; ++i) x_dual[i].value = x[i];
+
+      resize_like(*df, x);
+      for (size_t i = 0; i < n; ++i)
+      {
+        x_dual[i].derivative = T(1);
+        const Dual<T> y_dual = f(static_cast<const std::vector<Dual<T>>&>(x_dual));
+        x_dual[i].derivative = T(0);
+
+        if (y and (i == 0)) *y = CODOMAIN_TYPE(y_dual.value);
+        (*df)[i] = y_dual.derivative;
+      }
+      if (y and (n == 0)) *y = CODOMAIN_TYPE(value_of(f(x)));
+
+      x_dual.swap(x_dual_buffer);
+    }
+  }
+
+  template <typename DOMAIN_TYPE,
+            typename CODOMAIN_TYPE,
+            typename DIFFERENTIAL_TYPE,
+            bool REVERSE_MODE,
+            typename F>
+  Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE>
+  differentiable_function(F&& f)
+  {
+    using differentiable_function_type =
+        Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE>;
+
+    struct Impl final : public differentiable_function_type::Diff_Interface
+    {
+      std::decay_t<F> _f;
+
+      Impl(F&& f) : _f(std::forward<F>(f)) {}
+
+      void
+      f_df_impl(const DOMAIN_TYPE& x, CODOMAIN_TYPE* y, DIFFERENTIAL_TYPE* df) const
+      {
+        if constexpr (REVERSE_MODE)
+        {
+          reverse_mode_f_df(_f, x, y, df);
+        }
+        else
+        {
+          forward_mode_f_df(_f, x, y, df);
+        }
+      }
+
+      void
+      f(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y) const
+      {
+        y = CODOMAIN_TYPE(value_of(_f(x)));
+      }
+      void
+      f_df(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y, DIFFERENTIAL_TYPE& df) const
+      {
+        f_df_impl(x, &y, &df);
+      }
+      void
+      df(const DOMAIN_TYPE& x, DIFFERENTIAL_TYPE& df) const
+      {
+        f_df_impl(x, nullptr, &df);
+      }
+    };
+    return {std::make_shared<const Impl>(std::forward<F>(f))};
+  }
+}
+
+//////////////////////////////////////////
+// reverse_mode_differentiable_function //
+//////////////////////////////////////////
+//
+// DIFFERENTIAL_TYPE defaults to DOMAIN_TYPE (gradient)
+//
+template <typename DOMAIN_TYPE,
+          typename CODOMAIN_TYPE,
+          typename DIFFERENTIAL_TYPE = DOMAIN_TYPE,
+          typename F>
+Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE>
+reverse_mode_differentiable_function(F&& f)
+{
+  return Automatic_Differentiation_Detail::
+      differentiable_function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE, true>(
+          std::forward<F>(f));
+}
+
+//////////////////////////////////////////
+// forward_mode_differentiable_function //
+//////////////////////////////////////////
+//
+template <typename DOMAIN_TYPE,
+          typename CODOMAIN_TYPE,
+          typename DIFFERENTIAL_TYPE = DOMAIN_TYPE,
+          typename F>
+Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE>
+forward_mode_differentiable_function(F&& f)
+{
+  return Automatic_Differentiation_Detail::
+      differentiable_function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE, false>(
+          std::forward<F>(f));
+}
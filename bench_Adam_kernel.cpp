@@ -0,0 +1,165 @@
+// Adam step: std::valarray expressions (previous implementation)
+// versus the fused Adam_step_kernel (scalar and SIMD), and the mixed
+// precision kernel (float parameters and gradient, bfloat16 moments)
+//
+// Usage: bench_Adam_kernel [max_dimension]
+//
+// Output (CSV): dimension, version, ns/iteration, modeled bytes/iteration,
+//               effective GB/s, heap allocations/iteration
+//
+#include "Adam_mixed_kernel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <valarray>
+#include <vector>
+
+// Counts heap allocations
+//
+static std::atomic<size_t> allocation_count{0};
+
+void*
+operator new(size_t size)
+{
+  ++allocation_count;
+  if (void* p = std::malloc(size)) return p;
+  throw std::bad_alloc();
+}
+void
+operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+void
+operator delete(void* p, size_t) noexcept
+{
+  std::free(p);
+}
+
+using namespace Optimize;
+
+using vector_type = std::valarray<double>;
+
+constexpr double beta_1           = 0.9;
+constexpr double beta_2           = 0.999;
+constexpr double internal_epsilon = 1e-8;
+constexpr double alpha            = 1e-3;
+
+void
+valarray_step(const size_t k,
+              const vector_type& grad,
+              vector_type& m_k,
+              vector_type& hat_m_k,
+              vector_type& v_k,
+              vector_type& hat_v_k,
+              vector_type& x)
+{
+  m_k     = beta_1 * m_k + (1 - beta_1) * grad;
+  v_k     = beta_2 * v_k + (1 - beta_2) * grad * grad;
+  hat_m_k = (1 / (1 - std::pow(beta_1, k))) * m_k;
+  hat_v_k = (1 / (1 - std::pow(beta_2, k))) * v_k;
+  x       = x - alpha * hat_m_k / (sqrt(hat_v_k) + internal_epsilon);
+}
+
+template <typename STEP>
+void
+report(const std::string& version,
+       const size_t n,
+       const size_t iterations,
+       const size_t modeled_bytes_per_component,
+       STEP&& step)
+{
+  step(1);  // warm up
+
+  const size_t allocation_count_before = allocation_count;
+  const auto start                     = std::chrono::steady_clock::now();
+
+  for (size_t k = 2; k < iterations + 2; ++k)
+  {
+    step(k);
+  }
+
+  const auto stop = std::chrono::steady_clock::now();
+  const double ns_per_iteration =
+      std::chrono::duration<double, std::nano>(stop - start).count() / iterations;
+  const double bytes_per_iteration = double(modeled_bytes_per_component * n);
+
+  std::cout << n << "," << version << "," << ns_per_iteration << "," << bytes_per_iteration << ","
+            << bytes_per_iteration / ns_per_iteration << ","
+            << double(allocation_count - allocation_count_before) / iterations << std::endl;
+}
+
+int
+main(int argc, char* argv[])
+{
+  const size_t max_n = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+  const Simd_Instruction_Set best_instruction_set = simd_instruction_set();
+
+  std::cout << "dimension,version,ns_per_iteration,modeled_bytes_per_iteration,GB_per_s,"
+               "allocations_per_iteration"
+            << std::endl;
+
+  for (size_t n = 10; n <= max_n; n *= 10)
+  {
+    const size_t iterations = std::max<size_t>(10, 100000000 / (n * 10));
+
+    vector_type grad(n);
+    for (size_t i = 0; i < n; ++i) grad[i] = std::cos(double(i));
+
+    {
+      vector_type m_k(0., n), hat_m_k(n), v_k(0., n), hat_v_k(n), x(1., n);
+
+      // reads + writes: m (3), v (3), hat_m (2), hat_v (2), x (4)
+      report("valarray", n, iterations, 14 * sizeof(double), [&](const size_t k) {
+        valarray_step(k, grad, m_k, hat_m_k, v_k, hat_v_k, x);
+      });
+    }
+    for (const auto instruction_set : {Simd_Instruction_Set::Scalar, best_instruction_set})
+    {
+      set_simd_instruction_set(instruction_set);
+
+      vector_type m_k(0., n), v_k(0., n), x(1., n);
+      Adam_Step_Scalars<double> scalars(beta_1, beta_2, internal_epsilon);
+
+      const std::string version = std::string("fused_") + to_string(instruction_set);
+
+      // reads: grad, m, v, x + writes: m, v, x
+      report(version, n, iterations, 7 * sizeof(double), [&](const size_t) {
+        scalars.next_iteration(alpha);
+        Adam_step_kernel(
+            scalars, n, std::begin(grad), std::begin(m_k), std::begin(v_k), std::begin(x));
+      });
+
+      std::vector<float> grad_float(std::begin(grad), std::end(grad)), x_float(n, 1.f);
+      std::vector<bfloat16> m_k_bfloat16(n, bfloat16(0)), v_k_bfloat16(n, bfloat16(0));
+      scalars = Adam_Step_Scalars<double>(beta_1, beta_2, internal_epsilon);
+
+      const std::string mixed_version = std::string("mixed_f32_bf16_") + to_string(instruction_set);
+
+      // reads: grad, m, v, x + writes: m, v, x
+      report(mixed_version,
+             n,
+             iterations,
+             2 * sizeof(float) + 4 * sizeof(bfloat16) + sizeof(float),
+             [&](const size_t) {
+               scalars.next_iteration(alpha);
+               Adam_mixed_step_kernel(scalars,
+                                      n,
+                                      grad_float.data(),
+                                      m_k_bfloat16.data(),
+                                      v_k_bfloat16.data(),
+                                      x_float.data());
+             });
+
+      if (instruction_set == best_instruction_set) break;
+    }
+    set_simd_instruction_set(best_instruction_set);
+  }
+}
@@ -0,0 +1,452 @@
+// Benchmark suite, for regression tracking across releases:
+//
+// - call cost: raw lambda, Static_Function, Function::f and
+//   Differentiable_Function::f_df, with and without counters
+// - Adam_optimize time per iteration versus dimension, quadratic and
+//   chained Rosenbrock objectives
+// - Newton / Steffensen throughput, scalar (type-erased and static)
+//   and batched
+//
+// Usage: bench_suite [--csv|--json] [--max-dimension=N] [--min-time=seconds]
+//
+// Output (stdout): one record per measure, benchmark, variant,
+// parameter (dimension, 0 if none), repetitions, ns per operation
+//
+#include "Adam.hpp"
+#include "functions.hpp"
+#include "root_1D.hpp"
+#include "static_functions.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using namespace Optimize;
+
+// Keeps value alive without extra cost
+//
+template <typename T>
+inline void
+do_not_optimize(const T& value)
+{
+#if defined(__GNUC__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile T sink;
+  sink = value;
+#endif
+}
+
+////////////
+// Report //
+////////////
+//
+struct Bench_Result
+{
+  std::string benchmark;
+  std::string variant;
+  size_t parameter;
+  size_t repetitions;
+  double ns_per_operation;
+};
+
+class Bench_Report
+{
+  std::vector<Bench_Result> _results;
+
+ public:
+  void
+  add(const Bench_Result& result)
+  {
+    _results.push_back(result);
+
+    // progress
+    std::cerr << result.benchmark << " " << result.variant << " " << result.parameter << ": "
+              << result.ns_per_operation << " ns" << std::endl;
+  }
+
+  void
+  print_csv(std::ostream& out) const
+  {
+    out << "benchmark,variant,parameter,repetitions,ns_per_operation" << std::endl;
+    for (const auto& result : _results)
+    {
+      out << result.benchmark << "," << result.variant << "," << result.parameter << ","
+          << result.repetitions << "," << result.ns_per_operation << std::endl;
+    }
+  }
+
+  void
+  print_json(std::ostream& out) const
+  {
+    out << "{" << std::endl;
+    out << "  \"context\": {\"compiler\": \"" << __VERSION__ << "\", \"simd\": \""
+        << to_string(simd_instruction_set()) << "\"}," << std::endl;
+    out << "  \"benchmarks\": [" << std::endl;
+    for (size_t i = 0; i < _results.size(); ++i)
+    {
+      const auto& result = _results[i];
+
+      out << "    {\"benchmark\": \"" << result.benchmark << "\", \"variant\": \""
+          << result.variant << "\", \"parameter\": " << result.parameter
+          << ", \"repetitions\": " << result.repetitions
+          << ", \"ns_per_operation\": " << result.ns_per_operation << "}"
+          << ((i + 1 < _results.size()) ? "," : "") << std::endl;
+    }
+    out << "  ]" << std::endl;
+    out << "}" << std::endl;
+  }
+};
+
+/////////////
+// measure //
+/////////////
+//
+// run(repetitions) performs repetitions operations (or returns the
+// number of operations actually performed), the repetition count
+// grows until the run lasts at least min_time seconds
+//
+template <typename RUN>
+Bench_Result
+measure(const std::string& benchmark,
+        const std::string& variant,
+        const size_t parameter,
+        const double min_time,
+        RUN&& run)
+{
+  size_t repetitions = 1;
+  for (;;)
+  {
+    size_t operations = repetitions;
+
+    const auto start = std::chrono::steady_clock::now();
+    if constexpr (std::is_void_v<std::invoke_result_t<RUN&, size_t>>)
+    {
+      run(repetitions);
+    }
+    else
+    {
+      operations = std::max<size_t>(1, run(repetitions));
+    }
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if ((seconds >= min_time) or (repetitions >= (size_t(1) << 40)))
+    {
+      return {benchmark, variant, parameter, operations, 1e9 * seconds / operations};
+    }
+    // aims 1.5 min_time at next run
+    const double scale = (seconds > 0) ? std::min(1.5 * min_time / seconds, 1000.) : 1000.;
+    repetitions        = std::max(repetitions + 1, size_t(double(repetitions) * scale));
+  }
+}
+
+///////////////
+// Call cost //
+///////////////
+//
+void
+square_root(const double& x, double* f, double* df, double c)
+{
+  if (f) *f = x * x - c;
+  if (df) *df = 2 * x;
+}
+
+template <typename F>
+void
+bench_f(Bench_Report& report, const std::string& variant, const double min_time, const F& f)
+{
+  report.add(measure("call_f", variant, 0, min_time, [&](const size_t repetitions) {
+    double sum = 0;
+    for (size_t i = 0; i < repetitions; ++i)
+    {
+      double y;
+      f(1 + 1e-9 * double(i), y);
+      sum += y;
+    }
+    do_not_optimize(sum);
+  }));
+}
+
+template <typename F>
+void
+bench_f_df(Bench_Report& report, const std::string& variant, const double min_time, const F& f)
+{
+  report.add(measure("call_f_df", variant, 0, min_time, [&](const size_t repetitions) {
+    double sum = 0;
+    for (size_t i = 0; i < repetitions; ++i)
+    {
+      double y, df;
+      f(1 + 1e-9 * double(i), y, df);
+      sum += y + df;
+    }
+    do_not_optimize(sum);
+  }));
+}
+
+void
+bench_call_cost(Bench_Report& report, const double min_time)
+{
+  auto lambda = [](const double& x, double& y) { square_root(x, &y, nullptr, 2); };
+
+  bench_f(report, "raw_lambda", min_time, lambda);
+
+  auto f_static = static_function<double, double>(lambda);
+  bench_f(report, "Static_Function", min_time, [&](const double& x, double& y) {
+    f_static.f(x, y);
+  });
+
+  const std::pair<const char*, Counter_Policy> policies[] = {
+      {"none", Counter_Policy::None},
+      {"plain", Counter_Policy::Plain},
+      {"relaxed_atomic", Counter_Policy::Relaxed_Atomic},
+      {"sharded", Counter_Policy::Sharded}};
+
+  Function<double, double> f(lambda);
+  auto call_f = [&](const double& x, double& y) { f.f(x, y); };
+
+  bench_f(report, "Function/counter_off", min_time, call_f);
+  for (const auto& [name, policy] : policies)
+  {
+    f.initialize_counter(policy);
+    bench_f(report, std::string("Function/counter_") + name, min_time, call_f);
+  }
+
+  auto raw_f_df = [](const double& x, double& y, double& df) { square_root(x, &y, &df, 2); };
+  bench_f_df(report, "raw_lambda", min_time, raw_f_df);
+
+  Differentiable_Function<double, double, double> df(square_root, 2);
+  auto call_f_df = [&](const double& x, double& y, double& d) { df.f_df(x, y, d); };
+
+  bench_f_df(report, "Differentiable_Function/counter_off", min_time, call_f_df);
+  for (const auto& [name, policy] : policies)
+  {
+    df.initialize_counter(policy);
+    bench_f_df(report, std::string("Differentiable_Function/counter_") + name, min_time, call_f_df);
+  }
+}
+
+//////////
+// Adam //
+//////////
+//
+using vector_type = std::vector<double>;
+
+// sum a_i x_i^2 / 2, a_i in [1, 10]
+void
+quadratic(const vector_type& x, double* f, vector_type* df)
+{
+  const size_t n = x.size();
+
+  if (f) *f = 0;
+  for (size_t i = 0; i < n; ++i)
+  {
+    const double a_i = 1 + double(i % 10);
+
+    if (f) *f += 0.5 * a_i * x[i] * x[i];
+    if (df) (*df)[i] = a_i * x[i];
+  }
+}
+
+// sum 100 (x_{i+1} - x_i^2)^2 + (1 - x_i)^2
+void
+chained_Rosenbrock(const vector_type& x, double* f, vector_type* df)
+{
+  const size_t n = x.size();
+
+  if (f) *f = 0;
+  if (df) std::fill(df->begin(), df->end(), 0.);
+  for (size_t i = 0; i + 1 < n; ++i)
+  {
+    const double a = x[i + 1] - x[i] * x[i];
+    const double b = 1 - x[i];
+
+    if (f) *f += 100 * a * a + b * b;
+    if (df)
+    {
+      (*df)[i] += -400 * a * x[i] - 2 * b;
+      (*df)[i + 1] += 200 * a;
+    }
+  }
+}
+
+void
+bench_Adam(Bench_Report& report, const double min_time, const size_t max_dimension)
+{
+  const std::pair<const char*, Differentiable_Function<vector_type, double, vector_type>>
+      objectives[] = {{"quadratic", {quadratic}}, {"chained_Rosenbrock", {chained_Rosenbrock}}};
+
+  for (const auto& [name, objective] : objectives)
+  {
+    for (size_t n = 10; n <= max_dimension; n *= 10)
+    {
+      // repetitions: Adam iterations, the steps actually done are
+      // reported (the gradient norm can underflow to 0)
+      Adam_Solver solver(make_Adam_configuration<double>(_absolute_epsilon_ = 1e-300));
+
+      vector_type x(n), grad(n);
+      double y;
+
+      report.add(measure("Adam_iteration", name, n, min_time, [&](const size_t repetitions) {
+        std::fill(x.begin(), x.end(), 0.5);
+        solver.configuration().maximimum_iterations = repetitions + 1;
+        solver.optimize(objective, x, y, grad);
+        do_not_optimize(x[0]);
+
+        return solver.workspace().step_count();
+      }));
+    }
+  }
+}
+
+/////////////
+// Root 1D //
+/////////////
+//
+// sqrt(c) for c = 1, 2... one operation is one equation
+//
+void
+bench_root_1D(Bench_Report& report, const double min_time)
+{
+  double c = 0;
+  auto g   = [&c](const double& x, double* f, double* df) { square_root(x, f, df, c); };
+
+  Differentiable_Function<double, double, double> f_erased(g);
+  auto f_static = static_differentiable_function<double, double, double>(g);
+
+  auto scalar_run = [&](const auto& solver) {
+    return [&, solver](const size_t repetitions) {
+      double sum = 0;
+      for (size_t i = 0; i < repetitions; ++i)
+      {
+        c        = 1 + double(i % 1000000);
+        double x = 1 + c / 2;
+        solver(x);
+        sum += x;
+      }
+      do_not_optimize(sum);
+    };
+  };
+
+  report.add(measure("Newton",
+                     "Differentiable_Function",
+                     0,
+                     min_time,
+                     scalar_run([&](double& x) { Newton(f_erased, x, 1e-10, 100); })));
+  report.add(measure("Newton",
+                     "Static_Differentiable_Function",
+                     0,
+                     min_time,
+                     scalar_run([&](double& x) { Newton(f_static, x, 1e-10, 100); })));
+
+  Function<double, double> f_erased_f(f_erased);
+
+  report.add(measure("Steffensen",
+                     "Function",
+                     0,
+                     min_time,
+                     scalar_run([&](double& x) { Steffensen(f_erased_f, x, 1e-10, 100); })));
+  report.add(measure("Steffensen",
+                     "Static_Function",
+                     0,
+                     min_time,
+                     scalar_run([&](double& x) { Steffensen(f_static, x, 1e-10, 100); })));
+
+  // Batched, one block of points per call
+  auto c_of = [](const size_t i) { return 1 + double(i % 1000000); };
+  std::vector<double> x_batch;
+
+  auto batch_run = [&](const auto& solver) {
+    return [&, solver](const size_t repetitions) {
+      x_batch.resize(repetitions);
+      for (size_t i = 0; i < repetitions; ++i) x_batch[i] = 1 + c_of(i) / 2;
+      solver(Span<double>(x_batch));
+      do_not_optimize(x_batch[0]);
+    };
+  };
+
+  report.add(measure("Newton", "batch", 0, min_time, batch_run([&](Span<double> x) {
+                       Newton_batch(
+                           [&](const size_t first,
+                               Span<const double> x,
+                               Span<double> f,
+                               Span<double> df) {
+                             for (size_t i = 0; i < x.size(); ++i)
+                             {
+                               square_root(x[i], &f[i], &df[i], c_of(first + i));
+                             }
+                           },
+                           x,
+                           {},
+                           1e-10,
+                           100);
+                     })));
+  report.add(measure("Steffensen", "batch", 0, min_time, batch_run([&](Span<double> x) {
+                       Steffensen_batch(
+                           [&](const size_t first, Span<const double> x, Span<double> f) {
+                             for (size_t i = 0; i < x.size(); ++i)
+                             {
+                               square_root(x[i], &f[i], nullptr, c_of(first + i));
+                             }
+                           },
+                           x,
+                           {},
+                           1e-10,
+                           100);
+                     })));
+}
+
+int
+main(int argc, char* argv[])
+{
+  bool json            = false;
+  size_t max_dimension = 1000000;
+  double min_time      = 0.2;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (std::strcmp(argv[i], "--json") == 0)
+    {
+      json = true;
+    }
+    else if (std::strcmp(argv[i], "--csv") == 0)
+    {
+      json = false;
+    }
+    else if (std::strncmp(argv[i], "--max-dimension=", 16) == 0)
+    {
+      max_dimension = size_t(std::strtod(argv[i] + 16, nullptr));
+    }
+    else if (std::strncmp(argv[i], "--min-time=", 11) == 0)
+    {
+      min_time = std::strtod(argv[i] + 11, nullptr);
+    }
+    else
+    {
+      std::cerr << "Usage: " << argv[0]
+                << " [--csv|--json] [--max-dimension=N] [--min-time=seconds]" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  Bench_Report report;
+
+  bench_call_cost(report, min_time);
+  bench_Adam(report, min_time, max_dimension);
+  bench_root_1D(report, min_time);
+
+  if (json)
+  {
+    report.print_json(std::cout);
+  }
+  else
+  {
+    report.print_csv(std::cout);
+  }
+  return EXIT_SUCCESS;
+}
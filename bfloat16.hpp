@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// bfloat16: the upper half of an IEEE float (same exponent range, 8
+// bits of precision), a storage type halving the memory traffic of
+// float vectors (Adam moments...). Arithmetic is done in float:
+//
+//   bfloat16 b(x);   // round to nearest even
+//   float y = b;     // exact
+//
+// See Adam_mixed_kernel.hpp for the SIMD conversions, bitwise
+// identical to these ones.
+
+//////////////
+// bfloat16 //
+//////////////
+//
+struct bfloat16
+{
+  std::uint16_t bits;
+
+  bfloat16() = default;
+
+  explicit bfloat16(const float x) : bits{from_float(x)} {}
+
+  operator float() const
+  {
+    const std::uint32_t u = std::uint32_t(bits) << 16;
+
+    float x;
+    std::memcpy(&x, &u, sizeof(x));
+    return x;
+  }
+
+  static std::uint16_t
+  from_float(const float x)
+  {
+    std::uint32_t u;
+    std::memcpy(&u, &x, sizeof(u));
+
+    // NaN: truncated, kept quiet (the rounding could overflow it)
+    if ((u & 0x7FFFFFFFu) > 0x7F800000u) return std::uint16_t((u >> 16) | 0x0040u);
+
+    return std::uint16_t((u + 0x7FFFu + ((u >> 16) & 1u)) >> 16);
+  }
+};
+
+static_assert(sizeof(bfloat16) == 2);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+
+// Assumed cache line size, used to pad data shared between threads
+// (std::hardware_destructive_interference_size is not reliably
+// available)
+//
+static constexpr size_t cache_line_size = 64;
+
+// One value per cache line
+//
+template <typename T>
+struct alignas(cache_line_size) Cache_Padded
+{
+  T value;
+};
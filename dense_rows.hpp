@@ -0,0 +1,436 @@
+#pragma once
+
+#include "cache_line.hpp"
+#include "functions.hpp"
+#include "span.hpp"
+#include "sum_of_terms.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) or defined(__APPLE__)
+#define MATH_FUNCTIONS_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Objectives whose data is a dense row-major binary matrix stored on
+// disk (raw float or double values, after an optional header). Rows
+// are read on demand instead of being loaded in memory first.
+//
+// Data sources:
+//
+// - Mapped_Matrix<T>: memory-mapped file (POSIX), random access to
+//   the rows, required by mini-batch objectives
+//
+// - Row_Block_Reader<T>: sequential reading of blocks of rows, given
+//   a Thread_Pool the next block is read while the current one is
+//   processed (when mmap is not available)
+//
+// Usage:
+//
+//   auto matrix = std::make_shared<const Mapped_Matrix<float>>("train.bin", column_count);
+//
+//   // row_loss *adds* the term of this row to *y and *df (not null if requested)
+//   auto row_loss = [](const std::valarray<double>& x, Span<const float> row,
+//                      double* y, std::valarray<double>* df) { ... };
+//
+//   auto whole     = dense_rows_objective<std::valarray<double>, double, std::valarray<double>>(
+//                        matrix, row_loss);
+//   auto minibatch = dense_rows_sum_of_terms<std::valarray<double>, double, std::valarray<double>>(
+//                        matrix, row_loss);
+//
+// Objectives return the average over the rows. DIFFERENTIAL_TYPE must
+// support df = 0 and df /= scalar (scalars, std::valarray), df is
+// expected to be already sized.
+
+namespace Dense_Rows_Detail
+{
+  // 1MB blocks (at least one row)
+  template <typename T>
+  size_t
+  default_block_rows(const size_t column_count)
+  {
+    return std::max<size_t>(1, (size_t(1) << 20) / (sizeof(T) * std::max<size_t>(1, column_count)));
+  }
+
+  // Hints the first cache lines of a row
+  template <typename T>
+  inline void
+  prefetch_row(const T* const row, const size_t column_count)
+  {
+#if defined(__GNUC__) or defined(__clang__)
+    constexpr size_t max_prefetched_bytes = 16 * cache_line_size;
+
+    const size_t bytes = std::min(column_count * sizeof(T), max_prefetched_bytes);
+    const char* p      = reinterpret_cast<const char*>(row);
+    for (size_t offset = 0; offset < bytes; offset += cache_line_size)
+    {
+      __builtin_prefetch(p + offset, 0 /* read */, 1 /* low temporal locality */);
+    }
+#else
+    (void)row;
+    (void)column_count;
+#endif
+  }
+}
+
+#if defined(MATH_FUNCTIONS_HAS_MMAP)
+///////////////////
+// Mapped_Matrix //
+///////////////////
+//
+// Read-only mapping, the row count is deduced from the file size
+//
+template <typename T>
+class Mapped_Matrix
+{
+ public:
+  using value_type = T;
+
+ protected:
+  const void* _mapping = nullptr;
+  size_t _mapping_size = 0;
+  const T* _data       = nullptr;
+  size_t _row_count    = 0;
+  size_t _column_count = 0;
+  size_t _block_rows   = 0;
+
+ public:
+  Mapped_Matrix(const std::string& path, const size_t column_count, const size_t header_bytes = 0)
+      : _column_count{column_count},
+        _block_rows{Dense_Rows_Detail::default_block_rows<T>(column_count)}
+  {
+    assert(column_count > 0);
+    assert(header_bytes % alignof(T) == 0);
+
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "open " + path);
+
+    struct stat file_status;
+    if (::fstat(fd, &file_status) != 0)
+    {
+      const int error = errno;
+      ::close(fd);
+      throw std::system_error(error, std::generic_category(), "fstat " + path);
+    }
+    _mapping_size = size_t(file_status.st_size);
+
+    if (_mapping_size < header_bytes)
+    {
+      ::close(fd);
+      throw std::runtime_error(path + ": file smaller than its header");
+    }
+    _row_count = (_mapping_size - header_bytes) / (sizeof(T) * column_count);
+
+    if (_mapping_size > 0)
+    {
+      void* const mapping = ::mmap(nullptr, _mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (mapping == MAP_FAILED)
+      {
+        const int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "mmap " + path);
+      }
+      _mapping = mapping;
+      _data    = reinterpret_cast<const T*>(static_cast<const char*>(_mapping) + header_bytes);
+    }
+    ::close(fd);  // the mapping stays valid
+  }
+
+  Mapped_Matrix(const Mapped_Matrix&) = delete;
+  Mapped_Matrix& operator=(const Mapped_Matrix&) = delete;
+
+  ~Mapped_Matrix()
+  {
+    if (_mapping) ::munmap(const_cast<void*>(_mapping), _mapping_size);
+  }
+
+  size_t
+  row_count() const
+  {
+    return _row_count;
+  }
+  size_t
+  column_count() const
+  {
+    return _column_count;
+  }
+
+  Span<const T>
+  row(const size_t i) const
+  {
+    assert(i < _row_count);
+    return {_data + i * _column_count, _column_count};
+  }
+
+  // Asks the kernel to read ahead these rows
+  void
+  will_need(const size_t row_begin, const size_t row_end) const
+  {
+    assert(row_begin <= row_end and row_end <= _row_count);
+
+    if (row_begin == row_end) return;
+
+    // madvise() wants page aligned addresses
+    const size_t page_size = size_t(::sysconf(_SC_PAGESIZE));
+    const char* const base = static_cast<const char*>(_mapping);
+    const char* begin      = reinterpret_cast<const char*>(_data + row_begin * _column_count);
+    const char* const end  = reinterpret_cast<const char*>(_data + row_end * _column_count);
+    begin                  = base + ((begin - base) / page_size) * page_size;
+
+    ::madvise(const_cast<char*>(begin), size_t(end - begin), MADV_WILLNEED);
+  }
+
+  // Calls f(first_row, const T* rows, row_count) for consecutive
+  // blocks of [row_begin, row_end[, the next block is prefetched
+  template <typename F>
+  void
+  for_each_block(const size_t row_begin, const size_t row_end, F&& f) const
+  {
+    assert(row_begin <= row_end and row_end <= _row_count);
+
+    for (size_t first = row_begin; first < row_end; first += _block_rows)
+    {
+      const size_t count = std::min(_block_rows, row_end - first);
+      const size_t next  = first + count;
+
+      will_need(next, std::min(next + _block_rows, row_end));
+
+      f(first, _data + first * _column_count, count);
+    }
+  }
+};
+#endif
+
+//////////////////////
+// Row_Block_Reader //
+//////////////////////
+//
+// Plain file reads, two buffers: the next block is read by a task of
+// thread_pool while the current one is processed (nullptr: one after
+// the other). Each for_each_block() call opens its own stream, hence
+// concurrent passes are allowed.
+//
+template <typename T>
+class Row_Block_Reader
+{
+ public:
+  using value_type = T;
+
+ protected:
+  std::string _path;
+  size_t _header_bytes;
+  size_t _row_count;
+  size_t _column_count;
+  size_t _block_rows;
+  Thread_Pool* _thread_pool;
+
+ public:
+  Row_Block_Reader(const std::string& path,
+                   const size_t column_count,
+                   const size_t header_bytes      = 0,
+                   const size_t block_rows        = 0,
+                   Thread_Pool* const thread_pool = nullptr)
+      : _path{path},
+        _header_bytes{header_bytes},
+        _row_count{0},
+        _column_count{column_count},
+        _block_rows{(block_rows > 0) ? block_rows
+                                     : Dense_Rows_Detail::default_block_rows<T>(column_count)},
+        _thread_pool{thread_pool}
+  {
+    assert(column_count > 0);
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (not file) throw std::runtime_error("cannot open " + path);
+
+    const size_t file_size = size_t(file.tellg());
+    if (file_size < header_bytes) throw std::runtime_error(path + ": file smaller than its header");
+
+    _row_count = (file_size - header_bytes) / (sizeof(T) * column_count);
+  }
+
+  size_t
+  row_count() const
+  {
+    return _row_count;
+  }
+  size_t
+  column_count() const
+  {
+    return _column_count;
+  }
+
+  // Calls f(first_row, const T* rows, row_count) for consecutive
+  // blocks of [row_begin, row_end[
+  template <typename F>
+  void
+  for_each_block(const size_t row_begin, const size_t row_end, F&& f) const
+  {
+    assert(row_begin <= row_end and row_end <= _row_count);
+
+    if (row_begin == row_end) return;
+
+    std::ifstream file(_path, std::ios::binary);
+    if (not file) throw std::runtime_error("cannot open " + _path);
+
+    const size_t row_bytes = _column_count * sizeof(T);
+    std::vector<T> buffers[2]{std::vector<T>(_block_rows * _column_count),
+                              std::vector<T>(_block_rows * _column_count)};
+
+    auto read = [&](const size_t buffer, const size_t first, const size_t count) {
+      file.seekg(std::streamoff(_header_bytes + first * row_bytes));
+      file.read(reinterpret_cast<char*>(buffers[buffer].data()),
+                std::streamsize(count * row_bytes));
+      return bool(file);
+    };
+
+    size_t current = 0;
+    size_t first   = row_begin;
+    size_t count   = std::min(_block_rows, row_end - first);
+
+    if (not read(current, first, count)) throw std::runtime_error("read error " + _path);
+    while (count > 0)
+    {
+      const size_t next       = first + count;
+      const size_t next_count = std::min(_block_rows, row_end - next);
+
+      // Task 0 processes the current block, task 1 reads the next one
+      // (tasks must not throw: f exceptions are rethrown afterwards)
+      bool has_read = true;
+      std::exception_ptr exception;
+      parallel_for(_thread_pool, (next_count > 0) ? 2 : 1, [&](const size_t task) {
+        if (task == 1)
+        {
+          has_read = read(1 - current, next, next_count);
+          return;
+        }
+        try
+        {
+          f(first, static_cast<const T*>(buffers[current].data()), count);
+        }
+        catch (...)
+        {
+          exception = std::current_exception();
+        }
+      });
+      if (exception) std::rethrow_exception(exception);
+      if (not has_read) throw std::runtime_error("read error " + _path);
+
+      current = 1 - current;
+      first   = next;
+      count   = next_count;
+    }
+  }
+};
+
+//////////////////////////
+// dense_rows_objective //
+//////////////////////////
+//
+// Average of row_loss over the rows [row_begin, row_end[ of source
+// (Mapped_Matrix or Row_Block_Reader), row_end = 0 means all the rows
+//
+template <typename DOMAIN_TYPE,
+          typename CODOMAIN_TYPE,
+          typename DIFFERENTIAL_TYPE,
+          typename SOURCE,
+          typename ROW_LOSS>
+Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE>
+dense_rows_objective(const std::shared_ptr<const SOURCE>& source,
+                     ROW_LOSS row_loss,
+                     const size_t row_begin = 0,
+                     size_t row_end         = 0)
+{
+  using value_type = typename SOURCE::value_type;
+
+  assert(source);
+
+  if (row_end == 0) row_end = source->row_count();
+  assert(row_begin < row_end and row_end <= source->row_count());
+
+  return {[source, row_loss, row_begin, row_end](
+              const DOMAIN_TYPE& x, CODOMAIN_TYPE* y, DIFFERENTIAL_TYPE* df) {
+    if (y) *y = 0;
+    if (df) *df = 0;
+
+    const size_t column_count = source->column_count();
+
+    source->for_each_block(
+        row_begin, row_end, [&](const size_t, const value_type* rows, const size_t count) {
+          for (size_t i = 0; i < count; ++i)
+          {
+            row_loss(x, Span<const value_type>(rows + i * column_count, column_count), y, df);
+          }
+        });
+
+    const size_t row_count = row_end - row_begin;
+    if (y) *y /= CODOMAIN_TYPE(row_count);
+    if (df) *df /= CODOMAIN_TYPE(row_count);
+  }};
+}
+
+#if defined(MATH_FUNCTIONS_HAS_MMAP)
+/////////////////////////////
+// dense_rows_sum_of_terms //
+/////////////////////////////
+//
+// One term per row, for the mini-batch solvers. Rows are prefetched a
+// few indices ahead as mini-batches are not contiguous.
+//
+template <typename DOMAIN_TYPE,
+          typename CODOMAIN_TYPE,
+          typename DIFFERENTIAL_TYPE,
+          typename T,
+          typename ROW_LOSS>
+Sum_Of_Terms_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE>
+dense_rows_sum_of_terms(const std::shared_ptr<const Mapped_Matrix<T>>& matrix, ROW_LOSS row_loss)
+{
+  assert(matrix);
+
+  return {matrix->row_count(),
+          [matrix, row_loss](const DOMAIN_TYPE& x,
+                             Span<const size_t> indices,
+                             CODOMAIN_TYPE* y,
+                             DIFFERENTIAL_TYPE* df) {
+            constexpr size_t prefetch_distance = 4;
+
+            if (y) *y = 0;
+            if (df) *df = 0;
+
+            const size_t column_count = matrix->column_count();
+            const size_t n            = indices.size();
+
+            for (size_t i = 0; i < std::min(prefetch_distance, n); ++i)
+            {
+              Dense_Rows_Detail::prefetch_row(matrix->row(indices[i]).data(), column_count);
+            }
+            for (size_t i = 0; i < n; ++i)
+            {
+              if (i + prefetch_distance < n)
+              {
+                Dense_Rows_Detail::prefetch_row(matrix->row(indices[i + prefetch_distance]).data(),
+                                                column_count);
+              }
+              row_loss(x, matrix->row(indices[i]), y, df);
+            }
+
+            if (y) *y /= CODOMAIN_TYPE(n);
+            if (df) *df /= CODOMAIN_TYPE(n);
+          }};
+}
+#endif
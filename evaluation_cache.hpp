@@ -0,0 +1,373 @@
+#pragma once
+
+#include "evaluation_counter.hpp"
+#include "functions.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <valarray>
+#include <vector>
+
+// Memoization of the last evaluations.
+//
+// Usage:
+//
+//   auto statistics = std::make_shared<Evaluation_Cache_Statistics>();
+//   auto f_cached   = memoize(f, 4, statistics);
+//
+// f_cached.f(x, y) is served from a previous f(), f_df() at the same
+// x, f_cached.df(x, grad) from a previous df() or f_df(). The counter
+// of f counts the real evaluations, statistics the cache hits.
+
+//////////////////////
+// Cache_Key_Traits //
+//////////////////////
+//
+// How to hash and compare domain points. Specialize it for your own
+// domain types.
+//
+template <typename T, typename ENABLE = void>
+struct Cache_Key_Traits
+{
+  static size_t
+  hash(const T& x)
+  {
+    return std::hash<T>()(x);
+  }
+  static bool
+  equal(const T& x, const T& y)
+  {
+    return x == y;
+  }
+};
+
+// Scalars: bitwise, hence +0 != -0 and NaN == NaN (same bits)
+template <typename T>
+struct Cache_Key_Traits<T, std::enable_if_t<std::is_arithmetic_v<T>>>
+{
+  static size_t
+  hash(const T& x)
+  {
+    size_t h = 0;
+    std::memcpy(&h, &x, std::min(sizeof(T), sizeof(size_t)));
+    return std::hash<size_t>()(h);
+  }
+  static bool
+  equal(const T& x, const T& y)
+  {
+    return std::memcmp(&x, &y, sizeof(T)) == 0;
+  }
+};
+
+namespace Evaluation_Cache_Detail
+{
+  inline size_t
+  hash_combine(const size_t seed, const size_t h)
+  {
+    return seed ^ (h + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+  }
+
+  template <typename CONTAINER>
+  struct Container_Key_Traits
+  {
+    using value_traits = Cache_Key_Traits<std::decay_t<decltype(std::declval<CONTAINER>()[0])>>;
+
+    static size_t
+    hash(const CONTAINER& x)
+    {
+      size_t h = x.size();
+      for (size_t i = 0; i < x.size(); ++i)
+      {
+        h = hash_combine(h, value_traits::hash(x[i]));
+      }
+      return h;
+    }
+    static bool
+    equal(const CONTAINER& x, const CONTAINER& y)
+    {
+      if (x.size() != y.size()) return false;
+      for (size_t i = 0; i < x.size(); ++i)
+      {
+        if (not value_traits::equal(x[i], y[i])) return false;
+      }
+      return true;
+    }
+  };
+}
+
+template <typename T>
+struct Cache_Key_Traits<std::valarray<T>>
+    : public Evaluation_Cache_Detail::Container_Key_Traits<std::valarray<T>>
+{
+};
+
+template <typename T, typename ALLOCATOR>
+struct Cache_Key_Traits<std::vector<T, ALLOCATOR>>
+    : public Evaluation_Cache_Detail::Container_Key_Traits<std::vector<T, ALLOCATOR>>
+{
+};
+
+/////////////////////////////////
+// Evaluation_Cache_Statistics //
+/////////////////////////////////
+//
+struct Evaluation_Cache_Statistics
+{
+  Evaluation_Counter f_hit{Counter_Policy::Relaxed_Atomic};
+  Evaluation_Counter f_miss{Counter_Policy::Relaxed_Atomic};
+  Evaluation_Counter df_hit{Counter_Policy::Relaxed_Atomic};
+  Evaluation_Counter df_miss{Counter_Policy::Relaxed_Atomic};
+};
+
+inline std::ostream&
+operator<<(std::ostream& out, const Evaluation_Cache_Statistics& to_print)
+{
+  out << "cache f  hit/miss: " << to_print.f_hit.value() << "/" << to_print.f_miss.value()
+      << std::endl;
+  out << "cache df hit/miss: " << to_print.df_hit.value() << "/" << to_print.df_miss.value()
+      << std::endl;
+  return out;
+}
+
+//////////////////////
+// Evaluation_Cache //
+//////////////////////
+//
+// The last K evaluated points (K small, lookup is linear on stored
+// hashes), thread-safe
+//
+template <typename DOMAIN_TYPE,
+          typename CODOMAIN_TYPE,
+          typename DIFFERENTIAL_TYPE,
+          typename KEY_TRAITS = Cache_Key_Traits<DOMAIN_TYPE>>
+class Evaluation_Cache
+{
+  struct Entry
+  {
+    size_t hash;
+    DOMAIN_TYPE x;
+    bool has_y  = false;
+    bool has_df = false;
+    CODOMAIN_TYPE y;
+    DIFFERENTIAL_TYPE df;
+  };
+
+  mutable std::mutex _mutex;
+  std::vector<Entry> _entries;
+  size_t _capacity;
+  size_t _oldest;  // next to be replaced when full
+
+  Entry*
+  find(const size_t hash, const DOMAIN_TYPE& x)
+  {
+    for (auto& entry : _entries)
+    {
+      if ((entry.hash == hash) and KEY_TRAITS::equal(entry.x, x)) return &entry;
+    }
+    return nullptr;
+  }
+
+  Entry&
+  find_or_insert(const size_t hash, const DOMAIN_TYPE& x)
+  {
+    Entry* entry = find(hash, x);
+    if (entry) return *entry;
+
+    if (_entries.size() < _capacity)
+    {
+      _entries.push_back(Entry{hash, x, false, false, CODOMAIN_TYPE(), DIFFERENTIAL_TYPE()});
+      return _entries.back();
+    }
+
+    Entry& replaced = _entries[_oldest];
+    _oldest         = (_oldest + 1) % _capacity;
+
+    replaced.hash   = hash;
+    replaced.x      = x;
+    replaced.has_y  = false;
+    replaced.has_df = false;
+    return replaced;
+  }
+
+ public:
+  explicit Evaluation_Cache(const size_t capacity) : _capacity{capacity}, _oldest{0}
+  {
+    assert(capacity > 0);
+    _entries.reserve(capacity);
+  }
+
+  static size_t
+  hash(const DOMAIN_TYPE& x)
+  {
+    return KEY_TRAITS::hash(x);
+  }
+
+  // Returns true and fills y/df if cached, a null argument is not
+  // requested
+  bool
+  lookup(const size_t hash, const DOMAIN_TYPE& x, CODOMAIN_TYPE* y, DIFFERENTIAL_TYPE* df)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const Entry* entry = find(hash, x);
+    if ((not entry) or (y and not entry->has_y) or (df and not entry->has_df)) return false;
+
+    if (y) *y = entry->y;
+    if (df) *df = entry->df;
+    return true;
+  }
+
+  void
+  store(const size_t hash,
+        const DOMAIN_TYPE& x,
+        const CODOMAIN_TYPE* y,
+        const DIFFERENTIAL_TYPE* df)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    Entry& entry = find_or_insert(hash, x);
+    if (y)
+    {
+      entry.y     = *y;
+      entry.has_y = true;
+    }
+    if (df)
+    {
+      entry.df     = *df;
+      entry.has_df = true;
+    }
+  }
+
+  void
+  clear()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.clear();
+    _oldest = 0;
+  }
+};
+
+/////////////
+// memoize //
+/////////////
+//
+template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE, typename STORAGE>
+Function<DOMAIN_TYPE, CODOMAIN_TYPE, STORAGE>
+memoize(const Function<DOMAIN_TYPE, CODOMAIN_TYPE, STORAGE>& func,
+        const size_t cache_size                                 = 1,
+        std::shared_ptr<Evaluation_Cache_Statistics> statistics = {})
+{
+  using function_type = Function<DOMAIN_TYPE, CODOMAIN_TYPE, STORAGE>;
+  // Differential type is unused, any default constructible type
+  using cache_type = Evaluation_Cache<DOMAIN_TYPE, CODOMAIN_TYPE, CODOMAIN_TYPE>;
+
+  if (not statistics) statistics = std::make_shared<Evaluation_Cache_Statistics>();
+
+  struct Impl final : public function_type::Interface
+  {
+    function_type _func;
+    mutable cache_type _cache;
+    std::shared_ptr<Evaluation_Cache_Statistics> _statistics;
+
+    Impl(const function_type& func,
+         const size_t cache_size,
+         const std::shared_ptr<Evaluation_Cache_Statistics>& statistics)
+        : _func(func), _cache(cache_size), _statistics(statistics)
+    {
+    }
+
+    void
+    f(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y) const
+    {
+      const size_t hash = cache_type::hash(x);
+      if (_cache.lookup(hash, x, &y, nullptr))
+      {
+        ++_statistics->f_hit;
+        return;
+      }
+      ++_statistics->f_miss;
+      _func.f(x, y);
+      _cache.store(hash, x, &y, nullptr);
+    }
+  };
+  return {std::make_shared<const Impl>(func, cache_size, statistics)};
+}
+
+template <typename DOMAIN_TYPE,
+          typename CODOMAIN_TYPE,
+          typename DIFFERENTIAL_TYPE,
+          typename STORAGE>
+Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE, STORAGE>
+memoize(
+    const Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE, STORAGE>& func,
+    const size_t cache_size                                 = 1,
+    std::shared_ptr<Evaluation_Cache_Statistics> statistics = {})
+{
+  using differentiable_function_type =
+      Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE, STORAGE>;
+  using cache_type = Evaluation_Cache<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE>;
+
+  if (not statistics) statistics = std::make_shared<Evaluation_Cache_Statistics>();
+
+  struct Impl final : public differentiable_function_type::Diff_Interface
+  {
+    differentiable_function_type _func;
+    mutable cache_type _cache;
+    std::shared_ptr<Evaluation_Cache_Statistics> _statistics;
+
+    Impl(const differentiable_function_type& func,
+         const size_t cache_size,
+         const std::shared_ptr<Evaluation_Cache_Statistics>& statistics)
+        : _func(func), _cache(cache_size), _statistics(statistics)
+    {
+    }
+
+    void
+    f(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y) const
+    {
+      const size_t hash = cache_type::hash(x);
+      if (_cache.lookup(hash, x, &y, nullptr))
+      {
+        ++_statistics->f_hit;
+        return;
+      }
+      ++_statistics->f_miss;
+      _func.f(x, y);
+      _cache.store(hash, x, &y, nullptr);
+    }
+    void
+    f_df(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y, DIFFERENTIAL_TYPE& df) const
+    {
+      const size_t hash = cache_type::hash(x);
+      if (_cache.lookup(hash, x, &y, &df))
+      {
+        ++_statistics->f_hit;
+        ++_statistics->df_hit;
+        return;
+      }
+      ++_statistics->f_miss;
+      ++_statistics->df_miss;
+      _func.f_df(x, y, df);
+      _cache.store(hash, x, &y, &df);
+    }
+    void
+    df(const DOMAIN_TYPE& x, DIFFERENTIAL_TYPE& df) const
+    {
+      const size_t hash = cache_type::hash(x);
+      if (_cache.lookup(hash, x, nullptr, &df))
+      {
+        ++_statistics->df_hit;
+        return;
+      }
+      ++_statistics->df_miss;
+      _func.df(x, df);
+      _cache.store(hash, x, nullptr, &df);
+    }
+  };
+  return {std::make_shared<const Impl>(func, cache_size, statistics)};
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "cache_line.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+
+////////////////////
+// Counter_Policy //
+////////////////////
+//
+// - None:           no counting, f_counter() returns 0
+// - Plain:          size_t, the fastest but NOT thread-safe
+// - Relaxed_Atomic: one relaxed std::atomic, thread-safe but all
+//                   threads contend on the same cache line
+// - Sharded:        one relaxed atomic per cache line and per thread
+//                   slot, aggregated when read
+//
+enum class Counter_Policy
+{
+  None,
+  Plain,
+  Relaxed_Atomic,
+  Sharded
+};
+
+////////////////////////
+// Evaluation_Counter //
+////////////////////////
+//
+class alignas(cache_line_size) Evaluation_Counter
+{
+ public:
+  // Number of shards, a power of 2
+  static constexpr size_t shard_count = 64;
+
+ protected:
+  struct alignas(cache_line_size) Shard
+  {
+    std::atomic<size_t> count{0};
+  };
+
+  Counter_Policy _policy;
+  size_t _plain_count;
+  std::atomic<size_t> _atomic_count;
+  std::unique_ptr<Shard[]> _shards;
+
+  // Each thread gets its own slot, assigned on first use
+  static size_t
+  thread_shard_index()
+  {
+    static std::atomic<size_t> next_index{0};
+    thread_local const size_t index =
+        next_index.fetch_add(1, std::memory_order_relaxed) & (shard_count - 1);
+    return index;
+  }
+
+ public:
+  explicit Evaluation_Counter(const Counter_Policy policy = Counter_Policy::Plain)
+      : _policy{policy}, _plain_count{0}, _atomic_count{0}
+  {
+    if (_policy == Counter_Policy::Sharded)
+    {
+      _shards.reset(new Shard[shard_count]);
+    }
+  }
+
+  Evaluation_Counter(const Evaluation_Counter&) = delete;
+  Evaluation_Counter& operator=(const Evaluation_Counter&) = delete;
+
+  Counter_Policy
+  policy() const
+  {
+    return _policy;
+  }
+
+  void
+  add(const size_t n)
+  {
+    switch (_policy)
+    {
+      case Counter_Policy::None:
+        break;
+      case Counter_Policy::Plain:
+        _plain_count += n;
+        break;
+      case Counter_Policy::Relaxed_Atomic:
+        _atomic_count.fetch_add(n, std::memory_order_relaxed);
+        break;
+      case Counter_Policy::Sharded:
+        _shards[thread_shard_index()].count.fetch_add(n, std::memory_order_relaxed);
+        break;
+    }
+  }
+
+  Evaluation_Counter&
+  operator++()
+  {
+    add(1);
+    return *this;
+  }
+  Evaluation_Counter&
+  operator+=(const size_t n)
+  {
+    add(n);
+    return *this;
+  }
+
+  // Aggregated count. With concurrent add() calls the returned value
+  // is a snapshot
+  size_t
+  value() const
+  {
+    switch (_policy)
+    {
+      case Counter_Policy::None:
+        return 0;
+      case Counter_Policy::Plain:
+        return _plain_count;
+      case Counter_Policy::Relaxed_Atomic:
+        return _atomic_count.load(std::memory_order_relaxed);
+      case Counter_Policy::Sharded:
+      {
+        size_t sum = 0;
+        for (size_t i = 0; i < shard_count; ++i)
+        {
+          sum += _shards[i].count.load(std::memory_order_relaxed);
+        }
+        return sum;
+      }
+    }
+    assert(0);
+    return 0;
+  }
+
+  // Not thread-safe
+  void
+  reset()
+  {
+    _plain_count = 0;
+    _atomic_count.store(0, std::memory_order_relaxed);
+    if (_shards)
+    {
+      for (size_t i = 0; i < shard_count; ++i)
+      {
+        _shards[i].count.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+};
+
+// Helper
+//
+inline std::shared_ptr<Evaluation_Counter>
+make_evaluation_counter(const Counter_Policy policy = Counter_Policy::Plain)
+{
+  return std::make_shared<Evaluation_Counter>(policy);
+}
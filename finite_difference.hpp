@@ -0,0 +1,232 @@
+#pragma once
+
+#include "async_function.hpp"
+#include "evaluation_cache.hpp"
+#include "functions.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <vector>
+
+// Differentiable_Function from a black-box Function<DOMAIN, CODOMAIN>,
+// the gradient being approximated by finite differences:
+//
+//   forward: df_i = (f(x + h_i e_i) - f(x)) / h_i                n + 1 evaluations
+//   central: df_i = (f(x + h_i e_i) - f(x - h_i e_i)) / (2 h_i)  2n evaluations
+//
+// with h_i = relative_step max(1, |x_i|).
+//
+// The perturbed evaluations are fanned out over thread_pool if given
+// (the counter of f must then be Relaxed_Atomic or Sharded; from a
+// task of the same pool, as in multistart(), they run inline), otherwise
+// they are grouped into f_batch() calls. f(x) is memoized, a df() at
+// the point of the last f() or f_df() does not evaluate it again.
+//
+// DOMAIN_TYPE: std::valarray<T>, std::vector<T>..., also used as
+// differential type
+
+enum class Finite_Difference_Scheme
+{
+  Forward,
+  Central
+};
+
+namespace Finite_Difference_Detail
+{
+  // Points per f_batch() call
+  static constexpr size_t batch_size = 64;
+
+  // Balances truncation and rounding errors
+  template <typename T>
+  T
+  default_relative_step(const Finite_Difference_Scheme scheme)
+  {
+    return (scheme == Finite_Difference_Scheme::Forward)
+               ? std::sqrt(std::numeric_limits<T>::epsilon())
+               : std::cbrt(std::numeric_limits<T>::epsilon());
+  }
+}
+
+///////////////////////
+// finite_difference //
+///////////////////////
+//
+// relative_step = 0: default, sqrt(epsilon) (forward) or cbrt(epsilon)
+// (central)
+//
+template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE, typename STORAGE>
+Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DOMAIN_TYPE, STORAGE>
+finite_difference(const Function<DOMAIN_TYPE, CODOMAIN_TYPE, STORAGE>& func,
+                  const Finite_Difference_Scheme scheme = Finite_Difference_Scheme::Central,
+                  Thread_Pool* const thread_pool        = nullptr,
+                  CODOMAIN_TYPE relative_step           = 0)
+{
+  using function_type = Function<DOMAIN_TYPE, CODOMAIN_TYPE, STORAGE>;
+  using differentiable_function_type =
+      Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DOMAIN_TYPE, STORAGE>;
+  using cache_type = Evaluation_Cache<DOMAIN_TYPE, CODOMAIN_TYPE, CODOMAIN_TYPE>;
+  using T          = CODOMAIN_TYPE;
+
+  if (relative_step == 0)
+  {
+    relative_step = Finite_Difference_Detail::default_relative_step<T>(scheme);
+  }
+  assert(relative_step > 0);
+
+  struct Impl final : public differentiable_function_type::Diff_Interface
+  {
+    function_type _func;
+    Finite_Difference_Scheme _scheme;
+    Thread_Pool* _thread_pool;
+    T _relative_step;
+    mutable cache_type _cache;
+
+    Impl(const function_type& func,
+         const Finite_Difference_Scheme scheme,
+         Thread_Pool* const thread_pool,
+         const T relative_step)
+        : _func(func),
+          _scheme(scheme),
+          _thread_pool(thread_pool),
+          _relative_step(relative_step),
+          _cache(1)
+    {
+    }
+
+    // Exactly representable step: (x + h) - x
+    T
+    step(const T x_i) const
+    {
+      const T h = _relative_step * std::max(T(1), std::abs(x_i));
+      return (x_i + h) - x_i;
+    }
+
+    // Perturbed point k of component i: x + h_i e_i (k = 0),
+    // x - h_i e_i (k = 1)
+    void
+    perturb(DOMAIN_TYPE& x_perturbed, const DOMAIN_TYPE& x, const size_t i, const size_t k) const
+    {
+      const T h      = step(x[i]);
+      x_perturbed[i] = (k == 0) ? x[i] + h : x[i] - h;
+    }
+
+    T
+    difference(const DOMAIN_TYPE& x, const size_t i, const T y, const T f_0, const T f_1) const
+    {
+      const T h = step(x[i]);
+      return (_scheme == Finite_Difference_Scheme::Forward) ? (f_0 - y) / h
+                                                            : (f_0 - f_1) / (2 * h);
+    }
+
+    // y: f(x), only used by the forward scheme
+    void
+    gradient(const DOMAIN_TYPE& x, const T y, DOMAIN_TYPE& df) const
+    {
+      const size_t n           = x.size();
+      const size_t point_count = (_scheme == Finite_Difference_Scheme::Forward) ? 1 : 2;
+
+      if (df.size() != n) df.resize(n);
+
+      if (_thread_pool)
+      {
+        // One perturbed copy per thread
+        std::vector<DOMAIN_TYPE> x_perturbed(_thread_pool->size(), x);
+
+        _thread_pool->parallel_for(n, [&](const size_t i, const size_t worker_index) {
+          DOMAIN_TYPE& x_i = x_perturbed[worker_index];
+
+          T f_k[2] = {T(0), T(0)};
+          for (size_t k = 0; k < point_count; ++k)
+          {
+            perturb(x_i, x, i, k);
+            _func.f(x_i, f_k[k]);
+          }
+          x_i[i] = x[i];
+
+          df[i] = difference(x, i, y, f_k[0], f_k[1]);
+        });
+        return;
+      }
+
+      // Batched: components [first, first + count[ at once
+      const size_t components_per_batch =
+          std::max<size_t>(1, Finite_Difference_Detail::batch_size / point_count);
+
+      std::vector<DOMAIN_TYPE> x_perturbed(std::min(n, components_per_batch) * point_count, x);
+      std::vector<T> f_perturbed(x_perturbed.size());
+
+      for (size_t first = 0; first < n; first += components_per_batch)
+      {
+        const size_t count = std::min(components_per_batch, n - first);
+
+        for (size_t j = 0; j < count; ++j)
+        {
+          for (size_t k = 0; k < point_count; ++k)
+          {
+            DOMAIN_TYPE& point = x_perturbed[j * point_count + k];
+
+            // Restores the component perturbed by the previous batch
+            if (first > 0)
+            {
+              const size_t previous = first - components_per_batch + j;
+              point[previous]       = x[previous];
+            }
+            perturb(point, x, first + j, k);
+          }
+        }
+
+        _func.f_batch(Span<const DOMAIN_TYPE>(x_perturbed.data(), count * point_count),
+                      Span<T>(f_perturbed.data(), count * point_count));
+
+        for (size_t j = 0; j < count; ++j)
+        {
+          const T f_0 = f_perturbed[j * point_count];
+          const T f_1 = (point_count == 2) ? f_perturbed[j * point_count + 1] : T(0);
+
+          df[first + j] = difference(x, first + j, y, f_0, f_1);
+        }
+      }
+    }
+
+    void
+    f(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y) const
+    {
+      const size_t hash = cache_type::hash(x);
+      if (_cache.lookup(hash, x, &y, nullptr)) return;
+
+      _func.f(x, y);
+      _cache.store(hash, x, &y, nullptr);
+    }
+    void
+    f_df(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y, DOMAIN_TYPE& df) const
+    {
+      f(x, y);
+      gradient(x, y, df);
+    }
+    void
+    df(const DOMAIN_TYPE& x, DOMAIN_TYPE& df) const
+    {
+      T y = T(0);
+      if (_scheme == Finite_Difference_Scheme::Forward) f(x, y);
+      gradient(x, y, df);
+    }
+  };
+  return {std::make_shared<const Impl>(func, scheme, thread_pool, relative_step)};
+}
+
+// Asynchronous objective: the perturbed points of each f_batch() call
+// (up to 64) are in flight at the same time
+//
+template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE>
+Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DOMAIN_TYPE>
+finite_difference(const Async_Function<DOMAIN_TYPE, CODOMAIN_TYPE>& func,
+                  const Finite_Difference_Scheme scheme = Finite_Difference_Scheme::Central,
+                  const CODOMAIN_TYPE relative_step     = 0)
+{
+  return finite_difference(func.as_function(), scheme, nullptr, relative_step);
+}
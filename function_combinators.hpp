@@ -0,0 +1,650 @@
+#pragma once
+
+#include "functions.hpp"
+#include "static_functions.hpp"
+#include "vector_traits.hpp"
+
+#include <cassert>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Objectives built from terms, fused into one function:
+//
+//   auto data_loss = static_differentiable_function<V, double, V>(loss);
+//   auto ridge     = accumulating_function<V, double, V>(
+//       [](const V& x, double* y, V* df, const double scale) {
+//         if (y) *y += scale * (x * x).sum();
+//         if (df) *df += (2 * scale) * x;
+//       });
+//
+//   auto objective = sum_function(data_loss, scaled_function(0.1, ridge));
+//
+//   Adam_optimize(configuration, objective.as_differentiable_function(), x, y, grad);
+//
+// The terms are stored by value and called directly (statically typed
+// terms are inlined), the type-erased version of the whole objective
+// costs one virtual call per evaluation.
+//
+// The gradients are accumulated into the output buffer: the first term
+// writes it, an accumulating_function() or combinator term adds to it
+// directly, any other term (Differentiable_Function,
+// Static_Differentiable_Function...) is evaluated into a scratch
+// buffer then added. The scratch buffers are thread-local and reused,
+// hence no allocation after the first evaluations.
+//
+// DIFFERENTIAL_TYPE: arithmetic or contiguous vector (Vector_Traits)
+
+namespace Function_Combinator_Detail
+{
+  // Bases of the types implementing
+  //
+  //   evaluate(x, y, df, scale, accumulate)
+  //
+  // y (df) null if not requested. accumulate: *y += scale f(x),
+  // *df += scale df(x), otherwise assignments.
+  struct Combinator_Tag
+  {
+  };
+
+  template <typename T>
+  static constexpr bool is_combinator_v = std::is_base_of_v<Combinator_Tag, T>;
+
+  // Thread-local stack of reused buffers, one level per nested
+  // evaluation
+  template <typename T>
+  class Scratch
+  {
+    static std::vector<std::unique_ptr<T>>&
+    pool()
+    {
+      thread_local std::vector<std::unique_ptr<T>> pool;
+      return pool;
+    }
+    static size_t&
+    depth()
+    {
+      thread_local size_t depth = 0;
+      return depth;
+    }
+
+    T* _value;
+
+   public:
+    Scratch()
+    {
+      auto& buffers = pool();
+      size_t& level = depth();
+
+      if (level == buffers.size()) buffers.push_back(std::make_unique<T>());
+      _value = buffers[level++].get();
+    }
+    Scratch(const Scratch&) = delete;
+    Scratch& operator=(const Scratch&) = delete;
+    ~Scratch() { --depth(); }
+
+    T&
+    operator*() const
+    {
+      return *_value;
+    }
+  };
+
+  ///////////////////////////
+  // Differential algebra //
+  ///////////////////////////
+  //
+  // df = 0, sized as x
+  template <typename DOMAIN_TYPE, typename DIFFERENTIAL_TYPE>
+  void
+  assign_zero(const DOMAIN_TYPE& x, DIFFERENTIAL_TYPE& df)
+  {
+    if constexpr (std::is_arithmetic_v<DIFFERENTIAL_TYPE>)
+    {
+      df = 0;
+    }
+    else
+    {
+      using traits = Vector_Traits<DIFFERENTIAL_TYPE>;
+      using scalar = typename traits::scalar_type;
+
+      const size_t n = Vector_Traits<DOMAIN_TYPE>::size(x);
+      traits::resize(df, n);
+
+      scalar* const p = traits::data(df);
+      for (size_t i = 0; i < n; ++i)
+      {
+        p[i] = scalar(0);
+      }
+    }
+  }
+
+  // df sized as x (values undefined), the repo convention for the
+  // differentials handed to a function
+  template <typename DOMAIN_TYPE, typename DIFFERENTIAL_TYPE>
+  void
+  resize_as(const DOMAIN_TYPE& x, DIFFERENTIAL_TYPE& df)
+  {
+    if constexpr (not std::is_arithmetic_v<DIFFERENTIAL_TYPE>)
+    {
+      Vector_Traits<DIFFERENTIAL_TYPE>::resize(df, Vector_Traits<DOMAIN_TYPE>::size(x));
+    }
+  }
+
+  // df *= scale
+  template <typename T, typename DIFFERENTIAL_TYPE>
+  void
+  scale_by(const T scale, DIFFERENTIAL_TYPE& df)
+  {
+    if constexpr (std::is_arithmetic_v<DIFFERENTIAL_TYPE>)
+    {
+      df *= scale;
+    }
+    else
+    {
+      using traits = Vector_Traits<DIFFERENTIAL_TYPE>;
+      using scalar = typename traits::scalar_type;
+
+      const size_t n  = traits::size(df);
+      scalar* const p = traits::data(df);
+      for (size_t i = 0; i < n; ++i)
+      {
+        p[i] = scalar(scale * p[i]);
+      }
+    }
+  }
+
+  // df += scale term_df
+  template <typename T, typename DIFFERENTIAL_TYPE>
+  void
+  add_scaled(const T scale, const DIFFERENTIAL_TYPE& term_df, DIFFERENTIAL_TYPE& df)
+  {
+    if constexpr (std::is_arithmetic_v<DIFFERENTIAL_TYPE>)
+    {
+      df += scale * term_df;
+    }
+    else
+    {
+      using traits = Vector_Traits<DIFFERENTIAL_TYPE>;
+      using scalar = typename traits::scalar_type;
+
+      const size_t n = traits::size(df);
+      assert(traits::size(term_df) == n);
+
+      const scalar* const q = traits::data(term_df);
+      scalar* const p       = traits::data(df);
+      for (size_t i = 0; i < n; ++i)
+      {
+        p[i] = scalar(p[i] + scale * q[i]);
+      }
+    }
+  }
+
+  //////////////
+  // evaluate //
+  //////////////
+  //
+  // Any term: combinators directly, other differentiable functions
+  // (f(), f_df(), df() members) through a scratch buffer when
+  // accumulating
+  template <typename TERM,
+            typename DOMAIN_TYPE,
+            typename CODOMAIN_TYPE,
+            typename DIFFERENTIAL_TYPE>
+  void
+  evaluate(const TERM& term,
+           const DOMAIN_TYPE& x,
+           CODOMAIN_TYPE* const y,
+           DIFFERENTIAL_TYPE* const df,
+           const CODOMAIN_TYPE scale,
+           const bool accumulate)
+  {
+    if constexpr (is_combinator_v<TERM>)
+    {
+      term.evaluate(x, y, df, scale, accumulate);
+    }
+    else
+    {
+      const auto call = [&](CODOMAIN_TYPE* const term_y, DIFFERENTIAL_TYPE* const term_df) {
+        if (term_y and term_df)
+        {
+          term.f_df(x, *term_y, *term_df);
+        }
+        else if (term_y)
+        {
+          term.f(x, *term_y);
+        }
+        else if (term_df)
+        {
+          term.df(x, *term_df);
+        }
+      };
+
+      if (not accumulate)
+      {
+        call(y, df);
+
+        if (scale != CODOMAIN_TYPE(1))
+        {
+          if (y) *y *= scale;
+          if (df) scale_by(scale, *df);
+        }
+        return;
+      }
+
+      CODOMAIN_TYPE term_y = CODOMAIN_TYPE(0);
+      if (df)
+      {
+        const Scratch<DIFFERENTIAL_TYPE> term_df;
+        resize_as(x, *term_df);
+
+        call(y ? &term_y : nullptr, &*term_df);
+        add_scaled(scale, *term_df, *df);
+      }
+      else
+      {
+        call(y ? &term_y : nullptr, nullptr);
+      }
+      if (y) *y += scale * term_y;
+    }
+  }
+}
+
+/////////////////////////
+// Function_Combinator //
+/////////////////////////
+//
+// Public interface of the combinators (same as
+// Static_Differentiable_Function), DERIVED implements evaluate()
+//
+template <typename DERIVED,
+          typename DOMAIN_TYPE,
+          typename CODOMAIN_TYPE,
+          typename DIFFERENTIAL_TYPE>
+class Function_Combinator : public Function_Combinator_Detail::Combinator_Tag
+{
+ public:
+  using differentiable_function_type =
+      Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE>;
+  using function_type     = typename differentiable_function_type::function_type;
+  using domain_type       = DOMAIN_TYPE;
+  using codomain_type     = CODOMAIN_TYPE;
+  using differential_type = DIFFERENTIAL_TYPE;
+
+  static_assert(std::is_arithmetic_v<DIFFERENTIAL_TYPE> or Is_Vector<DIFFERENTIAL_TYPE>::value,
+                "Expected an arithmetic or contiguous vector differential type");
+
+ protected:
+  std::shared_ptr<Evaluation_Counter> _f_counter;
+  std::shared_ptr<Evaluation_Counter> _df_counter;
+
+  const DERIVED&
+  derived() const
+  {
+    return static_cast<const DERIVED&>(*this);
+  }
+
+ public:
+  // Type erasure: one implementation for all the terms, counters are
+  // shared
+  operator differentiable_function_type() const
+  {
+    struct Impl final : public differentiable_function_type::Diff_Interface
+    {
+      DERIVED _combinator;
+
+      Impl(const DERIVED& combinator) : _combinator(combinator) {}
+
+      void
+      f(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y) const
+      {
+        _combinator.evaluate(x, &y, nullptr, CODOMAIN_TYPE(1), false);
+      }
+      void
+      f_df(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y, DIFFERENTIAL_TYPE& df) const
+      {
+        _combinator.evaluate(x, &y, &df, CODOMAIN_TYPE(1), false);
+      }
+      void
+      df(const DOMAIN_TYPE& x, DIFFERENTIAL_TYPE& df) const
+      {
+        _combinator.evaluate(x, nullptr, &df, CODOMAIN_TYPE(1), false);
+      }
+    };
+    return {std::make_shared<const Impl>(derived()), _f_counter, _df_counter};
+  }
+
+  operator function_type() const { return as_differentiable_function().as_function(); }
+
+  differentiable_function_type
+  as_differentiable_function() const
+  {
+    return static_cast<differentiable_function_type>(*this);
+  }
+
+  function_type
+  as_function() const
+  {
+    return static_cast<function_type>(*this);
+  }
+
+  void
+  f(const domain_type& x, codomain_type& y) const
+  {
+    if (_f_counter) ++(*_f_counter);
+
+    derived().evaluate(x, &y, nullptr, codomain_type(1), false);
+  }
+
+  void
+  f_df(const domain_type& x, codomain_type& y, differential_type& df) const
+  {
+    if (_f_counter) ++(*_f_counter);
+    if (_df_counter) ++(*_df_counter);
+
+    derived().evaluate(x, &y, &df, codomain_type(1), false);
+  }
+
+  void
+  df(const domain_type& x, differential_type& df) const
+  {
+    if (_df_counter) ++(*_df_counter);
+
+    derived().evaluate(x, nullptr, &df, codomain_type(1), false);
+  }
+
+  // Counter_Policy::Relaxed_Atomic or Sharded if evaluated from
+  // several threads, see evaluation_counter.hpp
+  void
+  initialize_counter(const Counter_Policy policy = Counter_Policy::Plain)
+  {
+    _f_counter  = make_evaluation_counter(policy);
+    _df_counter = make_evaluation_counter(policy);
+  }
+
+  size_t
+  f_counter() const
+  {
+    assert(_f_counter);
+    return _f_counter->value();
+  }
+
+  size_t
+  df_counter() const
+  {
+    assert(_df_counter);
+    return _df_counter->value();
+  }
+};
+
+///////////////////////////
+// Accumulating_Function //
+///////////////////////////
+//
+// F is a callable(domain,codomain*,differential*,scale) adding
+// scale f(x) to *y and scale df(x) to *df (if not null): regularizers
+// and other terms written without temporary gradient
+//
+template <typename F, typename DOMAIN_TYPE, typename CODOMAIN_TYPE, typename DIFFERENTIAL_TYPE>
+class Accumulating_Function
+    : public Function_Combinator<
+          Accumulating_Function<F, DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE>,
+          DOMAIN_TYPE,
+          CODOMAIN_TYPE,
+          DIFFERENTIAL_TYPE>
+{
+  static_assert(std::is_invocable_r_v<void,
+                                      const F&,
+                                      const DOMAIN_TYPE&,
+                                      CODOMAIN_TYPE*,
+                                      DIFFERENTIAL_TYPE*,
+                                      CODOMAIN_TYPE>,
+                "Expected lambda(domain,codomain*,differential*,scale)");
+
+ protected:
+  F _f;
+
+ public:
+  Accumulating_Function(const F& f) : _f(f) {}
+  Accumulating_Function(F&& f) : _f(std::move(f)) {}
+
+  void
+  evaluate(const DOMAIN_TYPE& x,
+           CODOMAIN_TYPE* const y,
+           DIFFERENTIAL_TYPE* const df,
+           const CODOMAIN_TYPE scale,
+           const bool accumulate) const
+  {
+    if (not accumulate)
+    {
+      if (y) *y = CODOMAIN_TYPE(0);
+      if (df) Function_Combinator_Detail::assign_zero(x, *df);
+    }
+    _f(x, y, df, scale);
+  }
+};
+
+// Helper
+//
+template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE, typename DIFFERENTIAL_TYPE, typename F>
+auto
+accumulating_function(F&& f)
+{
+  return Accumulating_Function<std::decay_t<F>, DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE>(
+      std::forward<F>(f));
+}
+
+//////////////////
+// Sum_Function //
+//////////////////
+//
+// TERMS: differentiable functions of the same types
+//
+template <typename DOMAIN_TYPE,
+          typename CODOMAIN_TYPE,
+          typename DIFFERENTIAL_TYPE,
+          typename... TERMS>
+class Sum_Function
+    : public Function_Combinator<
+          Sum_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE, TERMS...>,
+          DOMAIN_TYPE,
+          CODOMAIN_TYPE,
+          DIFFERENTIAL_TYPE>
+{
+  static_assert(sizeof...(TERMS) > 0);
+
+ protected:
+  std::tuple<TERMS...> _terms;
+
+ public:
+  Sum_Function(const TERMS&... terms) : _terms(terms...) {}
+
+  // The first term assigns, the next ones accumulate
+  void
+  evaluate(const DOMAIN_TYPE& x,
+           CODOMAIN_TYPE* const y,
+           DIFFERENTIAL_TYPE* const df,
+           const CODOMAIN_TYPE scale,
+           bool accumulate) const
+  {
+    std::apply(
+        [&](const TERMS&... terms) {
+          ((Function_Combinator_Detail::evaluate(terms, x, y, df, scale, accumulate),
+            accumulate = true),
+           ...);
+        },
+        _terms);
+  }
+};
+
+// Helper: domain, codomain and differential types from the first term
+//
+template <typename TERM, typename... TERMS>
+auto
+sum_function(const TERM& term, const TERMS&... terms)
+{
+  return Sum_Function<typename TERM::domain_type,
+                      typename TERM::codomain_type,
+                      typename TERM::differential_type,
+                      TERM,
+                      TERMS...>(term, terms...);
+}
+
+/////////////////////
+// Scaled_Function //
+/////////////////////
+//
+// scale term(x), nested scales are multiplied (no extra pass)
+//
+template <typename TERM>
+class Scaled_Function : public Function_Combinator<Scaled_Function<TERM>,
+                                                   typename TERM::domain_type,
+                                                   typename TERM::codomain_type,
+                                                   typename TERM::differential_type>
+{
+ public:
+  using domain_type       = typename TERM::domain_type;
+  using codomain_type     = typename TERM::codomain_type;
+  using differential_type = typename TERM::differential_type;
+
+ protected:
+  codomain_type _scale;
+  TERM _term;
+
+ public:
+  Scaled_Function(const codomain_type scale, const TERM& term) : _scale(scale), _term(term) {}
+
+  void
+  evaluate(const domain_type& x,
+           codomain_type* const y,
+           differential_type* const df,
+           const codomain_type scale,
+           const bool accumulate) const
+  {
+    Function_Combinator_Detail::evaluate(_term, x, y, df, scale * _scale, accumulate);
+  }
+};
+
+// Helper
+//
+template <typename TERM>
+auto
+scaled_function(const typename TERM::codomain_type scale, const TERM& term)
+{
+  return Scaled_Function<TERM>(scale, term);
+}
+
+/////////////////////////////////
+// Linear_Composition_Function //
+/////////////////////////////////
+//
+// term(A x), gradient A^T term'(A x). The linear map A is given by
+//
+//   apply(x, z)                  z = A x (z resized by apply)
+//   apply_transpose_add(w, df)   df += A^T w
+//
+// TERM domain (and differential): the image of A
+//
+template <typename DOMAIN_TYPE,
+          typename DIFFERENTIAL_TYPE,
+          typename TERM,
+          typename APPLY,
+          typename APPLY_TRANSPOSE_ADD>
+class Linear_Composition_Function
+    : public Function_Combinator<Linear_Composition_Function<DOMAIN_TYPE,
+                                                             DIFFERENTIAL_TYPE,
+                                                             TERM,
+                                                             APPLY,
+                                                             APPLY_TRANSPOSE_ADD>,
+                                 DOMAIN_TYPE,
+                                 typename TERM::codomain_type,
+                                 DIFFERENTIAL_TYPE>
+{
+ public:
+  using codomain_type           = typename TERM::codomain_type;
+  using image_type              = typename TERM::domain_type;
+  using image_differential_type = typename TERM::differential_type;
+
+  static_assert(std::is_invocable_r_v<void, const APPLY&, const DOMAIN_TYPE&, image_type&>,
+                "Expected apply(domain,image&)");
+  static_assert(std::is_invocable_r_v<void,
+                                      const APPLY_TRANSPOSE_ADD&,
+                                      const image_differential_type&,
+                                      DIFFERENTIAL_TYPE&>,
+                "Expected apply_transpose_add(image_differential,differential&)");
+
+ protected:
+  TERM _term;
+  APPLY _apply;
+  APPLY_TRANSPOSE_ADD _apply_transpose_add;
+
+ public:
+  Linear_Composition_Function(const TERM& term,
+                              const APPLY& apply,
+                              const APPLY_TRANSPOSE_ADD& apply_transpose_add)
+      : _term(term), _apply(apply), _apply_transpose_add(apply_transpose_add)
+  {
+  }
+
+  void
+  evaluate(const DOMAIN_TYPE& x,
+           codomain_type* const y,
+           DIFFERENTIAL_TYPE* const df,
+           const codomain_type scale,
+           const bool accumulate) const
+  {
+    using namespace Function_Combinator_Detail;
+
+    const Scratch<image_type> z;
+    _apply(x, *z);
+
+    codomain_type term_y = codomain_type(0);
+    if (df)
+    {
+      // The scale applies to the (smaller or not) image gradient
+      const Scratch<image_differential_type> w;
+      resize_as(*z, *w);
+
+      Function_Combinator_Detail::evaluate(
+          _term, *z, y ? &term_y : nullptr, &*w, scale, false);
+
+      if (not accumulate) assign_zero(x, *df);
+      _apply_transpose_add(*w, *df);
+    }
+    else
+    {
+      Function_Combinator_Detail::evaluate(
+          _term, *z, &term_y, static_cast<image_differential_type*>(nullptr), scale, false);
+    }
+
+    if (y) *y = accumulate ? *y + term_y : term_y;
+  }
+};
+
+// Helper
+//
+//   // f(A x), A: m x n row major
+//   auto g = linear_composition<V, V>(
+//       f,
+//       [&](const V& x, V& z) { z.resize(m); ... z = A x ... },
+//       [&](const V& w, V& df) { ... df += A^T w ... });
+//
+template <typename DOMAIN_TYPE,
+          typename DIFFERENTIAL_TYPE,
+          typename TERM,
+          typename APPLY,
+          typename APPLY_TRANSPOSE_ADD>
+auto
+linear_composition(const TERM& term,
+                   APPLY&& apply,
+                   APPLY_TRANSPOSE_ADD&& apply_transpose_add)
+{
+  return Linear_Composition_Function<DOMAIN_TYPE,
+                                     DIFFERENTIAL_TYPE,
+                                     TERM,
+                                     std::decay_t<APPLY>,
+                                     std::decay_t<APPLY_TRANSPOSE_ADD>>(
+      term, std::forward<APPLY>(apply), std::forward<APPLY_TRANSPOSE_ADD>(apply_transpose_add));
+}
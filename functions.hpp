@@ -1,36 +1,65 @@
 #pragma once
 
+#include "evaluation_counter.hpp"
 #include "identity.hpp"
+#include "pimpl_storage.hpp"
+#include "span.hpp"
 
 #include <cassert>
 #include <memory>
+#include <type_traits>
+
+// Tag selecting the constructors that wrap a lambda evaluating a
+// whole batch of points at once (see f_batch())
+//
+struct Batch_Lambda_Tag
+{
+};
+static constexpr Batch_Lambda_Tag batch_lambda{};
 
 //////////////
 // Function //
 //////////////
 //
-template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE>
+// STORAGE: how the implementation is stored, see pimpl_storage.hpp
+//
+template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE, typename STORAGE = Shared_Storage>
 class Function
 {
  public:
   using domain_type   = DOMAIN_TYPE;
   using codomain_type = CODOMAIN_TYPE;
+  using storage_type  = STORAGE;
 
   struct Interface
   {
     virtual void f(const domain_type& x, codomain_type& f) const = 0;
 
+    // Default: one f() call per point, override it to process the
+    // whole batch at once
+    virtual void
+    f_batch(Span<const domain_type> x, Span<codomain_type> y) const
+    {
+      assert(x.size() == y.size());
+
+      const size_t n = x.size();
+      for (size_t i = 0; i < n; ++i)
+      {
+        f(x[i], y[i]);
+      }
+    }
+
     virtual ~Interface() = default;
   };
 
  protected:
-  using pimpl_type = std::shared_ptr<const Interface>;
+  using pimpl_type = typename STORAGE::template pimpl_type<Interface>;
   pimpl_type _pimpl;
-  std::shared_ptr<size_t> _f_counter;
+  std::shared_ptr<Evaluation_Counter> _f_counter;
 
  public:
   Function() : _pimpl{} {}
-  Function(pimpl_type&& pimpl, std::shared_ptr<size_t> f_counter = {})
+  Function(pimpl_type&& pimpl, std::shared_ptr<Evaluation_Counter> f_counter = {})
       : _pimpl{std::move(pimpl)}, _f_counter{f_counter}
   {
   }
@@ -53,7 +82,7 @@ class Function
         y = _f(x);
       }
     };
-    _pimpl = std::make_shared<Impl>(std::forward<F>(f));
+    _pimpl.template emplace<Impl>(std::forward<F>(f));
   }
   // lambda(domain,codomain&)
   template <
@@ -74,7 +103,35 @@ class Function
         _f(x, y);
       }
     };
-    _pimpl = std::make_shared<Impl>(std::forward<F>(f));
+    _pimpl.template emplace<Impl>(std::forward<F>(f));
+  }
+  // batch_lambda, lambda(Span<const domain>,Span<codomain>)
+  template <typename F,
+            std::enable_if_t<std::is_invocable_r_v<void,
+                                                   std::decay_t<F>,
+                                                   Span<const DOMAIN_TYPE>,
+                                                   Span<CODOMAIN_TYPE>>>* = nullptr>
+  Function(Batch_Lambda_Tag, F&& f)
+  {
+    struct Impl final : public Interface
+    {
+      std::decay_t<F> _f;
+
+      Impl(F&& f) : _f(std::forward<F>(f)) {}
+
+      void
+      f(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y) const
+      {
+        _f(Span<const DOMAIN_TYPE>(&x, 1), Span<CODOMAIN_TYPE>(&y, 1));
+      }
+      void
+      f_batch(Span<const DOMAIN_TYPE> x, Span<CODOMAIN_TYPE> y) const
+      {
+        assert(x.size() == y.size());
+        _f(x, y);
+      }
+    };
+    _pimpl.template emplace<Impl>(std::forward<F>(f));
   }
   // codomain_type foo(const domain_type& x, extra_args... )
   template <typename... EXTRA_ARGS>
@@ -100,25 +157,38 @@ class Function
     (*_pimpl).f(x, y);
   }
 
+  // Evaluates y[i] = f(x[i]) with only one virtual call
   void
-  initialize_counter()
+  f_batch(Span<const domain_type> x, Span<codomain_type> y) const
   {
-    _f_counter = std::make_shared<size_t>(0);
+    assert(x.size() == y.size());
+
+    if (_f_counter) (*_f_counter) += x.size();
+
+    (*_pimpl).f_batch(x, y);
+  }
+
+  // Counter_Policy::Relaxed_Atomic or Sharded if evaluated from
+  // several threads, see evaluation_counter.hpp
+  void
+  initialize_counter(const Counter_Policy policy = Counter_Policy::Plain)
+  {
+    _f_counter = make_evaluation_counter(policy);
   }
 
   size_t
   f_counter() const
   {
     assert(_f_counter);
-    return *_f_counter;
+    return _f_counter->value();
   }
 };
 
 // Helper
 //
-template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE>
+template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE, typename STORAGE>
 std::enable_if_t<std::is_default_constructible_v<CODOMAIN_TYPE>, CODOMAIN_TYPE>
-eval_f(const Function<DOMAIN_TYPE, CODOMAIN_TYPE>& func, const Identity_t<DOMAIN_TYPE>& x)
+eval_f(const Function<DOMAIN_TYPE, CODOMAIN_TYPE, STORAGE>& func, const Identity_t<DOMAIN_TYPE>& x)
 {
   CODOMAIN_TYPE y;
   func.f(x, y);
@@ -129,14 +199,18 @@ eval_f(const Function<DOMAIN_TYPE, CODOMAIN_TYPE>& func, const Identity_t<DOMAIN
 // Differentiable Function //
 /////////////////////////////
 //
-template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE, typename DIFFERENTIAL_TYPE>
+template <typename DOMAIN_TYPE,
+          typename CODOMAIN_TYPE,
+          typename DIFFERENTIAL_TYPE,
+          typename STORAGE = Shared_Storage>
 class Differentiable_Function
 {
  public:
-  using function_type     = Function<DOMAIN_TYPE, CODOMAIN_TYPE>;
+  using function_type     = Function<DOMAIN_TYPE, CODOMAIN_TYPE, STORAGE>;
   using domain_type       = typename function_type::domain_type;
   using codomain_type     = typename function_type::codomain_type;
   using differential_type = DIFFERENTIAL_TYPE;
+  using storage_type      = STORAGE;
 
   struct Diff_Interface : public function_type::Interface
   {
@@ -144,22 +218,59 @@ class Differentiable_Function
                       codomain_type& y,
                       differential_type& differential) const           = 0;
     virtual void df(const domain_type& x, differential_type& df) const = 0;
+
+    // Default: one f_df() (or df()) call per point
+    virtual void
+    f_df_batch(Span<const domain_type> x,
+               Span<codomain_type> y,
+               Span<differential_type> differential) const
+    {
+      assert(x.size() == y.size());
+      assert(x.size() == differential.size());
+
+      const size_t n = x.size();
+      for (size_t i = 0; i < n; ++i)
+      {
+        f_df(x[i], y[i], differential[i]);
+      }
+    }
+    virtual void
+    df_batch(Span<const domain_type> x, Span<differential_type> differential) const
+    {
+      assert(x.size() == differential.size());
+
+      const size_t n = x.size();
+      for (size_t i = 0; i < n; ++i)
+      {
+        df(x[i], differential[i]);
+      }
+    }
   };
 
  protected:
-  using pimpl_type = std::shared_ptr<const Diff_Interface>;
+  using pimpl_type = typename STORAGE::template pimpl_type<Diff_Interface>;
 
  public:
   pimpl_type _pimpl;
-  std::shared_ptr<size_t> _f_counter;
-  std::shared_ptr<size_t> _df_counter;
+  std::shared_ptr<Evaluation_Counter> _f_counter;
+  std::shared_ptr<Evaluation_Counter> _df_counter;
 
  public:
-  operator function_type() const { return {_pimpl, _f_counter}; }
+  // With Inline_Storage prefer the rvalue version, the lvalue one must
+  // copy the implementation (hence not available with
+  // Move_Only_Inline_Storage)
+  operator function_type() const&
+  {
+    static_assert(std::is_copy_constructible_v<pimpl_type>,
+                  "Move-only storage: use std::move(f).as_function()");
+
+    return {_pimpl, _f_counter};
+  }
+  operator function_type() && { return {std::move(_pimpl), std::move(_f_counter)}; }
 
   Differentiable_Function(pimpl_type&& pimpl,
-                          std::shared_ptr<size_t> f_counter  = {},
-                          std::shared_ptr<size_t> df_counter = {})
+                          std::shared_ptr<Evaluation_Counter> f_counter  = {},
+                          std::shared_ptr<Evaluation_Counter> df_counter = {})
       : _pimpl(std::move(pimpl)), _f_counter{f_counter}, _df_counter{df_counter}
   {
   }
@@ -194,7 +305,66 @@ class Differentiable_Function
         _f(x, nullptr, &df);
       }
     };
-    _pimpl = std::make_shared<Impl>(std::forward<F>(f));
+    _pimpl.template emplace<Impl>(std::forward<F>(f));
+  }
+  // batch_lambda, lambda(Span<const domain>,Span<codomain>,Span<differential>)
+  //
+  // An empty y (or df) span means that the function values (or
+  // differentials) are not requested.
+  template <typename F,
+            std::enable_if_t<std::is_invocable_r_v<void,
+                                                   std::decay_t<F>,
+                                                   Span<const DOMAIN_TYPE>,
+                                                   Span<CODOMAIN_TYPE>,
+                                                   Span<DIFFERENTIAL_TYPE>>>* = nullptr>
+  Differentiable_Function(Batch_Lambda_Tag, F&& f)
+  {
+    struct Impl final : public Diff_Interface
+    {
+      std::decay_t<F> _f;
+
+      Impl(F&& f) : _f(std::forward<F>(f)) {}
+
+      void
+      f(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y) const
+      {
+        _f(Span<const DOMAIN_TYPE>(&x, 1), Span<CODOMAIN_TYPE>(&y, 1), Span<DIFFERENTIAL_TYPE>());
+      }
+      void
+      f_df(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y, DIFFERENTIAL_TYPE& df) const
+      {
+        _f(Span<const DOMAIN_TYPE>(&x, 1),
+           Span<CODOMAIN_TYPE>(&y, 1),
+           Span<DIFFERENTIAL_TYPE>(&df, 1));
+      }
+      void
+      df(const DOMAIN_TYPE& x, DIFFERENTIAL_TYPE& df) const
+      {
+        _f(Span<const DOMAIN_TYPE>(&x, 1), Span<CODOMAIN_TYPE>(), Span<DIFFERENTIAL_TYPE>(&df, 1));
+      }
+      void
+      f_batch(Span<const DOMAIN_TYPE> x, Span<CODOMAIN_TYPE> y) const
+      {
+        assert(x.size() == y.size());
+        _f(x, y, Span<DIFFERENTIAL_TYPE>());
+      }
+      void
+      f_df_batch(Span<const DOMAIN_TYPE> x,
+                 Span<CODOMAIN_TYPE> y,
+                 Span<DIFFERENTIAL_TYPE> df) const
+      {
+        assert(x.size() == y.size());
+        assert(x.size() == df.size());
+        _f(x, y, df);
+      }
+      void
+      df_batch(Span<const DOMAIN_TYPE> x, Span<DIFFERENTIAL_TYPE> df) const
+      {
+        assert(x.size() == df.size());
+        _f(x, Span<CODOMAIN_TYPE>(), df);
+      }
+    };
+    _pimpl.template emplace<Impl>(std::forward<F>(f));
   }
   // void foo(const std::vector<double>& x, double* f, std::vector<double>* df, extra_args...)
   template <typename... EXTRA_ARGS>
@@ -208,10 +378,15 @@ class Differentiable_Function
   }
 
   function_type
-  as_function() const
+  as_function() const&
   {
     return static_cast<function_type>(*this);
   }
+  function_type
+  as_function() &&
+  {
+    return static_cast<function_type>(std::move(*this));
+  }
 
   void
   f(const domain_type& x, codomain_type& y) const
@@ -238,33 +413,71 @@ class Differentiable_Function
     (*_pimpl).df(x, df);
   }
 
+  // Batched versions: one virtual call for the whole batch
+  void
+  f_batch(Span<const domain_type> x, Span<codomain_type> y) const
+  {
+    assert(x.size() == y.size());
+
+    if (_f_counter) (*_f_counter) += x.size();
+
+    (*_pimpl).f_batch(x, y);
+  }
+
+  void
+  f_df_batch(Span<const domain_type> x, Span<codomain_type> y, Span<differential_type> df) const
+  {
+    assert(x.size() == y.size());
+    assert(x.size() == df.size());
+
+    if (_f_counter) (*_f_counter) += x.size();
+    if (_df_counter) (*_df_counter) += x.size();
+
+    (*_pimpl).f_df_batch(x, y, df);
+  }
+
+  void
+  df_batch(Span<const domain_type> x, Span<differential_type> df) const
+  {
+    assert(x.size() == df.size());
+
+    if (_df_counter) (*_df_counter) += x.size();
+
+    (*_pimpl).df_batch(x, df);
+  }
+
+  // Counter_Policy::Relaxed_Atomic or Sharded if evaluated from
+  // several threads, see evaluation_counter.hpp
   void
-  initialize_counter()
+  initialize_counter(const Counter_Policy policy = Counter_Policy::Plain)
   {
-    _f_counter  = std::make_shared<size_t>(0);
-    _df_counter = std::make_shared<size_t>(0);
+    _f_counter  = make_evaluation_counter(policy);
+    _df_counter = make_evaluation_counter(policy);
   }
 
   size_t
   f_counter() const
   {
     assert(_f_counter);
-    return *_f_counter;
+    return _f_counter->value();
   }
 
   size_t
   df_counter() const
   {
     assert(_df_counter);
-    return *_df_counter;
+    return _df_counter->value();
   }
 };
 
 // Helper
 //
-template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE, typename DIFFERENTIAL_TYPE>
+template <typename DOMAIN_TYPE,
+          typename CODOMAIN_TYPE,
+          typename DIFFERENTIAL_TYPE,
+          typename STORAGE>
 std::enable_if_t<std::is_default_constructible_v<CODOMAIN_TYPE>, CODOMAIN_TYPE>
-eval_f(const Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE>& func,
+eval_f(const Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE, STORAGE>& func,
        const Identity_t<DOMAIN_TYPE>& x)
 {
   CODOMAIN_TYPE y;
@@ -0,0 +1,338 @@
+#pragma once
+
+#include "functions.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+// Opt-in timing of f(), f_df() and df() calls.
+//
+// Usage:
+//
+//   auto profile = std::make_shared<Evaluation_Profile>();
+//   auto f_timed = instrument(f, profile);
+//
+//   Time_Split time_split;
+//   timed_run(*profile, time_split, [&]() { return Newton(f_timed, x); });
+//
+//   std::cerr << *profile << time_split;
+//
+
+using Evaluation_Clock = std::chrono::steady_clock;
+
+///////////////////////
+// Timing_Statistics //
+///////////////////////
+//
+struct Timing_Statistics
+{
+  // bucket i counts durations in [2^i, 2^(i+1)[ ns
+  static constexpr size_t histogram_size = 40;
+
+  size_t count         = 0;
+  double total_seconds = 0;
+  double min_seconds   = std::numeric_limits<double>::infinity();
+  double max_seconds   = 0;
+  std::array<size_t, histogram_size> histogram{};
+
+  void
+  add(const Evaluation_Clock::duration duration)
+  {
+    const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    const double seconds   = std::chrono::duration<double>(duration).count();
+
+    ++count;
+    total_seconds += seconds;
+    min_seconds = std::min(min_seconds, seconds);
+    max_seconds = std::max(max_seconds, seconds);
+
+    size_t bucket = 0;
+    for (auto n = nanoseconds; (n > 1) and (bucket + 1 < histogram_size); n >>= 1)
+    {
+      ++bucket;
+    }
+    ++histogram[bucket];
+  }
+
+  double
+  mean_seconds() const
+  {
+    return (count > 0) ? total_seconds / count : 0;
+  }
+};
+
+inline std::ostream&
+operator<<(std::ostream& out, const Timing_Statistics& to_print)
+{
+  out << "count = " << to_print.count;
+  if (to_print.count == 0) return out;
+
+  out << " total = " << std::setprecision(6) << to_print.total_seconds << "s"
+      << " mean = " << to_print.mean_seconds() << "s"
+      << " min = " << to_print.min_seconds << "s"
+      << " max = " << to_print.max_seconds << "s"
+      << " histogram(log2 ns):";
+  for (size_t i = 0; i < Timing_Statistics::histogram_size; ++i)
+  {
+    if (to_print.histogram[i]) out << " [" << i << "]=" << to_print.histogram[i];
+  }
+  return out;
+}
+
+////////////////////////
+// Evaluation_Profile //
+////////////////////////
+//
+// Shared by the instrumented wrappers, thread-safe
+//
+class Evaluation_Profile
+{
+ public:
+  enum Method
+  {
+    F,
+    F_DF,
+    DF
+  };
+
+ protected:
+  std::atomic<bool> _enabled;
+  mutable std::mutex _mutex;
+  std::array<Timing_Statistics, 3> _statistics;
+
+ public:
+  explicit Evaluation_Profile(const bool enabled = true) : _enabled{enabled} {}
+
+  bool
+  is_enabled() const
+  {
+    return _enabled.load(std::memory_order_relaxed);
+  }
+  void
+  set_enabled(const bool enabled)
+  {
+    _enabled.store(enabled, std::memory_order_relaxed);
+  }
+
+  void
+  add(const Method method, const Evaluation_Clock::duration duration)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _statistics[method].add(duration);
+  }
+
+  Timing_Statistics
+  statistics(const Method method) const
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _statistics[method];
+  }
+
+  // Time spent in the objective function, all methods
+  double
+  total_seconds() const
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _statistics[F].total_seconds + _statistics[F_DF].total_seconds +
+           _statistics[DF].total_seconds;
+  }
+
+  void
+  reset()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _statistics = {};
+  }
+
+  // Measures the call if enabled, otherwise just calls
+  template <typename CALL>
+  void
+  measure(const Method method, CALL&& call)
+  {
+    if (not is_enabled())
+    {
+      call();
+      return;
+    }
+    const auto start = Evaluation_Clock::now();
+    call();
+    add(method, Evaluation_Clock::now() - start);
+  }
+};
+
+inline std::ostream&
+operator<<(std::ostream& out, const Evaluation_Profile& to_print)
+{
+  out << "f    : " << to_print.statistics(Evaluation_Profile::F) << std::endl;
+  out << "f_df : " << to_print.statistics(Evaluation_Profile::F_DF) << std::endl;
+  out << "df   : " << to_print.statistics(Evaluation_Profile::DF) << std::endl;
+  return out;
+}
+
+////////////////
+// instrument //
+////////////////
+//
+// Returns a wrapper timing each call of func. Batched calls are
+// measured as a whole.
+//
+template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE, typename STORAGE>
+Function<DOMAIN_TYPE, CODOMAIN_TYPE, STORAGE>
+instrument(const Function<DOMAIN_TYPE, CODOMAIN_TYPE, STORAGE>& func,
+           const std::shared_ptr<Evaluation_Profile>& profile)
+{
+  using function_type = Function<DOMAIN_TYPE, CODOMAIN_TYPE, STORAGE>;
+
+  assert(profile);
+
+  struct Impl final : public function_type::Interface
+  {
+    function_type _func;
+    std::shared_ptr<Evaluation_Profile> _profile;
+
+    Impl(const function_type& func, const std::shared_ptr<Evaluation_Profile>& profile)
+        : _func(func), _profile(profile)
+    {
+    }
+
+    void
+    f(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y) const
+    {
+      _profile->measure(Evaluation_Profile::F, [&]() { _func.f(x, y); });
+    }
+    void
+    f_batch(Span<const DOMAIN_TYPE> x, Span<CODOMAIN_TYPE> y) const
+    {
+      _profile->measure(Evaluation_Profile::F, [&]() { _func.f_batch(x, y); });
+    }
+  };
+  return {std::make_shared<const Impl>(func, profile)};
+}
+
+template <typename DOMAIN_TYPE,
+          typename CODOMAIN_TYPE,
+          typename DIFFERENTIAL_TYPE,
+          typename STORAGE>
+Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE, STORAGE>
+instrument(
+    const Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE, STORAGE>& func,
+    const std::shared_ptr<Evaluation_Profile>& profile)
+{
+  using differentiable_function_type =
+      Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE, STORAGE>;
+
+  assert(profile);
+
+  struct Impl final : public differentiable_function_type::Diff_Interface
+  {
+    differentiable_function_type _func;
+    std::shared_ptr<Evaluation_Profile> _profile;
+
+    Impl(const differentiable_function_type& func,
+         const std::shared_ptr<Evaluation_Profile>& profile)
+        : _func(func), _profile(profile)
+    {
+    }
+
+    void
+    f(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y) const
+    {
+      _profile->measure(Evaluation_Profile::F, [&]() { _func.f(x, y); });
+    }
+    void
+    f_df(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y, DIFFERENTIAL_TYPE& df) const
+    {
+      _profile->measure(Evaluation_Profile::F_DF, [&]() { _func.f_df(x, y, df); });
+    }
+    void
+    df(const DOMAIN_TYPE& x, DIFFERENTIAL_TYPE& df) const
+    {
+      _profile->measure(Evaluation_Profile::DF, [&]() { _func.df(x, df); });
+    }
+    void
+    f_batch(Span<const DOMAIN_TYPE> x, Span<CODOMAIN_TYPE> y) const
+    {
+      _profile->measure(Evaluation_Profile::F, [&]() { _func.f_batch(x, y); });
+    }
+    void
+    f_df_batch(Span<const DOMAIN_TYPE> x,
+               Span<CODOMAIN_TYPE> y,
+               Span<DIFFERENTIAL_TYPE> df) const
+    {
+      _profile->measure(Evaluation_Profile::F_DF, [&]() { _func.f_df_batch(x, y, df); });
+    }
+    void
+    df_batch(Span<const DOMAIN_TYPE> x, Span<DIFFERENTIAL_TYPE> df) const
+    {
+      _profile->measure(Evaluation_Profile::DF, [&]() { _func.df_batch(x, df); });
+    }
+  };
+  return {std::make_shared<const Impl>(func, profile)};
+}
+
+////////////////
+// Time_Split //
+////////////////
+//
+// Time in objective versus time in solver
+//
+struct Time_Split
+{
+  double total_seconds     = 0;
+  double objective_seconds = 0;
+
+  double
+  solver_seconds() const
+  {
+    return std::max(0., total_seconds - objective_seconds);
+  }
+};
+
+inline std::ostream&
+operator<<(std::ostream& out, const Time_Split& to_print)
+{
+  const double ratio =
+      (to_print.total_seconds > 0) ? 100 * to_print.objective_seconds / to_print.total_seconds : 0;
+
+  out << "total time:     " << std::setprecision(6) << to_print.total_seconds << "s" << std::endl;
+  out << "objective time: " << to_print.objective_seconds << "s (" << std::setprecision(3) << ratio
+      << "%)" << std::endl;
+  out << "solver time:    " << std::setprecision(6) << to_print.solver_seconds() << "s"
+      << std::endl;
+  return out;
+}
+
+// Runs solver() (any solver call using functions instrumented with
+// profile), fills time_split and returns solver() result
+//
+template <typename SOLVER>
+decltype(auto)
+timed_run(const Evaluation_Profile& profile, Time_Split& time_split, SOLVER&& solver)
+{
+  const double objective_seconds_before = profile.total_seconds();
+  const auto start                      = Evaluation_Clock::now();
+
+  struct Finalize
+  {
+    const Evaluation_Profile& profile;
+    Time_Split& time_split;
+    const double objective_seconds_before;
+    const Evaluation_Clock::time_point start;
+
+    ~Finalize()
+    {
+      time_split.total_seconds =
+          std::chrono::duration<double>(Evaluation_Clock::now() - start).count();
+      time_split.objective_seconds = profile.total_seconds() - objective_seconds_before;
+    }
+  } finalize{profile, time_split, objective_seconds_before, start};
+
+  return solver();
+}
@@ -0,0 +1,370 @@
+#pragma once
+
+#include "cache_line.hpp"
+#include "iteration_observer.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+// Logs Iteration_Records to a file without I/O in the solver threads:
+// observers push into a bounded lock-free ring buffer (multiple
+// producers), a background thread drains it to the file.
+//
+//   Iteration_Log log("adam.csv");
+//
+//   Adam_optimize(f, x, y, grad, _Adam_observer_ = log.observer());
+//
+//   // multistart: one run tag per start
+//   log.observer(start)
+//
+// A full buffer never blocks a solver: the record is dropped and
+// counted (see dropped()).
+//
+// Formats:
+// - CSV: header line then one line per record
+// - Binary: raw Iteration_Record array (native endianness), it can
+//   be mapped by Mapped_Matrix<Iteration_Record> or read back with
+//   fread()
+// - Text: aligned solver, iteration, x (root finders only), y,
+//   gradient norm and step columns, the solvers verbose output (see
+//   verbose_log())
+
+///////////////////
+// Iteration_Log //
+///////////////////
+//
+class Iteration_Log
+{
+ public:
+  enum class Format
+  {
+    CSV,
+    Binary,
+    Text
+  };
+
+ protected:
+  struct alignas(cache_line_size) Slot
+  {
+    std::atomic<size_t> sequence;
+    Iteration_Record record;
+  };
+
+  std::unique_ptr<Slot[]> _slots;
+  size_t _mask;
+
+  alignas(cache_line_size) std::atomic<size_t> _enqueue_position;
+  alignas(cache_line_size) std::atomic<size_t> _dequeue_position;  // only the writer modifies it
+  std::atomic<size_t> _flushed_position;
+  std::atomic<size_t> _dropped;
+
+  struct File_Closer
+  {
+    void
+    operator()(std::FILE* const file) const
+    {
+      std::fclose(file);
+    }
+  };
+  using Owned_File = std::unique_ptr<std::FILE, File_Closer>;
+
+  Owned_File _owned_file;  // null if the file is borrowed
+  std::FILE* _file;
+  Format _format;
+
+  std::atomic<bool> _stop;
+  std::thread _writer;
+
+  // The idle writer blocks until a push() (or the destruction) wakes
+  // it, push() only locks when the writer is idle
+  std::atomic<bool> _writer_idle{false};
+  std::mutex _wake_mutex;
+  std::condition_variable _wake_condition;
+  bool _wake_requested = false;
+
+  bool
+  has_pending() const
+  {
+    const size_t position = _dequeue_position.load(std::memory_order_relaxed);
+
+    return _slots[position & _mask].sequence.load(std::memory_order_acquire) == position + 1;
+  }
+
+  // Single consumer
+  bool
+  pop(Iteration_Record& record)
+  {
+    const size_t position = _dequeue_position.load(std::memory_order_relaxed);
+    Slot& slot            = _slots[position & _mask];
+
+    if (slot.sequence.load(std::memory_order_acquire) != position + 1) return false;
+
+    record = slot.record;
+    slot.sequence.store(position + _mask + 1, std::memory_order_release);
+    _dequeue_position.store(position + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  void
+  write(const Iteration_Record& record)
+  {
+    if (_format == Format::Binary)
+    {
+      std::fwrite(&record, sizeof(record), 1, _file);
+      return;
+    }
+    if (_format == Format::Text)
+    {
+      std::fprintf(
+          _file, "%-16s %5llu ", record.solver, static_cast<unsigned long long>(record.iteration));
+      if (not std::isnan(record.x)) std::fprintf(_file, "%19.12g ", record.x);
+      std::fprintf(_file, "%17.10g %17.10g %17.10g\n", record.y, record.grad_norm, record.step);
+      return;
+    }
+    std::fprintf(_file,
+                 "%s,%lu,%llu,%.17g,%.17g,%.17g,%.17g,%.17g\n",
+                 record.solver,
+                 static_cast<unsigned long>(record.run),
+                 static_cast<unsigned long long>(record.iteration),
+                 record.elapsed,
+                 record.x,
+                 record.y,
+                 record.grad_norm,
+                 record.step);
+  }
+
+  void
+  run_writer()
+  {
+    Iteration_Record record;
+
+    for (;;)
+    {
+      // Read before draining: nothing pushed before stop is missed
+      const bool stop = _stop.load(std::memory_order_acquire);
+
+      bool has_written = false;
+      while (pop(record))
+      {
+        write(record);
+        has_written = true;
+      }
+      if (has_written or stop)
+      {
+        std::fflush(_file);
+        _flushed_position.store(_dequeue_position.load(std::memory_order_relaxed),
+                                std::memory_order_release);
+      }
+      if (stop) return;
+
+      if (not has_written)
+      {
+        std::unique_lock<std::mutex> lock(_wake_mutex);
+
+        // Idle flag then pending check, push() publishes then checks
+        // the flag: one of them sees the other
+        _writer_idle.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        _wake_condition.wait(lock, [this]() { return _wake_requested or has_pending(); });
+        _wake_requested = false;
+        _writer_idle.store(false, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void
+  wake_writer()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_wake_mutex);
+      _wake_requested = true;
+    }
+    _wake_condition.notify_one();
+  }
+
+  static Owned_File
+  open(const std::string& path, const Format format)
+  {
+    Owned_File file(std::fopen(path.c_str(), (format == Format::Binary) ? "wb" : "w"));
+    if (not file) throw std::system_error(errno, std::generic_category(), "fopen " + path);
+
+    return file;
+  }
+
+  // owned_file: closed by the log, even if the construction throws
+  Iteration_Log(Owned_File owned_file,
+                std::FILE* const borrowed_file,
+                const Format format,
+                const size_t capacity)
+      : _enqueue_position{0},
+        _dequeue_position{0},
+        _flushed_position{0},
+        _dropped{0},
+        _owned_file{std::move(owned_file)},
+        _file{_owned_file ? _owned_file.get() : borrowed_file},
+        _format{format},
+        _stop{false}
+  {
+    assert(_file);
+
+    size_t size = 2;
+    while (size < capacity) size *= 2;
+
+    _slots = std::make_unique<Slot[]>(size);
+    _mask  = size - 1;
+    for (size_t i = 0; i < size; ++i)
+    {
+      _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    if (format == Format::CSV)
+    {
+      std::fprintf(_file, "solver,run,iteration,elapsed,x,y,grad_norm,step\n");
+    }
+
+    _writer = std::thread([this]() { run_writer(); });
+  }
+
+ public:
+  // file: already open (stderr...), not closed by the log. capacity:
+  // rounded up to a power of 2
+  explicit Iteration_Log(std::FILE* const file,
+                         const Format format   = Format::CSV,
+                         const size_t capacity = 1 << 14)
+      : Iteration_Log(Owned_File(), file, format, capacity)
+  {
+  }
+
+  explicit Iteration_Log(const std::string& path,
+                         const Format format   = Format::CSV,
+                         const size_t capacity = 1 << 14)
+      : Iteration_Log(open(path, format), nullptr, format, capacity)
+  {
+  }
+
+  Iteration_Log(const Iteration_Log&) = delete;
+  Iteration_Log& operator=(const Iteration_Log&) = delete;
+
+  // Writes the remaining records
+  ~Iteration_Log()
+  {
+    _stop.store(true, std::memory_order_release);
+    wake_writer();
+    _writer.join();
+  }
+
+  // Lock-free (but waking the idle writer), returns false (record
+  // dropped) if the buffer is full
+  bool
+  push(const Iteration_Record& record) noexcept
+  {
+    size_t position = _enqueue_position.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      Slot& slot            = _slots[position & _mask];
+      const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      const auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+
+      if (difference == 0)
+      {
+        if (_enqueue_position.compare_exchange_weak(
+                position, position + 1, std::memory_order_relaxed))
+        {
+          slot.record = record;
+          slot.sequence.store(position + 1, std::memory_order_release);
+
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          if (_writer_idle.load(std::memory_order_relaxed)) wake_writer();
+
+          return true;
+        }
+      }
+      else if (difference < 0)
+      {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      else
+      {
+        position = _enqueue_position.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Observer pushing the records, stamped with run. The log must
+  // outlive it.
+  Iteration_Observer
+  observer(const std::uint32_t run = 0)
+  {
+    return [this, run](const Iteration_Record& record) {
+      Iteration_Record stamped = record;
+      stamped.run              = run;
+      push(stamped);
+    };
+  }
+
+  // Waits until the records pushed so far are written to the file
+  void
+  flush() const
+  {
+    const size_t position = _enqueue_position.load(std::memory_order_acquire);
+    while (_flushed_position.load(std::memory_order_acquire) < position)
+    {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  size_t
+  dropped() const
+  {
+    return _dropped.load(std::memory_order_relaxed);
+  }
+};
+
+/////////////////
+// verbose_log //
+/////////////////
+//
+// The solvers verbose output: Text format on stderr. The solvers
+// push their verbose records and flush() at the end of the run, the
+// lines being written by the log thread.
+//
+inline Iteration_Log&
+verbose_log()
+{
+  static Iteration_Log log(stderr, Iteration_Log::Format::Text);
+
+  return log;
+}
+
+// Flushes verbose_log() at the end of a verbose solver run (scope)
+class Verbose_Scope
+{
+  bool _verbose;
+
+ public:
+  explicit Verbose_Scope(const bool verbose) : _verbose{verbose} {}
+
+  Verbose_Scope(const Verbose_Scope&) = delete;
+  Verbose_Scope& operator=(const Verbose_Scope&) = delete;
+
+  ~Verbose_Scope()
+  {
+    if (_verbose) verbose_log().flush();
+  }
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+
+// Per-iteration solver telemetry: solvers call an optional observer
+// with an Iteration_Record at each iteration. The default (empty
+// observer) costs one test per iteration, no clock read.
+//
+// See iteration_log.hpp for a sink logging every iteration to a file
+// without stalling the solver threads.
+
+//////////////////////
+// Iteration_Record //
+//////////////////////
+//
+// Trivially copyable, 64 bytes: also the binary log file layout.
+// Unavailable values are NaN.
+//
+struct Iteration_Record
+{
+  char solver[12];          // NUL terminated (truncated) solver name
+  std::uint32_t run;        // user tag (multistart start...), see Iteration_Log
+  std::uint64_t iteration;  // 1, 2...
+  double elapsed;           // seconds since the solver call
+  double y;                 // objective value (root finders: f(x_k))
+  double grad_norm;         // gradient norm (root finders: |f'(x_k)|)
+  double step;              // Adam: alpha_k, root finders: |x_k+1 - x_k|
+  double x;                 // root finders: x_k+1, vector solvers: NaN
+};
+
+static_assert(sizeof(Iteration_Record) == 64);
+
+static constexpr double iteration_not_available = std::numeric_limits<double>::quiet_NaN();
+
+inline Iteration_Record
+make_iteration_record(const char* const solver,
+                      const size_t iteration,
+                      const double elapsed,
+                      const double y,
+                      const double grad_norm,
+                      const double step,
+                      const double x = iteration_not_available)
+{
+  Iteration_Record record;
+
+  std::strncpy(record.solver, solver, sizeof(record.solver) - 1);
+  record.solver[sizeof(record.solver) - 1] = '\0';
+
+  record.run       = 0;
+  record.iteration = iteration;
+  record.elapsed   = elapsed;
+  record.y         = y;
+  record.grad_norm = grad_norm;
+  record.step      = step;
+  record.x         = x;
+
+  return record;
+}
+
+// Empty: no-op
+using Iteration_Observer = std::function<void(const Iteration_Record&)>;
+
+/////////////////////
+// Iteration_Timer //
+/////////////////////
+//
+// Seconds since construction, the clock is only read when enabled
+// (observed solver)
+//
+class Iteration_Timer
+{
+  std::chrono::steady_clock::time_point _start;
+  bool _enabled;
+
+ public:
+  explicit Iteration_Timer(const bool enabled) : _start{}, _enabled{enabled}
+  {
+    if (_enabled) _start = std::chrono::steady_clock::now();
+  }
+
+  double
+  elapsed() const
+  {
+    if (not _enabled) return iteration_not_available;
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+  }
+};
@@ -0,0 +1,425 @@
+#pragma once
+
+#include "functions.hpp"
+#include "named_types.hpp"
+#include "span.hpp"
+#include "vector_traits.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+
+// Line searches along a descent direction d from x, on
+//
+//   phi(t) = f(x + t d)
+//
+// Each trial point is one f_df() call: phi(t) and phi'(t) = <d, grad>
+// in one evaluation. The accepted trial point, its value and gradient
+// stay in the Line_Search_Workspace so that the caller takes them as
+// the next iterate without evaluating it again:
+//
+//   const auto result = line_search(configuration, f, x, y, d, d_dot_grad, t_0, workspace);
+//
+//   if (result.success)
+//   {
+//     x = workspace.x_trial();  // y = result.y, grad = workspace.grad_trial()
+//   }
+//
+// - Armijo_Backtracking: sufficient decrease
+//
+//     phi(t) <= phi(0) + c_1 t phi'(0)
+//
+//   shrinking t by (safeguarded) quadratic interpolation
+//
+// - Strong_Wolfe: sufficient decrease and curvature condition
+//
+//     |phi'(t)| <= c_2 |phi'(0)|
+//
+//   t is expanded while phi decreases, then the bracket is zoomed by
+//   cubic interpolation of the cached (t, phi, phi') end points
+//   (Nocedal & Wright, Numerical Optimization, Algorithms 3.5-3.6).
+//   Longer steps than backtracking, and <s, y> > 0 for quasi-Newton
+//   updates.
+
+namespace Optimize
+{
+  ///////////////////////////
+  // Dedicated Named_Types //
+  ///////////////////////////
+  //
+  enum class Line_Search_Method
+  {
+    Armijo_Backtracking,
+    Strong_Wolfe
+  };
+
+  using Line_Search_Kind = Named_Type<struct Line_Search_Kind_Tag, Line_Search_Method>;
+  static constexpr auto _line_search_method_ =
+      typename Line_Search_Kind::argument_syntactic_sugar();
+
+  // Sufficient decrease constant
+  using Line_Search_C_1 =
+      Named_Assert_Type<struct Line_Search_C_1_Tag, Assert_In_01_Strict<double>, double>;
+  static constexpr auto _line_search_c_1_ = typename Line_Search_C_1::argument_syntactic_sugar();
+
+  // Curvature constant (Strong_Wolfe), c_1 < c_2
+  using Line_Search_C_2 =
+      Named_Assert_Type<struct Line_Search_C_2_Tag, Assert_In_01_Strict<double>, double>;
+  static constexpr auto _line_search_c_2_ = typename Line_Search_C_2::argument_syntactic_sugar();
+
+  // Maximum number of f_df() calls per line search
+  using Line_Search_Maximum_Evaluations =
+      Named_Assert_Type<struct Line_Search_Maximum_Evaluations_Tag,
+                        Assert_Positive<size_t>,
+                        size_t>;
+  static constexpr auto _line_search_maximum_evaluations_ =
+      typename Line_Search_Maximum_Evaluations::argument_syntactic_sugar();
+
+  ///////////////////////////////
+  // Line_Search_Configuration //
+  ///////////////////////////////
+  //
+  // Embedded in the solver configurations, the options are the solver
+  // ones (see make_L_BFGS_configuration())
+  //
+  struct Line_Search_Configuration
+  {
+    Line_Search_Kind method = Line_Search_Method::Strong_Wolfe;
+
+    Line_Search_C_1 c_1 = 1e-4;
+    Line_Search_C_2 c_2 = 0.9;
+
+    Line_Search_Maximum_Evaluations maximum_evaluations = 20;
+  };
+
+  ////////////////////////
+  // Line_Search_Result //
+  ////////////////////////
+  //
+  template <typename SCALAR_TYPE>
+  struct Line_Search_Result
+  {
+    bool success;        // workspace trial point accepted
+    SCALAR_TYPE step;    // accepted t
+    SCALAR_TYPE y;       // phi(t)
+    size_t evaluations;  // f_df() calls
+  };
+
+  ///////////////////////////
+  // Line_Search_Workspace //
+  ///////////////////////////
+  //
+  // Trial point storage, and the last accepted step for the initial
+  // step of the next line search (see initial_step())
+  //
+  template <typename VECTOR_TYPE>
+  class Line_Search_Workspace
+  {
+   public:
+    using scalar_type = typename Vector_Traits<VECTOR_TYPE>::scalar_type;
+
+   protected:
+    VECTOR_TYPE _x_trial;
+    VECTOR_TYPE _grad_trial;
+
+    scalar_type _previous_step;
+    scalar_type _previous_directional_derivative;
+
+   public:
+    Line_Search_Workspace() : _previous_step{0}, _previous_directional_derivative{0} {}
+
+    void
+    resize(const size_t domain_size)
+    {
+      Vector_Traits<VECTOR_TYPE>::resize(_x_trial, domain_size);
+      Vector_Traits<VECTOR_TYPE>::resize(_grad_trial, domain_size);
+    }
+
+    // Forgets the previous step
+    void
+    reset()
+    {
+      _previous_step                   = 0;
+      _previous_directional_derivative = 0;
+    }
+
+    // After a successful line_search(): the accepted point and its
+    // gradient
+    VECTOR_TYPE&
+    x_trial()
+    {
+      return _x_trial;
+    }
+    VECTOR_TYPE&
+    grad_trial()
+    {
+      return _grad_trial;
+    }
+
+    // Same first order change as the previous accepted step,
+    //
+    //   t_0 = t_k-1 phi'_k-1(0) / phi'_k(0)
+    //
+    // default_step for the first line search (or after reset()).
+    // Solvers without a natural step scaling (gradient descent) benefit
+    // the most, quasi-Newton ones use t_0 = 1.
+    scalar_type
+    initial_step(const scalar_type directional_derivative, const scalar_type default_step) const
+    {
+      if ((_previous_step == 0) or not(directional_derivative < 0)) return default_step;
+
+      return _previous_step * _previous_directional_derivative / directional_derivative;
+    }
+
+    // Used by line_search()
+    void
+    accepted(const scalar_type step, const scalar_type directional_derivative)
+    {
+      _previous_step                   = step;
+      _previous_directional_derivative = directional_derivative;
+    }
+  };
+
+  namespace Line_Search_Detail
+  {
+    template <typename SCALAR_TYPE>
+    SCALAR_TYPE
+    dot(const SCALAR_TYPE* const u, const SCALAR_TYPE* const v, const size_t n)
+    {
+      SCALAR_TYPE sum = 0;
+      for (size_t i = 0; i < n; ++i) sum += u[i] * v[i];
+      return sum;
+    }
+
+    // An evaluated trial point
+    template <typename SCALAR_TYPE>
+    struct Trial
+    {
+      SCALAR_TYPE t;
+      SCALAR_TYPE phi;
+      SCALAR_TYPE dphi;
+    };
+
+    // phi(t), phi'(t) at x + t d, in the workspace trial point
+    template <typename SCALAR_TYPE, typename VECTOR_TYPE>
+    class Phi
+    {
+      using traits      = Vector_Traits<VECTOR_TYPE>;
+      using scalar_type = typename traits::scalar_type;
+
+      const Differentiable_Function<VECTOR_TYPE, SCALAR_TYPE, VECTOR_TYPE>& _objective_function;
+      const scalar_type* const _x;
+      Span<const scalar_type> _direction;
+      Line_Search_Workspace<VECTOR_TYPE>& _workspace;
+
+     public:
+      size_t evaluations = 0;
+
+      Phi(const Differentiable_Function<VECTOR_TYPE, SCALAR_TYPE, VECTOR_TYPE>& objective_function,
+          const VECTOR_TYPE& x,
+          Span<const scalar_type> direction,
+          Line_Search_Workspace<VECTOR_TYPE>& workspace)
+          : _objective_function(objective_function),
+            _x{traits::data(x)},
+            _direction{direction},
+            _workspace(workspace)
+      {
+      }
+
+      Trial<SCALAR_TYPE>
+      operator()(const SCALAR_TYPE t)
+      {
+        const size_t n       = _direction.size();
+        scalar_type* x_trial = traits::data(_workspace.x_trial());
+
+        for (size_t i = 0; i < n; ++i) x_trial[i] = _x[i] + scalar_type(t) * _direction[i];
+
+        Trial<SCALAR_TYPE> trial{t, 0, 0};
+        _objective_function.f_df(_workspace.x_trial(), trial.phi, _workspace.grad_trial());
+        ++evaluations;
+
+        trial.dphi = dot(_direction.data(), traits::data(_workspace.grad_trial()), n);
+        return trial;
+      }
+    };
+
+    // Minimizer of the cubic interpolating phi, phi' at a and b,
+    // safeguarded in the middle 80% of the interval (bisection if
+    // the cubic has no minimizer)
+    template <typename SCALAR_TYPE>
+    SCALAR_TYPE
+    cubic_minimizer(const Trial<SCALAR_TYPE>& a, const Trial<SCALAR_TYPE>& b)
+    {
+      using std::copysign;
+      using std::isfinite;
+      using std::max;
+      using std::min;
+      using std::sqrt;
+
+      const SCALAR_TYPE d_1        = a.dphi + b.dphi - 3 * (a.phi - b.phi) / (a.t - b.t);
+      const SCALAR_TYPE d_2_square = d_1 * d_1 - a.dphi * b.dphi;
+
+      const SCALAR_TYPE low    = min(a.t, b.t);
+      const SCALAR_TYPE high   = max(a.t, b.t);
+      const SCALAR_TYPE margin = SCALAR_TYPE(0.1) * (high - low);
+      const SCALAR_TYPE middle = (a.t + b.t) / 2;
+
+      if (not(d_2_square >= 0)) return middle;
+
+      const SCALAR_TYPE d_2 = copysign(sqrt(d_2_square), b.t - a.t);
+      const SCALAR_TYPE t =
+          b.t - (b.t - a.t) * (b.dphi + d_2 - d_1) / (b.dphi - a.dphi + 2 * d_2);
+
+      if (not isfinite(t)) return middle;
+
+      return min(max(t, low + margin), high - margin);
+    }
+
+    template <typename SCALAR_TYPE, typename PHI>
+    Line_Search_Result<SCALAR_TYPE>
+    Armijo_backtracking(const Line_Search_Configuration& configuration,
+                        PHI& phi,
+                        const Trial<SCALAR_TYPE>& origin,
+                        SCALAR_TYPE t)
+    {
+      using std::max;
+      using std::min;
+
+      const SCALAR_TYPE c_1 = configuration.c_1.value();
+
+      while (phi.evaluations < configuration.maximum_evaluations.value())
+      {
+        const Trial<SCALAR_TYPE> trial = phi(t);
+
+        if (trial.phi <= origin.phi + c_1 * t * origin.dphi)
+        {
+          return {true, t, trial.phi, phi.evaluations};
+        }
+
+        // Minimizer of the quadratic interpolating phi(0), phi'(0),
+        // phi(t), in [0.1 t, 0.5 t]
+        const SCALAR_TYPE denominator = 2 * (trial.phi - origin.phi - origin.dphi * t);
+        const SCALAR_TYPE t_quadratic = -origin.dphi * t * t / denominator;
+
+        t = (t_quadratic == t_quadratic) ? min(max(t_quadratic, SCALAR_TYPE(0.1) * t),
+                                               SCALAR_TYPE(0.5) * t)
+                                         : SCALAR_TYPE(0.5) * t;
+      }
+      return {false, t, origin.phi, phi.evaluations};
+    }
+
+    template <typename SCALAR_TYPE, typename PHI>
+    Line_Search_Result<SCALAR_TYPE>
+    strong_Wolfe(const Line_Search_Configuration& configuration,
+                 PHI& phi,
+                 const Trial<SCALAR_TYPE>& origin,
+                 SCALAR_TYPE t)
+    {
+      using std::abs;
+
+      const SCALAR_TYPE c_1 = configuration.c_1.value();
+      const SCALAR_TYPE c_2 = configuration.c_2.value();
+      const size_t maximum  = configuration.maximum_evaluations.value();
+
+      assert(c_1 < c_2);
+
+      const auto sufficient_decrease = [&](const Trial<SCALAR_TYPE>& trial) {
+        return trial.phi <= origin.phi + c_1 * trial.t * origin.dphi;
+      };
+      const auto curvature = [&](const Trial<SCALAR_TYPE>& trial) {
+        return abs(trial.dphi) <= -c_2 * origin.dphi;
+      };
+
+      // Bracketing: lo is the best point satisfying the sufficient
+      // decrease, hi the other end
+      Trial<SCALAR_TYPE> lo = origin;
+      Trial<SCALAR_TYPE> hi = origin;
+      bool bracketed        = false;
+
+      while (phi.evaluations < maximum)
+      {
+        const Trial<SCALAR_TYPE> trial = phi(t);
+
+        if ((not sufficient_decrease(trial)) or (trial.phi >= lo.phi and lo.t > 0))
+        {
+          hi        = trial;
+          bracketed = true;
+          break;
+        }
+        if (curvature(trial)) return {true, trial.t, trial.phi, phi.evaluations};
+
+        if (trial.dphi >= 0)
+        {
+          hi        = lo;
+          lo        = trial;
+          bracketed = true;
+          break;
+        }
+        lo = trial;
+        t *= 2;
+      }
+      if (not bracketed) return {false, lo.t, lo.phi, phi.evaluations};
+
+      // Zoom, the trial point is always the last evaluated one
+      while (phi.evaluations < maximum)
+      {
+        const Trial<SCALAR_TYPE> trial = phi(cubic_minimizer(lo, hi));
+
+        if ((not sufficient_decrease(trial)) or (trial.phi >= lo.phi))
+        {
+          hi = trial;
+          continue;
+        }
+        if (curvature(trial)) return {true, trial.t, trial.phi, phi.evaluations};
+
+        if (trial.dphi * (hi.t - lo.t) >= 0) hi = lo;
+        lo = trial;
+      }
+      return {false, lo.t, lo.phi, phi.evaluations};
+    }
+  }
+
+  /////////////////
+  // line_search //
+  /////////////////
+  //
+  // y: f(x), directional_derivative: <direction, grad f(x)> < 0,
+  // initial_step: first trial t (see Line_Search_Workspace::initial_step())
+  //
+  // On success the workspace trial point is the accepted one. On
+  // failure (maximum evaluations) x is the best known point.
+  //
+  template <typename SCALAR_TYPE, typename VECTOR_TYPE>
+  Line_Search_Result<SCALAR_TYPE>
+  line_search(
+      const Line_Search_Configuration& configuration,
+      const Differentiable_Function<VECTOR_TYPE, SCALAR_TYPE, VECTOR_TYPE>& objective_function,
+      const VECTOR_TYPE& x,
+      const SCALAR_TYPE y,
+      Span<const typename Vector_Traits<VECTOR_TYPE>::scalar_type> direction,
+      const SCALAR_TYPE directional_derivative,
+      const SCALAR_TYPE initial_step,
+      Line_Search_Workspace<VECTOR_TYPE>& workspace)
+  {
+    using namespace Line_Search_Detail;
+
+    assert(Vector_Traits<VECTOR_TYPE>::size(x) == direction.size());
+    assert(directional_derivative < 0);
+    assert(initial_step > 0);
+
+    workspace.resize(direction.size());
+
+    Phi<SCALAR_TYPE, VECTOR_TYPE> phi(objective_function, x, direction, workspace);
+    const Trial<SCALAR_TYPE> origin{0, y, directional_derivative};
+
+    const Line_Search_Result<SCALAR_TYPE> result =
+        (configuration.method.value() == Line_Search_Method::Strong_Wolfe)
+            ? strong_Wolfe(configuration, phi, origin, initial_step)
+            : Armijo_backtracking(configuration, phi, origin, initial_step);
+
+    if (result.success) workspace.accepted(result.step, directional_derivative);
+
+    return result;
+  }
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Runs the same solver from several initial points.
+//
+// Usage:
+//
+//   Thread_Pool thread_pool(8);
+//
+//   auto report = multistart(&thread_pool, f, initial_points,
+//                            [](const auto& f, auto& x) { return Newton(f, x); });
+//
+//   // optional: stop launching new starts once one is accepted
+//   auto report = multistart(&thread_pool, f, initial_points, solver,
+//                            [](const auto& result) { return result.has_converged; });
+//
+// The solver is solver(f, x) -> has_converged, or solver(f, x,
+// cancellation) where cancellation is a const std::atomic<bool>& the
+// solver can poll to stop early.
+//
+// Each start uses its own copy of f (the implementation is shared)
+// with fresh counters, so the evaluations of each start are reported
+// without sharing counters between threads. The counters of f are not
+// updated.
+
+///////////////////////
+// Multistart_Result //
+///////////////////////
+//
+template <typename DOMAIN_TYPE>
+struct Multistart_Result
+{
+  DOMAIN_TYPE x;               // solution (initial point if not run)
+  bool has_run       = false;  // false: cancelled before being started
+  bool has_converged = false;
+  size_t f_counter   = 0;
+  size_t df_counter  = 0;
+};
+
+template <typename DOMAIN_TYPE>
+struct Multistart_Report
+{
+  std::vector<Multistart_Result<DOMAIN_TYPE>> results;  // same order as initial points
+
+  // sums over the starts
+  size_t f_counter  = 0;
+  size_t df_counter = 0;
+
+  // first accepted start (in completion order)
+  std::optional<size_t> accepted;
+};
+
+namespace Multistart_Detail
+{
+  template <typename FUNCTION, typename = void>
+  struct Has_DF_Counter : std::false_type
+  {
+  };
+  template <typename FUNCTION>
+  struct Has_DF_Counter<FUNCTION,
+                        std::void_t<decltype(std::declval<const FUNCTION&>().df_counter())>>
+      : std::true_type
+  {
+  };
+
+  template <typename FUNCTION, typename DOMAIN_TYPE, typename SOLVER>
+  bool
+  call_solver(SOLVER& solver,
+              const FUNCTION& f,
+              DOMAIN_TYPE& x,
+              const std::atomic<bool>& cancellation)
+  {
+    if constexpr (std::is_invocable_v<SOLVER&,
+                                      const FUNCTION&,
+                                      DOMAIN_TYPE&,
+                                      const std::atomic<bool>&>)
+    {
+      return solver(f, x, cancellation);
+    }
+    else
+    {
+      return solver(f, x);
+    }
+  }
+
+  struct Accept_None
+  {
+    template <typename RESULT>
+    bool
+    operator()(const RESULT&) const
+    {
+      return false;
+    }
+  };
+}
+
+////////////////
+// multistart //
+////////////////
+//
+// thread_pool == nullptr: sequential
+//
+// ACCEPT: accept(const Multistart_Result&) -> bool, true cancels the
+// remaining starts. It can be called concurrently.
+//
+template <typename FUNCTION,
+          typename DOMAIN_TYPE,
+          typename SOLVER,
+          typename ACCEPT = Multistart_Detail::Accept_None>
+Multistart_Report<DOMAIN_TYPE>
+multistart(Thread_Pool* const thread_pool,
+           const FUNCTION& f,
+           const std::vector<DOMAIN_TYPE>& initial_points,
+           SOLVER&& solver,
+           ACCEPT&& accept = ACCEPT())
+{
+  const size_t start_count = initial_points.size();
+
+  Multistart_Report<DOMAIN_TYPE> report;
+  report.results.resize(start_count);
+
+  std::atomic<bool> cancellation{false};
+  std::atomic<size_t> accepted{start_count};  // start_count: none
+
+  // Starts last from a few iterations to full runs: work stealing
+  parallel_for_work_stealing(thread_pool, start_count, [&](const size_t start) {
+    auto& result = report.results[start];
+    result.x     = initial_points[start];
+
+    if (cancellation.load(std::memory_order_relaxed)) return;
+
+    FUNCTION f_start(f);
+    f_start.initialize_counter();
+
+    result.has_run = true;
+    result.has_converged =
+        Multistart_Detail::call_solver(solver, f_start, result.x, cancellation);
+
+    result.f_counter = f_start.f_counter();
+    if constexpr (Multistart_Detail::Has_DF_Counter<FUNCTION>::value)
+    {
+      result.df_counter = f_start.df_counter();
+    }
+
+    if (accept(static_cast<const Multistart_Result<DOMAIN_TYPE>&>(result)))
+    {
+      size_t none = start_count;
+      accepted.compare_exchange_strong(none, start);
+      cancellation.store(true, std::memory_order_relaxed);
+    }
+  });
+
+  for (const auto& result : report.results)
+  {
+    report.f_counter += result.f_counter;
+    report.df_counter += result.df_counter;
+  }
+  if (accepted.load() < start_count) report.accepted = accepted.load();
+
+  return report;
+}
+
+//////////////////////////
+// multistart_in_flight //
+//////////////////////////
+//
+// Latency-bound objectives (Async_Function::as_function(), remote
+// service...): max_in_flight starts run concurrently, each one on its
+// own thread mostly blocked on its pending evaluation, hence up to
+// max_in_flight evaluations in flight whatever the number of cores.
+//
+template <typename FUNCTION,
+          typename DOMAIN_TYPE,
+          typename SOLVER,
+          typename ACCEPT = Multistart_Detail::Accept_None>
+Multistart_Report<DOMAIN_TYPE>
+multistart_in_flight(const size_t max_in_flight,
+                     const FUNCTION& f,
+                     const std::vector<DOMAIN_TYPE>& initial_points,
+                     SOLVER&& solver,
+                     ACCEPT&& accept = ACCEPT())
+{
+  assert(max_in_flight > 0);
+
+  const size_t thread_count = std::min(max_in_flight, initial_points.size());
+  if (thread_count <= 1)
+  {
+    return multistart(nullptr,
+                      f,
+                      initial_points,
+                      std::forward<SOLVER>(solver),
+                      std::forward<ACCEPT>(accept));
+  }
+
+  Thread_Pool thread_pool(thread_count);
+
+  return multistart(&thread_pool,
+                    f,
+                    initial_points,
+                    std::forward<SOLVER>(solver),
+                    std::forward<ACCEPT>(accept));
+}
@@ -34,6 +34,16 @@ struct Assert_Positive
   }
 };
 
+template <typename T>
+struct Assert_Non_Negative
+{
+  void
+  operator()(const T& t) const
+  {
+    assert(t >= 0);
+  }
+};
+
 template <typename T>
 struct Assert_In_01_Strict
 {
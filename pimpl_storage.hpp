@@ -0,0 +1,402 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Storage policies for the Function/Differentiable_Function pimpl
+//
+// - Shared_Storage: (default) heap allocated implementation shared
+//   between copies (std::shared_ptr)
+//
+// - Inline_Storage<CAPACITY>: small-buffer optimization, the
+//   implementation is stored inside the Function object when it fits
+//   into CAPACITY bytes, copies duplicate it. It falls back to
+//   Shared_Storage behavior for large or move-only captures.
+//
+// - Move_Only_Inline_Storage<CAPACITY>: ditto, but Function objects
+//   can only be moved. Also allows lambdas capturing move-only
+//   objects.
+
+////////////////////////////////
+// Shared_Pimpl (the default) //
+////////////////////////////////
+//
+template <typename INTERFACE>
+class Shared_Pimpl
+{
+  template <typename>
+  friend class Shared_Pimpl;
+
+ public:
+  using interface_type = INTERFACE;
+
+ protected:
+  std::shared_ptr<const INTERFACE> _ptr;
+
+ public:
+  Shared_Pimpl() = default;
+
+  template <typename T,
+            std::enable_if_t<std::is_convertible_v<T*, const INTERFACE*>>* = nullptr>
+  Shared_Pimpl(std::shared_ptr<T> ptr) : _ptr(std::move(ptr))
+  {
+  }
+
+  // Differentiable_Function -> Function
+  template <typename OTHER_INTERFACE,
+            std::enable_if_t<std::is_convertible_v<const OTHER_INTERFACE*, const INTERFACE*>>* =
+                nullptr>
+  Shared_Pimpl(const Shared_Pimpl<OTHER_INTERFACE>& other) : _ptr(other._ptr)
+  {
+  }
+  template <typename OTHER_INTERFACE,
+            std::enable_if_t<std::is_convertible_v<const OTHER_INTERFACE*, const INTERFACE*>>* =
+                nullptr>
+  Shared_Pimpl(Shared_Pimpl<OTHER_INTERFACE>&& other) : _ptr(std::move(other._ptr))
+  {
+  }
+
+  template <typename IMPL, typename... ARGS>
+  void
+  emplace(ARGS&&... args)
+  {
+    _ptr = std::make_shared<const IMPL>(std::forward<ARGS>(args)...);
+  }
+
+  explicit operator bool() const { return static_cast<bool>(_ptr); }
+
+  const INTERFACE&
+  operator*() const
+  {
+    assert(_ptr);
+    return *_ptr;
+  }
+  const INTERFACE*
+  operator->() const
+  {
+    assert(_ptr);
+    return _ptr.get();
+  }
+
+  // Implementation stored inside the wrapper object
+  bool
+  is_inline() const
+  {
+    return false;
+  }
+};
+
+struct Shared_Storage
+{
+  template <typename INTERFACE>
+  using pimpl_type = Shared_Pimpl<INTERFACE>;
+};
+
+//////////////////
+// Inline_Pimpl //
+//////////////////
+//
+namespace Pimpl_Storage_Detail
+{
+  // Type-erased special members of the inline stored IMPL
+  struct Operations
+  {
+    // nullptr if IMPL is not copy constructible
+    void (*copy)(const void* source, void* destination);
+    // move construct destination then destroy source
+    void (*move)(void* source, void* destination);
+    void (*destroy)(void* object);
+  };
+
+  template <typename IMPL>
+  struct Operations_Of
+  {
+    static void
+    copy(const void* source, void* destination)
+    {
+      new (destination) IMPL(*static_cast<const IMPL*>(source));
+    }
+    static void
+    move(void* source, void* destination)
+    {
+      IMPL* const source_impl = static_cast<IMPL*>(source);
+      new (destination) IMPL(std::move(*source_impl));
+      source_impl->~IMPL();
+    }
+    static void
+    destroy(void* object)
+    {
+      static_cast<IMPL*>(object)->~IMPL();
+    }
+
+    static constexpr auto
+    copy_pointer()
+    {
+      if constexpr (std::is_copy_constructible_v<IMPL>)
+      {
+        return &copy;
+      }
+      else
+      {
+        return static_cast<decltype(&copy)>(nullptr);
+      }
+    }
+
+    static constexpr Operations value = {copy_pointer(), &move, &destroy};
+  };
+
+  template <typename INTERFACE, size_t CAPACITY>
+  class Inline_Pimpl_Base
+  {
+    template <typename, size_t>
+    friend class Inline_Pimpl_Base;
+
+   public:
+    using interface_type                 = INTERFACE;
+    static constexpr size_t capacity     = CAPACITY;
+    static constexpr size_t buffer_size  = (CAPACITY > 0) ? CAPACITY : 1;
+    static constexpr size_t buffer_align = alignof(std::max_align_t);
+
+    template <typename IMPL>
+    static constexpr bool fits_inline_v = (sizeof(IMPL) <= CAPACITY) and
+                                          (alignof(IMPL) <= buffer_align) and
+                                          std::is_nothrow_move_constructible_v<IMPL>;
+
+   protected:
+    alignas(buffer_align) unsigned char _buffer[buffer_size];
+    // Points into _buffer (inline) or to _heap.get() (fallback)
+    const INTERFACE* _ptr = nullptr;
+    // Not null iff inline
+    const Operations* _operations = nullptr;
+    std::shared_ptr<const INTERFACE> _heap;
+
+    // The INTERFACE sub-object has the same offset in any IMPL instance
+    const INTERFACE*
+    rebase(const INTERFACE* ptr, const unsigned char* other_buffer) const
+    {
+      return reinterpret_cast<const INTERFACE*>(
+          _buffer + (reinterpret_cast<const unsigned char*>(ptr) - other_buffer));
+    }
+
+    template <typename OTHER_INTERFACE, size_t OTHER_CAPACITY>
+    void
+    copy_from(const Inline_Pimpl_Base<OTHER_INTERFACE, OTHER_CAPACITY>& other)
+    {
+      assert(not _ptr);
+
+      if (other._operations)
+      {
+        static_assert(OTHER_CAPACITY <= CAPACITY);
+        assert(other._operations->copy && "stored implementation is not copy constructible");
+
+        other._operations->copy(other._buffer, _buffer);
+        _operations = other._operations;
+        _ptr        = rebase(static_cast<const INTERFACE*>(other._ptr), other._buffer);
+      }
+      else
+      {
+        _heap = other._heap;
+        _ptr  = _heap.get();
+      }
+    }
+
+    template <typename OTHER_INTERFACE, size_t OTHER_CAPACITY>
+    void
+    move_from(Inline_Pimpl_Base<OTHER_INTERFACE, OTHER_CAPACITY>&& other) noexcept
+    {
+      assert(not _ptr);
+
+      if (other._operations)
+      {
+        static_assert(OTHER_CAPACITY <= CAPACITY);
+
+        other._operations->move(other._buffer, _buffer);
+        _operations = other._operations;
+        _ptr        = rebase(static_cast<const INTERFACE*>(other._ptr), other._buffer);
+
+        other._operations = nullptr;
+        other._ptr        = nullptr;
+      }
+      else
+      {
+        _heap = std::move(other._heap);
+        _ptr  = _heap.get();
+
+        other._ptr = nullptr;
+      }
+    }
+
+    void
+    reset() noexcept
+    {
+      if (_operations)
+      {
+        _operations->destroy(_buffer);
+        _operations = nullptr;
+      }
+      _heap.reset();
+      _ptr = nullptr;
+    }
+
+   public:
+    Inline_Pimpl_Base() = default;
+
+    template <typename T,
+              std::enable_if_t<std::is_convertible_v<T*, const INTERFACE*>>* = nullptr>
+    Inline_Pimpl_Base(std::shared_ptr<T> ptr) : _heap(std::move(ptr))
+    {
+      _ptr = _heap.get();
+    }
+
+    Inline_Pimpl_Base(const Inline_Pimpl_Base& other) { copy_from(other); }
+    Inline_Pimpl_Base(Inline_Pimpl_Base&& other) noexcept { move_from(std::move(other)); }
+
+    // Differentiable_Function -> Function
+    template <typename OTHER_INTERFACE,
+              size_t OTHER_CAPACITY,
+              std::enable_if_t<std::is_convertible_v<const OTHER_INTERFACE*, const INTERFACE*>>* =
+                  nullptr>
+    Inline_Pimpl_Base(const Inline_Pimpl_Base<OTHER_INTERFACE, OTHER_CAPACITY>& other)
+    {
+      copy_from(other);
+    }
+    template <typename OTHER_INTERFACE,
+              size_t OTHER_CAPACITY,
+              std::enable_if_t<std::is_convertible_v<const OTHER_INTERFACE*, const INTERFACE*>>* =
+                  nullptr>
+    Inline_Pimpl_Base(Inline_Pimpl_Base<OTHER_INTERFACE, OTHER_CAPACITY>&& other) noexcept
+    {
+      move_from(std::move(other));
+    }
+
+    Inline_Pimpl_Base&
+    operator=(const Inline_Pimpl_Base& other)
+    {
+      if (this != &other)
+      {
+        reset();
+        copy_from(other);
+      }
+      return *this;
+    }
+    Inline_Pimpl_Base&
+    operator=(Inline_Pimpl_Base&& other) noexcept
+    {
+      if (this != &other)
+      {
+        reset();
+        move_from(std::move(other));
+      }
+      return *this;
+    }
+
+    ~Inline_Pimpl_Base() { reset(); }
+
+    template <typename IMPL, typename... ARGS>
+    void
+    emplace(ARGS&&... args)
+    {
+      static_assert(std::is_base_of_v<INTERFACE, IMPL>);
+
+      reset();
+
+      if constexpr (fits_inline_v<IMPL>)
+      {
+        _ptr        = new (_buffer) IMPL(std::forward<ARGS>(args)...);
+        _operations = &Operations_Of<IMPL>::value;
+      }
+      else
+      {
+        _heap = std::make_shared<const IMPL>(std::forward<ARGS>(args)...);
+        _ptr  = _heap.get();
+      }
+    }
+
+    explicit operator bool() const { return _ptr != nullptr; }
+
+    const INTERFACE&
+    operator*() const
+    {
+      assert(_ptr);
+      return *_ptr;
+    }
+    const INTERFACE*
+    operator->() const
+    {
+      assert(_ptr);
+      return _ptr;
+    }
+
+    bool
+    is_inline() const
+    {
+      return _operations != nullptr;
+    }
+  };
+}
+
+template <typename INTERFACE, size_t CAPACITY, bool COPYABLE>
+class Inline_Pimpl : public Pimpl_Storage_Detail::Inline_Pimpl_Base<INTERFACE, CAPACITY>
+{
+  using base_type = Pimpl_Storage_Detail::Inline_Pimpl_Base<INTERFACE, CAPACITY>;
+
+ public:
+  using base_type::base_type;
+  Inline_Pimpl() = default;
+
+  // A move-only IMPL could not be duplicated by the copies: shared on
+  // the heap (Shared_Storage behavior) instead of stored inline
+  template <typename IMPL, typename... ARGS>
+  void
+  emplace(ARGS&&... args)
+  {
+    if constexpr (std::is_copy_constructible_v<IMPL>)
+    {
+      base_type::template emplace<IMPL>(std::forward<ARGS>(args)...);
+    }
+    else
+    {
+      static_assert(std::is_base_of_v<INTERFACE, IMPL>);
+
+      this->reset();
+      this->_heap = std::make_shared<const IMPL>(std::forward<ARGS>(args)...);
+      this->_ptr  = this->_heap.get();
+    }
+  }
+};
+
+template <typename INTERFACE, size_t CAPACITY>
+class Inline_Pimpl<INTERFACE, CAPACITY, false>
+    : public Pimpl_Storage_Detail::Inline_Pimpl_Base<INTERFACE, CAPACITY>
+{
+  using base_type = Pimpl_Storage_Detail::Inline_Pimpl_Base<INTERFACE, CAPACITY>;
+
+ public:
+  using base_type::base_type;
+  Inline_Pimpl()                    = default;
+  Inline_Pimpl(const Inline_Pimpl&) = delete;
+  Inline_Pimpl(Inline_Pimpl&&)      = default;
+  Inline_Pimpl& operator=(const Inline_Pimpl&) = delete;
+  Inline_Pimpl& operator=(Inline_Pimpl&&) = default;
+
+  // Differentiable_Function -> Function: rvalues only
+  template <typename OTHER_INTERFACE, size_t OTHER_CAPACITY>
+  Inline_Pimpl(const Pimpl_Storage_Detail::Inline_Pimpl_Base<OTHER_INTERFACE, OTHER_CAPACITY>&) =
+      delete;
+};
+
+// Default capacity: vtable pointer + a few captured doubles
+//
+template <size_t CAPACITY = 6 * sizeof(void*), bool COPYABLE = true>
+struct Inline_Storage
+{
+  template <typename INTERFACE>
+  using pimpl_type = Inline_Pimpl<INTERFACE, CAPACITY, COPYABLE>;
+};
+
+template <size_t CAPACITY = 6 * sizeof(void*)>
+using Move_Only_Inline_Storage = Inline_Storage<CAPACITY, false>;
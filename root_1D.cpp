@@ -1,7 +1,15 @@
+#include "evaluation_cache.hpp"
 #include "functions.hpp"
+#include "instrumentation.hpp"
+#include "root_1D.hpp"
+#include "static_functions.hpp"
 
+#include <chrono>
+#include <cmath>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <vector>
 
 template <typename T>
 void
@@ -17,86 +25,92 @@ square_root(const T& x, T* f, T* df, T c)
   }
 }
 
-template <typename T>
-void
-show_iteration(size_t iter, T x, T f)
+int
+main()
 {
-  constexpr auto max_digits = std::numeric_limits<T>::max_digits10;
+  Differentiable_Function f(square_root<double>, 2);
+  bool has_converged;
+  const double x_init = 2;
+  double x;
 
-  std::cerr << std::setw(4) << iter << " x = " << std::setw(max_digits + 5)
-            << std::setprecision(max_digits) << x << " f = " << std::setw(max_digits + 5)
-            << std::setprecision(max_digits) << f << std::endl;
-}
+  ////////////////
 
-template <typename T>
-bool
-Newton(const Differentiable_Function<T, T, T>& f_obj,
-       T& x,
-       double epsilon  = 1e-10,
-       size_t max_iter = 20)
-{
-  T f, df; // assumed to be default constructible
+  std::cerr << std::endl << "Newton" << std::endl;
+  f.initialize_counter();
+  x = x_init;
 
-  bool has_converged = false;
+  auto profile = std::make_shared<Evaluation_Profile>();
+  auto f_timed = instrument(f, profile);
+  Time_Split time_split;
 
-  for (size_t iter = 1; iter <= max_iter; ++iter)
-  {
-    f_obj.f_df(x, f, df);
+  has_converged =
+      timed_run(*profile, time_split, [&]() { return Newton(f_timed, x, 1e-10, 20, true); });
 
-    auto delta_x = -f / df;
+  std::cerr << "has converged: " << std::boolalpha << has_converged << std::endl;
+  std::cerr << "f counter:  " << f.f_counter() << std::endl;
+  std::cerr << "df counter: " << f.df_counter() << std::endl;
+  std::cerr << *profile << time_split;
 
-    has_converged = std::abs(delta_x) < epsilon;
+  ////////////////
 
-    x = x + delta_x;
+  std::cerr << std::endl << "Steffensen" << std::endl;
+  f.initialize_counter();
+  x = x_init;
 
-    show_iteration(iter, x, f);
+  profile             = std::make_shared<Evaluation_Profile>();
+  auto function_timed = instrument(f.as_function(), profile);
 
-    if (has_converged) break;
-  }
-  return has_converged;
-}
+  has_converged = timed_run(*profile, time_split, [&]() {
+    return Steffensen(function_timed, x, 1e-10, 20, true);
+  });
 
-template <typename T>
-bool
-Steffensen(const Function<T, T>& f_obj, T& x, double epsilon = 1e-10, size_t max_iter = 20)
-{
-  T f, g; // assumed to be default constructible
+  std::cerr << "has converged: " << std::boolalpha << has_converged << std::endl;
+  std::cerr << "f counter:  " << f.f_counter() << std::endl;
+  std::cerr << "df counter: " << f.df_counter() << std::endl;
+  std::cerr << *profile << time_split;
 
-  bool has_converged = false;
+  ////////////////
 
-  for (size_t iter = 1; iter <= max_iter; ++iter)
-  {
-    f_obj.f(x, f);
-    f_obj.f(x + f, g);
+  std::cerr << std::endl << "Steffensen, memoized" << std::endl;
+  f.initialize_counter();
 
-    auto delta_x = -f * f / (g - f);
+  auto statistics = std::make_shared<Evaluation_Cache_Statistics>();
+  auto f_cached   = memoize(f, 16, statistics);
 
-    has_converged = std::abs(delta_x) < epsilon;
+  // Restarted from the same point: the points of the first run are
+  // served by the cache, as f(2) for the Brent bracket
+  for (size_t run = 0; run < 2; ++run)
+  {
+    x             = x_init;
+    has_converged = Steffensen(f_cached.as_function(), x, 1e-10, 20);
+  }
+  const bool bracket_converged = Brent(f_cached.as_function(), 0., 2., x, 1e-10, 100);
+  has_converged                = has_converged and bracket_converged;
 
-    x = x + delta_x;
+  std::cerr << "has converged: " << std::boolalpha << has_converged << std::endl;
+  std::cerr << "f counter:  " << f.f_counter() << std::endl;
+  std::cerr << "df counter: " << f.df_counter() << std::endl;
+  std::cerr << *statistics;
 
-    show_iteration(iter, x, f);
+  ////////////////
 
-    if (has_converged) break;
-  }
-  return has_converged;
-}
+  std::cerr << std::endl << "Newton (static function)" << std::endl;
+  auto static_f = static_differentiable_function<double, double, double>(square_root<double>, 2);
+  static_f.initialize_counter();
+  x = x_init;
 
-int
-main()
-{
-  Differentiable_Function f(square_root<double>, 2);
-  bool has_converged;
-  const double x_init = 2;
-  double x;
+  has_converged = Newton(static_f, x, 1e-10, 20, true);
+
+  std::cerr << "has converged: " << std::boolalpha << has_converged << std::endl;
+  std::cerr << "f counter:  " << static_f.f_counter() << std::endl;
+  std::cerr << "df counter: " << static_f.df_counter() << std::endl;
 
   ////////////////
 
-  std::cerr << std::endl << "Newton" << std::endl;
+  std::cerr << std::endl << "Brent, bracket [0, 2]" << std::endl;
   f.initialize_counter();
-  x = x_init;
 
-  has_converged = Newton(f, x);
+  has_converged = Brent(f.as_function(), 0., 2., x, 1e-10, 100, true);
 
   std::cerr << "has converged: " << std::boolalpha << has_converged << std::endl;
   std::cerr << "f counter:  " << f.f_counter() << std::endl;
@@ -104,13 +118,70 @@ main()
 
   ////////////////
 
-  std::cerr << std::endl << "Steffensen" << std::endl;
+  std::cerr << std::endl << "Newton-bisection, bracket [0, 2]" << std::endl;
   f.initialize_counter();
   x = x_init;
 
-  has_converged = Steffensen(f.as_function(), x);
+  has_converged = Newton_bisection(f, 0., 2., x, 1e-10, 100, true);
 
   std::cerr << "has converged: " << std::boolalpha << has_converged << std::endl;
   std::cerr << "f counter:  " << f.f_counter() << std::endl;
   std::cerr << "df counter: " << f.df_counter() << std::endl;
+
+  ////////////////
+
+  std::cerr << std::endl << "Newton (batch, sqrt(c) for c = 1..n)" << std::endl;
+  const size_t n = 1000000;
+  std::vector<double> c(n), x_batch(n, x_init);
+  for (size_t i = 0; i < n; ++i) c[i] = 1 + i;
+
+  auto batch_square_root =
+      [&](const size_t first, Span<const double> x, Span<double> f, Span<double> df) {
+        for (size_t i = 0; i < x.size(); ++i)
+        {
+          square_root(x[i], &f[i], &df[i], c[first + i]);
+        }
+      };
+
+  const auto start = std::chrono::steady_clock::now();
+  const size_t converged_count =
+      Newton_batch(batch_square_root, Span<double>(x_batch), {}, 1e-10, 100);
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  double max_error = 0;
+  for (size_t i = 0; i < n; ++i)
+  {
+    max_error = std::max(max_error, std::abs(x_batch[i] - std::sqrt(c[i])));
+  }
+  std::cerr << "converged: " << converged_count << "/" << n << std::endl;
+  std::cerr << "max error: " << max_error << std::endl;
+  std::cerr << "equations/s: " << n / seconds << std::endl;
+
+  ////////////////
+
+  std::cerr << std::endl << "Newton-bisection (batch, bracket [0, c + 1])" << std::endl;
+  std::vector<double> a_batch(n, 0), b_batch(n);
+  for (size_t i = 0; i < n; ++i) b_batch[i] = c[i] + 1;
+  x_batch.assign(n, x_init);
+
+  const auto bracketed_start            = std::chrono::steady_clock::now();
+  const size_t bracketed_converged_count = Newton_bisection_batch(batch_square_root,
+                                                                  Span<const double>(a_batch),
+                                                                  Span<const double>(b_batch),
+                                                                  Span<double>(x_batch),
+                                                                  {},
+                                                                  1e-10,
+                                                                  100);
+  const double bracketed_seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - bracketed_start).count();
+
+  max_error = 0;
+  for (size_t i = 0; i < n; ++i)
+  {
+    max_error = std::max(max_error, std::abs(x_batch[i] - std::sqrt(c[i])));
+  }
+  std::cerr << "converged: " << bracketed_converged_count << "/" << n << std::endl;
+  std::cerr << "max error: " << max_error << std::endl;
+  std::cerr << "equations/s: " << n / bracketed_seconds << std::endl;
 }
@@ -0,0 +1,638 @@
+#pragma once
+
+#include "identity.hpp"
+#include "iteration_log.hpp"
+#include "iteration_observer.hpp"
+#include "span.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <type_traits>
+
+// 1D root finding
+//
+// - Newton(f, x), Steffensen(f, x): one equation, quiet unless verbose
+//   (verbose_log()), an optional Iteration_Observer receives every
+//   iteration (same for Brent() and Newton_bisection())
+//
+// - Newton_batch(f, x, has_converged), Steffensen_batch(...): many
+//   independent equations solved in lockstep, blocks of lanes are
+//   evaluated by one batched call and a per-lane mask freezes the
+//   converged lanes. No I/O.
+//
+//   f is either a (Static_)Differentiable_Function (same equation for
+//   all lanes, batched by f_df_batch()/f_batch()) or a lambda
+//   evaluating equations [first, first + x.size()[, by example
+//
+//     [&](size_t first, Span<const double> x, Span<double> f, Span<double> df) {
+//       for (size_t i = 0; i < x.size(); ++i)
+//       {
+//         f[i]  = x[i] * x[i] - c[first + i];
+//         df[i] = 2 * x[i];
+//       }
+//     }
+//
+//   (Steffensen_batch: lambda(first, x, f))
+
+// verbose: pushed to verbose_log(), x: the new iterate, df: NaN if
+// not available
+template <typename T>
+void
+observe_iteration(const bool verbose,
+                  const Iteration_Observer& observer,
+                  const char* const solver,
+                  const size_t iter,
+                  const Iteration_Timer& timer,
+                  const T x,
+                  const T f,
+                  const T df,
+                  const T delta_x)
+{
+  const Iteration_Record record = make_iteration_record(solver,
+                                                        iter,
+                                                        timer.elapsed(),
+                                                        double(f),
+                                                        std::abs(double(df)),
+                                                        std::abs(double(delta_x)),
+                                                        double(x));
+
+  if (verbose) verbose_log().push(record);
+  if (observer) observer(record);
+}
+
+////////////
+// Newton //
+////////////
+//
+// DIFFERENTIABLE_FUNCTION: Differentiable_Function<T, T, T> or
+// Static_Differentiable_Function<F, T, T, T> (direct call, inlinable)
+//
+template <typename DIFFERENTIABLE_FUNCTION>
+bool
+Newton(const DIFFERENTIABLE_FUNCTION& f_obj,
+       typename DIFFERENTIABLE_FUNCTION::domain_type& x,
+       double epsilon                     = 1e-10,
+       size_t max_iter                    = 20,
+       const bool verbose                 = false,
+       const Iteration_Observer& observer = {})
+{
+  using T = typename DIFFERENTIABLE_FUNCTION::domain_type;
+
+  T f, df;  // assumed to be default constructible
+
+  bool has_converged = false;
+
+  const Iteration_Timer timer(static_cast<bool>(observer));
+  const Verbose_Scope verbose_scope(verbose);
+
+  for (size_t iter = 1; iter <= max_iter; ++iter)
+  {
+    f_obj.f_df(x, f, df);
+
+    auto delta_x = -f / df;
+
+    has_converged = std::abs(delta_x) < epsilon;
+
+    x = x + delta_x;
+
+    if (verbose or observer)
+    {
+      observe_iteration(verbose, observer, "Newton", iter, timer, x, f, df, delta_x);
+    }
+
+    if (has_converged) break;
+  }
+  return has_converged;
+}
+
+////////////////
+// Steffensen //
+////////////////
+//
+// FUNCTION: Function<T, T> or Static_Function<F, T, T>
+//
+template <typename FUNCTION>
+bool
+Steffensen(const FUNCTION& f_obj,
+           typename FUNCTION::domain_type& x,
+           double epsilon                     = 1e-10,
+           size_t max_iter                    = 20,
+           const bool verbose                 = false,
+           const Iteration_Observer& observer = {})
+{
+  using T = typename FUNCTION::domain_type;
+
+  T f, g;  // assumed to be default constructible
+
+  bool has_converged = false;
+
+  const Iteration_Timer timer(static_cast<bool>(observer));
+  const Verbose_Scope verbose_scope(verbose);
+
+  for (size_t iter = 1; iter <= max_iter; ++iter)
+  {
+    f_obj.f(x, f);
+    f_obj.f(x + f, g);
+
+    auto delta_x = -f * f / (g - f);
+
+    has_converged = std::abs(delta_x) < epsilon;
+
+    x = x + delta_x;
+
+    if (verbose or observer)
+    {
+      const T df = iteration_not_available;
+      observe_iteration(verbose, observer, "Steffensen", iter, timer, x, f, df, delta_x);
+    }
+
+    if (has_converged) break;
+  }
+  return has_converged;
+}
+
+///////////
+// Brent //
+///////////
+//
+// Bracketed root finding, f(a) and f(b) of opposite signs (otherwise
+// returns false). Inverse quadratic interpolation or secant steps,
+// safeguarded by bisection: always converges, one f() call per
+// iteration (+2 for the bracket).
+//
+// FUNCTION: Function<T, T> or Static_Function<F, T, T>
+//
+template <typename FUNCTION>
+bool
+Brent(const FUNCTION& f_obj,
+      typename FUNCTION::domain_type a,
+      typename FUNCTION::domain_type b,
+      typename FUNCTION::domain_type& x,
+      double epsilon                     = 1e-10,
+      size_t max_iter                    = 100,
+      const bool verbose                 = false,
+      const Iteration_Observer& observer = {})
+{
+  using T = typename FUNCTION::domain_type;
+
+  const Iteration_Timer timer(static_cast<bool>(observer));
+  const Verbose_Scope verbose_scope(verbose);
+
+  T fa, fb;  // assumed to be default constructible
+  f_obj.f(a, fa);
+  f_obj.f(b, fb);
+
+  if ((fa > 0) == (fb > 0) and (fa != 0) and (fb != 0)) return false;
+
+  // b: best estimate, c: previous b or the other end of the bracket
+  T c = a, fc = fa, d = b - a, e = d;
+
+  for (size_t iter = 1; iter <= max_iter; ++iter)
+  {
+    if ((fb > 0) == (fc > 0))
+    {
+      c  = a;
+      fc = fa;
+      d = e = b - a;
+    }
+    if (std::abs(fc) < std::abs(fb))
+    {
+      a  = b;
+      b  = c;
+      c  = a;
+      fa = fb;
+      fb = fc;
+      fc = fa;
+    }
+
+    const T tolerance = 2 * std::numeric_limits<T>::epsilon() * std::abs(b) + epsilon / 2;
+    const T m         = (c - b) / 2;
+
+    if ((std::abs(m) <= tolerance) or (fb == 0))
+    {
+      x = b;
+      return true;
+    }
+
+    if ((std::abs(e) >= tolerance) and (std::abs(fa) > std::abs(fb)))
+    {
+      // Interpolation
+      T p, q;
+      const T s = fb / fa;
+      if (a == c)
+      {
+        p = 2 * m * s;  // secant
+        q = 1 - s;
+      }
+      else
+      {
+        const T r = fb / fc;  // inverse quadratic
+        const T t = fa / fc;
+        p         = s * (2 * m * t * (t - r) - (b - a) * (r - 1));
+        q         = (t - 1) * (r - 1) * (s - 1);
+      }
+      if (p > 0)
+        q = -q;
+      else
+        p = -p;
+
+      if (2 * p < std::min(3 * m * q - std::abs(tolerance * q), std::abs(e * q)))
+      {
+        e = d;
+        d = p / q;
+      }
+      else
+      {
+        d = e = m;  // bisection
+      }
+    }
+    else
+    {
+      d = e = m;  // bisection
+    }
+
+    a  = b;
+    fa = fb;
+    b += (std::abs(d) > tolerance) ? d : (m > 0 ? tolerance : -tolerance);
+    f_obj.f(b, fb);
+
+    if (verbose or observer)
+    {
+      const T df = iteration_not_available;
+      observe_iteration(verbose, observer, "Brent", iter, timer, b, fb, df, b - a);
+    }
+  }
+  x = b;
+  return false;
+}
+
+//////////////////////
+// Newton_bisection //
+//////////////////////
+//
+// Newton steps, replaced by bisection when they leave the bracket
+// [a, b] or do not reduce it fast enough. One f_df() call per
+// iteration (+2 f() for the bracket). x: initial guess (the middle of
+// [a, b] if outside), then the root.
+//
+// DIFFERENTIABLE_FUNCTION: Differentiable_Function<T, T, T> or
+// Static_Differentiable_Function<F, T, T, T>
+//
+template <typename DIFFERENTIABLE_FUNCTION>
+bool
+Newton_bisection(const DIFFERENTIABLE_FUNCTION& f_obj,
+                 const typename DIFFERENTIABLE_FUNCTION::domain_type a,
+                 const typename DIFFERENTIABLE_FUNCTION::domain_type b,
+                 typename DIFFERENTIABLE_FUNCTION::domain_type& x,
+                 double epsilon                     = 1e-10,
+                 size_t max_iter                    = 100,
+                 const bool verbose                 = false,
+                 const Iteration_Observer& observer = {})
+{
+  using T = typename DIFFERENTIABLE_FUNCTION::domain_type;
+
+  const Iteration_Timer timer(static_cast<bool>(observer));
+  const Verbose_Scope verbose_scope(verbose);
+
+  T fa, fb;  // assumed to be default constructible
+  f_obj.f(a, fa);
+  f_obj.f(b, fb);
+
+  if (fa == 0 or fb == 0)
+  {
+    x = (fa == 0) ? a : b;
+    return true;
+  }
+  if ((fa > 0) == (fb > 0)) return false;
+
+  // f(x_negative) < 0 < f(x_positive)
+  T x_negative = (fa < 0) ? a : b;
+  T x_positive = (fa < 0) ? b : a;
+
+  if (not((x - a) * (x - b) < 0)) x = (a + b) / 2;
+
+  T f, df;
+  T delta_x_old = std::abs(b - a);
+
+  for (size_t iter = 1; iter <= max_iter; ++iter)
+  {
+    f_obj.f_df(x, f, df);
+
+    if (f == 0) return true;
+    (f < 0 ? x_negative : x_positive) = x;
+
+    const T x_newton = x - f / df;
+    const bool use_bisection =
+        not((x_newton - x_negative) * (x_newton - x_positive) < 0) or
+        (std::abs(2 * f) > std::abs(delta_x_old * df));
+
+    const T x_new   = use_bisection ? (x_negative + x_positive) / 2 : x_newton;
+    const T delta_x = x_new - x;
+
+    delta_x_old = delta_x;
+    x           = x_new;
+
+    if (verbose or observer)
+    {
+      observe_iteration(verbose, observer, "Newton_bis", iter, timer, x, f, df, delta_x);
+    }
+
+    if (std::abs(delta_x) < epsilon) return true;
+  }
+  return false;
+}
+
+///////////////////
+// Batch solvers //
+///////////////////
+//
+namespace Root_1D_Detail
+{
+  // Lanes processed in lockstep, the per-block buffers live on the
+  // stack
+  static constexpr size_t batch_block_size = 256;
+
+  template <typename F, typename T>
+  void
+  f_df_block(const F& f, const size_t first, Span<const T> x, Span<T> y, Span<T> df)
+  {
+    if constexpr (std::is_invocable_v<const F&, size_t, Span<const T>, Span<T>, Span<T>>)
+    {
+      f(first, x, y, df);
+    }
+    else
+    {
+      f.f_df_batch(x, y, df);
+    }
+  }
+
+  template <typename F, typename T>
+  void
+  f_block(const F& f, const size_t first, Span<const T> x, Span<T> y)
+  {
+    if constexpr (std::is_invocable_v<const F&, size_t, Span<const T>, Span<T>>)
+    {
+      f(first, x, y);
+    }
+    else
+    {
+      f.f_batch(x, y);
+    }
+  }
+
+  // f values only, from a lambda(first, x, f, df) or f_batch()
+  template <typename F, typename T>
+  void
+  f_block_of_f_df(
+      const F& f, const size_t first, Span<const T> x, Span<T> y, Span<T> df_workspace)
+  {
+    if constexpr (std::is_invocable_v<const F&, size_t, Span<const T>, Span<T>, Span<T>>)
+    {
+      f(first, x, y, df_workspace);
+    }
+    else
+    {
+      f.f_batch(x, y);
+    }
+  }
+
+  // Per-lane state
+  static constexpr unsigned char lane_converged = 0;
+  static constexpr unsigned char lane_active    = 1;
+  static constexpr unsigned char lane_failed    = 2;  // by example no bracket
+
+  // Block driver: initialize(block_first, block_size, state) can mark
+  // failed lanes, update(block_first, block_size, state) performs one
+  // iteration on the active lanes of the block and returns the number
+  // of lanes still active
+  template <typename T, typename INITIALIZE, typename UPDATE>
+  size_t
+  solve_blocks(Span<T> x,
+               Span<bool> has_converged,
+               const size_t max_iter,
+               INITIALIZE&& initialize,
+               UPDATE&& update)
+  {
+    assert(has_converged.empty() or (has_converged.size() == x.size()));
+
+    size_t converged_count = 0;
+
+    for (size_t first = 0; first < x.size(); first += batch_block_size)
+    {
+      const size_t size = std::min(batch_block_size, x.size() - first);
+
+      std::array<unsigned char, batch_block_size> state;
+      std::fill(state.begin(), state.begin() + size, lane_active);
+
+      size_t active_count = initialize(first, size, state.data());
+      for (size_t iter = 1; (iter <= max_iter) and (active_count > 0); ++iter)
+      {
+        active_count = update(first, size, state.data());
+      }
+
+      for (size_t i = 0; i < size; ++i)
+      {
+        converged_count += (state[i] == lane_converged);
+        if (not has_converged.empty()) has_converged[first + i] = (state[i] == lane_converged);
+      }
+    }
+    return converged_count;
+  }
+  template <typename T, typename UPDATE>
+  size_t
+  solve_blocks(Span<T> x, Span<bool> has_converged, const size_t max_iter, UPDATE&& update)
+  {
+    return solve_blocks(
+        x,
+        has_converged,
+        max_iter,
+        [](const size_t, const size_t size, unsigned char*) { return size; },
+        std::forward<UPDATE>(update));
+  }
+}
+
+//////////////////
+// Newton_batch //
+//////////////////
+//
+// Returns the number of converged lanes, has_converged (optional, can
+// be empty) receives the per-lane status
+//
+template <typename F, typename T>
+size_t
+Newton_batch(const F& f_obj,
+             Span<T> x,
+             Span<bool> has_converged    = {},
+             const Identity_t<T> epsilon = 1e-10,
+             const size_t max_iter       = 20)
+{
+  using namespace Root_1D_Detail;
+
+  std::array<T, batch_block_size> f, df;
+
+  auto update = [&](const size_t first, const size_t size, unsigned char* const state) {
+    const Span<T> x_block = x.subspan(first, size);
+
+    f_df_block(f_obj,
+               first,
+               Span<const T>(x_block),
+               Span<T>(f.data(), size),
+               Span<T>(df.data(), size));
+
+    // Branch-free, vectorizable
+    size_t active_count = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+      const bool active = (state[i] == lane_active);
+      const T delta_x   = active ? -f[i] / df[i] : T(0);
+
+      x_block[i] += delta_x;
+      state[i] = (active and (std::abs(delta_x) < epsilon)) ? lane_converged : state[i];
+      active_count += (state[i] == lane_active);
+    }
+    return active_count;
+  };
+
+  return solve_blocks(x, has_converged, max_iter, update);
+}
+
+//////////////////////
+// Steffensen_batch //
+//////////////////////
+//
+template <typename F, typename T>
+size_t
+Steffensen_batch(const F& f_obj,
+                 Span<T> x,
+                 Span<bool> has_converged    = {},
+                 const Identity_t<T> epsilon = 1e-10,
+                 const size_t max_iter       = 20)
+{
+  using namespace Root_1D_Detail;
+
+  std::array<T, batch_block_size> f, x_plus_f, g;
+
+  auto update = [&](const size_t first, const size_t size, unsigned char* const state) {
+    const Span<T> x_block = x.subspan(first, size);
+
+    f_block(f_obj, first, Span<const T>(x_block), Span<T>(f.data(), size));
+    for (size_t i = 0; i < size; ++i) x_plus_f[i] = x_block[i] + f[i];
+    f_block(f_obj, first, Span<const T>(x_plus_f.data(), size), Span<T>(g.data(), size));
+
+    size_t active_count = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+      const bool active = (state[i] == lane_active);
+      const T delta_x   = active ? -f[i] * f[i] / (g[i] - f[i]) : T(0);
+
+      x_block[i] += delta_x;
+      state[i] = (active and (std::abs(delta_x) < epsilon)) ? lane_converged : state[i];
+      active_count += (state[i] == lane_active);
+    }
+    return active_count;
+  };
+
+  return solve_blocks(x, has_converged, max_iter, update);
+}
+
+////////////////////////////
+// Newton_bisection_batch //
+////////////////////////////
+//
+// Per-lane brackets [a[i], b[i]], x[i]: initial guesses then roots.
+// Lanes without bracket are reported as not converged.
+//
+template <typename F, typename T>
+size_t
+Newton_bisection_batch(const F& f_obj,
+                       Span<const T> a,
+                       Span<const T> b,
+                       Span<T> x,
+                       Span<bool> has_converged    = {},
+                       const Identity_t<T> epsilon = 1e-10,
+                       const size_t max_iter       = 100)
+{
+  using namespace Root_1D_Detail;
+
+  assert(a.size() == x.size() and b.size() == x.size());
+
+  std::array<T, batch_block_size> f, df, x_negative, x_positive, delta_x_old;
+
+  auto initialize = [&](const size_t first, const size_t size, unsigned char* const state) {
+    const Span<T> x_block = x.subspan(first, size);
+
+    // x_negative, x_positive as buffers for f(a), f(b)
+    const Span<T> df_workspace(df.data(), size);
+    f_block_of_f_df(
+        f_obj, first, a.subspan(first, size), Span<T>(x_negative.data(), size), df_workspace);
+    f_block_of_f_df(
+        f_obj, first, b.subspan(first, size), Span<T>(x_positive.data(), size), df_workspace);
+
+    size_t active_count = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+      const T a_i = a[first + i], b_i = b[first + i];
+      const T fa = x_negative[i], fb = x_positive[i];
+
+      if (fa == 0 or fb == 0)
+      {
+        x_block[i] = (fa == 0) ? a_i : b_i;
+        state[i]   = lane_converged;
+      }
+      else if ((fa > 0) == (fb > 0))
+      {
+        state[i] = lane_failed;
+      }
+      x_negative[i]  = (fa < 0) ? a_i : b_i;
+      x_positive[i]  = (fa < 0) ? b_i : a_i;
+      delta_x_old[i] = std::abs(b_i - a_i);
+
+      if ((state[i] == lane_active) and not((x_block[i] - a_i) * (x_block[i] - b_i) < 0))
+      {
+        x_block[i] = (a_i + b_i) / 2;
+      }
+      active_count += (state[i] == lane_active);
+    }
+    return active_count;
+  };
+
+  auto update = [&](const size_t first, const size_t size, unsigned char* const state) {
+    const Span<T> x_block = x.subspan(first, size);
+
+    f_df_block(f_obj,
+               first,
+               Span<const T>(x_block),
+               Span<T>(f.data(), size),
+               Span<T>(df.data(), size));
+
+    size_t active_count = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+      const bool active = (state[i] == lane_active);
+      const T x_i       = x_block[i];
+
+      x_negative[i] = (active and f[i] < 0) ? x_i : x_negative[i];
+      x_positive[i] = (active and f[i] > 0) ? x_i : x_positive[i];
+
+      const T x_newton = x_i - f[i] / df[i];
+      const bool use_bisection =
+          not((x_newton - x_negative[i]) * (x_newton - x_positive[i]) < 0) or
+          (std::abs(2 * f[i]) > std::abs(delta_x_old[i] * df[i]));
+
+      const T x_new   = use_bisection ? (x_negative[i] + x_positive[i]) / 2 : x_newton;
+      const T delta_x = (active and f[i] != 0) ? x_new - x_i : T(0);
+
+      delta_x_old[i] = active ? delta_x : delta_x_old[i];
+      x_block[i]     = x_i + delta_x;
+      state[i]       = (active and (std::abs(delta_x) < epsilon)) ? lane_converged : state[i];
+      active_count += (state[i] == lane_active);
+    }
+    return active_count;
+  };
+
+  return solve_blocks(x, has_converged, max_iter, initialize, update);
+}
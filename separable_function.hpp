@@ -0,0 +1,298 @@
+#pragma once
+
+#include "function_combinators.hpp"
+#include "functions.hpp"
+#include "sum_of_terms.hpp"
+#include "thread_pool.hpp"
+#include "vector_traits.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <numeric>
+#include <type_traits>
+#include <vector>
+
+// The whole objective F(x) = 1/N sum_i f_i(x) of a
+// Sum_Of_Terms_Function, the terms being evaluated in parallel:
+//
+//   Thread_Pool thread_pool(8);
+//   auto objective = separable_function(loss, &thread_pool);
+//
+//   Adam_optimize(configuration, objective, x, y, grad);
+//
+// The terms are split into chunks of grain_size terms (one
+// f_df_minibatch() call each), handed out round-robin to one
+// accumulator per thread. The accumulators are summed by a pairwise
+// tree. The chunk to accumulator assignment being fixed, the results
+// are reproducible for a given term count, grain size and thread
+// count.
+//
+// grain_size = 0: 4 chunks per thread
+//
+// The terms lambda must be callable from several threads (its
+// counters then Relaxed_Atomic or Sharded) and must not throw. As
+// everywhere, df is sized by the caller: the accumulators handed to
+// the lambda have the size of the df given to the returned function.
+// Concurrent evaluations of the returned function are supported
+// (each call uses thread_local accumulators of its calling thread, no
+// lock is held across parallel_for()), an evaluation from a task of
+// thread_pool (multistart()) runs inline.
+//
+// DIFFERENTIAL_TYPE: contiguous vector (Vector_Traits)
+
+namespace Separable_Function_Detail
+{
+  // Gradient elements per reduction task
+  static constexpr size_t reduction_block_size = 4096;
+
+  static constexpr size_t chunks_per_thread = 4;
+
+  // Per evaluation, slot 0 accumulates into the caller's buffer
+  template <typename CODOMAIN_TYPE, typename DIFFERENTIAL_TYPE, typename SCALAR>
+  struct Accumulators
+  {
+    std::vector<CODOMAIN_TYPE> y;
+    std::vector<DIFFERENTIAL_TYPE> df;
+    std::vector<DIFFERENTIAL_TYPE> chunk_df;
+    std::vector<SCALAR*> df_data;
+  };
+}
+
+////////////////////////
+// separable_function //
+////////////////////////
+//
+// thread_pool = nullptr (or one thread): a single call with all the
+// terms
+//
+template <typename DOMAIN_TYPE,
+          typename CODOMAIN_TYPE,
+          typename DIFFERENTIAL_TYPE,
+          typename STORAGE>
+Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE, STORAGE>
+separable_function(
+    const Sum_Of_Terms_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE, STORAGE>& terms,
+    Thread_Pool* const thread_pool,
+    const size_t grain_size = 0)
+{
+  using terms_type = Sum_Of_Terms_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE, STORAGE>;
+  using differentiable_function_type =
+      Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE, STORAGE>;
+  using traits = Vector_Traits<DIFFERENTIAL_TYPE>;
+  using scalar = typename traits::scalar_type;
+  using accumulators_type =
+      Separable_Function_Detail::Accumulators<CODOMAIN_TYPE, DIFFERENTIAL_TYPE, scalar>;
+
+  static_assert(Is_Vector<DIFFERENTIAL_TYPE>::value, "Expected a contiguous vector differential");
+
+  assert(terms.term_count() > 0);
+
+  struct Impl final : public differentiable_function_type::Diff_Interface
+  {
+    terms_type _terms;
+    Thread_Pool* _thread_pool;
+    size_t _grain_size;
+    std::vector<size_t> _indices;  // 0, 1, ... N - 1
+
+    Impl(const terms_type& terms, Thread_Pool* const thread_pool, const size_t grain_size)
+        : _terms(terms),
+          _thread_pool(thread_pool),
+          _grain_size(grain_size),
+          _indices(terms.term_count())
+    {
+      std::iota(_indices.begin(), _indices.end(), size_t(0));
+
+      const size_t thread_count = _thread_pool ? _thread_pool->size() : 1;
+      if (_grain_size == 0)
+      {
+        const size_t chunk_count = thread_count * Separable_Function_Detail::chunks_per_thread;
+        _grain_size = std::max<size_t>(1, (_indices.size() + chunk_count - 1) / chunk_count);
+      }
+    }
+
+    // y (df) null if not requested
+    void
+    evaluate_minibatch(const DOMAIN_TYPE& x,
+                       Span<const size_t> indices,
+                       CODOMAIN_TYPE* const y,
+                       DIFFERENTIAL_TYPE* const df) const
+    {
+      if (y and df)
+      {
+        _terms.f_df_minibatch(x, indices, *y, *df);
+      }
+      else if (y)
+      {
+        _terms.f_minibatch(x, indices, *y);
+      }
+      else
+      {
+        _terms.df_minibatch(x, indices, *df);
+      }
+    }
+
+    // Slot accumulator: sum over its chunks of |chunk| / N chunk
+    // average
+    void
+    accumulate_slot(const DOMAIN_TYPE& x,
+                    accumulators_type& accumulators,
+                    const size_t slot,
+                    const size_t slot_count,
+                    DIFFERENTIAL_TYPE* const df) const
+    {
+      const size_t term_count  = _indices.size();
+      const size_t chunk_count = (term_count + _grain_size - 1) / _grain_size;
+      const bool y_requested   = not accumulators.y.empty();
+
+      CODOMAIN_TYPE y_slot = CODOMAIN_TYPE(0);
+
+      for (size_t chunk = slot; chunk < chunk_count; chunk += slot_count)
+      {
+        const size_t begin = chunk * _grain_size;
+        const size_t size  = std::min(_grain_size, term_count - begin);
+        const bool first   = (chunk == slot);
+
+        const CODOMAIN_TYPE weight = CODOMAIN_TYPE(size) / CODOMAIN_TYPE(term_count);
+
+        CODOMAIN_TYPE y_chunk       = CODOMAIN_TYPE(0);
+        DIFFERENTIAL_TYPE* df_chunk = df ? (first ? df : &accumulators.chunk_df[slot]) : nullptr;
+
+        evaluate_minibatch(x,
+                           Span<const size_t>(_indices.data() + begin, size),
+                           y_requested ? &y_chunk : nullptr,
+                           df_chunk);
+
+        y_slot += weight * y_chunk;
+
+        if (not df) continue;
+
+        scalar* const p = traits::data(*df);
+        const size_t n  = traits::size(*df);
+        if (first)
+        {
+          for (size_t i = 0; i < n; ++i)
+          {
+            p[i] = scalar(weight * p[i]);
+          }
+        }
+        else
+        {
+          assert(traits::size(*df_chunk) == n);
+
+          const scalar* const q = traits::data(*df_chunk);
+          for (size_t i = 0; i < n; ++i)
+          {
+            p[i] = scalar(p[i] + weight * q[i]);
+          }
+        }
+      }
+      if (y_requested) accumulators.y[slot] = y_slot;
+    }
+
+    void
+    evaluate(const DOMAIN_TYPE& x, CODOMAIN_TYPE* const y, DIFFERENTIAL_TYPE* const df) const
+    {
+      const size_t term_count   = _indices.size();
+      const size_t chunk_count  = (term_count + _grain_size - 1) / _grain_size;
+      const size_t thread_count = _thread_pool ? _thread_pool->size() : 1;
+      const size_t slot_count   = std::min(thread_count, chunk_count);
+
+      if (slot_count <= 1)
+      {
+        evaluate_minibatch(x, _indices, y, df);
+        return;
+      }
+
+      const Function_Combinator_Detail::Scratch<accumulators_type> scratch;
+      accumulators_type& accumulators = *scratch;
+
+      accumulators.y.assign(y ? slot_count : 0, CODOMAIN_TYPE(0));
+      if (df)
+      {
+        const size_t n = traits::size(*df);
+
+        accumulators.df.resize(slot_count);
+        accumulators.chunk_df.resize(slot_count);
+        for (size_t slot = 0; slot < slot_count; ++slot)
+        {
+          if (slot > 0) traits::resize(accumulators.df[slot], n);  // slot 0: df
+          traits::resize(accumulators.chunk_df[slot], n);
+        }
+      }
+
+      _thread_pool->parallel_for(slot_count, [&](const size_t slot) {
+        DIFFERENTIAL_TYPE* const accumulator = (slot == 0) ? df : &accumulators.df[slot];
+
+        accumulate_slot(x, accumulators, slot, slot_count, df ? accumulator : nullptr);
+      });
+
+      // Pairwise tree: slot s += slot s + stride
+      if (df)
+      {
+        const size_t n = traits::size(*df);
+
+        std::vector<scalar*>& df_data = accumulators.df_data;
+
+        df_data.resize(slot_count);
+        df_data[0] = traits::data(*df);
+        for (size_t slot = 1; slot < slot_count; ++slot)
+        {
+          assert(traits::size(accumulators.df[slot]) == n);
+          df_data[slot] = traits::data(accumulators.df[slot]);
+        }
+
+        const size_t block_size  = Separable_Function_Detail::reduction_block_size;
+        const size_t block_count = (n + block_size - 1) / block_size;
+
+        parallel_for(_thread_pool, block_count, [&](const size_t block) {
+          const size_t begin = block * block_size;
+          const size_t end   = std::min(n, begin + block_size);
+
+          for (size_t stride = 1; stride < slot_count; stride *= 2)
+          {
+            for (size_t slot = 0; slot + stride < slot_count; slot += 2 * stride)
+            {
+              scalar* const p       = df_data[slot];
+              const scalar* const q = df_data[slot + stride];
+              for (size_t i = begin; i < end; ++i)
+              {
+                p[i] += q[i];
+              }
+            }
+          }
+        });
+      }
+      if (y)
+      {
+        std::vector<CODOMAIN_TYPE>& y_slots = accumulators.y;
+
+        for (size_t stride = 1; stride < slot_count; stride *= 2)
+        {
+          for (size_t slot = 0; slot + stride < slot_count; slot += 2 * stride)
+          {
+            y_slots[slot] += y_slots[slot + stride];
+          }
+        }
+        *y = y_slots[0];
+      }
+    }
+
+    void
+    f(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y) const
+    {
+      evaluate(x, &y, nullptr);
+    }
+    void
+    f_df(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y, DIFFERENTIAL_TYPE& df) const
+    {
+      evaluate(x, &y, &df);
+    }
+    void
+    df(const DOMAIN_TYPE& x, DIFFERENTIAL_TYPE& df) const
+    {
+      evaluate(x, nullptr, &df);
+    }
+  };
+  return {std::make_shared<const Impl>(terms, thread_pool, grain_size)};
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+
+// Runtime selection of the SIMD kernels.
+//
+// x86-64: AVX-512F or AVX2+FMA kernels are compiled thanks to GCC/Clang
+// target attributes (no -march flag needed) and selected at runtime
+// from the CPU features. AArch64: NEON is always available.
+//
+// Define MATH_FUNCTIONS_NO_SIMD to only use the scalar kernels.
+
+#if not defined(MATH_FUNCTIONS_NO_SIMD)
+#if (defined(__GNUC__) or defined(__clang__)) and defined(__x86_64__)
+#define MATH_FUNCTIONS_SIMD_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) and defined(__ARM_NEON)
+#define MATH_FUNCTIONS_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+#endif
+
+enum class Simd_Instruction_Set
+{
+  Scalar,
+  AVX2,
+  AVX512,
+  NEON
+};
+
+namespace Simd_Detail
+{
+  inline Simd_Instruction_Set
+  detect_simd_instruction_set()
+  {
+#if defined(MATH_FUNCTIONS_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return Simd_Instruction_Set::AVX512;
+    if (__builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma"))
+      return Simd_Instruction_Set::AVX2;
+#elif defined(MATH_FUNCTIONS_SIMD_NEON)
+    return Simd_Instruction_Set::NEON;
+#endif
+    return Simd_Instruction_Set::Scalar;
+  }
+
+  inline std::atomic<Simd_Instruction_Set>&
+  selected_simd_instruction_set()
+  {
+    static std::atomic<Simd_Instruction_Set> selected{detect_simd_instruction_set()};
+    return selected;
+  }
+}
+
+// The instruction set used by the kernels
+//
+inline Simd_Instruction_Set
+simd_instruction_set()
+{
+  return Simd_Detail::selected_simd_instruction_set().load(std::memory_order_relaxed);
+}
+
+// Forces an instruction set (benchmarks, tests). It must be supported
+// by the CPU, use Scalar to disable SIMD.
+//
+inline void
+set_simd_instruction_set(const Simd_Instruction_Set instruction_set)
+{
+  Simd_Detail::selected_simd_instruction_set().store(instruction_set, std::memory_order_relaxed);
+}
+
+inline const char*
+to_string(const Simd_Instruction_Set instruction_set)
+{
+  switch (instruction_set)
+  {
+    case Simd_Instruction_Set::Scalar:
+      return "scalar";
+    case Simd_Instruction_Set::AVX2:
+      return "avx2";
+    case Simd_Instruction_Set::AVX512:
+      return "avx512";
+    case Simd_Instruction_Set::NEON:
+      return "neon";
+  }
+  return "unknown";
+}
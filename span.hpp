@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <valarray>
+
+//////////
+// Span //
+//////////
+//
+// Minimal C++17 stand-in for std::span<T>: a non-owning (pointer,
+// size) view over contiguous storage.
+//
+template <typename T>
+class Span
+{
+ public:
+  using element_type = T;
+  using value_type   = std::remove_cv_t<T>;
+  using size_type    = size_t;
+  using pointer      = T*;
+  using reference    = T&;
+  using iterator     = T*;
+
+ protected:
+  T* _data;
+  size_t _size;
+
+ public:
+  constexpr Span() noexcept : _data{nullptr}, _size{0} {}
+  constexpr Span(T* data, size_t size) noexcept : _data{data}, _size{size} {}
+
+  // Span<T> -> Span<const T>
+  template <typename U, std::enable_if_t<std::is_convertible_v<U (*)[], T (*)[]>>* = nullptr>
+  constexpr Span(const Span<U>& other) noexcept : _data{other.data()}, _size{other.size()}
+  {
+  }
+
+  // Any contiguous container providing std::data() and std::size()
+  template <typename CONTAINER,
+            typename DATA = decltype(std::data(std::declval<CONTAINER&>())),
+            std::enable_if_t<not std::is_same_v<std::decay_t<CONTAINER>, Span> and
+                             std::is_convertible_v<DATA, T*>>* = nullptr>
+  constexpr Span(CONTAINER& container) noexcept
+      : _data{std::data(container)}, _size{std::size(container)}
+  {
+  }
+
+  // std::valarray has no data() member
+  Span(std::valarray<value_type>& v) noexcept : _data{std::begin(v)}, _size{v.size()} {}
+
+  template <typename U = T, std::enable_if_t<std::is_const_v<U>>* = nullptr>
+  Span(const std::valarray<value_type>& v) noexcept : _data{std::begin(v)}, _size{v.size()}
+  {
+  }
+
+  constexpr T*
+  data() const noexcept
+  {
+    return _data;
+  }
+  constexpr size_t
+  size() const noexcept
+  {
+    return _size;
+  }
+  constexpr bool
+  empty() const noexcept
+  {
+    return _size == 0;
+  }
+
+  constexpr T&
+  operator[](const size_t i) const
+  {
+    assert(i < _size);
+    return _data[i];
+  }
+
+  constexpr T*
+  begin() const noexcept
+  {
+    return _data;
+  }
+  constexpr T*
+  end() const noexcept
+  {
+    return _data + _size;
+  }
+
+  constexpr Span
+  subspan(const size_t offset, const size_t count) const
+  {
+    assert(offset + count <= _size);
+    return {_data + offset, count};
+  }
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "span.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Sparse vector of a given dimension: (index, value) pairs, typically
+// the differential type of high-dimensional objectives whose gradients
+// have few non-zeros (sparse features):
+//
+//   Differentiable_Function<std::valarray<double>, double, Sparse_Vector<double>> f(
+//       [&](const std::valarray<double>& x, double* y, Sparse_Vector<double>* df) {
+//         ...
+//         if (df)
+//         {
+//           df->clear();
+//           for (...) df->push_back(feature, value);
+//         }
+//       });
+//
+// As an output the vector is cleared first. Indices can be pushed in
+// any order and repeated: coalesce() sorts them and sums the values
+// of a repeated index. The storage is kept by clear(), no allocation
+// once the capacity is reached.
+//
+// See Adam_sparse.hpp for lazy Adam iterations.
+
+///////////////////
+// Sparse_Vector //
+///////////////////
+//
+template <typename SCALAR_TYPE>
+class Sparse_Vector
+{
+ public:
+  using scalar_type = SCALAR_TYPE;
+
+ protected:
+  std::vector<size_t> _indices;
+  std::vector<SCALAR_TYPE> _values;
+  size_t _size;
+
+  std::vector<std::pair<size_t, SCALAR_TYPE>> _coalesce_buffer;
+
+ public:
+  Sparse_Vector() : _size{0} {}
+  explicit Sparse_Vector(const size_t size) : _size{size} {}
+
+  // Dimension
+  size_t
+  size() const
+  {
+    return _size;
+  }
+  // Changes the dimension, clears the entries
+  void
+  resize(const size_t size)
+  {
+    _size = size;
+    clear();
+  }
+
+  size_t
+  non_zero_count() const
+  {
+    return _indices.size();
+  }
+
+  void
+  clear()
+  {
+    _indices.clear();
+    _values.clear();
+  }
+
+  void
+  reserve(const size_t non_zero_count)
+  {
+    _indices.reserve(non_zero_count);
+    _values.reserve(non_zero_count);
+  }
+
+  void
+  push_back(const size_t index, const SCALAR_TYPE value)
+  {
+    assert(index < _size);
+
+    _indices.push_back(index);
+    _values.push_back(value);
+  }
+
+  Span<const size_t>
+  indices() const
+  {
+    return {_indices.data(), _indices.size()};
+  }
+  Span<const SCALAR_TYPE>
+  values() const
+  {
+    return {_values.data(), _values.size()};
+  }
+  Span<SCALAR_TYPE>
+  values()
+  {
+    return {_values.data(), _values.size()};
+  }
+
+  // Strictly increasing indices
+  bool
+  is_coalesced() const
+  {
+    return std::adjacent_find(_indices.begin(), _indices.end(), [](size_t a, size_t b) {
+             return a >= b;
+           }) == _indices.end();
+  }
+
+  // Sorts the indices and sums the values of the repeated ones (only
+  // a linear test if already done)
+  void
+  coalesce()
+  {
+    if (is_coalesced()) return;
+
+    _coalesce_buffer.clear();
+    for (size_t i = 0; i < _indices.size(); ++i)
+    {
+      _coalesce_buffer.emplace_back(_indices[i], _values[i]);
+    }
+    std::sort(_coalesce_buffer.begin(),
+              _coalesce_buffer.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    clear();
+    for (const auto& [index, value] : _coalesce_buffer)
+    {
+      if ((not _indices.empty()) and (_indices.back() == index))
+      {
+        _values.back() += value;
+      }
+      else
+      {
+        _indices.push_back(index);
+        _values.push_back(value);
+      }
+    }
+  }
+};
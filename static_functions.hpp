@@ -0,0 +1,344 @@
+#pragma once
+
+#include "functions.hpp"
+
+#include <cassert>
+#include <memory>
+#include <utility>
+
+// Statically typed counterparts of Function and
+// Differentiable_Function. The wrapped callable is stored by value
+// and called directly, hence solvers templated on the function type
+// can inline it. Use the conversion operators to get the type-erased
+// version at API boundaries.
+
+namespace Static_Function_Detail
+{
+  // lambda(domain)->codomain or lambda(domain,codomain&)
+  template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE, typename F>
+  inline void
+  call_f(const F& f, const DOMAIN_TYPE& x, CODOMAIN_TYPE& y)
+  {
+    if constexpr (std::is_invocable_r_v<void, const F&, const DOMAIN_TYPE&, CODOMAIN_TYPE&>)
+    {
+      f(x, y);
+    }
+    else
+    {
+      static_assert(std::is_invocable_r_v<CODOMAIN_TYPE, const F&, const DOMAIN_TYPE&>,
+                    "Expected lambda(domain)->codomain or lambda(domain,codomain&)");
+      y = f(x);
+    }
+  }
+}
+
+/////////////////////
+// Static_Function //
+/////////////////////
+//
+template <typename F, typename DOMAIN_TYPE, typename CODOMAIN_TYPE>
+class Static_Function
+{
+ public:
+  using function_type = Function<DOMAIN_TYPE, CODOMAIN_TYPE>;
+  using domain_type   = DOMAIN_TYPE;
+  using codomain_type = CODOMAIN_TYPE;
+
+ protected:
+  F _f;
+  std::shared_ptr<Evaluation_Counter> _f_counter;
+
+ public:
+  Static_Function(const F& f) : _f(f) {}
+  Static_Function(F&& f) : _f(std::move(f)) {}
+
+  // Type erasure, the counter is shared
+  operator function_type() const
+  {
+    struct Impl final : public function_type::Interface
+    {
+      F _f;
+
+      Impl(const F& f) : _f(f) {}
+
+      void
+      f(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y) const
+      {
+        Static_Function_Detail::call_f(_f, x, y);
+      }
+    };
+    return {std::make_shared<const Impl>(_f), _f_counter};
+  }
+
+  function_type
+  as_function() const
+  {
+    return static_cast<function_type>(*this);
+  }
+
+  void
+  f(const domain_type& x, codomain_type& y) const
+  {
+    if (_f_counter) ++(*_f_counter);
+
+    Static_Function_Detail::call_f(_f, x, y);
+  }
+
+  void
+  f_batch(Span<const domain_type> x, Span<codomain_type> y) const
+  {
+    assert(x.size() == y.size());
+
+    if (_f_counter) (*_f_counter) += x.size();
+
+    const size_t n = x.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+      Static_Function_Detail::call_f(_f, x[i], y[i]);
+    }
+  }
+
+  // Counter_Policy::Relaxed_Atomic or Sharded if evaluated from
+  // several threads, see evaluation_counter.hpp
+  void
+  initialize_counter(const Counter_Policy policy = Counter_Policy::Plain)
+  {
+    _f_counter = make_evaluation_counter(policy);
+  }
+
+  size_t
+  f_counter() const
+  {
+    assert(_f_counter);
+    return _f_counter->value();
+  }
+};
+
+// Helper
+//
+template <typename DOMAIN_TYPE, typename CODOMAIN_TYPE, typename F, typename... EXTRA_ARGS>
+auto
+static_function(F&& f, const EXTRA_ARGS&... args)
+{
+  if constexpr (sizeof...(EXTRA_ARGS) == 0)
+  {
+    return Static_Function<std::decay_t<F>, DOMAIN_TYPE, CODOMAIN_TYPE>(std::forward<F>(f));
+  }
+  else
+  {
+    auto g = [f, args...](const DOMAIN_TYPE& x, CODOMAIN_TYPE& y) {
+      if constexpr (std::is_invocable_r_v<void,
+                                          const std::decay_t<F>&,
+                                          const DOMAIN_TYPE&,
+                                          CODOMAIN_TYPE&,
+                                          const EXTRA_ARGS&...>)
+      {
+        f(x, y, args...);
+      }
+      else
+      {
+        y = f(x, args...);
+      }
+    };
+    return Static_Function<decltype(g), DOMAIN_TYPE, CODOMAIN_TYPE>(std::move(g));
+  }
+}
+
+////////////////////////////////////
+// Static_Differentiable_Function //
+////////////////////////////////////
+//
+// F is a callable(domain,codomain*,differential*)
+//
+template <typename F, typename DOMAIN_TYPE, typename CODOMAIN_TYPE, typename DIFFERENTIAL_TYPE>
+class Static_Differentiable_Function
+{
+ public:
+  using differentiable_function_type =
+      Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE>;
+  using function_type     = typename differentiable_function_type::function_type;
+  using domain_type       = DOMAIN_TYPE;
+  using codomain_type     = CODOMAIN_TYPE;
+  using differential_type = DIFFERENTIAL_TYPE;
+
+  static_assert(std::is_invocable_r_v<void,
+                                      const F&,
+                                      const DOMAIN_TYPE&,
+                                      CODOMAIN_TYPE*,
+                                      DIFFERENTIAL_TYPE*>,
+                "Expected lambda(domain,codomain*,differential*)");
+
+ protected:
+  F _f;
+  std::shared_ptr<Evaluation_Counter> _f_counter;
+  std::shared_ptr<Evaluation_Counter> _df_counter;
+
+ public:
+  Static_Differentiable_Function(const F& f) : _f(f) {}
+  Static_Differentiable_Function(F&& f) : _f(std::move(f)) {}
+
+  // Type erasure, counters are shared
+  operator differentiable_function_type() const
+  {
+    struct Impl final : public differentiable_function_type::Diff_Interface
+    {
+      F _f;
+
+      Impl(const F& f) : _f(f) {}
+
+      void
+      f(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y) const
+      {
+        _f(x, &y, nullptr);
+      }
+      void
+      f_df(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y, DIFFERENTIAL_TYPE& df) const
+      {
+        _f(x, &y, &df);
+      }
+      void
+      df(const DOMAIN_TYPE& x, DIFFERENTIAL_TYPE& df) const
+      {
+        _f(x, nullptr, &df);
+      }
+    };
+    return {std::make_shared<const Impl>(_f), _f_counter, _df_counter};
+  }
+
+  operator function_type() const { return as_differentiable_function().as_function(); }
+
+  differentiable_function_type
+  as_differentiable_function() const
+  {
+    return static_cast<differentiable_function_type>(*this);
+  }
+
+  function_type
+  as_function() const
+  {
+    return static_cast<function_type>(*this);
+  }
+
+  void
+  f(const domain_type& x, codomain_type& y) const
+  {
+    if (_f_counter) ++(*_f_counter);
+
+    _f(x, &y, nullptr);
+  }
+
+  void
+  f_df(const domain_type& x, codomain_type& y, differential_type& df) const
+  {
+    if (_f_counter) ++(*_f_counter);
+    if (_df_counter) ++(*_df_counter);
+
+    _f(x, &y, &df);
+  }
+
+  void
+  df(const domain_type& x, differential_type& df) const
+  {
+    if (_df_counter) ++(*_df_counter);
+
+    _f(x, nullptr, &df);
+  }
+
+  void
+  f_batch(Span<const domain_type> x, Span<codomain_type> y) const
+  {
+    assert(x.size() == y.size());
+
+    if (_f_counter) (*_f_counter) += x.size();
+
+    const size_t n = x.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+      _f(x[i], &y[i], nullptr);
+    }
+  }
+
+  void
+  f_df_batch(Span<const domain_type> x, Span<codomain_type> y, Span<differential_type> df) const
+  {
+    assert(x.size() == y.size());
+    assert(x.size() == df.size());
+
+    if (_f_counter) (*_f_counter) += x.size();
+    if (_df_counter) (*_df_counter) += x.size();
+
+    const size_t n = x.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+      _f(x[i], &y[i], &df[i]);
+    }
+  }
+
+  void
+  df_batch(Span<const domain_type> x, Span<differential_type> df) const
+  {
+    assert(x.size() == df.size());
+
+    if (_df_counter) (*_df_counter) += x.size();
+
+    const size_t n = x.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+      _f(x[i], nullptr, &df[i]);
+    }
+  }
+
+  // Counter_Policy::Relaxed_Atomic or Sharded if evaluated from
+  // several threads, see evaluation_counter.hpp
+  void
+  initialize_counter(const Counter_Policy policy = Counter_Policy::Plain)
+  {
+    _f_counter  = make_evaluation_counter(policy);
+    _df_counter = make_evaluation_counter(policy);
+  }
+
+  size_t
+  f_counter() const
+  {
+    assert(_f_counter);
+    return _f_counter->value();
+  }
+
+  size_t
+  df_counter() const
+  {
+    assert(_df_counter);
+    return _df_counter->value();
+  }
+};
+
+// Helper
+//
+// static_differentiable_function<double, double, double>(square_root<double>, 2)
+//
+template <typename DOMAIN_TYPE,
+          typename CODOMAIN_TYPE,
+          typename DIFFERENTIAL_TYPE,
+          typename F,
+          typename... EXTRA_ARGS>
+auto
+static_differentiable_function(F&& f, const EXTRA_ARGS&... args)
+{
+  if constexpr (sizeof...(EXTRA_ARGS) == 0)
+  {
+    return Static_Differentiable_Function<std::decay_t<F>,
+                                          DOMAIN_TYPE,
+                                          CODOMAIN_TYPE,
+                                          DIFFERENTIAL_TYPE>(std::forward<F>(f));
+  }
+  else
+  {
+    auto g = [f, args...](const DOMAIN_TYPE& x, CODOMAIN_TYPE* y, DIFFERENTIAL_TYPE* df) {
+      f(x, y, df, args...);
+    };
+    return Static_Differentiable_Function<decltype(g),
+                                          DOMAIN_TYPE,
+                                          CODOMAIN_TYPE,
+                                          DIFFERENTIAL_TYPE>(std::move(g));
+  }
+}
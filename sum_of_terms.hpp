@@ -0,0 +1,220 @@
+#pragma once
+
+#include "evaluation_counter.hpp"
+#include "functions.hpp"
+#include "pimpl_storage.hpp"
+#include "span.hpp"
+
+#include <cassert>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+// Objective that is an average of terms, typically one term per
+// data row:
+//
+//   F(x) = 1/N sum_{i=0}^{N-1} f_i(x)
+//
+// Only a subset of the terms (a mini-batch) is evaluated at once, the
+// minibatch methods return the average over the given indices:
+//
+//   F_I(x) = 1/|I| sum_{i in I} f_i(x)
+//
+// Usage:
+//
+//   Sum_Of_Terms_Function<std::valarray<double>, double, std::valarray<double>> loss(
+//       row_count,
+//       [&](const auto& x, Span<const size_t> indices, double* y, std::valarray<double>* df) {
+//         ...
+//       });
+//
+// The counters count evaluated terms.
+
+///////////////////////////
+// Sum_Of_Terms_Function //
+///////////////////////////
+//
+template <typename DOMAIN_TYPE,
+          typename CODOMAIN_TYPE,
+          typename DIFFERENTIAL_TYPE,
+          typename STORAGE = Shared_Storage>
+class Sum_Of_Terms_Function
+{
+ public:
+  using domain_type                 = DOMAIN_TYPE;
+  using codomain_type               = CODOMAIN_TYPE;
+  using differential_type           = DIFFERENTIAL_TYPE;
+  using storage_type                = STORAGE;
+  using differentiable_function_type =
+      Differentiable_Function<DOMAIN_TYPE, CODOMAIN_TYPE, DIFFERENTIAL_TYPE, STORAGE>;
+
+  struct Terms_Interface
+  {
+    virtual void f_minibatch(const domain_type& x,
+                             Span<const size_t> indices,
+                             codomain_type& y) const          = 0;
+    virtual void f_df_minibatch(const domain_type& x,
+                                Span<const size_t> indices,
+                                codomain_type& y,
+                                differential_type& df) const  = 0;
+    virtual void df_minibatch(const domain_type& x,
+                              Span<const size_t> indices,
+                              differential_type& df) const    = 0;
+
+    virtual ~Terms_Interface() = default;
+  };
+
+ protected:
+  using pimpl_type = typename STORAGE::template pimpl_type<Terms_Interface>;
+  pimpl_type _pimpl;
+  size_t _term_count;
+  std::shared_ptr<Evaluation_Counter> _f_counter;
+  std::shared_ptr<Evaluation_Counter> _df_counter;
+
+ public:
+  Sum_Of_Terms_Function(pimpl_type&& pimpl,
+                        const size_t term_count,
+                        std::shared_ptr<Evaluation_Counter> f_counter  = {},
+                        std::shared_ptr<Evaluation_Counter> df_counter = {})
+      : _pimpl(std::move(pimpl)),
+        _term_count{term_count},
+        _f_counter{f_counter},
+        _df_counter{df_counter}
+  {
+  }
+  // lambda(domain,Span<const size_t> indices,codomain*,differential*)
+  template <typename F,
+            std::enable_if_t<std::is_invocable_r_v<void,
+                                                   std::decay_t<F>,
+                                                   DOMAIN_TYPE,
+                                                   Span<const size_t>,
+                                                   CODOMAIN_TYPE*,
+                                                   DIFFERENTIAL_TYPE*>>* = nullptr>
+  Sum_Of_Terms_Function(const size_t term_count, F&& f) : _term_count{term_count}
+  {
+    struct Impl final : public Terms_Interface
+    {
+      std::decay_t<F> _f;
+
+      Impl(F&& f) : _f(std::forward<F>(f)) {}
+
+      void
+      f_minibatch(const DOMAIN_TYPE& x, Span<const size_t> indices, CODOMAIN_TYPE& y) const
+      {
+        _f(x, indices, &y, nullptr);
+      }
+      void
+      f_df_minibatch(const DOMAIN_TYPE& x,
+                     Span<const size_t> indices,
+                     CODOMAIN_TYPE& y,
+                     DIFFERENTIAL_TYPE& df) const
+      {
+        _f(x, indices, &y, &df);
+      }
+      void
+      df_minibatch(const DOMAIN_TYPE& x, Span<const size_t> indices, DIFFERENTIAL_TYPE& df) const
+      {
+        _f(x, indices, nullptr, &df);
+      }
+    };
+    _pimpl.template emplace<Impl>(std::forward<F>(f));
+  }
+
+  size_t
+  term_count() const
+  {
+    return _term_count;
+  }
+
+  void
+  f_minibatch(const domain_type& x, Span<const size_t> indices, codomain_type& y) const
+  {
+    assert(not indices.empty());
+
+    if (_f_counter) (*_f_counter) += indices.size();
+
+    (*_pimpl).f_minibatch(x, indices, y);
+  }
+
+  void
+  f_df_minibatch(const domain_type& x,
+                 Span<const size_t> indices,
+                 codomain_type& y,
+                 differential_type& df) const
+  {
+    assert(not indices.empty());
+
+    if (_f_counter) (*_f_counter) += indices.size();
+    if (_df_counter) (*_df_counter) += indices.size();
+
+    (*_pimpl).f_df_minibatch(x, indices, y, df);
+  }
+
+  void
+  df_minibatch(const domain_type& x, Span<const size_t> indices, differential_type& df) const
+  {
+    assert(not indices.empty());
+
+    if (_df_counter) (*_df_counter) += indices.size();
+
+    (*_pimpl).df_minibatch(x, indices, df);
+  }
+
+  // The whole objective F(x) (all the terms), evaluations are counted
+  // by the counters of *this
+  differentiable_function_type
+  as_differentiable_function() const
+  {
+    struct Impl final : public differentiable_function_type::Diff_Interface
+    {
+      Sum_Of_Terms_Function _terms;
+      std::vector<size_t> _all_indices;
+
+      Impl(const Sum_Of_Terms_Function& terms)
+          : _terms(terms), _all_indices(terms.term_count())
+      {
+        std::iota(_all_indices.begin(), _all_indices.end(), size_t(0));
+      }
+
+      void
+      f(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y) const
+      {
+        _terms.f_minibatch(x, _all_indices, y);
+      }
+      void
+      f_df(const DOMAIN_TYPE& x, CODOMAIN_TYPE& y, DIFFERENTIAL_TYPE& df) const
+      {
+        _terms.f_df_minibatch(x, _all_indices, y, df);
+      }
+      void
+      df(const DOMAIN_TYPE& x, DIFFERENTIAL_TYPE& df) const
+      {
+        _terms.df_minibatch(x, _all_indices, df);
+      }
+    };
+    return {std::make_shared<const Impl>(*this)};
+  }
+
+  // Counter_Policy::Relaxed_Atomic or Sharded if evaluated from
+  // several threads, see evaluation_counter.hpp
+  void
+  initialize_counter(const Counter_Policy policy = Counter_Policy::Plain)
+  {
+    _f_counter  = make_evaluation_counter(policy);
+    _df_counter = make_evaluation_counter(policy);
+  }
+
+  size_t
+  f_counter() const
+  {
+    assert(_f_counter);
+    return _f_counter->value();
+  }
+
+  size_t
+  df_counter() const
+  {
+    assert(_df_counter);
+    return _df_counter->value();
+  }
+};
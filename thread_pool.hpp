@@ -0,0 +1,319 @@
+#pragma once
+
+#include "cache_line.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Thread_Pool_Detail
+{
+  // f(task_index) or f(task_index, worker_index)
+  template <typename F>
+  inline void
+  call_task(F& f, const size_t task_index, const size_t worker_index)
+  {
+    if constexpr (std::is_invocable_v<F&, size_t, size_t>)
+    {
+      f(task_index, worker_index);
+    }
+    else
+    {
+      (void)worker_index;
+      f(task_index);
+    }
+  }
+
+  // Pool and worker running the current thread's task, if any
+  struct Current_Task
+  {
+    const void* thread_pool = nullptr;
+    size_t worker_index     = 0;
+  };
+  inline thread_local Current_Task current_task;
+
+  class Current_Task_Scope
+  {
+    Current_Task _previous;
+
+   public:
+    Current_Task_Scope(const void* const thread_pool, const size_t worker_index)
+        : _previous(current_task)
+    {
+      current_task = {thread_pool, worker_index};
+    }
+    Current_Task_Scope(const Current_Task_Scope&) = delete;
+    Current_Task_Scope& operator=(const Current_Task_Scope&) = delete;
+    ~Current_Task_Scope() { current_task = _previous; }
+  };
+}
+
+/////////////////
+// Thread_Pool //
+/////////////////
+//
+// Persistent worker threads. parallel_for() blocks until completion,
+// the calling thread also processes tasks.
+//
+// Tasks are f(task_index) or f(task_index, worker_index), worker_index
+// in [0, size()[ (0 is the calling thread) allows per-thread states.
+//
+// A parallel_for() called from a task of the same pool (a parallel
+// objective in multistart() for instance) runs its tasks inline,
+// with the worker_index of the calling task.
+//
+// Tasks must not throw.
+//
+class Thread_Pool
+{
+ protected:
+  // Tasks of one worker (work stealing): the owner pops the front,
+  // thieves the back
+  struct Task_Range
+  {
+    std::mutex mutex;
+    size_t begin = 0;
+    size_t end   = 0;
+  };
+
+  std::vector<std::thread> _workers;
+  std::vector<Cache_Padded<Task_Range>> _task_ranges;
+
+  std::mutex _parallel_for_mutex;  // one parallel_for() at a time
+
+  std::mutex _mutex;
+  std::condition_variable _start_condition;
+  std::condition_variable _done_condition;
+  size_t _generation     = 0;
+  bool _stop             = false;
+  size_t _active_workers = 0;
+
+  // Current job
+  void (*_task)(void* context, size_t task_index, size_t worker_index) = nullptr;
+  void* _context                                                        = nullptr;
+  size_t _task_count                                                    = 0;
+  bool _work_stealing                                                   = false;
+  std::atomic<size_t> _next_task{0};
+
+  static bool
+  pop_front(Task_Range& range, size_t& task_index)
+  {
+    std::lock_guard<std::mutex> lock(range.mutex);
+    if (range.begin == range.end) return false;
+    task_index = range.begin++;
+    return true;
+  }
+  static bool
+  pop_back(Task_Range& range, size_t& task_index)
+  {
+    std::lock_guard<std::mutex> lock(range.mutex);
+    if (range.begin == range.end) return false;
+    task_index = --range.end;
+    return true;
+  }
+
+  void
+  run_tasks(const size_t worker_index)
+  {
+    const Thread_Pool_Detail::Current_Task_Scope task_scope(this, worker_index);
+
+    if (not _work_stealing)
+    {
+      for (size_t task_index; (task_index = _next_task.fetch_add(1, std::memory_order_relaxed)) <
+                              _task_count;)
+      {
+        _task(_context, task_index, worker_index);
+      }
+      return;
+    }
+
+    const size_t participants = _task_ranges.size();
+    size_t task_index;
+
+    for (;;)
+    {
+      while (pop_front(_task_ranges[worker_index].value, task_index))
+      {
+        _task(_context, task_index, worker_index);
+      }
+
+      // Own range is empty: steal from the others, stop when all are
+      // empty (no task is ever added during a job)
+      bool has_stolen = false;
+      for (size_t i = 1; (i < participants) and not has_stolen; ++i)
+      {
+        has_stolen =
+            pop_back(_task_ranges[(worker_index + i) % participants].value, task_index);
+      }
+      if (not has_stolen) return;
+
+      _task(_context, task_index, worker_index);
+    }
+  }
+
+  template <typename F>
+  void
+  run_job(const size_t task_count, F&& f, const bool work_stealing)
+  {
+    // Nested in a task of this pool: the workers are busy (and
+    // _parallel_for_mutex is held), inline with the task worker_index
+    const Thread_Pool_Detail::Current_Task& current_task = Thread_Pool_Detail::current_task;
+    const bool nested = (current_task.thread_pool == this);
+
+    if ((task_count <= 1) or _workers.empty() or nested)
+    {
+      const size_t worker_index = nested ? current_task.worker_index : 0;
+      for (size_t task_index = 0; task_index < task_count; ++task_index)
+      {
+        Thread_Pool_Detail::call_task(f, task_index, worker_index);
+      }
+      return;
+    }
+
+    using f_type = std::remove_reference_t<F>;
+
+    std::lock_guard<std::mutex> parallel_for_lock(_parallel_for_mutex);
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      _task = [](void* context, const size_t task_index, const size_t worker_index) {
+        Thread_Pool_Detail::call_task(*static_cast<f_type*>(context), task_index, worker_index);
+      };
+      _context       = const_cast<void*>(static_cast<const void*>(std::addressof(f)));
+      _task_count    = task_count;
+      _work_stealing = work_stealing;
+      _next_task.store(0, std::memory_order_relaxed);
+
+      if (work_stealing)
+      {
+        // Contiguous initial ranges
+        const size_t participants = _task_ranges.size();
+        for (size_t i = 0; i < participants; ++i)
+        {
+          Task_Range& range = _task_ranges[i].value;
+          std::lock_guard<std::mutex> range_lock(range.mutex);
+          range.begin = (i * task_count) / participants;
+          range.end   = ((i + 1) * task_count) / participants;
+        }
+      }
+      _active_workers = _workers.size();
+      ++_generation;
+    }
+    _start_condition.notify_all();
+
+    run_tasks(0);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done_condition.wait(lock, [&]() { return _active_workers == 0; });
+  }
+
+  void
+  worker_loop(const size_t worker_index)
+  {
+    size_t seen_generation = 0;
+    for (;;)
+    {
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _start_condition.wait(lock, [&]() { return _stop or (_generation != seen_generation); });
+        if (_stop) return;
+        seen_generation = _generation;
+      }
+
+      run_tasks(worker_index);
+
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--_active_workers == 0) _done_condition.notify_one();
+      }
+    }
+  }
+
+ public:
+  // thread_count includes the calling thread
+  explicit Thread_Pool(const size_t thread_count = std::thread::hardware_concurrency())
+      : _task_ranges(std::max<size_t>(1, thread_count))
+  {
+    for (size_t i = 1; i < thread_count; ++i)
+    {
+      _workers.emplace_back([this, i]() { worker_loop(i); });
+    }
+  }
+
+  Thread_Pool(const Thread_Pool&) = delete;
+  Thread_Pool& operator=(const Thread_Pool&) = delete;
+
+  ~Thread_Pool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _start_condition.notify_all();
+    for (auto& worker : _workers) worker.join();
+  }
+
+  size_t
+  size() const
+  {
+    return _workers.size() + 1;
+  }
+
+  // Calls f for task_index in [0, task_count[, tasks are handed out
+  // one at a time (cheap, similar tasks)
+  template <typename F>
+  void
+  parallel_for(const size_t task_count, F&& f)
+  {
+    run_job(task_count, std::forward<F>(f), false);
+  }
+
+  // Ditto, but each thread starts with a contiguous range of tasks and
+  // steals from the others when done (tasks of irregular durations)
+  template <typename F>
+  void
+  parallel_for_work_stealing(const size_t task_count, F&& f)
+  {
+    run_job(task_count, std::forward<F>(f), true);
+  }
+};
+
+// Helper: nullptr means sequential
+//
+template <typename F>
+void
+parallel_for(Thread_Pool* const thread_pool, const size_t task_count, F&& f)
+{
+  if (thread_pool)
+  {
+    thread_pool->parallel_for(task_count, std::forward<F>(f));
+  }
+  else
+  {
+    for (size_t task_index = 0; task_index < task_count; ++task_index)
+    {
+      Thread_Pool_Detail::call_task(f, task_index, 0);
+    }
+  }
+}
+
+template <typename F>
+void
+parallel_for_work_stealing(Thread_Pool* const thread_pool, const size_t task_count, F&& f)
+{
+  if (thread_pool)
+  {
+    thread_pool->parallel_for_work_stealing(task_count, std::forward<F>(f));
+  }
+  else
+  {
+    parallel_for(nullptr, task_count, std::forward<F>(f));
+  }
+}
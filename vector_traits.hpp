@@ -0,0 +1,187 @@
+#pragma once
+
+#include "cache_line.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <valarray>
+#include <vector>
+
+// Contiguous storage access for the vector algorithms (Adam, norms),
+// so they work directly on the caller's storage without copies:
+// std::valarray, std::vector (possibly with Aligned_Allocator), Span,
+// Eigen vectors and maps... any type with data() and size() members.
+//
+//   using traits = Vector_Traits<VECTOR_TYPE>;
+//
+//   traits::scalar_type
+//   traits::data(v)       -> (const) scalar_type*
+//   traits::size(v)       -> size_t
+//   traits::resize(v, n)  resizes if possible (values are undefined),
+//                         otherwise asserts size(v) == n
+
+///////////////////
+// Vector_Traits //
+///////////////////
+//
+// Not a contiguous vector
+template <typename VECTOR_TYPE, typename = void>
+struct Vector_Traits
+{
+};
+
+// std::valarray has no data() member
+template <typename T>
+struct Vector_Traits<std::valarray<T>>
+{
+  using scalar_type = T;
+
+  static T*
+  data(std::valarray<T>& v)
+  {
+    return std::begin(v);
+  }
+  static const T*
+  data(const std::valarray<T>& v)
+  {
+    return std::begin(v);
+  }
+  static size_t
+  size(const std::valarray<T>& v)
+  {
+    return v.size();
+  }
+  static void
+  resize(std::valarray<T>& v, const size_t n)
+  {
+    if (v.size() != n) v.resize(n);
+  }
+};
+
+namespace Vector_Traits_Detail
+{
+  template <typename VECTOR_TYPE, typename = void>
+  struct Has_Resize : std::false_type
+  {
+  };
+  template <typename VECTOR_TYPE>
+  struct Has_Resize<VECTOR_TYPE,
+                    std::void_t<decltype(std::declval<VECTOR_TYPE&>().resize(size_t()))>>
+      : std::true_type
+  {
+  };
+}
+
+// data() and size() members
+template <typename VECTOR_TYPE>
+struct Vector_Traits<VECTOR_TYPE,
+                     std::void_t<decltype(std::declval<VECTOR_TYPE&>().data()),
+                                 decltype(std::declval<const VECTOR_TYPE&>().size())>>
+{
+  using scalar_type =
+      std::remove_cv_t<std::remove_pointer_t<decltype(std::declval<VECTOR_TYPE&>().data())>>;
+
+  static auto
+  data(VECTOR_TYPE& v)
+  {
+    return v.data();
+  }
+  static auto
+  data(const VECTOR_TYPE& v)
+  {
+    return v.data();
+  }
+  static size_t
+  size(const VECTOR_TYPE& v)
+  {
+    return static_cast<size_t>(v.size());
+  }
+  static void
+  resize(VECTOR_TYPE& v, const size_t n)
+  {
+    if (size(v) == n) return;
+
+    if constexpr (Vector_Traits_Detail::Has_Resize<VECTOR_TYPE>::value)
+    {
+      v.resize(n);
+    }
+    else
+    {
+      assert(false && "fixed size vector");
+    }
+  }
+};
+
+template <typename VECTOR_TYPE, typename = void>
+struct Is_Vector : std::false_type
+{
+};
+template <typename VECTOR_TYPE>
+struct Is_Vector<VECTOR_TYPE, std::void_t<typename Vector_Traits<VECTOR_TYPE>::scalar_type>>
+    : std::true_type
+{
+};
+
+template <typename VECTOR_TYPE>
+static constexpr bool is_vector_v = Is_Vector<VECTOR_TYPE>::value;
+
+///////////////////////
+// Aligned_Allocator //
+///////////////////////
+//
+// For std::vector storage aligned on ALIGNMENT bytes (the default is
+// cache line alignment, also suitable for AVX-512 loads)
+//
+template <typename T, size_t ALIGNMENT = cache_line_size>
+struct Aligned_Allocator
+{
+  static_assert((ALIGNMENT & (ALIGNMENT - 1)) == 0, "power of 2 expected");
+  static_assert(ALIGNMENT >= alignof(T));
+
+  using value_type = T;
+
+  template <typename U>
+  struct rebind
+  {
+    using other = Aligned_Allocator<U, ALIGNMENT>;
+  };
+
+  Aligned_Allocator() noexcept = default;
+  template <typename U>
+  Aligned_Allocator(const Aligned_Allocator<U, ALIGNMENT>&) noexcept
+  {
+  }
+
+  T*
+  allocate(const size_t n)
+  {
+    if (n > std::numeric_limits<size_t>::max() / sizeof(T)) throw std::bad_array_new_length();
+
+    return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(ALIGNMENT)));
+  }
+  void
+  deallocate(T* const p, const size_t) noexcept
+  {
+    ::operator delete(p, std::align_val_t(ALIGNMENT));
+  }
+
+  template <typename U>
+  bool
+  operator==(const Aligned_Allocator<U, ALIGNMENT>&) const noexcept
+  {
+    return true;
+  }
+  template <typename U>
+  bool
+  operator!=(const Aligned_Allocator<U, ALIGNMENT>&) const noexcept
+  {
+    return false;
+  }
+};
+
+template <typename T>
+using Aligned_Vector = std::vector<T, Aligned_Allocator<T>>;